@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+//
+// Fan-out benchmark for the QXmppServerMuc multi-user chat service.
+//
+// Starts a server on the loopback interface and connects clients to it from
+// several threads. For each room size, that many clients join a room of
+// their own, then messages are injected into the server from the first
+// occupant. The benchmark measures the time the server spends routing each
+// message and the time until every occupant received it. The results are
+// written to stdout as a single JSON object with one entry per room size, so
+// that runs can be compared across commits.
+//
+
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppServerMuc.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDomDocument>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+
+static const QString benchmarkResource = QStringLiteral("bench");
+
+struct Options
+{
+    QVector<int> roomSizes = { 10, 100, 1000 };
+    int messages = 100;
+    int clientThreads = 4;
+    int serverThreads = 0;
+    int presenceBatchInterval = 100;
+    quint16 port = 15223;
+};
+
+static QString roomJid(int size)
+{
+    return QStringLiteral("room%1@conference.%2").arg(QString::number(size), benchmarkDomain);
+}
+
+///
+/// The OccupantGroup class lets a group of clients join rooms.
+///
+class OccupantGroup : public BenchmarkClientGroup
+{
+    Q_OBJECT
+
+public:
+    using BenchmarkClientGroup::BenchmarkClientGroup;
+
+    /// Lets the clients with an index below the room's size join it.
+    Q_INVOKABLE void joinRoom(int size)
+    {
+        const auto &clients = this->clients();
+        for (int i = 0; i < clients.size() && firstClient() + i < size; ++i) {
+            auto *client = clients.at(i);
+            if (!client->isAuthenticated())
+                continue;
+
+            QXmppPresence presence;
+            presence.setTo(roomJid(size) + QLatin1Char('/') + client->configuration().user());
+            client->sendPacket(presence);
+        }
+    }
+
+protected:
+    void configureClient(QXmppConfiguration &config) override
+    {
+        config.setResource(benchmarkResource);
+    }
+
+    bool acceptMessage(const QXmppMessage &message) override
+    {
+        return message.type() == QXmppMessage::GroupChat && !message.stamp().isValid();
+    }
+};
+
+// Processes events until the condition holds or the timeout in milliseconds
+// elapsed, and returns whether the condition holds.
+template<typename Condition>
+static bool waitFor(Condition condition, int timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!condition()) {
+        if (timer.elapsed() > timeout)
+            return false;
+        sleepWithEvents(1);
+    }
+    return true;
+}
+
+static qint64 messagesReceived(const QVector<OccupantGroup *> &groups)
+{
+    qint64 received = 0;
+    for (auto *group : groups)
+        received += group->messagesReceived;
+    return received;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("bench_qxmppmucfanout"));
+
+    Options options;
+    options.clientThreads = qMax(1, QThread::idealThreadCount());
+
+    QStringList defaultRoomSizes;
+    for (const auto size : std::as_const(options.roomSizes))
+        defaultRoomSizes << QString::number(size);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measures the cost of fanning out messages to the occupants of QXmppServerMuc rooms."));
+    parser.addHelpOption();
+    const QCommandLineOption roomSizesOption(QStringLiteral("room-sizes"), QStringLiteral("Comma-separated numbers of occupants."), QStringLiteral("sizes"), defaultRoomSizes.join(QLatin1Char(',')));
+    const QCommandLineOption messagesOption(QStringLiteral("messages"), QStringLiteral("Number of messages sent to each room."), QStringLiteral("count"), QString::number(options.messages));
+    const QCommandLineOption clientThreadsOption(QStringLiteral("client-threads"), QStringLiteral("Number of client threads."), QStringLiteral("count"), QString::number(options.clientThreads));
+    const QCommandLineOption serverThreadsOption(QStringLiteral("server-threads"), QStringLiteral("Number of server worker threads."), QStringLiteral("count"), QString::number(options.serverThreads));
+    const QCommandLineOption batchIntervalOption(QStringLiteral("presence-batch-interval"), QStringLiteral("Interval in milliseconds during which presences are batched."), QStringLiteral("msecs"), QString::number(options.presenceBatchInterval));
+    const QCommandLineOption portOption(QStringLiteral("port"), QStringLiteral("Port of the server."), QStringLiteral("port"), QString::number(options.port));
+    parser.addOptions({ roomSizesOption, messagesOption, clientThreadsOption, serverThreadsOption,
+                        batchIntervalOption, portOption });
+    parser.process(app);
+
+    options.roomSizes.clear();
+    for (const auto &size : parser.value(roomSizesOption).split(QLatin1Char(','))) {
+        if (size.toInt() > 0)
+            options.roomSizes << size.toInt();
+    }
+    if (options.roomSizes.isEmpty()) {
+        fprintf(stderr, "No room sizes given\n");
+        return EXIT_FAILURE;
+    }
+    const int clients = *std::max_element(options.roomSizes.cbegin(), options.roomSizes.cend());
+    options.messages = qMax(1, parser.value(messagesOption).toInt());
+    options.clientThreads = qBound(1, parser.value(clientThreadsOption).toInt(), clients);
+    options.serverThreads = qMax(0, parser.value(serverThreadsOption).toInt());
+    options.presenceBatchInterval = qMax(0, parser.value(batchIntervalOption).toInt());
+    options.port = quint16(parser.value(portOption).toUInt());
+
+    benchmarkClock.start();
+
+    // start the server
+    BenchmarkPasswordChecker passwordChecker;
+    QXmppServer server;
+    server.setDomain(benchmarkDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setWorkerThreadCount(options.serverThreads);
+    auto *muc = new QXmppServerMuc;
+    muc->setHistorySize(0);
+    muc->setPresenceBatchInterval(options.presenceBatchInterval);
+    server.addExtension(muc);
+    if (!server.listenForClients(QHostAddress::LocalHost, options.port)) {
+        fprintf(stderr, "Could not listen on port %d\n", options.port);
+        return EXIT_FAILURE;
+    }
+
+    // spread the clients over the threads
+    QVector<QThread *> threads;
+    QVector<OccupantGroup *> groups;
+    for (int i = 0; i < options.clientThreads; ++i) {
+        const int first = clients * i / options.clientThreads;
+        const int last = clients * (i + 1) / options.clientThreads;
+
+        auto *thread = new QThread;
+        auto *group = new OccupantGroup(options.port, first, last - first);
+        group->moveToThread(thread);
+        thread->start();
+        threads << thread;
+        groups << group;
+    }
+
+    // log in
+    fprintf(stderr, "Connecting %d clients\n", clients);
+    runOnGroups(groups, "connectClients", &OccupantGroup::clientsConnected);
+
+    // the messages are injected into the server as if the first occupant
+    // sent them, only the body is updated between messages
+    QDomDocument document;
+    auto message = document.createElement(QStringLiteral("message"));
+    message.setAttribute(QStringLiteral("from"), QStringLiteral("user0@%1/%2").arg(benchmarkDomain, benchmarkResource));
+    message.setAttribute(QStringLiteral("type"), QStringLiteral("groupchat"));
+    auto body = document.createElement(QStringLiteral("body"));
+    auto bodyText = document.createTextNode(QString());
+    body.appendChild(bodyText);
+    message.appendChild(body);
+    document.appendChild(message);
+
+    QJsonArray rooms;
+    bool complete = true;
+    for (const auto size : std::as_const(options.roomSizes)) {
+        const auto jid = roomJid(size);
+
+        // join the room
+        fprintf(stderr, "Joining %d occupants\n", size);
+        QElapsedTimer phaseTimer;
+        phaseTimer.start();
+        for (auto *group : std::as_const(groups))
+            QMetaObject::invokeMethod(group, "joinRoom", Qt::QueuedConnection, Q_ARG(int, size));
+        const bool joined = waitFor([&]() { return muc->occupants(jid).size() >= size; }, 60000);
+        const double joinSeconds = phaseTimer.nsecsElapsed() / 1e9;
+
+        // let the last presences arrive, so they do not delay the messages
+        sleepWithEvents(options.presenceBatchInterval + 500);
+        const int occupants = muc->occupants(jid).size();
+        for (auto *group : std::as_const(groups))
+            group->takeLatencies();
+
+        // send the messages back to back
+        fprintf(stderr, "Sending %d messages to %d occupants\n", options.messages, occupants);
+        message.setAttribute(QStringLiteral("to"), jid);
+        const qint64 receivedBefore = messagesReceived(groups);
+        const qint64 expected = qint64(options.messages) * occupants;
+        qint64 routeNsecs = 0;
+        phaseTimer.start();
+        for (int i = 0; i < options.messages; ++i) {
+            bodyText.setData(QString::number(benchmarkClock.nsecsElapsed()));
+            const qint64 start = benchmarkClock.nsecsElapsed();
+            server.handleElement(message);
+            routeNsecs += benchmarkClock.nsecsElapsed() - start;
+        }
+        const bool delivered = waitFor([&]() { return messagesReceived(groups) - receivedBefore >= expected; }, 60000);
+        const double deliverySeconds = phaseTimer.nsecsElapsed() / 1e9;
+        const qint64 received = messagesReceived(groups) - receivedBefore;
+        complete = complete && joined && delivered;
+
+        QVector<qint64> latencies;
+        for (auto *group : std::as_const(groups))
+            latencies += group->takeLatencies();
+        std::sort(latencies.begin(), latencies.end());
+
+        QJsonObject room;
+        room[QStringLiteral("occupants")] = occupants;
+        room[QStringLiteral("join_seconds")] = joinSeconds;
+        room[QStringLiteral("messages")] = options.messages;
+        room[QStringLiteral("deliveries_expected")] = expected;
+        room[QStringLiteral("deliveries")] = received;
+        room[QStringLiteral("route_us_per_message")] = routeNsecs / 1e3 / options.messages;
+        room[QStringLiteral("route_ns_per_delivery")] = occupants ? double(routeNsecs) / options.messages / occupants : 0.0;
+        room[QStringLiteral("delivery_seconds")] = deliverySeconds;
+        room[QStringLiteral("deliveries_per_second")] = received / deliverySeconds;
+        room[QStringLiteral("latency_p50_ms")] = percentile(latencies, 0.5);
+        room[QStringLiteral("latency_p99_ms")] = percentile(latencies, 0.99);
+        rooms.append(room);
+    }
+
+    // destroy the rooms first, so that the occupants do not see each other
+    // leave
+    muc->stop();
+    runOnGroups(groups, "disconnectClients", &OccupantGroup::clientsDisconnected);
+    for (auto *thread : std::as_const(threads)) {
+        thread->quit();
+        thread->wait();
+    }
+    server.close();
+
+    int connected = 0;
+    int failed = 0;
+    for (auto *group : std::as_const(groups)) {
+        connected += group->connectedClients;
+        failed += group->failedClients;
+    }
+    qDeleteAll(groups);
+    qDeleteAll(threads);
+
+    QJsonObject result;
+    result[QStringLiteral("benchmark")] = QStringLiteral("qxmppmucfanout");
+    result[QStringLiteral("qxmpp_version")] = QXmppVersion();
+    result[QStringLiteral("client_threads")] = options.clientThreads;
+    result[QStringLiteral("server_threads")] = options.serverThreads;
+    result[QStringLiteral("presence_batch_interval")] = options.presenceBatchInterval;
+    result[QStringLiteral("connected")] = connected;
+    result[QStringLiteral("failed")] = failed;
+    result[QStringLiteral("complete")] = complete;
+    result[QStringLiteral("rooms")] = rooms;
+
+    fprintf(stdout, "%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    return failed || !complete ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#include "bench_qxmppmucfanout.moc"
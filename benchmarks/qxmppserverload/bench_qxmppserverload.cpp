@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+//
+// Load generator for QXmppServer.
+//
+// Starts a server on the loopback interface and connects a number of clients
+// to it from several threads. Once all clients are logged in, they exchange
+// messages and presences at a fixed rate for a given duration. The results
+// are written to stdout as a single JSON object, so that runs can be compared
+// across commits.
+//
+// Clients and server share the process, so the memory per connection covers
+// both ends of a connection.
+//
+
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "util.h"
+
+#include <algorithm>
+#include <random>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+
+struct Options
+{
+    int clients = 100;
+    int clientThreads = 4;
+    int serverThreads = 0;
+    double messageRate = 1.0;
+    double presenceRate = 0.1;
+    int duration = 10;
+    quint16 port = 15222;
+    QString mechanism = QStringLiteral("PLAIN");
+};
+
+// Returns the resident set size of the process in kibibytes, or -1 if it is
+// not known.
+static qint64 residentSetSize()
+{
+    QFile file(QStringLiteral("/proc/self/status"));
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine();
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').first().toLongLong();
+    }
+    return -1;
+}
+
+///
+/// The LoadGenerator class sends messages and presences from a group of
+/// clients at a fixed rate.
+///
+class LoadGenerator : public BenchmarkClientGroup
+{
+    Q_OBJECT
+
+public:
+    LoadGenerator(const Options &options, int firstClient, int clientCount)
+        : BenchmarkClientGroup(options.port, firstClient, clientCount),
+          m_options(options),
+          m_random(firstClient),
+          m_timer(new QTimer(this))
+    {
+        m_timer->setInterval(10);
+        connect(m_timer, &QTimer::timeout, this, &LoadGenerator::sendTraffic);
+    }
+
+    Q_INVOKABLE void startTraffic()
+    {
+        m_trafficClock.start();
+        m_messageBudget = 0;
+        m_presenceBudget = 0;
+        m_timer->start();
+    }
+
+    Q_INVOKABLE void stopTraffic()
+    {
+        m_timer->stop();
+    }
+
+    // only read once the thread has finished
+    qint64 messagesSent = 0;
+    qint64 presencesSent = 0;
+
+protected:
+    void configureClient(QXmppConfiguration &config) override
+    {
+        config.setSaslAuthMechanism(m_options.mechanism);
+    }
+
+private:
+    void sendTraffic()
+    {
+        // the budgets carry fractional messages over to the next tick
+        const double elapsed = m_trafficClock.restart() / 1000.0;
+        m_messageBudget += m_options.messageRate * connectedClients * elapsed;
+        m_presenceBudget += m_options.presenceRate * connectedClients * elapsed;
+
+        std::uniform_int_distribution<int> recipients(0, m_options.clients - 1);
+        for (; m_messageBudget >= 1; m_messageBudget -= 1) {
+            auto *client = nextClient();
+            if (!client)
+                return;
+
+            QXmppMessage message;
+            message.setTo(QStringLiteral("user%1@%2").arg(QString::number(recipients(m_random)), benchmarkDomain));
+            message.setBody(QString::number(benchmarkClock.nsecsElapsed()));
+            client->sendPacket(message);
+            messagesSent++;
+        }
+
+        for (; m_presenceBudget >= 1; m_presenceBudget -= 1) {
+            auto *client = nextClient();
+            if (!client)
+                return;
+
+            QXmppPresence presence;
+            presence.setStatusText(QString::number(presencesSent));
+            client->sendPacket(presence);
+            presencesSent++;
+        }
+    }
+
+    QXmppClient *nextClient()
+    {
+        const auto &clients = this->clients();
+        for (int i = 0; i < clients.size(); ++i) {
+            auto *client = clients.at(m_nextClient % clients.size());
+            m_nextClient = (m_nextClient + 1) % clients.size();
+            if (client->isAuthenticated())
+                return client;
+        }
+        return nullptr;
+    }
+
+    const Options m_options;
+    std::mt19937 m_random;
+    int m_nextClient = 0;
+
+    QTimer *m_timer;
+    QElapsedTimer m_trafficClock;
+    double m_messageBudget = 0;
+    double m_presenceBudget = 0;
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("bench_qxmppserverload"));
+
+    Options options;
+    options.clientThreads = qMax(1, QThread::idealThreadCount());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measures the throughput and latency of QXmppServer."));
+    parser.addHelpOption();
+    const QCommandLineOption clientsOption(QStringLiteral("clients"), QStringLiteral("Number of clients."), QStringLiteral("count"), QString::number(options.clients));
+    const QCommandLineOption clientThreadsOption(QStringLiteral("client-threads"), QStringLiteral("Number of client threads."), QStringLiteral("count"), QString::number(options.clientThreads));
+    const QCommandLineOption serverThreadsOption(QStringLiteral("server-threads"), QStringLiteral("Number of server worker threads."), QStringLiteral("count"), QString::number(options.serverThreads));
+    const QCommandLineOption messageRateOption(QStringLiteral("message-rate"), QStringLiteral("Messages per second sent by each client."), QStringLiteral("rate"), QString::number(options.messageRate));
+    const QCommandLineOption presenceRateOption(QStringLiteral("presence-rate"), QStringLiteral("Presences per second sent by each client."), QStringLiteral("rate"), QString::number(options.presenceRate));
+    const QCommandLineOption durationOption(QStringLiteral("duration"), QStringLiteral("Duration of the traffic phase in seconds."), QStringLiteral("seconds"), QString::number(options.duration));
+    const QCommandLineOption portOption(QStringLiteral("port"), QStringLiteral("Port of the server."), QStringLiteral("port"), QString::number(options.port));
+    const QCommandLineOption mechanismOption(QStringLiteral("mechanism"), QStringLiteral("SASL mechanism used by the clients."), QStringLiteral("mechanism"), options.mechanism);
+    parser.addOptions({ clientsOption, clientThreadsOption, serverThreadsOption, messageRateOption,
+                        presenceRateOption, durationOption, portOption, mechanismOption });
+    parser.process(app);
+
+    options.clients = qMax(1, parser.value(clientsOption).toInt());
+    options.clientThreads = qBound(1, parser.value(clientThreadsOption).toInt(), options.clients);
+    options.serverThreads = qMax(0, parser.value(serverThreadsOption).toInt());
+    options.messageRate = qMax(0.0, parser.value(messageRateOption).toDouble());
+    options.presenceRate = qMax(0.0, parser.value(presenceRateOption).toDouble());
+    options.duration = qMax(1, parser.value(durationOption).toInt());
+    options.port = quint16(parser.value(portOption).toUInt());
+    options.mechanism = parser.value(mechanismOption);
+
+    benchmarkClock.start();
+
+    // start the server
+    BenchmarkPasswordChecker passwordChecker;
+    QXmppServer server;
+    server.setDomain(benchmarkDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setWorkerThreadCount(options.serverThreads);
+    if (!server.listenForClients(QHostAddress::LocalHost, options.port)) {
+        fprintf(stderr, "Could not listen on port %d\n", options.port);
+        return EXIT_FAILURE;
+    }
+    const qint64 rssBefore = residentSetSize();
+
+    // spread the clients over the threads
+    QVector<QThread *> threads;
+    QVector<LoadGenerator *> generators;
+    for (int i = 0; i < options.clientThreads; ++i) {
+        const int first = options.clients * i / options.clientThreads;
+        const int last = options.clients * (i + 1) / options.clientThreads;
+
+        auto *thread = new QThread;
+        auto *generator = new LoadGenerator(options, first, last - first);
+        generator->moveToThread(thread);
+        thread->start();
+        threads << thread;
+        generators << generator;
+    }
+
+    // log in
+    fprintf(stderr, "Connecting %d clients\n", options.clients);
+    QElapsedTimer phaseTimer;
+    phaseTimer.start();
+    runOnGroups(generators, "connectClients", &LoadGenerator::clientsConnected);
+    const double connectSeconds = phaseTimer.nsecsElapsed() / 1e9;
+    const qint64 rssConnected = residentSetSize();
+
+    // exchange messages, then give the last ones some time to arrive
+    fprintf(stderr, "Sending traffic for %d seconds\n", options.duration);
+    for (auto *generator : std::as_const(generators))
+        QMetaObject::invokeMethod(generator, "startTraffic", Qt::QueuedConnection);
+    phaseTimer.start();
+    sleepWithEvents(options.duration * 1000);
+    for (auto *generator : std::as_const(generators))
+        QMetaObject::invokeMethod(generator, "stopTraffic", Qt::QueuedConnection);
+    const double trafficSeconds = phaseTimer.nsecsElapsed() / 1e9;
+    sleepWithEvents(1000);
+
+    // log out
+    runOnGroups(generators, "disconnectClients", &LoadGenerator::clientsDisconnected);
+    for (auto *thread : std::as_const(threads)) {
+        thread->quit();
+        thread->wait();
+    }
+    server.close();
+
+    // collect the results
+    QVector<qint64> latencies;
+    int connected = 0;
+    int failed = 0;
+    qint64 messagesSent = 0;
+    qint64 messagesReceived = 0;
+    qint64 presencesSent = 0;
+    for (auto *generator : std::as_const(generators)) {
+        latencies += generator->takeLatencies();
+        connected += generator->connectedClients;
+        failed += generator->failedClients;
+        messagesSent += generator->messagesSent;
+        messagesReceived += generator->messagesReceived;
+        presencesSent += generator->presencesSent;
+    }
+    qDeleteAll(generators);
+    qDeleteAll(threads);
+    std::sort(latencies.begin(), latencies.end());
+
+    QJsonObject result;
+    result[QStringLiteral("benchmark")] = QStringLiteral("qxmppserverload");
+    result[QStringLiteral("qxmpp_version")] = QXmppVersion();
+    result[QStringLiteral("clients")] = options.clients;
+    result[QStringLiteral("client_threads")] = options.clientThreads;
+    result[QStringLiteral("server_threads")] = options.serverThreads;
+    result[QStringLiteral("message_rate")] = options.messageRate;
+    result[QStringLiteral("presence_rate")] = options.presenceRate;
+    result[QStringLiteral("mechanism")] = options.mechanism;
+    result[QStringLiteral("connected")] = connected;
+    result[QStringLiteral("failed")] = failed;
+    result[QStringLiteral("connect_seconds")] = connectSeconds;
+    result[QStringLiteral("connections_per_second")] = connected / connectSeconds;
+    result[QStringLiteral("traffic_seconds")] = trafficSeconds;
+    result[QStringLiteral("messages_sent")] = messagesSent;
+    result[QStringLiteral("messages_received")] = messagesReceived;
+    result[QStringLiteral("presences_sent")] = presencesSent;
+    result[QStringLiteral("messages_per_second")] = messagesReceived / trafficSeconds;
+    result[QStringLiteral("latency_p50_ms")] = percentile(latencies, 0.5);
+    result[QStringLiteral("latency_p99_ms")] = percentile(latencies, 0.99);
+    if (rssBefore >= 0 && rssConnected >= 0 && connected > 0)
+        result[QStringLiteral("rss_per_connection_kib")] = double(rssConnected - rssBefore) / connected;
+
+    fprintf(stdout, "%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#include "bench_qxmppserverload.moc"
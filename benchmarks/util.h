@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef BENCHMARKS_UTIL_H
+#define BENCHMARKS_UTIL_H
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppPasswordChecker.h"
+
+#include <atomic>
+#include <cmath>
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QMutex>
+#include <QSet>
+#include <QTimer>
+
+inline const QString benchmarkDomain = QStringLiteral("localhost");
+inline const QString benchmarkPassword = QStringLiteral("password");
+
+// Monotonic clock shared by all threads, used to timestamp messages.
+inline QElapsedTimer benchmarkClock;
+
+class BenchmarkPasswordChecker : public QXmppPasswordChecker
+{
+public:
+    /// Accepts every benchmark user with the common password.
+    QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password) override
+    {
+        if (!request.username().startsWith(QStringLiteral("user")))
+            return QXmppPasswordReply::AuthorizationError;
+        password = benchmarkPassword;
+        return QXmppPasswordReply::NoError;
+    }
+
+    bool hasGetPassword() const override
+    {
+        return true;
+    }
+};
+
+inline double percentile(const QVector<qint64> &sorted, double p)
+{
+    if (sorted.isEmpty())
+        return 0;
+    const int index = qBound(0, int(std::ceil(p * sorted.size())) - 1, sorted.size() - 1);
+    return sorted.at(index) / 1e6;
+}
+
+inline void sleepWithEvents(int msecs)
+{
+    QEventLoop loop;
+    QTimer::singleShot(msecs, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+///
+/// The BenchmarkClientGroup class drives a group of clients from one thread.
+///
+/// The clients are named user<index>, starting at the given first index.
+/// Subclasses adjust the configuration of the clients and filter the
+/// messages which count towards the latencies.
+///
+class BenchmarkClientGroup : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchmarkClientGroup(quint16 port, int firstClient, int clientCount)
+        : m_port(port),
+          m_firstClient(firstClient),
+          m_clientCount(clientCount)
+    {
+    }
+
+    Q_INVOKABLE void connectClients()
+    {
+        m_clients.reserve(m_clientCount);
+        connectNext();
+    }
+
+    Q_INVOKABLE void disconnectClients()
+    {
+        m_pendingDisconnects = 0;
+        for (auto *client : std::as_const(m_clients)) {
+            if (client->isConnected()) {
+                m_pendingDisconnects++;
+                client->disconnectFromServer();
+            }
+        }
+        if (!m_pendingDisconnects)
+            finishDisconnect();
+    }
+
+    QVector<qint64> takeLatencies()
+    {
+        QMutexLocker locker(&m_latenciesMutex);
+        QVector<qint64> latencies;
+        latencies.swap(m_latencies);
+        return latencies;
+    }
+
+    Q_SIGNAL void clientsConnected();
+    Q_SIGNAL void clientsDisconnected();
+
+    std::atomic<qint64> messagesReceived { 0 };
+
+    // only read once the thread has finished
+    int connectedClients = 0;
+    int failedClients = 0;
+
+protected:
+    virtual void configureClient(QXmppConfiguration &config)
+    {
+        Q_UNUSED(config)
+    }
+
+    virtual bool acceptMessage(const QXmppMessage &message)
+    {
+        Q_UNUSED(message)
+        return true;
+    }
+
+    const QVector<QXmppClient *> &clients() const
+    {
+        return m_clients;
+    }
+
+    int firstClient() const
+    {
+        return m_firstClient;
+    }
+
+private:
+    // connect a few clients at a time, to stay within the listen backlog
+    void connectNext()
+    {
+        while (m_connecting.size() < 16 && m_clients.size() < m_clientCount) {
+            const int index = m_firstClient + m_clients.size();
+
+            auto *client = new QXmppClient(this);
+            connect(client, &QXmppClient::connected, this, [this, client]() {
+                if (m_connecting.remove(client)) {
+                    connectedClients++;
+                    connectNext();
+                }
+            });
+            connect(client, &QXmppClient::error, this, [this, client]() {
+                if (m_connecting.remove(client)) {
+                    failedClients++;
+                    connectNext();
+                }
+            });
+            connect(client, &QXmppClient::disconnected, this, [this]() {
+                if (m_pendingDisconnects > 0 && --m_pendingDisconnects == 0)
+                    finishDisconnect();
+            });
+            connect(client, &QXmppClient::messageReceived, this, &BenchmarkClientGroup::messageReceived);
+
+            QXmppConfiguration config;
+            config.setDomain(benchmarkDomain);
+            config.setHost(QStringLiteral("127.0.0.1"));
+            config.setPort(m_port);
+            config.setUser(QStringLiteral("user%1").arg(index));
+            config.setPassword(benchmarkPassword);
+            config.setStreamSecurityMode(QXmppConfiguration::TLSDisabled);
+            config.setAutoReconnectionEnabled(false);
+            config.setKeepAliveInterval(0);
+            configureClient(config);
+
+            m_clients << client;
+            m_connecting.insert(client);
+            client->connectToServer(config);
+        }
+
+        if (m_connecting.isEmpty() && m_clients.size() == m_clientCount)
+            emit clientsConnected();
+    }
+
+    void messageReceived(const QXmppMessage &message)
+    {
+        if (!acceptMessage(message))
+            return;
+
+        bool ok = false;
+        const qint64 sent = message.body().toLongLong(&ok);
+        if (!ok)
+            return;
+
+        const qint64 latency = benchmarkClock.nsecsElapsed() - sent;
+        {
+            QMutexLocker locker(&m_latenciesMutex);
+            m_latencies << latency;
+        }
+        messagesReceived++;
+    }
+
+    void finishDisconnect()
+    {
+        // This runs from the disconnected() handler of the last client, and
+        // QXmppClient still uses itself once that signal returned, so the
+        // clients must not be deleted right away. The deferred deletes are
+        // processed before the thread finishes.
+        for (auto *client : std::as_const(m_clients))
+            client->deleteLater();
+        m_clients.clear();
+        emit clientsDisconnected();
+    }
+
+    const quint16 m_port;
+    const int m_firstClient;
+    const int m_clientCount;
+
+    QVector<QXmppClient *> m_clients;
+    QSet<QXmppClient *> m_connecting;
+    int m_pendingDisconnects = 0;
+
+    QMutex m_latenciesMutex;
+    QVector<qint64> m_latencies;
+};
+
+// Invokes a method on every group and waits until each of them emitted the
+// given signal.
+template<typename Group, typename Signal>
+void runOnGroups(const QVector<Group *> &groups, const char *method, Signal signal)
+{
+    QEventLoop loop;
+    int pending = groups.size();
+    for (auto *group : groups) {
+        QObject::connect(group, signal, &loop, [&]() {
+            if (--pending == 0)
+                loop.quit();
+        });
+        QMetaObject::invokeMethod(group, method, Qt::QueuedConnection);
+    }
+    if (pending)
+        loop.exec();
+    for (auto *group : groups)
+        QObject::disconnect(group, signal, &loop, nullptr);
+}
+
+#endif  // BENCHMARKS_UTIL_H
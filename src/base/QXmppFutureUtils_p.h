@@ -42,6 +42,8 @@
 
 #include <QFutureWatcher>
 #include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
 
 namespace QXmpp::Private {
 
@@ -135,6 +137,31 @@ auto chain(QFuture<Input> &&source, QObject *context, Converter task) -> QFuture
     return resultInterface->future();
 }
 
+// Runs a function in a thread pool (QThreadPool::start() only accepts
+// functions since Qt 5.15).
+template<typename Function>
+void runInThreadPool(QThreadPool *pool, Function function)
+{
+    class FunctionRunnable : public QRunnable
+    {
+    public:
+        explicit FunctionRunnable(Function &&function)
+            : m_function(std::move(function))
+        {
+        }
+
+        void run() override
+        {
+            m_function();
+        }
+
+    private:
+        Function m_function;
+    };
+
+    pool->start(new FunctionRunnable(std::move(function)));
+}
+
 template<typename IqType, typename Input, typename Converter>
 auto parseIq(Input &&sendResult, Converter convert) -> decltype(convert({}))
 {
@@ -29,6 +29,7 @@
 #include <QChildEvent>
 #include <QDateTime>
 #include <QFile>
+#include <QMetaMethod>
 #include <QMetaType>
 #include <QTextStream>
 
@@ -67,6 +68,8 @@ static void relaySignals(QXmppLoggable *from, QXmppLoggable *to)
                      to, &QXmppLoggable::setGauge);
     QObject::connect(from, &QXmppLoggable::updateCounter,
                      to, &QXmppLoggable::updateCounter);
+    QObject::connect(from, &QXmppLoggable::updateHistogram,
+                     to, &QXmppLoggable::updateHistogram);
 }
 
 /// Constructs a new QXmppLoggable.
@@ -74,12 +77,68 @@ static void relaySignals(QXmppLoggable *from, QXmppLoggable *to)
 /// \param parent
 
 QXmppLoggable::QXmppLoggable(QObject *parent)
-    : QObject(parent)
+    : QObject(parent), m_messageTypes(QXmppLogger::AnyMessage)
 {
     auto *logParent = qobject_cast<QXmppLoggable *>(parent);
     if (logParent) {
         relaySignals(this, logParent);
     }
+    updateMessageTypes();
+}
+
+/// Tells the loggable that its signals are connected to the given \a logger.
+///
+/// Log messages of types which are not enabled on the logger are then no
+/// longer emitted, unless something else is connected to logMessage().
+///
+/// \since QXmpp 1.5
+
+void QXmppLoggable::setLogSink(QXmppLogger *logger)
+{
+    if (m_logSink == logger)
+        return;
+
+    if (m_logSink) {
+        disconnect(m_logSink, &QXmppLogger::enabledMessageTypesChanged,
+                   this, &QXmppLoggable::updateMessageTypes);
+    }
+    m_logSink = logger;
+    if (m_logSink) {
+        connect(m_logSink, &QXmppLogger::enabledMessageTypesChanged,
+                this, &QXmppLoggable::updateMessageTypes);
+    }
+    updateMessageTypes();
+}
+
+// Recomputes the types of messages anybody listens to and pushes them down
+// to the children.
+void QXmppLoggable::updateMessageTypes()
+{
+    auto *logParent = qobject_cast<QXmppLoggable *>(parent());
+
+    // receivers we do not know about might want anything
+    int unknownReceivers = receivers(SIGNAL(logMessage(QXmppLogger::MessageType, QString)));
+    QXmppLogger::MessageTypes types = QXmppLogger::NoMessage;
+    if (logParent) {
+        types |= logParent->m_messageTypes;
+        unknownReceivers--;
+    }
+    if (m_logSink) {
+        types |= m_logSink->enabledMessageTypes();
+        unknownReceivers--;
+    }
+    if (unknownReceivers > 0)
+        types = QXmppLogger::AnyMessage;
+
+    if (types == m_messageTypes)
+        return;
+
+    m_messageTypes = types;
+    const auto objects = children();
+    for (auto *object : objects) {
+        if (auto *child = qobject_cast<QXmppLoggable *>(object))
+            child->updateMessageTypes();
+    }
 }
 
 /// \cond
@@ -91,6 +150,7 @@ void QXmppLoggable::childEvent(QChildEvent *event)
 
     if (event->added()) {
         relaySignals(child, this);
+        child->updateMessageTypes();
     } else if (event->removed()) {
         disconnect(child, &QXmppLoggable::logMessage,
                    this, &QXmppLoggable::logMessage);
@@ -98,8 +158,23 @@ void QXmppLoggable::childEvent(QChildEvent *event)
                    this, &QXmppLoggable::setGauge);
         disconnect(child, &QXmppLoggable::updateCounter,
                    this, &QXmppLoggable::updateCounter);
+        disconnect(child, &QXmppLoggable::updateHistogram,
+                   this, &QXmppLoggable::updateHistogram);
     }
 }
+
+void QXmppLoggable::connectNotify(const QMetaMethod &signal)
+{
+    if (signal == QMetaMethod::fromSignal(&QXmppLoggable::logMessage))
+        updateMessageTypes();
+}
+
+void QXmppLoggable::disconnectNotify(const QMetaMethod &signal)
+{
+    // an invalid method means everything was disconnected
+    if (!signal.isValid() || signal == QMetaMethod::fromSignal(&QXmppLoggable::logMessage))
+        updateMessageTypes();
+}
 /// \endcond
 
 class QXmppLoggerPrivate
@@ -157,8 +232,11 @@ QXmppLogger::LoggingType QXmppLogger::loggingType()
 void QXmppLogger::setLoggingType(QXmppLogger::LoggingType type)
 {
     if (d->loggingType != type) {
+        const auto oldTypes = enabledMessageTypes();
         d->loggingType = type;
         reopen();
+        if (enabledMessageTypes() != oldTypes)
+            emit enabledMessageTypesChanged();
     }
 }
 
@@ -173,7 +251,24 @@ QXmppLogger::MessageTypes QXmppLogger::messageTypes()
 
 void QXmppLogger::setMessageTypes(QXmppLogger::MessageTypes types)
 {
-    d->messageTypes = types;
+    if (d->messageTypes != types) {
+        const auto oldTypes = enabledMessageTypes();
+        d->messageTypes = types;
+        if (enabledMessageTypes() != oldTypes)
+            emit enabledMessageTypesChanged();
+    }
+}
+
+/// Returns the types of messages which are actually logged, taking into
+/// account both the logging type and the message types.
+///
+/// \since QXmpp 1.5
+
+QXmppLogger::MessageTypes QXmppLogger::enabledMessageTypes() const
+{
+    if (d->loggingType == QXmppLogger::NoLogging)
+        return QXmppLogger::NoMessage;
+    return d->messageTypes;
 }
 
 /// Add a logging message.
@@ -226,6 +321,18 @@ void QXmppLogger::updateCounter(const QString &counter, qint64 amount)
     Q_UNUSED(amount);
 }
 
+/// Records \a value in the distribution of the given \a histogram.
+///
+/// NOTE: the base implementation does nothing.
+///
+/// \since QXmpp 1.5
+
+void QXmppLogger::updateHistogram(const QString &histogram, double value)
+{
+    Q_UNUSED(histogram);
+    Q_UNUSED(value);
+}
+
 QString QXmppLogger::logFilePath()
 {
     return d->logFilePath;
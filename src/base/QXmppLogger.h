@@ -28,6 +28,7 @@
 #include "QXmppGlobal.h"
 
 #include <QObject>
+#include <QPointer>
 
 #ifdef QXMPP_LOGGABLE_TRACE
 #define qxmpp_loggable_trace(x) QString("%1(0x%2) %3").arg(metaObject()->className(), QString::number(reinterpret_cast<qint64>(this), 16), x)
@@ -100,9 +101,12 @@ public:
     QXmppLogger::MessageTypes messageTypes();
     void setMessageTypes(QXmppLogger::MessageTypes types);
 
+    QXmppLogger::MessageTypes enabledMessageTypes() const;
+
 public Q_SLOTS:
     virtual void setGauge(const QString &gauge, double value);
     virtual void updateCounter(const QString &counter, qint64 amount);
+    virtual void updateHistogram(const QString &histogram, double value);
 
     void log(QXmppLogger::MessageType type, const QString &text);
     void reopen();
@@ -111,6 +115,12 @@ Q_SIGNALS:
     /// This signal is emitted whenever a log message is received.
     void message(QXmppLogger::MessageType type, const QString &text);
 
+    /// This signal is emitted when the types of messages which are actually
+    /// logged change.
+    ///
+    /// \since QXmpp 1.5
+    void enabledMessageTypesChanged();
+
 private:
     static QXmppLogger *m_logger;
     QXmppLoggerPrivate *d;
@@ -130,8 +140,25 @@ public:
 protected:
     /// \cond
     void childEvent(QChildEvent *event) override;
+    void connectNotify(const QMetaMethod &signal) override;
+    void disconnectNotify(const QMetaMethod &signal) override;
     /// \endcond
 
+    void setLogSink(QXmppLogger *logger);
+
+    /// Returns true if a log message of the given \a type would reach any
+    /// sink.
+    ///
+    /// Use this to avoid building expensive log messages which would be
+    /// discarded anyway.
+    ///
+    /// \since QXmpp 1.5
+
+    bool isLoggingEnabled(QXmppLogger::MessageType type) const
+    {
+        return m_messageTypes.testFlag(type);
+    }
+
     /// Logs a debugging message.
     ///
     /// \param message
@@ -186,6 +213,17 @@ Q_SIGNALS:
 
     /// Updates the given \a counter by \a amount.
     void updateCounter(const QString &counter, qint64 amount = 1);
+
+    /// Records \a value in the distribution of the given \a histogram.
+    ///
+    /// \since QXmpp 1.5
+    void updateHistogram(const QString &histogram, double value);
+
+private:
+    void updateMessageTypes();
+
+    QPointer<QXmppLogger> m_logSink;
+    QXmppLogger::MessageTypes m_messageTypes;
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(QXmppLogger::MessageTypes)
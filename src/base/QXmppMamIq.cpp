@@ -149,7 +149,7 @@ void QXmppMamQueryIq::parseElementFromChild(const QDomElement &element)
 {
     QDomElement queryElement = element.firstChildElement(QStringLiteral("query"));
     d->node = queryElement.attribute(QStringLiteral("node"));
-    d->queryId = queryElement.attribute(QStringLiteral("queryId"));
+    d->queryId = queryElement.attribute(QStringLiteral("queryid"));
     QDomElement resultSetElement = queryElement.firstChildElement(QStringLiteral("set"));
     if (!resultSetElement.isNull()) {
         d->resultSetQuery.parse(resultSetElement);
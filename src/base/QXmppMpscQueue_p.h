@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPMPSCQUEUE_P_H
+#define QXMPPMPSCQUEUE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <atomic>
+#include <utility>
+
+namespace QXmpp::Private {
+
+//
+// Unbounded lock-free queue with multiple producers and a single consumer.
+//
+// Any thread may push(), but only one thread at a time may pop(). Pushing
+// never blocks. pop() may report an empty queue while a concurrent push() is
+// still in progress; the value is returned by a later pop().
+//
+// T must be default-constructible.
+//
+template<typename T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : m_head(&m_stub), m_tail(&m_stub)
+    {
+    }
+
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value)) {
+        }
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(T value)
+    {
+        link(new Node { std::move(value) });
+    }
+
+    bool pop(T &value)
+    {
+        auto *tail = m_tail;
+        auto *next = tail->next.load(std::memory_order_acquire);
+
+        // skip the stub node
+        if (tail == &m_stub) {
+            if (!next)
+                return false;
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            return take(tail, next, value);
+        }
+
+        // a producer is linking a new node
+        if (tail != m_head.load(std::memory_order_acquire))
+            return false;
+
+        // re-insert the stub so that the last node can be taken
+        link(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            return take(tail, next, value);
+        }
+        return false;
+    }
+
+private:
+    struct Node
+    {
+        T value;
+        std::atomic<Node *> next { nullptr };
+    };
+
+    void link(Node *node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        auto *previous = m_head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    bool take(Node *tail, Node *next, T &value)
+    {
+        m_tail = next;
+        value = std::move(tail->value);
+        delete tail;
+        return true;
+    }
+
+    Node m_stub;
+    std::atomic<Node *> m_head;
+    Node *m_tail;
+};
+
+}  // namespace QXmpp::Private
+
+#endif  // QXMPPMPSCQUEUE_P_H
@@ -51,7 +51,8 @@ QXmppPacket::QXmppPacket(const QByteArray &data, bool isXmppStanza, std::shared_
       m_data(data),
       m_isXmppStanza(isXmppStanza)
 {
-    m_interface->reportStarted();
+    if (m_interface)
+        m_interface->reportStarted();
 }
 
 QByteArray QXmppPacket::data() const
@@ -59,6 +60,11 @@ QByteArray QXmppPacket::data() const
     return m_data;
 }
 
+void QXmppPacket::setData(const QByteArray &data)
+{
+    m_data = data;
+}
+
 bool QXmppPacket::isXmppStanza() const
 {
     return m_isXmppStanza;
@@ -66,16 +72,18 @@ bool QXmppPacket::isXmppStanza() const
 
 QFuture<QXmpp::SendResult> QXmppPacket::future()
 {
-    return m_interface->future();
+    return m_interface ? m_interface->future() : QFuture<QXmpp::SendResult>();
 }
 
 void QXmppPacket::reportFinished()
 {
-    m_interface->reportFinished();
+    if (m_interface)
+        m_interface->reportFinished();
 }
 
 void QXmppPacket::reportResult(const QXmpp::SendResult &result)
 {
-    m_interface->reportResult(result);
+    if (m_interface)
+        m_interface->reportResult(result);
 }
 /// \endcond
@@ -33,6 +33,12 @@
 
 class QXmppNonza;
 
+//
+// A serialized packet, and the interface reporting the result of sending it.
+//
+// The interface may be null if nobody is interested in the result, in that
+// case reporting results does nothing.
+//
 class QXmppPacket
 {
 public:
@@ -41,6 +47,7 @@ public:
     QXmppPacket(const QByteArray &data, bool isXmppStanza, std::shared_ptr<QFutureInterface<QXmpp::SendResult>>);
 
     QByteArray data() const;
+    void setData(const QByteArray &data);
     bool isXmppStanza() const;
 
     QFuture<QXmpp::SendResult> future();
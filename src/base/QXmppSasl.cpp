@@ -121,6 +121,18 @@ static QByteArray generateNonce()
     return nonce.toBase64();
 }
 
+// Compares two byte arrays in a time which only depends on their size.
+static bool constantTimeEquals(const QByteArray &a, const QByteArray &b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    char difference = 0;
+    for (int i = 0; i < a.size(); i++)
+        difference |= a[i] ^ b[i];
+    return difference == 0;
+}
+
 static QMap<char, QByteArray> parseGS2(const QByteArray &ba)
 {
     QMap<char, QByteArray> map;
@@ -260,19 +272,32 @@ void QXmppSaslResponse::toXml(QXmlStreamWriter *writer) const
     writer->writeEndElement();
 }
 
-QXmppSaslSuccess::QXmppSaslSuccess()
+QXmppSaslSuccess::QXmppSaslSuccess(const QByteArray &value)
+    : m_value(value)
 {
 }
 
+QByteArray QXmppSaslSuccess::value() const
+{
+    return m_value;
+}
+
+void QXmppSaslSuccess::setValue(const QByteArray &value)
+{
+    m_value = value;
+}
+
 void QXmppSaslSuccess::parse(const QDomElement &element)
 {
-    Q_UNUSED(element);
+    m_value = QByteArray::fromBase64(element.text().toLatin1());
 }
 
 void QXmppSaslSuccess::toXml(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement(QStringLiteral("success"));
     writer->writeDefaultNamespace(ns_xmpp_sasl);
+    if (!m_value.isEmpty())
+        writer->writeCharacters(m_value.toBase64());
     writer->writeEndElement();
 }
 
@@ -703,6 +728,8 @@ QXmppSaslServer *QXmppSaslServer::create(const QString &mechanism, QObject *pare
         return new QXmppSaslServerDigestMd5(parent);
     } else if (mechanism == QStringLiteral("ANONYMOUS")) {
         return new QXmppSaslServerAnonymous(parent);
+    } else if (SCRAM_ALGORITHMS.contains(mechanism)) {
+        return new QXmppSaslServerScram(SCRAM_ALGORITHMS.value(mechanism), parent);
     } else {
         return nullptr;
     }
@@ -890,6 +917,146 @@ QXmppSaslServer::Response QXmppSaslServerPlain::respond(const QByteArray &reques
     }
 }
 
+QXmppSaslServerScram::QXmppSaslServerScram(QCryptographicHash::Algorithm algorithm, QObject *parent)
+    : QXmppSaslServer(parent),
+      m_algorithm(algorithm),
+      m_step(0),
+      m_iterations(0),
+      m_fakeCredentials(false)
+{
+    Q_ASSERT(SCRAM_ALGORITHMS.values().contains(algorithm));
+
+    m_nonce = generateNonce();
+}
+
+QString QXmppSaslServerScram::mechanism() const
+{
+    return SCRAM_ALGORITHMS.key(m_algorithm);
+}
+
+QCryptographicHash::Algorithm QXmppSaslServerScram::algorithm() const
+{
+    return m_algorithm;
+}
+
+/// Sets the credentials stored for the user, which are needed to answer the
+/// client's first message.
+
+void QXmppSaslServerScram::setCredentials(const QByteArray &salt, int iterations, const QByteArray &storedKey, const QByteArray &serverKey)
+{
+    m_salt = salt;
+    m_iterations = iterations;
+    m_storedKey = storedKey;
+    m_serverKey = serverKey;
+    m_fakeCredentials = false;
+}
+
+/// Sets made-up credentials for a user who does not exist.
+///
+/// The client then gets a server-first message like for any other user, with
+/// a salt derived from the username, and authentication fails once the
+/// client's proof is checked. This way the existence of accounts can not be
+/// probed (RFC 5802, section 5.1).
+
+void QXmppSaslServerScram::setFakeCredentials()
+{
+    // the same user gets the same salt for the lifetime of the process
+    static const QByteArray saltSecret = QXmppUtils::generateRandomBytes(32);
+
+    const int length = hashLength(m_algorithm);
+    m_salt = QMessageAuthenticationCode::hash(username().toUtf8(), saltSecret, QCryptographicHash::Sha256).left(16);
+    m_iterations = 4096;
+    m_storedKey = QXmppUtils::generateRandomBytes(length);
+    m_serverKey = QXmppUtils::generateRandomBytes(length);
+    m_fakeCredentials = true;
+}
+
+QXmppSaslServer::Response QXmppSaslServerScram::respond(const QByteArray &request, QByteArray &response)
+{
+    if (m_step == 0) {
+        if (request.isEmpty()) {
+            response = QByteArray();
+            return Challenge;
+        }
+
+        // channel binding and authorization identities are not supported
+        if (!request.startsWith("n,,") && !request.startsWith("y,,")) {
+            warning(QStringLiteral("QXmppSaslServerScram : Unsupported GS2 header"));
+            return Failed;
+        }
+        const QByteArray clientFirstMessageBare = request.mid(3);
+        const QMap<char, QByteArray> input = parseGS2(clientFirstMessageBare);
+        const QByteArray username = input.value('n');
+        const QByteArray clientNonce = input.value('r');
+        if (!clientFirstMessageBare.startsWith("n=") || username.isEmpty() || clientNonce.isEmpty() || input.contains('m')) {
+            warning(QStringLiteral("QXmppSaslServerScram : Invalid input"));
+            return Failed;
+        }
+
+        setUsername(QString::fromUtf8(QByteArray(username).replace("=2C", ",").replace("=3D", "=")));
+        if (m_storedKey.isEmpty() || m_serverKey.isEmpty() || m_salt.isEmpty() || m_iterations < 1)
+            return InputNeeded;
+
+        m_gs2Header = request.left(3);
+        m_clientFirstMessageBare = clientFirstMessageBare;
+        m_nonce = clientNonce + m_nonce;
+        m_serverFirstMessage = QByteArrayLiteral("r=") + m_nonce + QByteArrayLiteral(",s=") + m_salt.toBase64() + QByteArrayLiteral(",i=") + QByteArray::number(m_iterations);
+
+        m_step++;
+        response = m_serverFirstMessage;
+        return Challenge;
+    } else if (m_step == 1) {
+        const int proofStart = request.lastIndexOf(",p=");
+        const QMap<char, QByteArray> input = parseGS2(request);
+        const QByteArray clientProof = QByteArray::fromBase64(input.value('p'));
+        if (proofStart < 0 || QByteArray::fromBase64(input.value('c')) != m_gs2Header || input.value('r') != m_nonce || clientProof.size() != m_storedKey.size()) {
+            warning(QStringLiteral("QXmppSaslServerScram : Invalid input"));
+            return Failed;
+        }
+
+        // recover the client key from the proof and check it against the
+        // stored key
+        const QByteArray authMessage = m_clientFirstMessageBare + QByteArrayLiteral(",") + m_serverFirstMessage + QByteArrayLiteral(",") + request.left(proofStart);
+        QByteArray clientKey = QMessageAuthenticationCode::hash(authMessage, m_storedKey, m_algorithm);
+        std::transform(clientKey.cbegin(), clientKey.cend(), clientProof.cbegin(),
+                       clientKey.begin(), std::bit_xor<char>());
+        const bool proofValid = constantTimeEquals(QCryptographicHash::hash(clientKey, m_algorithm), m_storedKey);
+        if (!proofValid || m_fakeCredentials)
+            return Failed;
+
+        // the server-final message is sent as additional data with success
+        m_step++;
+        response = QByteArrayLiteral("v=") + QMessageAuthenticationCode::hash(authMessage, m_serverKey, m_algorithm).toBase64();
+        return Succeeded;
+    } else {
+        warning(QStringLiteral("QXmppSaslServerScram : Invalid step"));
+        return Failed;
+    }
+}
+
+/// Returns the SASL mechanism for the given SCRAM hash algorithm, or an
+/// empty string if the algorithm is not supported.
+
+QString QXmppSaslServerScram::mechanismName(QCryptographicHash::Algorithm algorithm)
+{
+    return SCRAM_ALGORITHMS.key(algorithm);
+}
+
+/// Derives the keys which a server stores for a user from the password.
+///
+/// This runs the PBKDF2 key derivation, so it should be done once when the
+/// password is set rather than at login time.
+
+void QXmppSaslServerScram::deriveKeys(QCryptographicHash::Algorithm algorithm, const QByteArray &password,
+                                      const QByteArray &salt, int iterations,
+                                      QByteArray &storedKey, QByteArray &serverKey)
+{
+    const QByteArray saltedPassword = deriveKeyPbkdf2(algorithm, password, salt, iterations, hashLength(algorithm));
+    const QByteArray clientKey = QMessageAuthenticationCode::hash(QByteArrayLiteral("Client Key"), saltedPassword, algorithm);
+    storedKey = QCryptographicHash::hash(clientKey, algorithm);
+    serverKey = QMessageAuthenticationCode::hash(QByteArrayLiteral("Server Key"), saltedPassword, algorithm);
+}
+
 void QXmppSaslDigestMd5::setNonce(const QByteArray &nonce)
 {
     forcedNonce = nonce;
@@ -196,12 +196,18 @@ private:
 class QXMPP_AUTOTEST_EXPORT QXmppSaslSuccess : public QXmppNonza
 {
 public:
-    QXmppSaslSuccess();
+    QXmppSaslSuccess(const QByteArray &value = QByteArray());
+
+    QByteArray value() const;
+    void setValue(const QByteArray &value);
 
     /// \cond
     void parse(const QDomElement &element) override;
     void toXml(QXmlStreamWriter *writer) const override;
     /// \endcond
+
+private:
+    QByteArray m_value;
 };
 
 class QXmppSaslClientAnonymous : public QXmppSaslClient
@@ -343,4 +349,35 @@ private:
     int m_step;
 };
 
+class QXMPP_AUTOTEST_EXPORT QXmppSaslServerScram : public QXmppSaslServer
+{
+public:
+    QXmppSaslServerScram(QCryptographicHash::Algorithm algorithm, QObject *parent = nullptr);
+    QString mechanism() const override;
+    QCryptographicHash::Algorithm algorithm() const;
+
+    void setCredentials(const QByteArray &salt, int iterations, const QByteArray &storedKey, const QByteArray &serverKey);
+    void setFakeCredentials();
+
+    Response respond(const QByteArray &challenge, QByteArray &response) override;
+
+    static QString mechanismName(QCryptographicHash::Algorithm algorithm);
+    static void deriveKeys(QCryptographicHash::Algorithm algorithm, const QByteArray &password,
+                           const QByteArray &salt, int iterations,
+                           QByteArray &storedKey, QByteArray &serverKey);
+
+private:
+    QCryptographicHash::Algorithm m_algorithm;
+    int m_step;
+    QByteArray m_gs2Header;
+    QByteArray m_clientFirstMessageBare;
+    QByteArray m_serverFirstMessage;
+    QByteArray m_nonce;
+    QByteArray m_salt;
+    int m_iterations;
+    QByteArray m_storedKey;
+    QByteArray m_serverKey;
+    bool m_fakeCredentials;
+};
+
 #endif
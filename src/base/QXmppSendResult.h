@@ -19,6 +19,8 @@ struct SendError
         SocketWriteError, ///< The packet was written to the socket with no success (only happens when Stream Management is disabled).
         Disconnected,     ///< The packet couldn't be sent because the connection hasn't been (re)established.
         EncryptionError,  ///< The packet couldn't be sent because prior encryption failed.
+        QueueLimitExceeded, ///< The packet was dropped from the stream management queue before it was acknowledged, because the queue's memory limit was exceeded (\since QXmpp 1.5).
+        Timeout,          ///< No response to the IQ request was received in time (\since QXmpp 1.5).
     };
 
     /// Text describing the error.
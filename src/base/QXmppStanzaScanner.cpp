@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppStanzaScanner_p.h"
+
+using namespace QXmpp::Private;
+
+static bool isXmlSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void StanzaScanner::scan(const QByteArray &data)
+{
+    const auto chunkStart = m_position;
+    const auto *bytes = data.constData();
+    const int size = data.size();
+
+    for (int i = 0; i < size; ++i) {
+        const char c = bytes[i];
+        m_tail = (m_tail << 8) | quint8(c);
+
+        switch (m_state) {
+        case Text:
+            if (c == '<') {
+                m_state = TagOpen;
+                m_inReference = false;
+                if (m_depth == 1) {
+                    m_capturing = true;
+                    m_captureStart = chunkStart + i;
+                    m_capture.clear();
+                    m_unforwardable = false;
+                }
+            } else {
+                scanReference(c);
+            }
+            break;
+        case TagOpen:
+            if (c == '/' || c == '?' || c == '!') {
+                // comments, processing instructions and the end of the
+                // stream are no stanzas
+                if (m_depth == 1)
+                    m_capturing = false;
+                else if (c == '?')
+                    m_unforwardable = true;
+                m_state = c == '/' ? EndTag : (c == '?' ? ProcessingInstruction : Markup);
+                m_markup.clear();
+            } else {
+                m_state = StartTag;
+                m_quote = 0;
+                m_last = c;
+                m_nameDone = false;
+                if (m_depth == 1)
+                    m_name = QByteArray(1, c);
+            }
+            break;
+        case StartTag:
+            if (m_quote) {
+                if (c == m_quote) {
+                    m_quote = 0;
+                    m_last = c;
+                    m_inReference = false;
+                } else {
+                    scanReference(c);
+                }
+            } else if (c == '"' || c == '\'') {
+                m_quote = c;
+            } else if (c == '>') {
+                m_state = Text;
+                if (m_last != '/')
+                    m_depth++;
+                else if (m_depth == 1)
+                    finishStanza(data, chunkStart, i + 1);
+            } else if (c == '=') {
+                // only the attributes of the stanza element itself matter
+                if (m_depth == 1 && m_name == QByteArrayLiteral("xmlns"))
+                    m_unforwardable = true;
+                m_last = c;
+            } else if (isXmlSpace(c)) {
+                m_nameDone = true;
+            } else {
+                if (m_depth == 1) {
+                    if (m_nameDone || m_last == '"' || m_last == '\'' || m_last == '=')
+                        m_name.clear();
+                    m_name.append(c);
+                }
+                m_nameDone = false;
+                m_last = c;
+            }
+            break;
+        case EndTag:
+            if (c == '>') {
+                m_state = Text;
+                m_depth--;
+                if (m_depth == 1)
+                    finishStanza(data, chunkStart, i + 1);
+            }
+            break;
+        case Markup:
+            m_markup.append(c);
+            if (m_markup == QByteArrayLiteral("--"))
+                m_state = Comment;
+            else if (m_markup == QByteArrayLiteral("[CDATA["))
+                m_state = CData;
+            else if (!QByteArrayLiteral("--").startsWith(m_markup) && !QByteArrayLiteral("[CDATA[").startsWith(m_markup))
+                m_state = Declaration;
+            if (m_depth > 1 && (m_state == Comment || m_state == Declaration))
+                m_unforwardable = true;
+            break;
+        case Comment:
+            if ((m_tail & 0xffffff) == 0x2d2d3e)  // "-->"
+                m_state = Text;
+            break;
+        case CData:
+            if ((m_tail & 0xffffff) == 0x5d5d3e)  // "]]>"
+                m_state = Text;
+            break;
+        case ProcessingInstruction:
+            if ((m_tail & 0xffff) == 0x3f3e)  // "?>"
+                m_state = Text;
+            break;
+        case Declaration:
+            if (c == '>')
+                m_state = Text;
+            break;
+        }
+    }
+
+    // keep the beginning of an incomplete stanza
+    if (m_capturing) {
+        const auto from = int(qMax<qint64>(0, m_captureStart - chunkStart));
+        m_capture.append(bytes + from, size - from);
+    }
+    m_position += size;
+}
+
+// Follows the entity references in text and attribute values. Only character
+// references and the five predefined entities are known to every parser.
+void StanzaScanner::scanReference(char c)
+{
+    if (c == '&') {
+        m_inReference = true;
+        m_reference.clear();
+    } else if (m_inReference) {
+        if (c == ';') {
+            m_inReference = false;
+            if (!m_reference.startsWith('#') &&
+                m_reference != QByteArrayLiteral("amp") &&
+                m_reference != QByteArrayLiteral("lt") &&
+                m_reference != QByteArrayLiteral("gt") &&
+                m_reference != QByteArrayLiteral("quot") &&
+                m_reference != QByteArrayLiteral("apos"))
+                m_unforwardable = true;
+        } else if (m_reference.size() < 8) {
+            // longer names are no predefined entities either
+            m_reference.append(c);
+        }
+    }
+}
+
+void StanzaScanner::finishStanza(const QByteArray &data, qint64 chunkStart, int end)
+{
+    QByteArray stanza;
+    if (!m_unforwardable) {
+        if (m_captureStart >= chunkStart) {
+            const auto begin = int(m_captureStart - chunkStart);
+            stanza = data.mid(begin, end - begin);
+        } else {
+            stanza = m_capture + data.left(end);
+        }
+    }
+    m_stanzas.enqueue(stanza);
+
+    m_capturing = false;
+    m_capture.clear();
+}
+
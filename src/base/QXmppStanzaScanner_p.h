@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSTANZASCANNER_P_H
+#define QXMPPSTANZASCANNER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "QXmppGlobal.h"
+
+#include <QByteArray>
+#include <QQueue>
+
+namespace QXmpp::Private {
+
+//
+// Finds the raw data of the stanzas in an incoming XML stream.
+//
+// The QXmlStreamReader only reports offsets into the decoded text, so the
+// received bytes are scanned separately. The scanner only understands as much
+// XML as is needed to find where each child of the stream element starts and
+// ends, anything else is left to the reader.
+//
+class QXMPP_AUTOTEST_EXPORT StanzaScanner
+{
+public:
+    void reset() { *this = StanzaScanner(); }
+    void scan(const QByteArray &data);
+
+    // Returns the data of the next complete stanza, or an empty byte array if
+    // the stanza can not be forwarded as it is: it declares its own default
+    // namespace, or it contains comments, processing instructions or entity
+    // references which only the sender's stream may know.
+    QByteArray takeStanza() { return m_stanzas.isEmpty() ? QByteArray() : m_stanzas.dequeue(); }
+
+private:
+    enum State {
+        Text,
+        TagOpen,
+        StartTag,
+        EndTag,
+        Markup,
+        Comment,
+        CData,
+        ProcessingInstruction,
+        Declaration,
+    };
+
+    void scanReference(char c);
+    void finishStanza(const QByteArray &data, qint64 chunkStart, int end);
+
+    State m_state = Text;
+    int m_depth = 0;
+
+    // start tag state
+    char m_quote = 0;
+    char m_last = 0;
+    QByteArray m_name;
+    bool m_nameDone = false;
+
+    // the characters following "<!" and the last bytes seen
+    QByteArray m_markup;
+    quint32 m_tail = 0;
+
+    // the name of the entity reference being read
+    bool m_inReference = false;
+    QByteArray m_reference;
+
+    // the stanza being received
+    bool m_capturing = false;
+    bool m_unforwardable = false;
+    qint64 m_position = 0;
+    qint64 m_captureStart = 0;
+    QByteArray m_capture;
+
+    QQueue<QByteArray> m_stanzas;
+};
+
+}  // namespace QXmpp::Private
+
+#endif  // QXMPPSTANZASCANNER_P_H
@@ -28,54 +28,256 @@
 #include "QXmppFutureUtils_p.h"
 #include "QXmppIq.h"
 #include "QXmppLogger.h"
+#include "QXmppNonza.h"
 #include "QXmppPacket_p.h"
+#include "QXmppStanzaScanner_p.h"
 #include "QXmppStanza.h"
 #include "QXmppStreamManagement_p.h"
+#include "QXmppTimingWheel_p.h"
+#include "QXmppTokenBucket_p.h"
 #include "QXmppUtils.h"
 
+#include <algorithm>
+#include <array>
+#include <utility>
+
 #include <QBuffer>
 #include <QDomDocument>
+#include <QElapsedTimer>
 #include <QFuture>
 #include <QFutureInterface>
 #include <QFutureWatcher>
+#include <QHash>
 #include <QHostAddress>
-#include <QMap>
-#include <QRegularExpression>
 #include <QSslSocket>
 #include <QStringList>
 #include <QTime>
+#include <QTimer>
+#include <QVector>
+#include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 
 using namespace QXmpp::Private;
 
+// size of the socket's read buffer while incoming data is rate limited
+static const qint64 RATE_LIMITED_READ_BUFFER_SIZE = 64 * 1024;
+
 #if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
 static bool randomSeeded = false;
 #endif
 
 using IqState = QFutureInterface<QXmppStream::IqResult>;
 
+struct RunningIq
+{
+    IqState interface;
+    // identifies the timeout scheduled for this IQ, 0 if there is none
+    quint32 timeoutSerial;
+};
+
+// default IQ timeout in milliseconds, IQs wait for their response forever
+static const int DEFAULT_IQ_TIMEOUT = 0;
+// resolution of the IQ timeout wheel in milliseconds
+static const int IQ_TIMEOUT_RESOLUTION = 1000;
+
 class QXmppStreamPrivate
 {
 public:
     QXmppStreamPrivate(QXmppStream *stream);
 
-    QString dataBuffer;
+    bool isSocketConnected() const;
+    void updateReadBufferSize();
+
+    // write queue
+    void queueData(const QByteArray &data);
+    void queueSharedData(const QByteArray &data);
+    int queueNonza(const QXmppNonza &nonza);
+    QByteArray serialize(const QXmppNonza &nonza);
+    void clearWriteQueue();
+
     QSslSocket *socket;
 
+    // incoming data
+    std::array<QByteArray, 4> readChunks;
+    std::size_t nextReadChunk;
+
+    // rate limits for incoming data
+    TokenBucket stanzaBucket;
+    TokenBucket byteBucket;
+    QElapsedTimer rateClock;
+    QTimer *throttleTimer;
+    bool throttled;
+
+    // Outgoing data is queued in writeSegments, followed by the end of
+    // writeBuffer starting at writeBufferMark. Data which is not kept
+    // anywhere else is serialized straight into writeBuffer, which is reused
+    // between flushes. Data which is also kept by stream management is
+    // queued as a shared QByteArray instead of copying it.
+    struct WriteSegment
+    {
+        // shared data, or a range in writeBuffer if null
+        QByteArray data;
+        int begin;
+        int end;
+    };
+    QVector<WriteSegment> writeSegments;
+    QByteArray writeBuffer;
+    QBuffer writeDevice;
+    QXmlStreamWriter xmlWriter;
+    int writeBufferMark;
+    qint64 writeQueueBytes;
+    int writeQueuePackets;
+
+    // serializer for packets that need their own buffer
+    QBuffer packetDevice;
+    QXmlStreamWriter packetWriter;
+
+    int corkLevel;
+    bool flushScheduled;
+
     // incoming stream state
-    QString streamOpenElement;
+    QXmlStreamReader reader;
+    QDomDocument stanzaDocument;
+    QDomElement currentElement;
+    QString pendingWhitespace;
+    int depth;
+    int parserGeneration;
+
+    // raw data of the incoming stanzas
+    bool rawStanzaDataEnabled;
+    bool rawStanzaDataUsable;
+    StanzaScanner stanzaScanner;
+    QByteArray rawStanzaData;
 
     // stream management
     QXmppStreamManager streamManager;
 
     // iq response handling
-    QMap<QString, IqState> runningIqs;
+    QHash<QString, RunningIq> runningIqs;
+    TimingWheel<std::pair<QString, quint32>> iqTimeouts;
+    QElapsedTimer iqClock;
+    QTimer *iqTimer;
+    quint32 lastIqTimeoutSerial;
+    int iqTimeout;
 };
 
 QXmppStreamPrivate::QXmppStreamPrivate(QXmppStream *stream)
     : socket(nullptr),
-      streamManager(stream)
+      nextReadChunk(0),
+      throttleTimer(new QTimer(stream)),
+      throttled(false),
+      writeBufferMark(0),
+      writeQueueBytes(0),
+      writeQueuePackets(0),
+      corkLevel(0),
+      flushScheduled(false),
+      depth(0),
+      parserGeneration(0),
+      rawStanzaDataEnabled(false),
+      rawStanzaDataUsable(true),
+      streamManager(stream),
+      iqTimeouts(IQ_TIMEOUT_RESOLUTION),
+      iqTimer(new QTimer(stream)),
+      lastIqTimeoutSerial(0),
+      iqTimeout(DEFAULT_IQ_TIMEOUT)
 {
+    // the capacity of the buffer is kept between flushes
+    writeBuffer.reserve(4096);
+    writeDevice.setBuffer(&writeBuffer);
+    writeDevice.open(QIODevice::WriteOnly);
+    xmlWriter.setDevice(&writeDevice);
+    packetWriter.setDevice(&packetDevice);
+
+    iqClock.start();
+    iqTimer->setInterval(IQ_TIMEOUT_RESOLUTION);
+
+    rateClock.start();
+    throttleTimer->setSingleShot(true);
+}
+
+bool QXmppStreamPrivate::isSocketConnected() const
+{
+    return socket && socket->state() == QAbstractSocket::ConnectedState;
+}
+
+void QXmppStreamPrivate::updateReadBufferSize()
+{
+    // While reading is paused, incoming data is left in the socket. With a
+    // limited read buffer, the socket then stops reading from the kernel and
+    // the peer is slowed down by TCP flow control.
+    if (socket)
+        socket->setReadBufferSize(stanzaBucket.isEnabled() || byteBucket.isEnabled() ? RATE_LIMITED_READ_BUFFER_SIZE : 0);
+}
+
+void QXmppStreamPrivate::queueData(const QByteArray &data)
+{
+    writeDevice.write(data);
+    writeQueueBytes += data.size();
+    writeQueuePackets++;
+}
+
+void QXmppStreamPrivate::queueSharedData(const QByteArray &data)
+{
+    if (writeBuffer.size() > writeBufferMark) {
+        writeSegments.append({ QByteArray(), writeBufferMark, int(writeBuffer.size()) });
+        writeBufferMark = writeBuffer.size();
+    }
+    writeSegments.append({ data, 0, int(data.size()) });
+    writeQueueBytes += data.size();
+    writeQueuePackets++;
+}
+
+// Serializes the nonza at the end of writeBuffer and returns where it starts.
+int QXmppStreamPrivate::queueNonza(const QXmppNonza &nonza)
+{
+    const auto start = int(writeBuffer.size());
+    nonza.toXml(&xmlWriter);
+    writeQueueBytes += writeBuffer.size() - start;
+    writeQueuePackets++;
+    return start;
+}
+
+// Serializes the nonza into a new byte array, reusing the XML writer.
+QByteArray QXmppStreamPrivate::serialize(const QXmppNonza &nonza)
+{
+    QByteArray data;
+    packetDevice.setBuffer(&data);
+    packetDevice.open(QIODevice::WriteOnly);
+    nonza.toXml(&packetWriter);
+    packetDevice.close();
+    packetDevice.setBuffer(nullptr);
+    return data;
+}
+
+void QXmppStreamPrivate::clearWriteQueue()
+{
+    writeSegments.clear();
+    writeBuffer.resize(0);
+    writeDevice.seek(0);
+    writeBufferMark = 0;
+    writeQueueBytes = 0;
+    writeQueuePackets = 0;
+}
+
+static QDomElement createElement(QDomDocument &document, const QXmlStreamReader &reader)
+{
+    auto element = document.createElementNS(reader.namespaceUri().toString(),
+                                            reader.qualifiedName().toString());
+
+    const auto attributes = reader.attributes();
+    for (const auto &attribute : attributes) {
+        element.setAttributeNS(attribute.namespaceUri().toString(),
+                               attribute.qualifiedName().toString(),
+                               attribute.value().toString());
+    }
+    return element;
+}
+
+static bool isWhitespace(const QByteArray &data)
+{
+    return std::all_of(data.cbegin(), data.cend(), [](char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    });
 }
 
 ///
@@ -105,6 +307,9 @@ QXmppStream::QXmppStream(QObject *parent)
         randomSeeded = true;
     }
 #endif
+
+    connect(d->iqTimer, &QTimer::timeout, this, &QXmppStream::_q_iqTimeoutTick);
+    connect(d->throttleTimer, &QTimer::timeout, this, &QXmppStream::_q_throttleTimeout);
 }
 
 ///
@@ -126,6 +331,7 @@ void QXmppStream::disconnectFromHost()
     if (d->socket) {
         if (d->socket->state() == QAbstractSocket::ConnectedState) {
             sendData(QByteArrayLiteral("</stream:stream>"));
+            flush();
             d->socket->flush();
         }
         // FIXME: according to RFC 6120 section 4.4, we should wait for
@@ -143,8 +349,47 @@ void QXmppStream::disconnectFromHost()
 void QXmppStream::handleStart()
 {
     d->streamManager.handleStart();
-    d->dataBuffer.clear();
-    d->streamOpenElement.clear();
+
+    // a new stream is a new XML document
+    d->reader.clear();
+    d->stanzaDocument = QDomDocument();
+    d->currentElement = QDomElement();
+    d->pendingWhitespace.clear();
+    d->depth = 0;
+    d->parserGeneration++;
+    d->stanzaScanner.reset();
+    d->rawStanzaDataUsable = true;
+}
+
+///
+/// Sets whether the raw data of incoming stanzas is kept while they are
+/// handled, so that it can be retrieved using rawStanzaData().
+///
+/// This must be set before the stream starts.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::setRawStanzaDataEnabled(bool enabled)
+{
+    d->rawStanzaDataEnabled = enabled;
+}
+
+///
+/// Returns the raw UTF-8 data of the stanza which is currently being handled
+/// by handleStanza().
+///
+/// The data can be forwarded to another stream without serializing the
+/// stanza again. It is empty if keeping raw stanza data is not enabled, or
+/// if the stanza declares its own default namespace, may depend on
+/// namespace prefixes declared on the stream element, or contains entity
+/// references other than the predefined ones, comments or processing
+/// instructions.
+///
+/// \since QXmpp 1.5
+///
+QByteArray QXmppStream::rawStanzaData() const
+{
+    return d->rawStanzaDataUsable ? d->rawStanzaData : QByteArray();
 }
 
 ///
@@ -159,26 +404,201 @@ bool QXmppStream::isConnected() const
 ///
 /// Sends raw data to the peer.
 ///
+/// The data is not written to the socket immediately: all data sent during
+/// one event loop iteration is collected and written at once when control
+/// returns to the event loop, or when the stream is uncorked.
+///
 /// \param data
 ///
 bool QXmppStream::sendData(const QByteArray &data)
 {
-    logSent(QString::fromUtf8(data));
-    if (!d->socket || d->socket->state() != QAbstractSocket::ConnectedState)
+    if (isLoggingEnabled(QXmppLogger::SentMessage))
+        logSent(QString::fromUtf8(data));
+    if (!d->isSocketConnected())
         return false;
-    return d->socket->write(data) == data.size();
+
+    d->queueData(data);
+    scheduleFlush();
+    return true;
+}
+
+void QXmppStream::scheduleFlush()
+{
+    if (!d->corkLevel && !d->flushScheduled) {
+        d->flushScheduled = true;
+        QMetaObject::invokeMethod(this, "_q_flushScheduled", Qt::QueuedConnection);
+    }
+}
+
+///
+/// Returns the maximum number of incoming stanzas handled per second, or 0
+/// if the number of stanzas is not limited.
+///
+/// \since QXmpp 1.5
+///
+int QXmppStream::stanzaRateLimit() const
+{
+    return int(d->stanzaBucket.rate());
+}
+
+///
+/// Limits the number of incoming stanzas handled per second.
+///
+/// Up to \a burst stanzas are handled at once, by default one second's
+/// worth. Once the limit is reached, the stream stops reading from its
+/// socket until enough time has passed. A limit of 0 disables the limit.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::setStanzaRateLimit(int stanzasPerSecond, int burst)
+{
+    d->stanzaBucket.setRate(stanzasPerSecond, burst, d->rateClock.elapsed());
+    d->updateReadBufferSize();
+
+    // check a paused stream against the new limit
+    if (d->throttled) {
+        d->throttleTimer->stop();
+        _q_throttleTimeout();
+    }
+}
+
+///
+/// Returns the maximum number of incoming bytes read per second, or 0 if the
+/// number of bytes is not limited.
+///
+/// \since QXmpp 1.5
+///
+qint64 QXmppStream::byteRateLimit() const
+{
+    return d->byteBucket.rate();
+}
+
+///
+/// Limits the number of incoming bytes read per second.
+///
+/// Up to \a burst bytes are read at once, by default one second's worth.
+/// Once the limit is reached, the stream stops reading from its socket until
+/// enough time has passed. A limit of 0 disables the limit.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::setByteRateLimit(qint64 bytesPerSecond, qint64 burst)
+{
+    d->byteBucket.setRate(bytesPerSecond, burst, d->rateClock.elapsed());
+    d->updateReadBufferSize();
+
+    // check a paused stream against the new limit
+    if (d->throttled) {
+        d->throttleTimer->stop();
+        _q_throttleTimeout();
+    }
+}
+
+///
+/// Corks the stream: data passed to sendData() is queued until uncork() is
+/// called as many times as cork() was called.
+///
+/// This can be used to send a batch of packets in as few writes as possible,
+/// regardless of the event loop.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::cork()
+{
+    d->corkLevel++;
+}
+
+///
+/// Uncorks the stream. Once the last cork has been removed, the queued data
+/// is written to the socket.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::uncork()
+{
+    if (d->corkLevel <= 0) {
+        warning(QStringLiteral("QXmppStream::uncork() called on a stream that is not corked"));
+        return;
+    }
+
+    if (--d->corkLevel == 0)
+        flush();
+}
+
+///
+/// Immediately writes all queued data to the socket, even if the stream is
+/// corked.
+///
+/// This needs to be called before changing the transport of the socket, e.g.
+/// before starting encryption.
+///
+/// Returns true if all queued data could be written.
+///
+/// \since QXmpp 1.5
+///
+bool QXmppStream::flush()
+{
+    if (!d->writeQueueBytes) {
+        d->clearWriteQueue();
+        return true;
+    }
+
+    if (!d->isSocketConnected()) {
+        d->clearWriteQueue();
+        return false;
+    }
+
+    const auto bytes = d->writeQueueBytes;
+    updateCounter(QStringLiteral("stream.flush.count"));
+    updateCounter(QStringLiteral("stream.flush.bytes"), bytes);
+    updateCounter(QStringLiteral("stream.flush.packets"), d->writeQueuePackets);
+
+    qint64 written = 0;
+    const auto write = [&](const char *data, qint64 size) {
+        const auto result = d->socket->write(data, size);
+        if (result > 0)
+            written += result;
+    };
+    for (const auto &segment : std::as_const(d->writeSegments)) {
+        if (segment.data.isNull())
+            write(d->writeBuffer.constData() + segment.begin, segment.end - segment.begin);
+        else
+            write(segment.data.constData(), segment.data.size());
+    }
+    write(d->writeBuffer.constData() + d->writeBufferMark, d->writeBuffer.size() - d->writeBufferMark);
+    d->clearWriteQueue();
+
+    if (written != bytes) {
+        warning(QStringLiteral("Could not write %1 bytes to socket").arg(QString::number(bytes)));
+        return false;
+    }
+    return true;
+}
+
+///
+/// Returns the number of bytes which have been sent but not written to the
+/// network yet, either because they are waiting in the stream's write queue
+/// or in the socket's buffer.
+///
+/// \since QXmpp 1.5
+///
+qint64 QXmppStream::bytesToWrite() const
+{
+    return d->writeQueueBytes + (d->socket ? d->socket->bytesToWrite() : 0);
 }
 
 ///
 /// Sends an XMPP packet to the peer.
 ///
+/// Unlike send(), this does not create a QFuture to report the result, which
+/// makes it the cheaper choice if the result is not needed. With stream
+/// management enabled the packet is still tracked for resending.
+///
 /// \param nonza
 ///
 bool QXmppStream::sendPacket(const QXmppNonza &nonza)
 {
-    bool success;
-    send(nonza, success);
-    return success;
+    return writeNonza(nonza, nullptr);
 }
 
 ///
@@ -188,8 +608,9 @@ bool QXmppStream::sendPacket(const QXmppNonza &nonza)
 ///
 QFuture<QXmpp::SendResult> QXmppStream::send(QXmppNonza &&nonza)
 {
-    bool success;
-    return send(QXmppPacket(nonza), success);
+    auto interface = std::make_shared<QFutureInterface<QXmpp::SendResult>>();
+    writeNonza(nonza, interface);
+    return interface->future();
 }
 
 ///
@@ -199,30 +620,69 @@ QFuture<QXmpp::SendResult> QXmppStream::send(QXmppNonza &&nonza)
 ///
 QFuture<QXmpp::SendResult> QXmppStream::send(QXmppPacket &&packet)
 {
-    bool success;
-    return send(std::move(packet), success);
+    writePacket(packet);
+    return packet.future();
 }
 
-QFuture<QXmpp::SendResult> QXmppStream::send(QXmppPacket &&packet, bool &writtenToSocket)
+bool QXmppStream::writePacket(QXmppPacket &packet)
 {
-    // the writtenToSocket parameter is just for backwards compat (see
-    // QXmppStream::sendPacket())
-    writtenToSocket = sendData(packet.data());
+    if (isLoggingEnabled(QXmppLogger::SentMessage))
+        logSent(QString::fromUtf8(packet.data()));
+    const auto written = d->isSocketConnected();
+    if (written) {
+        d->queueSharedData(packet.data());
+        scheduleFlush();
+    }
 
     // handle stream management
-    d->streamManager.handlePacketSent(packet, writtenToSocket);
+    d->streamManager.handlePacketSent(packet, written);
 
-    return packet.future();
+    return written;
+}
+
+bool QXmppStream::writeNonza(const QXmppNonza &nonza, std::shared_ptr<QFutureInterface<QXmpp::SendResult>> interface)
+{
+    // stream management keeps the serialized stanza, which is then shared
+    // with the write queue
+    if (nonza.isXmppStanza() && d->streamManager.enabled()) {
+        QXmppPacket packet(d->serialize(nonza), true, std::move(interface));
+        return writePacket(packet);
+    }
+
+    // otherwise the nonza is serialized directly into the write queue
+    const auto start = d->queueNonza(nonza);
+    const auto size = int(d->writeBuffer.size()) - start;
+    if (isLoggingEnabled(QXmppLogger::SentMessage))
+        logSent(QString::fromUtf8(d->writeBuffer.constData() + start, size));
+
+    const auto written = d->isSocketConnected();
+    if (written) {
+        scheduleFlush();
+    } else {
+        // drop the data again
+        d->writeBuffer.resize(start);
+        d->writeDevice.seek(start);
+        d->writeQueueBytes -= size;
+        d->writeQueuePackets--;
+    }
+
+    QXmppPacket packet(QByteArray(), nonza.isXmppStanza(), std::move(interface));
+    d->streamManager.handlePacketSent(packet, written);
+    return written;
 }
 
 ///
 /// Sends an IQ packet and returns the response asynchronously.
 ///
+/// If no response is received within \a timeout milliseconds, the IQ fails
+/// with QXmpp::SendError::Timeout. A negative value selects the default
+/// iqTimeout(), 0 disables the timeout.
+///
 /// \warning THIS API IS NOT FINALIZED YET!
 ///
 /// \since QXmpp 1.5
 ///
-QFuture<QXmppStream::IqResult> QXmppStream::sendIq(QXmppIq &&iq)
+QFuture<QXmppStream::IqResult> QXmppStream::sendIq(QXmppIq &&iq, int timeout)
 {
     using namespace QXmpp;
 
@@ -237,17 +697,21 @@ QFuture<QXmppStream::IqResult> QXmppStream::sendIq(QXmppIq &&iq)
         iq.setId(QXmppUtils::generateStanzaUuid());
     }
 
-    return sendIq(QXmppPacket(iq), iq.id());
+    return sendIq(QXmppPacket(iq), iq.id(), timeout);
 }
 
 ///
 /// Sends an IQ packet and returns the response asynchronously.
 ///
+/// If no response is received within \a timeout milliseconds, the IQ fails
+/// with QXmpp::SendError::Timeout. A negative value selects the default
+/// iqTimeout(), 0 disables the timeout.
+///
 /// \warning THIS API IS NOT FINALIZED YET!
 ///
 /// \since QXmpp 1.5
 ///
-QFuture<QXmppStream::IqResult> QXmppStream::sendIq(QXmppPacket &&packet, const QString &id)
+QFuture<QXmppStream::IqResult> QXmppStream::sendIq(QXmppPacket &&packet, const QString &id, int timeout)
 {
     using namespace QXmpp;
 
@@ -268,8 +732,8 @@ QFuture<QXmppStream::IqResult> QXmppStream::sendIq(QXmppPacket &&packet, const Q
         awaitLast(sendFuture, this, [this, id](SendResult result) {
             if (std::holds_alternative<SendError>(result)) {
                 if (auto itr = d->runningIqs.find(id); itr != d->runningIqs.end()) {
-                    itr.value().reportResult(std::get<SendError>(result));
-                    itr.value().reportFinished();
+                    itr->interface.reportResult(std::get<SendError>(result));
+                    itr->interface.reportFinished();
 
                     d->runningIqs.erase(itr);
                 }
@@ -278,10 +742,48 @@ QFuture<QXmppStream::IqResult> QXmppStream::sendIq(QXmppPacket &&packet, const Q
     }
 
     IqState interface(IqState::Started);
-    d->runningIqs.insert(id, interface);
+    quint32 timeoutSerial = 0;
+    if (const auto msecs = timeout < 0 ? d->iqTimeout : timeout; msecs > 0) {
+        // serial 0 means "no timeout"
+        if (++d->lastIqTimeoutSerial == 0)
+            ++d->lastIqTimeoutSerial;
+        timeoutSerial = d->lastIqTimeoutSerial;
+
+        d->iqTimeouts.schedule(d->iqClock.elapsed(), msecs, { id, timeoutSerial });
+        if (!d->iqTimer->isActive())
+            d->iqTimer->start();
+    }
+
+    d->runningIqs.insert(id, { interface, timeoutSerial });
     return interface.future();
 }
 
+///
+/// Returns the default time in milliseconds after which IQ requests without
+/// a response fail with QXmpp::SendError::Timeout.
+///
+/// \since QXmpp 1.5
+///
+int QXmppStream::iqTimeout() const
+{
+    return d->iqTimeout;
+}
+
+///
+/// Sets the default time in milliseconds after which IQ requests without a
+/// response fail with QXmpp::SendError::Timeout. A value of 0 disables the
+/// timeout.
+///
+/// The default value is 0, so IQ requests wait for their response until the
+/// stream is closed.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::setIqTimeout(int msecs)
+{
+    d->iqTimeout = qMax(0, msecs);
+}
+
 ///
 /// Cancels all ongoing IQ requests and reports QXmpp::SendError::Disconnected.
 ///
@@ -290,11 +792,11 @@ QFuture<QXmppStream::IqResult> QXmppStream::sendIq(QXmppPacket &&packet, const Q
 void QXmppStream::cancelOngoingIqs()
 {
     for (auto &state : d->runningIqs) {
-        state.reportResult(QXmpp::SendError {
+        state.interface.reportResult(QXmpp::SendError {
             QStringLiteral("IQ has been cancelled."),
             QXmpp::SendError::Disconnected
         });
-        state.reportFinished();
+        state.interface.reportFinished();
     }
     d->runningIqs.clear();
 }
@@ -336,8 +838,10 @@ QSslSocket *QXmppStream::socket() const
 void QXmppStream::setSocket(QSslSocket *socket)
 {
     d->socket = socket;
+    d->clearWriteQueue();
     if (!d->socket)
         return;
+    d->updateReadBufferSize();
 
     // socket events
     connect(socket, &QAbstractSocket::connected, this, &QXmppStream::_q_socketConnected);
@@ -368,112 +872,258 @@ void QXmppStream::_q_socketError(QAbstractSocket::SocketError socketError)
     warning(QStringLiteral("Socket error: ") + socket()->errorString());
 }
 
-void QXmppStream::_q_socketReadyRead()
+void QXmppStream::_q_iqTimeoutTick()
 {
-    processData(QString::fromUtf8(d->socket->readAll()));
+    // Timeouts of IQs which already got a response are not removed from the
+    // wheel, they are recognized by their serial instead.
+    d->iqTimeouts.expire(d->iqClock.elapsed(), [&](std::pair<QString, quint32> &&timeout) {
+        auto itr = d->runningIqs.find(timeout.first);
+        if (itr == d->runningIqs.end() || itr->timeoutSerial != timeout.second)
+            return;
+
+        warning(QStringLiteral("IQ request %1 timed out").arg(timeout.first));
+        itr->interface.reportResult(QXmpp::SendError {
+            QStringLiteral("IQ request timed out."),
+            QXmpp::SendError::Timeout
+        });
+        itr->interface.reportFinished();
+        d->runningIqs.erase(itr);
+    });
+
+    if (d->iqTimeouts.isEmpty())
+        d->iqTimer->stop();
 }
 
-void QXmppStream::processData(const QString &data)
+void QXmppStream::_q_flushScheduled()
 {
-    // As we may only have partial XML content, we need to cache the received
-    // data until it has been successfully parsed. In case it can't be parsed,
-    //
-    // There are only two small problems with the current strategy:
-    //  * When we receive a full stanza + a partial one, we can't parse the
-    //    first stanza until another stanza arrives that is complete.
-    //  * We don't know when we received invalid XML (would cause a growing
-    //    cache and a timeout after some time).
-    // However, both issues could only be solved using an XML stream reader
-    // which would cause many other problems since we don't actually use it for
-    // parsing the content.
-    d->dataBuffer.append(data);
+    d->flushScheduled = false;
+    if (!d->corkLevel)
+        flush();
+}
 
-    //
-    // Check for whitespace pings
-    //
-    if (d->dataBuffer.isEmpty() || d->dataBuffer.trimmed().isEmpty()) {
-        d->dataBuffer.clear();
+void QXmppStream::_q_socketReadyRead()
+{
+    // leave the data in the socket while a rate limit is reached
+    if (throttleRead())
+        return;
 
-        logReceived({});
-        handleStanza({});
+    // The data is read into a small ring of buffers which are reused once the
+    // XML reader has released them, so reading does not allocate in the
+    // steady state.
+    auto &chunk = d->readChunks[d->nextReadChunk];
+    d->nextReadChunk = (d->nextReadChunk + 1) % d->readChunks.size();
+    if (!chunk.isDetached())
+        chunk = QByteArray();
+
+    auto size = d->socket->bytesAvailable();
+    if (d->byteBucket.isEnabled())
+        size = qMin(size, d->byteBucket.tokens());
+    chunk.resize(int(size));
+    const auto bytesRead = d->socket->read(chunk.data(), chunk.size());
+    if (bytesRead <= 0)
         return;
-    }
+    chunk.resize(int(bytesRead));
+    d->byteBucket.take(bytesRead);
 
-    //
-    // Check whether we received a stream open or closing tag
-    //
-    static const QRegularExpression streamStartRegex(R"(^(<\?xml.*\?>)?\s*<stream:stream[^>]*>)");
-    static const QRegularExpression streamEndRegex("</stream:stream>$");
+    processData(chunk);
+
+    // no further readyRead() is emitted for the data which was left
+    if (d->socket && d->socket->bytesAvailable() > 0)
+        throttleRead();
+}
 
-    QRegularExpressionMatch streamOpenMatch;
-    bool hasStreamOpen = d->streamOpenElement.isEmpty() &&
-        (streamOpenMatch = streamStartRegex.match(d->dataBuffer)).hasMatch();
+void QXmppStream::_q_throttleTimeout()
+{
+    d->throttled = false;
+    if (throttleRead())
+        return;
 
-    bool hasStreamClose = streamEndRegex.match(d->dataBuffer).hasMatch();
+    // handle the stanzas which were already read, then read more
+    parseData();
+    if (!d->throttled && d->socket && d->socket->bytesAvailable() > 0)
+        _q_socketReadyRead();
+}
 
+///
+/// Pauses reading and parsing incoming data if a rate limit has been
+/// reached, until the limit allows it again.
+///
+/// Returns true if reading is paused.
+///
+bool QXmppStream::throttleRead()
+{
+    if (d->throttled)
+        return true;
+
+    const auto now = d->rateClock.elapsed();
+    const bool stanzasExceeded = d->stanzaBucket.isEmpty(now);
+    const bool bytesExceeded = d->byteBucket.isEmpty(now);
+    if (!stanzasExceeded && !bytesExceeded)
+        return false;
+
+    d->throttled = true;
+    d->throttleTimer->start(int(qMax(d->stanzaBucket.msecsUntilAvailable(now),
+                                     d->byteBucket.msecsUntilAvailable(now))));
+
+    if (stanzasExceeded)
+        updateCounter(QStringLiteral("stream.throttled.stanzas"));
+    if (bytesExceeded)
+        updateCounter(QStringLiteral("stream.throttled.bytes"));
+    return true;
+}
+
+void QXmppStream::processData(const QByteArray &data)
+{
     //
-    // The stream start/end and stanza packets can't be parsed without any
-    // modifications with QDomDocument. This is because of multiple reasons:
-    //  * The <stream:stream> open element is not considered valid without the
-    //    closing tag.
-    //  * Only the closing tag is of course not valid too.
-    //  * Stanzas/Nonzas need to have the correct stream namespaces set:
-    //     * For being able to parse <stream:features/>
-    //     * For having the correct namespace (e.g. 'jabber:client') set to
-    //       stanzas and their child elements (e.g. <body/> of a message).
+    // The incoming UTF-8 data is fed into a QXmlStreamReader that is kept for
+    // the whole lifetime of the XML stream (until handleStart() is called again),
+    // so each byte is only parsed once, no matter how many reads a stanza is
+    // split into.
     //
-    // The wrapping strategy looks like this:
-    //  * The stream open tag is cached once it arrives, for later access
-    //  * Incoming XML that has no <stream> open tag will be prepended by the
-    //    cached <stream> tag.
-    //  * Incoming XML that has no <stream> close tag will be appended by a
-    //    generic string "</stream:stream>"
+    // The parsed tokens are used to build the DOM elements:
+    //  * The <stream:stream> open tag (depth 0) is passed to handleStream().
+    //  * Each top-level child of the stream (depth 1) is built up in its own
+    //    QDomDocument and processed as soon as its end tag has been read.
+    //  * The </stream:stream> closing tag closes the connection.
     //
-    // The result is parsed by QDomDocument and the child elements of the stream
-    // are processed. In case the received data contained a stream open tag,
-    // the stream is processed (before the stanzas are processed). In case we
-    // received a </stream> closing tag, the connection is closed.
+    // Whitespace between stanzas is used as a keep-alive ping and reported as
+    // an empty element.
     //
-    auto wrappedStanzas = d->dataBuffer;
-    if (!hasStreamOpen) {
-        wrappedStanzas.prepend(d->streamOpenElement);
-    }
-    if (!hasStreamClose) {
-        wrappedStanzas.append(QStringLiteral("</stream:stream>"));
+    if (d->depth <= 1 && isWhitespace(data)) {
+        logReceived({});
+        handleStanza({});
+    } else if (isLoggingEnabled(QXmppLogger::ReceivedMessage)) {
+        logReceived(QString::fromUtf8(data));
     }
 
-    //
-    // Try to parse the wrapped XML
-    //
-    QDomDocument doc;
-    if (!doc.setContent(wrappedStanzas, true))
-        return;
+    if (d->rawStanzaDataEnabled)
+        d->stanzaScanner.scan(data);
+    d->reader.addData(data);
 
-    //
-    // Success: We can clear the buffer and send a 'received' log message
-    //
-    logReceived(d->dataBuffer);
-    d->dataBuffer.clear();
+    parseData();
+}
 
-    // process stream start
-    if (hasStreamOpen) {
-        d->streamOpenElement = streamOpenMatch.captured();
-        handleStream(doc.documentElement());
-    }
+void QXmppStream::parseData()
+{
+    // parsing is paused while the stanza rate limit is reached, the data
+    // stays in the XML reader
+    if (d->throttled)
+        return;
+
+    const auto generation = d->parserGeneration;
+    while (generation == d->parserGeneration) {
+        const auto token = d->reader.readNext();
+        if (token == QXmlStreamReader::Invalid || token == QXmlStreamReader::EndDocument) {
+            break;
+        }
 
-    // process stanzas
-    auto stanza = doc.documentElement().firstChildElement();
-    for (; !stanza.isNull(); stanza = stanza.nextSiblingElement()) {
-        // handle possible stream management packets first
-        if (d->streamManager.handleStanza(stanza) || handleIqResponse(stanza))
-            continue;
+        // whitespace is only kept if it is followed by more text
+        if (token != QXmlStreamReader::Characters)
+            d->pendingWhitespace.clear();
+
+        switch (token) {
+        case QXmlStreamReader::StartElement:
+            if (d->depth == 0) {
+                // process stream start
+                QDomDocument document;
+                auto streamElement = createElement(document, d->reader);
+                document.appendChild(streamElement);
+                d->depth++;
+
+                // stanzas using prefixes declared on the stream element
+                // cannot be forwarded as they are
+                const auto declarations = d->reader.namespaceDeclarations();
+                d->rawStanzaDataUsable = std::all_of(declarations.cbegin(), declarations.cend(), [](const QXmlStreamNamespaceDeclaration &declaration) {
+                    return declaration.prefix().isEmpty() || declaration.prefix() == QStringLiteral("stream");
+                });
+
+                handleStream(streamElement);
+            } else if (d->depth == 1) {
+                d->stanzaDocument = QDomDocument();
+                d->currentElement = createElement(d->stanzaDocument, d->reader);
+                d->stanzaDocument.appendChild(d->currentElement);
+                d->depth++;
+            } else {
+                auto element = createElement(d->stanzaDocument, d->reader);
+                d->currentElement.appendChild(element);
+                d->currentElement = element;
+                d->depth++;
+            }
+            break;
+        case QXmlStreamReader::EndElement:
+            d->depth--;
+            if (d->depth == 0) {
+                // process stream end
+                disconnectFromHost();
+                return;
+            } else if (d->depth == 1) {
+                const auto stanza = d->stanzaDocument.documentElement();
+                d->currentElement = QDomElement();
+                d->stanzaDocument = QDomDocument();
+                if (d->rawStanzaDataEnabled)
+                    d->rawStanzaData = d->stanzaScanner.takeStanza();
+
+                // handle possible stream management packets first
+                if (d->streamManager.handleStanza(stanza) || handleIqResponse(stanza)) {
+                    d->rawStanzaData.clear();
+                } else {
+                    // process all other kinds of packets
+                    handleStanza(stanza);
+                    d->rawStanzaData.clear();
+                }
 
-        // process all other kinds of packets
-        handleStanza(stanza);
+                d->stanzaBucket.take(1);
+                if (d->stanzaBucket.isEnabled() && throttleRead())
+                    return;
+            } else {
+                d->currentElement = d->currentElement.parentNode().toElement();
+            }
+            break;
+        case QXmlStreamReader::Characters:
+            // whitespace between stanzas is not part of any stanza
+            if (d->depth <= 1)
+                break;
+
+            if (d->reader.isCDATA()) {
+                d->currentElement.appendChild(d->stanzaDocument.createCDATASection(d->reader.text().toString()));
+            } else {
+                // the text of an element may be reported in several parts if
+                // it was split between reads, so whitespace is appended to
+                // the text before it, or kept until more text follows
+                auto lastChild = d->currentElement.lastChild();
+                const bool continuesText = lastChild.isText() && !lastChild.isCDATASection();
+                if (continuesText) {
+                    lastChild.toText().appendData(d->reader.text().toString());
+                } else if (d->reader.isWhitespace()) {
+                    d->pendingWhitespace += d->reader.text().toString();
+                } else {
+                    d->currentElement.appendChild(d->stanzaDocument.createTextNode(d->pendingWhitespace + d->reader.text().toString()));
+                    d->pendingWhitespace.clear();
+                }
+            }
+            break;
+        case QXmlStreamReader::DTD:
+        case QXmlStreamReader::EntityReference:
+        case QXmlStreamReader::Comment:
+        case QXmlStreamReader::ProcessingInstruction:
+            // RFC 6120 section 11.1 forbids these in XMPP streams, the
+            // reader is stopped so that no further data is parsed
+            warning(QStringLiteral("Received restricted XML"));
+            d->reader.raiseError(QStringLiteral("Restricted XML"));
+            sendData(QByteArrayLiteral("<stream:error><restricted-xml xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error>"));
+            disconnectFromHost();
+            return;
+        default:
+            // the XML declaration is not part of any stanza
+            break;
+        }
     }
 
-    // process stream end
-    if (hasStreamClose) {
+    if (generation == d->parserGeneration &&
+        d->reader.hasError() &&
+        d->reader.error() != QXmlStreamReader::PrematureEndOfDocumentError &&
+        d->reader.error() != QXmlStreamReader::CustomError) {
+        warning(QStringLiteral("Received invalid XML: %1").arg(d->reader.errorString()));
         disconnectFromHost();
     }
 }
@@ -493,8 +1143,8 @@ bool QXmppStream::handleIqResponse(const QDomElement &stanza)
     if (auto itr = d->runningIqs.find(stanza.attribute(QStringLiteral("id")));
         itr != d->runningIqs.end()) {
 
-        itr.value().reportResult(stanza);
-        itr.value().reportFinished();
+        itr->interface.reportResult(stanza);
+        itr->interface.reportFinished();
 
         d->runningIqs.erase(itr);
         return true;
@@ -509,11 +1159,17 @@ bool QXmppStream::handleIqResponse(const QDomElement &stanza)
 /// \param resetSequenceNumber Indicates if the sequence numbers should be
 /// reset. This must be done if the stream is not resumed.
 ///
+/// Returns false if the stanzas of a resumed stream could not be resent,
+/// because one of them could not be read back from the spill file (see
+/// setStreamManagementQueueLimit()). That stanza's send result reports an
+/// error and the stream can not be continued, as the peer's sequence
+/// numbers would no longer match.
+///
 /// \since QXmpp 1.0
 ///
-void QXmppStream::enableStreamManagement(bool resetSequenceNumber)
+bool QXmppStream::enableStreamManagement(bool resetSequenceNumber)
 {
-    d->streamManager.enableStreamManagement(resetSequenceNumber);
+    return d->streamManager.enableStreamManagement(resetSequenceNumber);
 }
 
 ///
@@ -536,3 +1192,70 @@ void QXmppStream::setAcknowledgedSequenceNumber(unsigned int sequenceNumber)
 {
     d->streamManager.setAcknowledgedSequenceNumber(sequenceNumber);
 }
+
+///
+/// Configures when acknowledgements are requested from the peer (\xep{0198}).
+///
+/// An acknowledgement is requested once \a stanzaInterval stanzas have been
+/// sent since the last request, once stanzas of \a byteThreshold bytes have
+/// been sent since the last request, or when no further stanza has been sent
+/// for \a idleTimeout milliseconds. A value of 0 disables the respective
+/// trigger.
+///
+/// \warning If all three triggers are disabled, acknowledgements are never
+/// requested during normal operation (only once after resuming a stream), so
+/// unacknowledged stanzas accumulate until the peer acknowledges them on its
+/// own. Combine this with setStreamManagementQueueLimit() or make sure the
+/// peer sends acknowledgements unsolicited.
+///
+/// By default an acknowledgement is requested after every stanza.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::setStreamManagementAckPolicy(unsigned int stanzaInterval, int idleTimeout, qint64 byteThreshold)
+{
+    d->streamManager.setAckRequestInterval(stanzaInterval);
+    d->streamManager.setAckRequestIdleTimeout(idleTimeout);
+    d->streamManager.setAckRequestByteThreshold(byteThreshold);
+}
+
+///
+/// Limits the memory used by stanzas waiting for an acknowledgement from the
+/// peer (\xep{0198}) to \a maxBytes. 0 means no limit, which is the default.
+///
+/// Once the limit is exceeded, the oldest stanzas are written to a temporary
+/// file in \a spillDirectory and read back when they need to be resent. If
+/// no directory is given, the oldest stanzas are removed from the queue
+/// instead and their send results report QXmpp::SendError::QueueLimitExceeded.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::setStreamManagementQueueLimit(qint64 maxBytes, const QString &spillDirectory)
+{
+    d->streamManager.setQueueMemoryLimit(maxBytes, spillDirectory);
+}
+
+///
+/// Writes the \xep{0198} sequence numbers and the stanzas that have not been
+/// acknowledged yet to \a stream.
+///
+/// \since QXmpp 1.5
+///
+void QXmppStream::writeStreamManagementState(QDataStream &stream) const
+{
+    d->streamManager.saveState(stream);
+}
+
+///
+/// Restores the \xep{0198} sequence numbers and unacknowledged stanzas
+/// previously written using writeStreamManagementState().
+///
+/// Returns false if the data could not be read, in which case the current
+/// state is unchanged.
+///
+/// \since QXmpp 1.5
+///
+bool QXmppStream::readStreamManagementState(QDataStream &stream)
+{
+    return d->streamManager.restoreState(stream);
+}
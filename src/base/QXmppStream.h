@@ -34,6 +34,7 @@
 #include <QAbstractSocket>
 #include <QObject>
 
+class QDataStream;
 class QDomElement;
 template<typename T>
 class QFuture;
@@ -64,13 +65,25 @@ public:
     QFuture<QXmpp::SendResult> send(QXmppPacket &&);
 
     using IqResult = std::variant<QDomElement, QXmpp::SendError>;
-    QFuture<IqResult> sendIq(QXmppIq &&);
-    QFuture<IqResult> sendIq(QXmppPacket &&, const QString &id);
+    QFuture<IqResult> sendIq(QXmppIq &&, int timeout = -1);
+    QFuture<IqResult> sendIq(QXmppPacket &&, const QString &id, int timeout = -1);
+    int iqTimeout() const;
+    void setIqTimeout(int msecs);
     void cancelOngoingIqs();
     bool hasIqId(const QString &id) const;
 
     void resetPacketCache();
 
+    void cork();
+    void uncork();
+    bool flush();
+    qint64 bytesToWrite() const;
+
+    int stanzaRateLimit() const;
+    void setStanzaRateLimit(int stanzasPerSecond, int burst = 0);
+    qint64 byteRateLimit() const;
+    void setByteRateLimit(qint64 bytesPerSecond, qint64 burst = 0);
+
 Q_SIGNALS:
     /// This signal is emitted when the stream is connected.
     void connected();
@@ -86,6 +99,10 @@ protected:
     // Overridable methods
     virtual void handleStart();
 
+    // Raw data of incoming stanzas
+    void setRawStanzaDataEnabled(bool enabled);
+    QByteArray rawStanzaData() const;
+
     /// Handles an incoming XMPP stanza.
     ///
     /// \param element
@@ -97,9 +114,13 @@ protected:
     virtual void handleStream(const QDomElement &element) = 0;
 
     // XEP-0198: Stream Management
-    void enableStreamManagement(bool resetSequenceNumber);
+    bool enableStreamManagement(bool resetSequenceNumber);
     unsigned int lastIncomingSequenceNumber() const;
     void setAcknowledgedSequenceNumber(unsigned int sequenceNumber);
+    void setStreamManagementAckPolicy(unsigned int stanzaInterval, int idleTimeout, qint64 byteThreshold);
+    void setStreamManagementQueueLimit(qint64 maxBytes, const QString &spillDirectory = QString());
+    void writeStreamManagementState(QDataStream &stream) const;
+    bool readStreamManagementState(QDataStream &stream);
 
 public Q_SLOTS:
     virtual void disconnectFromHost();
@@ -109,15 +130,22 @@ private Q_SLOTS:
     void _q_socketConnected();
     void _q_socketEncrypted();
     void _q_socketError(QAbstractSocket::SocketError error);
+    void _q_flushScheduled();
+    void _q_iqTimeoutTick();
     void _q_socketReadyRead();
+    void _q_throttleTimeout();
 
 private:
     friend class QXmppStreamManager;
     friend class tst_QXmppStream;
     friend class TestClient;
 
-    QFuture<QXmpp::SendResult> send(QXmppPacket &&, bool &);
-    void processData(const QString &data);
+    bool writePacket(QXmppPacket &packet);
+    bool writeNonza(const QXmppNonza &nonza, std::shared_ptr<QFutureInterface<QXmpp::SendResult>> interface);
+    void scheduleFlush();
+    void processData(const QByteArray &data);
+    void parseData();
+    bool throttleRead();
     bool handleIqResponse(const QDomElement &);
 
     QXmppStreamPrivate *const d;
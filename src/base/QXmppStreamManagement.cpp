@@ -28,6 +28,14 @@
 #include "QXmppStream.h"
 #include "QXmppStreamManagement_p.h"
 
+#include <algorithm>
+#include <utility>
+
+#include <QDataStream>
+#include <QTemporaryFile>
+#include <QTimer>
+#include <QVector>
+
 /// \cond
 QXmppStreamManagementEnable::QXmppStreamManagementEnable(const bool resume, const unsigned max)
     : m_resume(resume), m_max(max)
@@ -329,8 +337,16 @@ void QXmppStreamManagementReq::toXml(QXmlStreamWriter *writer)
 }
 
 QXmppStreamManager::QXmppStreamManager(QXmppStream *stream)
-    : stream(stream)
-{
+    : stream(stream),
+      m_ackRequestTimer(new QTimer(stream))
+{
+    // the timer is parented to the stream so it follows it between threads
+    m_ackRequestTimer->setSingleShot(true);
+    m_ackRequestTimer->setInterval(0);
+    QObject::connect(m_ackRequestTimer, &QTimer::timeout, stream, [this]() {
+        if (m_stanzasSinceAckRequest)
+            sendAcknowledgementRequest();
+    });
 }
 
 QXmppStreamManager::~QXmppStreamManager()
@@ -351,18 +367,37 @@ unsigned int QXmppStreamManager::lastIncomingSequenceNumber() const
 void QXmppStreamManager::handleDisconnect()
 {
     m_enabled = false;
+    m_stanzasSinceAckRequest = 0;
+    m_bytesSinceAckRequest = 0;
+    m_ackRequestPending = false;
+    m_ackRequestTimer->stop();
 }
 
 void QXmppStreamManager::handleStart()
 {
     m_enabled = false;
+    m_stanzasSinceAckRequest = 0;
+    m_bytesSinceAckRequest = 0;
+    m_ackRequestPending = false;
+    m_ackRequestTimer->stop();
 }
 
 void QXmppStreamManager::handlePacketSent(QXmppPacket &packet, bool sentData)
 {
     if (m_enabled && packet.isXmppStanza()) {
-        m_unacknowledgedStanzas.insert(++m_lastOutgoingSequenceNumber, packet);
-        sendAcknowledgementRequest();
+        enqueue(++m_lastOutgoingSequenceNumber, packet);
+        m_stanzasSinceAckRequest++;
+        m_bytesSinceAckRequest += packet.data().size();
+        enforceQueueLimit();
+        updateUnacknowledgedGauges();
+
+        if ((m_ackRequestInterval && m_stanzasSinceAckRequest >= m_ackRequestInterval) ||
+            (m_ackRequestByteThreshold && m_bytesSinceAckRequest >= m_ackRequestByteThreshold)) {
+            sendAcknowledgementRequest();
+        } else if (m_ackRequestTimer->interval() > 0) {
+            // (re)start the idle timer
+            m_ackRequestTimer->start();
+        }
     } else {
         if (sentData) {
             packet.reportResult(QXmpp::SendSuccess { false });
@@ -395,49 +430,137 @@ bool QXmppStreamManager::handleStanza(const QDomElement &stanza)
     return false;
 }
 
-void QXmppStreamManager::enableStreamManagement(bool resetSequenceNumber)
+//
+// Enables stream management and resends the unacknowledged stanzas.
+//
+// Returns false if a resumed session (\a resetSequenceNumber is false) can
+// not be continued, because a spilled stanza could not be read back. The
+// stanza is reported as failed and the remaining stanzas are not resent, so
+// the caller needs to end the session and start a new one.
+//
+bool QXmppStreamManager::enableStreamManagement(bool resetSequenceNumber)
 {
     m_enabled = true;
 
     if (resetSequenceNumber) {
-        m_lastOutgoingSequenceNumber = 0;
         m_lastIncomingSequenceNumber = 0;
+        m_lastAcknowledgedSequenceNumber = 0;
+    }
 
-        // resend unacked stanzas
-        if (!m_unacknowledgedStanzas.isEmpty()) {
-            auto oldUnackedStanzas = m_unacknowledgedStanzas;
-            m_unacknowledgedStanzas.clear();
-
-            for (auto &packet : oldUnackedStanzas) {
-                m_unacknowledgedStanzas.insert(++m_lastOutgoingSequenceNumber, packet);
-                stream->sendData(packet.data());
+    // Resend unacked stanzas in order. They are numbered starting from the
+    // last acknowledged stanza, so stanzas which have been dropped from the
+    // queue do not leave gaps in the sequence.
+    m_lastOutgoingSequenceNumber = m_lastAcknowledgedSequenceNumber;
+    for (int i = 0; i < m_queueSize;) {
+        auto &stanza = queueEntry(i);
+        const auto data = stanza.spillOffset < 0 ? std::optional(stanza.packet.data()) : readSpilled(stanza);
+        if (!data) {
+            auto lost = takeAt(i);
+            lost.packet.reportResult(QXmpp::SendError {
+                QStringLiteral("Could not read the stanza back from the stream management spill file."),
+                QXmpp::SendError::QueueLimitExceeded });
+            lost.packet.reportFinished();
+            stream->updateCounter(QStringLiteral("stream-management.unacked.dropped"));
+            updateUnacknowledgedGauges(true);
+
+            if (!resetSequenceNumber) {
+                m_enabled = false;
+                return false;
             }
-
-            sendAcknowledgementRequest();
+            continue;
         }
-    } else {
-        // resend unacked stanzas
-        if (!m_unacknowledgedStanzas.isEmpty()) {
-            for (auto &packet : m_unacknowledgedStanzas) {
-                stream->sendData(packet.data());
-            }
 
-            sendAcknowledgementRequest();
-        }
+        stanza.sequenceNumber = ++m_lastOutgoingSequenceNumber;
+        stream->sendData(*data);
+        i++;
     }
+
+    if (m_queueSize)
+        sendAcknowledgementRequest();
+    return true;
 }
 
 void QXmppStreamManager::setAcknowledgedSequenceNumber(unsigned int sequenceNumber)
 {
-    for (auto it = m_unacknowledgedStanzas.begin(); it != m_unacknowledgedStanzas.end();) {
-        if (it.key() <= sequenceNumber) {
-            it->reportResult(QXmpp::SendSuccess { true });
-            it->reportFinished();
-            it = m_unacknowledgedStanzas.erase(it);
-        } else {
-            break;
-        }
+    m_lastAcknowledgedSequenceNumber = sequenceNumber;
+
+    while (m_queueSize && queueEntry(0).sequenceNumber <= sequenceNumber) {
+        auto stanza = dequeue();
+        stanza.packet.reportResult(QXmpp::SendSuccess { true });
+        stanza.packet.reportFinished();
     }
+    updateUnacknowledgedGauges();
+}
+
+qint64 QXmppStreamManager::queueMemoryLimit() const
+{
+    return m_queueMemoryLimit;
+}
+
+//
+// Sets the maximum size in bytes of unacknowledged stanzas kept in memory. 0
+// means no limit.
+//
+// Once the limit is exceeded the oldest stanzas are written to a spill file in
+// \a spillDirectory, or if no directory is set, they are removed from the
+// queue and reported as failed.
+//
+void QXmppStreamManager::setQueueMemoryLimit(qint64 bytes, const QString &spillDirectory)
+{
+    m_queueMemoryLimit = qMax<qint64>(0, bytes);
+    m_spillDirectory = spillDirectory;
+    enforceQueueLimit();
+    updateUnacknowledgedGauges(true);
+}
+
+unsigned int QXmppStreamManager::ackRequestInterval() const
+{
+    return m_ackRequestInterval;
+}
+
+//
+// Sets the number of stanzas after which an acknowledgement is requested.
+//
+// The default of 1 requests an acknowledgement after every stanza, 0
+// disables requesting acknowledgements based on the number of stanzas.
+//
+// If the stanza interval, the idle timeout and the byte threshold are all 0,
+// acknowledgements are only requested after resuming a stream.
+//
+void QXmppStreamManager::setAckRequestInterval(unsigned int stanzas)
+{
+    m_ackRequestInterval = stanzas;
+}
+
+int QXmppStreamManager::ackRequestIdleTimeout() const
+{
+    return m_ackRequestTimer->interval();
+}
+
+//
+// Sets the time in milliseconds after the last sent stanza after which an
+// acknowledgement is requested for the stanzas that were not covered by a
+// request yet. 0 disables the idle timeout.
+//
+void QXmppStreamManager::setAckRequestIdleTimeout(int msecs)
+{
+    m_ackRequestTimer->setInterval(qMax(0, msecs));
+    if (!msecs)
+        m_ackRequestTimer->stop();
+}
+
+qint64 QXmppStreamManager::ackRequestByteThreshold() const
+{
+    return m_ackRequestByteThreshold;
+}
+
+//
+// Sets the number of bytes sent since the last acknowledgement request after
+// which another acknowledgement is requested. 0 disables the byte threshold.
+//
+void QXmppStreamManager::setAckRequestByteThreshold(qint64 bytes)
+{
+    m_ackRequestByteThreshold = qMax<qint64>(0, bytes);
 }
 
 void QXmppStreamManager::handleAcknowledgement(const QDomElement &element)
@@ -447,6 +570,12 @@ void QXmppStreamManager::handleAcknowledgement(const QDomElement &element)
 
     QXmppStreamManagementAck ack;
     ack.parse(element);
+
+    if (m_ackRequestPending) {
+        m_ackRequestPending = false;
+        stream->setGauge(QStringLiteral("stream-management.ack.rtt"), m_ackRequestSent.elapsed());
+    }
+
     setAcknowledgedSequenceNumber(ack.seqNo());
 }
 
@@ -470,6 +599,16 @@ void QXmppStreamManager::sendAcknowledgementRequest()
     if (!m_enabled)
         return;
 
+    m_stanzasSinceAckRequest = 0;
+    m_bytesSinceAckRequest = 0;
+    m_ackRequestTimer->stop();
+
+    // the round-trip time is measured from the oldest unanswered request
+    if (!m_ackRequestPending) {
+        m_ackRequestPending = true;
+        m_ackRequestSent.start();
+    }
+
     // prepare packet
     QByteArray data;
     QXmlStreamWriter xmlStream(&data);
@@ -479,13 +618,209 @@ void QXmppStreamManager::sendAcknowledgementRequest()
     stream->sendData(data);
 }
 
+//
+// Writes the sequence numbers and the unacknowledged stanzas (including
+// spilled ones) to \a out.
+//
+void QXmppStreamManager::saveState(QDataStream &out)
+{
+    // Spilled stanzas which can not be read back are left out. The stanzas
+    // are renumbered when they are resent, so this does not leave a gap.
+    QVector<std::pair<unsigned int, QByteArray>> stanzas;
+    stanzas.reserve(m_queueSize);
+    for (int i = 0; i < m_queueSize; i++) {
+        const auto &stanza = queueEntry(i);
+        if (const auto data = stanza.spillOffset < 0 ? std::optional(stanza.packet.data()) : readSpilled(stanza))
+            stanzas.append({ stanza.sequenceNumber, *data });
+    }
+
+    out << m_lastIncomingSequenceNumber
+        << m_lastOutgoingSequenceNumber
+        << m_lastAcknowledgedSequenceNumber
+        << qint32(stanzas.size());
+
+    for (const auto &stanza : std::as_const(stanzas)) {
+        out << stanza.first << stanza.second;
+    }
+}
+
+//
+// Restores state written by saveState(). The current unacknowledged stanzas
+// are reported as disconnected and replaced by the restored ones, whose send
+// results are not observed by anyone.
+//
+bool QXmppStreamManager::restoreState(QDataStream &in)
+{
+    unsigned int lastIncomingSequenceNumber;
+    unsigned int lastOutgoingSequenceNumber;
+    unsigned int lastAcknowledgedSequenceNumber;
+    qint32 count;
+    in >> lastIncomingSequenceNumber
+        >> lastOutgoingSequenceNumber
+        >> lastAcknowledgedSequenceNumber
+        >> count;
+    if (in.status() != QDataStream::Ok || count < 0)
+        return false;
+
+    QVector<std::pair<unsigned int, QByteArray>> stanzas;
+    for (qint32 i = 0; i < count; i++) {
+        unsigned int sequenceNumber;
+        QByteArray data;
+        in >> sequenceNumber >> data;
+        if (in.status() != QDataStream::Ok)
+            return false;
+        stanzas.append({ sequenceNumber, data });
+    }
+
+    resetCache();
+    m_lastIncomingSequenceNumber = lastIncomingSequenceNumber;
+    m_lastOutgoingSequenceNumber = lastOutgoingSequenceNumber;
+    m_lastAcknowledgedSequenceNumber = lastAcknowledgedSequenceNumber;
+    for (const auto &stanza : std::as_const(stanzas)) {
+        enqueue(stanza.first, QXmppPacket(stanza.second, true, nullptr));
+    }
+    enforceQueueLimit();
+    updateUnacknowledgedGauges(true);
+    return true;
+}
+
 void QXmppStreamManager::resetCache()
 {
-    for (auto &packet : m_unacknowledgedStanzas) {
-        packet.reportResult(QXmpp::SendError { QStringLiteral("Disconnected"), QXmpp::SendError::Disconnected });
-        packet.reportFinished();
+    const bool dropped = m_queueSize > 0;
+    while (m_queueSize) {
+        auto stanza = dequeue();
+        stanza.packet.reportResult(QXmpp::SendError { QStringLiteral("Disconnected"), QXmpp::SendError::Disconnected });
+        stanza.packet.reportFinished();
+    }
+    updateUnacknowledgedGauges(dropped);
+}
+
+//
+// Reports the size of the queue when its state changes: when stanzas start
+// or stop being spilled and when the limit was hit, or if \a force is set.
+// The gauges are not updated for every stanza and acknowledgement, which
+// would emit three signals each time.
+//
+void QXmppStreamManager::updateUnacknowledgedGauges(bool force)
+{
+    const bool spilling = m_spilledCount > 0;
+    if (!force && !m_queueLimitHit && spilling == m_reportedSpilling)
+        return;
+    m_reportedSpilling = spilling;
+    m_queueLimitHit = false;
+
+    stream->setGauge(QStringLiteral("stream-management.unacked.count"), m_queueSize);
+    stream->setGauge(QStringLiteral("stream-management.unacked.bytes"), m_unacknowledgedBytes);
+    stream->setGauge(QStringLiteral("stream-management.unacked.spilled"), m_spilledCount);
+}
+
+QXmppStreamManager::UnacknowledgedStanza &QXmppStreamManager::queueEntry(int index)
+{
+    return *m_queue[(m_queueHead + index) & (m_queue.size() - 1)];
+}
+
+void QXmppStreamManager::enqueue(unsigned int sequenceNumber, const QXmppPacket &packet)
+{
+    // grow the ring, keeping its capacity a power of two
+    if (m_queueSize == int(m_queue.size())) {
+        std::vector<std::optional<UnacknowledgedStanza>> queue(std::max<std::size_t>(16, m_queue.size() * 2));
+        for (int i = 0; i < m_queueSize; i++)
+            queue[i] = std::move(m_queue[(m_queueHead + i) & (m_queue.size() - 1)]);
+        m_queue = std::move(queue);
+        m_queueHead = 0;
+    }
+
+    const auto size = packet.data().size();
+    m_queue[(m_queueHead + m_queueSize) & (m_queue.size() - 1)] = UnacknowledgedStanza { sequenceNumber, packet, -1, size };
+    m_queueSize++;
+    m_unacknowledgedBytes += size;
+    m_memoryBytes += size;
+}
+
+QXmppStreamManager::UnacknowledgedStanza QXmppStreamManager::dequeue()
+{
+    auto &slot = m_queue[m_queueHead];
+    auto stanza = std::move(*slot);
+    slot.reset();
+    m_queueHead = (m_queueHead + 1) & (m_queue.size() - 1);
+    m_queueSize--;
+
+    m_unacknowledgedBytes -= stanza.size;
+    if (stanza.spillOffset < 0) {
+        m_memoryBytes -= stanza.size;
+    } else if (--m_spilledCount == 0) {
+        // the spill file is append-only and reused once it is drained
+        m_spillFile->resize(0);
     }
+    return stanza;
+}
 
-    m_unacknowledgedStanzas.clear();
+//
+// Removes the stanza at \a index from the queue, keeping the order of the
+// other stanzas.
+//
+QXmppStreamManager::UnacknowledgedStanza QXmppStreamManager::takeAt(int index)
+{
+    const auto mask = m_queue.size() - 1;
+    for (int i = index; i > 0; i--)
+        std::swap(m_queue[(m_queueHead + i) & mask], m_queue[(m_queueHead + i - 1) & mask]);
+    return dequeue();
+}
+
+void QXmppStreamManager::enforceQueueLimit()
+{
+    // spilled stanzas always form the head of the queue
+    while (m_queueMemoryLimit && m_memoryBytes > m_queueMemoryLimit && m_spilledCount < m_queueSize) {
+        if (!m_spillDirectory.isEmpty() && spill(queueEntry(m_spilledCount)))
+            continue;
+
+        // fail the oldest stanza
+        auto stanza = dequeue();
+        stanza.packet.reportResult(QXmpp::SendError {
+            QStringLiteral("Stream management queue limit exceeded before the stanza was acknowledged."),
+            QXmpp::SendError::QueueLimitExceeded });
+        stanza.packet.reportFinished();
+        stream->updateCounter(QStringLiteral("stream-management.unacked.dropped"));
+        m_queueLimitHit = true;
+    }
+}
+
+bool QXmppStreamManager::spill(UnacknowledgedStanza &stanza)
+{
+    if (!m_spillFile) {
+        m_spillFile = std::make_unique<QTemporaryFile>(m_spillDirectory + QStringLiteral("/qxmpp-sm-XXXXXX"));
+        if (!m_spillFile->open()) {
+            stream->warning(QStringLiteral("Could not open stream management spill file: %1").arg(m_spillFile->errorString()));
+            m_spillFile.reset();
+            return false;
+        }
+    }
+
+    const auto offset = m_spillFile->size();
+    const auto data = stanza.packet.data();
+    if (!m_spillFile->seek(offset) || m_spillFile->write(data) != data.size()) {
+        stream->warning(QStringLiteral("Could not write to stream management spill file: %1").arg(m_spillFile->errorString()));
+        m_spillFile->resize(offset);
+        return false;
+    }
+
+    stanza.spillOffset = offset;
+    stanza.packet.setData(QByteArray());
+    m_memoryBytes -= stanza.size;
+    m_spilledCount++;
+    stream->updateCounter(QStringLiteral("stream-management.unacked.spilled-bytes"), stanza.size);
+    return true;
+}
+
+std::optional<QByteArray> QXmppStreamManager::readSpilled(const UnacknowledgedStanza &stanza)
+{
+    QByteArray data;
+    if (m_spillFile->seek(stanza.spillOffset))
+        data = m_spillFile->read(stanza.size);
+    if (data.size() != stanza.size) {
+        stream->warning(QStringLiteral("Could not read from stream management spill file: %1").arg(m_spillFile->errorString()));
+        return std::nullopt;
+    }
+    return data;
 }
 /// \endcond
@@ -25,13 +25,21 @@
 #define QXMPPSTREAMMANAGEMENT_P_H
 
 #include "QXmppGlobal.h"
+#include "QXmppPacket_p.h"
 #include "QXmppStanza.h"
 
+#include <memory>
+#include <optional>
+#include <vector>
+
 #include <QDomDocument>
+#include <QElapsedTimer>
 #include <QXmlStreamWriter>
 
+class QDataStream;
+class QTemporaryFile;
+class QTimer;
 class QXmppStream;
-class QXmppPacket;
 
 //
 //  W A R N I N G
@@ -201,21 +209,84 @@ public:
     bool handleStanza(const QDomElement &stanza);
 
     void resetCache();
-    void enableStreamManagement(bool resetSequenceNumber);
+    bool enableStreamManagement(bool resetSequenceNumber);
     void setAcknowledgedSequenceNumber(unsigned int sequenceNumber);
 
+    // ack request policy
+    unsigned int ackRequestInterval() const;
+    void setAckRequestInterval(unsigned int stanzas);
+    int ackRequestIdleTimeout() const;
+    void setAckRequestIdleTimeout(int msecs);
+    qint64 ackRequestByteThreshold() const;
+    void setAckRequestByteThreshold(qint64 bytes);
+
+    // resend queue limit
+    qint64 queueMemoryLimit() const;
+    void setQueueMemoryLimit(qint64 bytes, const QString &spillDirectory);
+
+    // persistence of the session state
+    void saveState(QDataStream &out);
+    bool restoreState(QDataStream &in);
+
 private:
+    struct UnacknowledgedStanza
+    {
+        unsigned int sequenceNumber;
+        QXmppPacket packet;
+        // position in the spill file, -1 while the data is kept in memory
+        qint64 spillOffset;
+        int size;
+    };
+
     void handleAcknowledgement(const QDomElement &element);
 
     void sendAcknowledgement();
     void sendAcknowledgementRequest();
+    void updateUnacknowledgedGauges(bool force = false);
+
+    // resend queue
+    UnacknowledgedStanza &queueEntry(int index);
+    void enqueue(unsigned int sequenceNumber, const QXmppPacket &packet);
+    UnacknowledgedStanza dequeue();
+    UnacknowledgedStanza takeAt(int index);
+    void enforceQueueLimit();
+    bool spill(UnacknowledgedStanza &stanza);
+    std::optional<QByteArray> readSpilled(const UnacknowledgedStanza &stanza);
 
     QXmppStream *stream;
 
     bool m_enabled = false;
-    QMap<unsigned int, QXmppPacket> m_unacknowledgedStanzas;
     unsigned int m_lastOutgoingSequenceNumber = 0;
     unsigned int m_lastIncomingSequenceNumber = 0;
+    unsigned int m_lastAcknowledgedSequenceNumber = 0;
+
+    // Unacknowledged stanzas in sequence order, kept in a ring buffer whose
+    // capacity is a power of two. The oldest m_spilledCount entries have
+    // their data stored in m_spillFile instead of memory.
+    std::vector<std::optional<UnacknowledgedStanza>> m_queue;
+    int m_queueHead = 0;
+    int m_queueSize = 0;
+    int m_spilledCount = 0;
+    qint64 m_unacknowledgedBytes = 0;
+    qint64 m_memoryBytes = 0;
+    qint64 m_queueMemoryLimit = 0;
+    QString m_spillDirectory;
+    std::unique_ptr<QTemporaryFile> m_spillFile;
+
+    // the state of the queue when its gauges were last reported
+    bool m_reportedSpilling = false;
+    bool m_queueLimitHit = false;
+
+    // ack request policy
+    unsigned int m_ackRequestInterval = 1;
+    qint64 m_ackRequestByteThreshold = 0;
+    unsigned int m_stanzasSinceAckRequest = 0;
+    qint64 m_bytesSinceAckRequest = 0;
+    QTimer *m_ackRequestTimer;
+
+    // ack round-trip time measurement
+    QElapsedTimer m_ackRequestSent;
+    bool m_ackRequestPending = false;
 };
 /// \endcond
 
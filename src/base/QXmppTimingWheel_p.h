@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPTIMINGWHEEL_P_H
+#define QXMPPTIMINGWHEEL_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <array>
+#include <utility>
+#include <vector>
+
+#include <QtGlobal>
+
+namespace QXmpp::Private {
+
+//
+// Hierarchical timing wheel.
+//
+// Values are scheduled to expire after a delay and are handed back by
+// expire() once that delay has passed. Scheduling is O(1); each value is
+// moved at most once per level until it expires. The wheel does not measure
+// time itself, the caller passes the current time in milliseconds.
+//
+// With the default resolution of 100 ms, the four levels of 64 slots cover
+// delays of up to about 19 days. Longer delays are capped.
+//
+template<typename T>
+class TimingWheel
+{
+public:
+    explicit TimingWheel(int resolution = 100)
+        : m_resolution(qMax(1, resolution))
+    {
+    }
+
+    int resolution() const { return m_resolution; }
+    bool isEmpty() const { return m_count == 0; }
+    int size() const { return m_count; }
+
+    void schedule(qint64 now, qint64 delay, T value)
+    {
+        // skip the ticks during which nothing was scheduled
+        const auto nowTick = tick(now);
+        if (m_count == 0)
+            m_tick = nowTick;
+
+        // round up, so a value never expires early
+        const auto ticks = quint64(qMax<qint64>(1, (delay + m_resolution - 1) / m_resolution));
+        insert(Entry { nowTick + qMin(ticks, MaxTicks - 1), std::move(value) });
+        m_count++;
+    }
+
+    // Advances the wheel to \a now and calls \a callback with every value
+    // that has expired.
+    template<typename Callback>
+    void expire(qint64 now, Callback callback)
+    {
+        const auto target = tick(now);
+        std::vector<T> expired;
+        while (m_tick < target && m_count) {
+            advance(expired);
+        }
+        if (m_count == 0)
+            m_tick = qMax(m_tick, target);
+
+        for (auto &value : expired) {
+            callback(std::move(value));
+        }
+    }
+
+private:
+    static constexpr int Bits = 6;
+    static constexpr int Slots = 1 << Bits;
+    static constexpr int Levels = 4;
+    static constexpr quint64 MaxTicks = quint64(1) << (Bits * Levels);
+
+    struct Entry
+    {
+        quint64 expiry;
+        T value;
+    };
+
+    quint64 tick(qint64 now) const
+    {
+        return quint64(qMax<qint64>(0, now)) / m_resolution;
+    }
+
+    void insert(Entry &&entry)
+    {
+        const auto delta = entry.expiry > m_tick ? entry.expiry - m_tick : 0;
+
+        int level = 0;
+        while (level < Levels - 1 && delta >= (quint64(1) << (Bits * (level + 1)))) {
+            level++;
+        }
+
+        const auto slot = (qMax(entry.expiry, m_tick) >> (Bits * level)) & (Slots - 1);
+        m_wheel[level][slot].push_back(std::move(entry));
+    }
+
+    void advance(std::vector<T> &expired)
+    {
+        m_tick++;
+
+        // once a level has completed a revolution, the next slot of the level
+        // above is distributed to the lower levels
+        int level = 1;
+        while (level < Levels && (m_tick & ((quint64(1) << (Bits * level)) - 1)) == 0) {
+            level++;
+        }
+        for (int i = level - 1; i > 0; i--) {
+            auto entries = std::exchange(m_wheel[i][(m_tick >> (Bits * i)) & (Slots - 1)], {});
+            for (auto &entry : entries) {
+                insert(std::move(entry));
+            }
+        }
+
+        // all values in the current slot of the lowest level expire now
+        auto entries = std::exchange(m_wheel[0][m_tick & (Slots - 1)], {});
+        for (auto &entry : entries) {
+            expired.push_back(std::move(entry.value));
+        }
+        m_count -= int(entries.size());
+    }
+
+    int m_resolution;
+    quint64 m_tick = 0;
+    int m_count = 0;
+    std::array<std::array<std::vector<Entry>, Slots>, Levels> m_wheel;
+};
+
+}  // namespace QXmpp::Private
+
+#endif  // QXMPPTIMINGWHEEL_P_H
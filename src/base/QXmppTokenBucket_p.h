@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPTOKENBUCKET_P_H
+#define QXMPPTOKENBUCKET_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtGlobal>
+
+namespace QXmpp::Private {
+
+//
+// Token bucket rate limiter.
+//
+// The bucket holds up to burst() tokens and is refilled at rate() tokens per
+// second. Taking tokens never fails: the bucket may go into debt, so that a
+// single large item is never blocked forever, and stays empty until the debt
+// has been paid back. A rate of zero disables the limit. The bucket does not
+// measure time itself, the caller passes the current time in milliseconds.
+//
+class TokenBucket
+{
+public:
+    bool isEnabled() const { return m_rate > 0; }
+    qint64 rate() const { return m_rate; }
+    qint64 burst() const { return m_burst; }
+    qint64 tokens() const { return m_tokens; }
+
+    // A burst of zero allows one second's worth of tokens.
+    void setRate(qint64 rate, qint64 burst, qint64 now)
+    {
+        m_rate = qMax<qint64>(0, rate);
+        m_burst = burst > 0 ? burst : m_rate;
+        m_tokens = m_burst;
+        m_lastRefill = now;
+    }
+
+    bool isEmpty(qint64 now)
+    {
+        refill(now);
+        return isEnabled() && m_tokens <= 0;
+    }
+
+    void take(qint64 count)
+    {
+        if (isEnabled())
+            m_tokens -= count;
+    }
+
+    // Returns the time in milliseconds until the bucket holds a token again.
+    qint64 msecsUntilAvailable(qint64 now)
+    {
+        refill(now);
+        if (!isEnabled() || m_tokens > 0)
+            return 0;
+
+        // round up, so the bucket is never checked too early
+        return ((1 - m_tokens) * 1000 + m_rate - 1) / m_rate;
+    }
+
+private:
+    void refill(qint64 now)
+    {
+        if (!isEnabled() || now <= m_lastRefill)
+            return;
+
+        // only whole tokens are added, the remainder of the elapsed time is
+        // carried over to the next refill
+        const auto added = (now - m_lastRefill) * m_rate / 1000;
+        if (added > 0) {
+            m_tokens = qMin(m_burst, m_tokens + added);
+            m_lastRefill += added * 1000 / m_rate;
+        }
+        if (m_tokens == m_burst)
+            m_lastRefill = now;
+    }
+
+    qint64 m_rate = 0;
+    qint64 m_burst = 0;
+    qint64 m_tokens = 0;
+    qint64 m_lastRefill = 0;
+};
+
+}  // namespace QXmpp::Private
+
+#endif  // QXMPPTOKENBUCKET_P_H
@@ -343,6 +343,10 @@ void QXmppClient::connectToServer(const QString& jid, const QString& password)
 ///
 /// This function does not end-to-end encrypt the packets.
 ///
+/// Unlike send(), no QFuture is created to report the result, which saves
+/// allocations for high-rate traffic like presences or chat states. With
+/// stream management enabled, the packet is still resent if needed.
+///
 /// \return Returns true if the packet was sent, false otherwise.
 ///
 /// Following code snippet illustrates how to send a message using this function:
@@ -431,15 +435,19 @@ QFuture<QXmpp::SendResult> QXmppClient::sendUnencrypted(QXmppStanza &&stanza)
 ///
 /// This does not do any end-to-encryption on the IQ.
 ///
+/// If no response is received within \a timeout milliseconds, the IQ fails
+/// with QXmpp::SendError::Timeout. A negative value selects the default
+/// timeout from QXmppConfiguration::iqTimeout().
+///
 /// \sa sendSensitiveIq()
 ///
 /// \warning THIS API IS NOT FINALIZED YET!
 ///
 /// \since QXmpp 1.5
 ///
-QFuture<QXmppClient::IqResult> QXmppClient::sendIq(QXmppIq &&iq)
+QFuture<QXmppClient::IqResult> QXmppClient::sendIq(QXmppIq &&iq, int timeout)
 {
-    return d->stream->sendIq(std::move(iq));
+    return d->stream->sendIq(std::move(iq), timeout);
 }
 
 ///
@@ -618,6 +626,37 @@ QXmppClient::StreamManagementState QXmppClient::streamManagementState() const
     return NoStreamManagement;
 }
 
+///
+/// Returns the state of the current \xep{0198}: Stream Management session,
+/// including the stanzas that have not been acknowledged yet.
+///
+/// The state can be stored and passed to restoreStreamManagementState()
+/// after restarting the application, so the session is resumed on the next
+/// connection instead of starting a new one. An empty byte array is returned
+/// if the session can not be resumed.
+///
+/// \note Call this before disconnectFromServer(), which ends the session.
+///
+/// \since QXmpp 1.5
+///
+QByteArray QXmppClient::saveStreamManagementState() const
+{
+    return d->stream->saveStreamManagementState();
+}
+
+///
+/// Restores a \xep{0198}: Stream Management session saved with
+/// saveStreamManagementState(). This must be called before connectToServer().
+///
+/// Returns false if the client is connected or the state could not be read.
+///
+/// \since QXmpp 1.5
+///
+bool QXmppClient::restoreStreamManagementState(const QByteArray &state)
+{
+    return d->stream->restoreStreamManagementState(state);
+}
+
 /// Returns the reference to QXmppRosterManager object of the client.
 ///
 /// \return Reference to the roster object of the connected client. Use this to
@@ -852,6 +891,8 @@ void QXmppClient::setLogger(QXmppLogger* logger)
                        d->logger, &QXmppLogger::setGauge);
             disconnect(this, &QXmppLoggable::updateCounter,
                        d->logger, &QXmppLogger::updateCounter);
+            disconnect(this, &QXmppLoggable::updateHistogram,
+                       d->logger, &QXmppLogger::updateHistogram);
         }
 
         d->logger = logger;
@@ -862,7 +903,10 @@ void QXmppClient::setLogger(QXmppLogger* logger)
                     d->logger, &QXmppLogger::setGauge);
             connect(this, &QXmppLoggable::updateCounter,
                     d->logger, &QXmppLogger::updateCounter);
+            connect(this, &QXmppLoggable::updateHistogram,
+                    d->logger, &QXmppLogger::updateHistogram);
         }
+        setLogSink(d->logger);
 
         emit loggerChanged(d->logger);
     }
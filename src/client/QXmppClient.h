@@ -215,6 +215,8 @@ public:
     void setActive(bool active);
 
     StreamManagementState streamManagementState() const;
+    QByteArray saveStreamManagementState() const;
+    bool restoreStreamManagementState(const QByteArray &state);
 
     QXmppPresence clientPresence() const;
     void setClientPresence(const QXmppPresence &presence);
@@ -236,7 +238,7 @@ public:
 
     QFuture<QXmpp::SendResult> send(QXmppStanza &&);
     QFuture<QXmpp::SendResult> sendUnencrypted(QXmppStanza &&);
-    QFuture<IqResult> sendIq(QXmppIq &&);
+    QFuture<IqResult> sendIq(QXmppIq &&, int timeout = -1);
     QFuture<IqResult> sendSensitiveIq(QXmppIq &&);
     QFuture<EmptyResult> sendGenericIq(QXmppIq &&);
 
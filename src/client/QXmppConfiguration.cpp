@@ -60,6 +60,15 @@ public:
     int keepAliveInterval;
     // interval in seconds, if zero won't timeout
     int keepAliveTimeout;
+    // XEP-0198 ack requests, default is after every stanza
+    unsigned int streamManagementAckInterval;
+    int streamManagementAckIdleTimeout;
+    qint64 streamManagementAckByteThreshold;
+    // XEP-0198 resend queue, default is unlimited
+    qint64 streamManagementQueueLimit;
+    QString streamManagementSpillDirectory;
+    // interval in milliseconds, if zero IQs won't time out
+    int iqTimeout;
     // will keep reconnecting if disconnected, default is true
     bool autoReconnectionEnabled;
     // which authentication systems to use (if any)
@@ -78,7 +87,7 @@ public:
 };
 
 QXmppConfigurationPrivate::QXmppConfigurationPrivate()
-    : port(5222), resource("QXmpp"), autoAcceptSubscriptions(false), sendIntialPresence(true), sendRosterRequest(true), keepAliveInterval(60), keepAliveTimeout(20), autoReconnectionEnabled(true), useSASLAuthentication(true), useNonSASLAuthentication(true), ignoreSslErrors(false), streamSecurityMode(QXmppConfiguration::TLSEnabled), nonSASLAuthMechanism(QXmppConfiguration::NonSASLDigest)
+    : port(5222), resource("QXmpp"), autoAcceptSubscriptions(false), sendIntialPresence(true), sendRosterRequest(true), keepAliveInterval(60), keepAliveTimeout(20), streamManagementAckInterval(1), streamManagementAckIdleTimeout(0), streamManagementAckByteThreshold(0), streamManagementQueueLimit(0), iqTimeout(0), autoReconnectionEnabled(true), useSASLAuthentication(true), useNonSASLAuthentication(true), ignoreSslErrors(false), streamSecurityMode(QXmppConfiguration::TLSEnabled), nonSASLAuthMechanism(QXmppConfiguration::NonSASLDigest)
 {
 }
 
@@ -570,6 +579,148 @@ int QXmppConfiguration::keepAliveTimeout() const
     return d->keepAliveTimeout;
 }
 
+/// Specifies after how many sent stanzas an acknowledgement is requested
+/// from the server when stream management (\xep{0198}) is enabled.
+///
+/// If set to zero, acknowledgements are not requested based on the number
+/// of stanzas.
+///
+/// The default value is 1, i.e. an acknowledgement is requested after every
+/// stanza.
+///
+/// \since QXmpp 1.5
+
+void QXmppConfiguration::setStreamManagementAckInterval(unsigned int stanzas)
+{
+    d->streamManagementAckInterval = stanzas;
+}
+
+/// Returns after how many sent stanzas an acknowledgement is requested.
+///
+/// \since QXmpp 1.5
+
+unsigned int QXmppConfiguration::streamManagementAckInterval() const
+{
+    return d->streamManagementAckInterval;
+}
+
+/// Specifies the time in milliseconds without sending further stanzas after
+/// which an acknowledgement is requested for the unacknowledged stanzas.
+///
+/// If set to zero, no acknowledgement is requested on idle.
+///
+/// The default value is 0.
+///
+/// \since QXmpp 1.5
+
+void QXmppConfiguration::setStreamManagementAckIdleTimeout(int msecs)
+{
+    d->streamManagementAckIdleTimeout = msecs;
+}
+
+/// Returns the idle time in milliseconds after which an acknowledgement is
+/// requested.
+///
+/// \since QXmpp 1.5
+
+int QXmppConfiguration::streamManagementAckIdleTimeout() const
+{
+    return d->streamManagementAckIdleTimeout;
+}
+
+/// Specifies the size in bytes of unacknowledged stanzas at which an
+/// acknowledgement is requested.
+///
+/// If set to zero, acknowledgements are not requested based on the size.
+///
+/// The default value is 0.
+///
+/// \since QXmpp 1.5
+
+void QXmppConfiguration::setStreamManagementAckByteThreshold(qint64 bytes)
+{
+    d->streamManagementAckByteThreshold = bytes;
+}
+
+/// Returns the size in bytes of unacknowledged stanzas at which an
+/// acknowledgement is requested.
+///
+/// \since QXmpp 1.5
+
+qint64 QXmppConfiguration::streamManagementAckByteThreshold() const
+{
+    return d->streamManagementAckByteThreshold;
+}
+
+/// Specifies the maximum size in bytes of sent stanzas which are kept in
+/// memory until the server acknowledges them (\xep{0198}).
+///
+/// When the limit is exceeded, the oldest stanzas are moved to a file in the
+/// streamManagementSpillDirectory(), or, if no directory is set, they are
+/// dropped and reported as QXmpp::SendError::QueueLimitExceeded.
+///
+/// If set to zero, there is no limit. The default value is 0.
+///
+/// \since QXmpp 1.5
+
+void QXmppConfiguration::setStreamManagementQueueLimit(qint64 bytes)
+{
+    d->streamManagementQueueLimit = bytes;
+}
+
+/// Returns the maximum size in bytes of unacknowledged stanzas kept in memory.
+///
+/// \since QXmpp 1.5
+
+qint64 QXmppConfiguration::streamManagementQueueLimit() const
+{
+    return d->streamManagementQueueLimit;
+}
+
+/// Specifies the directory in which unacknowledged stanzas are stored once
+/// the streamManagementQueueLimit() is exceeded.
+///
+/// \since QXmpp 1.5
+
+void QXmppConfiguration::setStreamManagementSpillDirectory(const QString &path)
+{
+    d->streamManagementSpillDirectory = path;
+}
+
+/// Returns the directory in which unacknowledged stanzas are stored once
+/// the streamManagementQueueLimit() is exceeded.
+///
+/// \since QXmpp 1.5
+
+QString QXmppConfiguration::streamManagementSpillDirectory() const
+{
+    return d->streamManagementSpillDirectory;
+}
+
+/// Specifies the time in milliseconds after which IQ requests sent using
+/// QXmppClient::sendIq() fail if no response has been received.
+///
+/// If set to zero, IQ requests don't time out and wait for their response
+/// until the stream is closed. This is the default, as it was the behaviour
+/// before the timeout was introduced.
+///
+/// \since QXmpp 1.5
+
+void QXmppConfiguration::setIqTimeout(int msecs)
+{
+    d->iqTimeout = msecs;
+}
+
+/// Returns the time in milliseconds after which IQ requests fail if no
+/// response has been received.
+///
+/// \since QXmpp 1.5
+
+int QXmppConfiguration::iqTimeout() const
+{
+    return d->iqTimeout;
+}
+
 /// Specifies a list of trusted CA certificates.
 
 void QXmppConfiguration::setCaCertificates(const QList<QSslCertificate>& caCertificates)
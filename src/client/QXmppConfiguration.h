@@ -144,6 +144,24 @@ public:
     int keepAliveTimeout() const;
     void setKeepAliveTimeout(int secs);
 
+    unsigned int streamManagementAckInterval() const;
+    void setStreamManagementAckInterval(unsigned int stanzas);
+
+    int streamManagementAckIdleTimeout() const;
+    void setStreamManagementAckIdleTimeout(int msecs);
+
+    qint64 streamManagementAckByteThreshold() const;
+    void setStreamManagementAckByteThreshold(qint64 bytes);
+
+    qint64 streamManagementQueueLimit() const;
+    void setStreamManagementQueueLimit(qint64 bytes);
+
+    QString streamManagementSpillDirectory() const;
+    void setStreamManagementSpillDirectory(const QString &path);
+
+    int iqTimeout() const;
+    void setIqTimeout(int msecs);
+
     QList<QSslCertificate> caCertificates() const;
     void setCaCertificates(const QList<QSslCertificate> &);
 
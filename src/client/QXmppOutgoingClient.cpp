@@ -37,6 +37,7 @@
 #include "QXmppUtils.h"
 
 #include <QCryptographicHash>
+#include <QDataStream>
 #include <QDnsLookup>
 #include <QNetworkProxy>
 #include <QSslConfiguration>
@@ -103,6 +104,8 @@ public:
     // Stream Management
     bool streamManagementAvailable;
     QString smId;
+    // full JID bound to the stream management session
+    QString smJid;
     bool canResume;
     bool isResuming;
     QString resumeHost;
@@ -247,6 +250,8 @@ QXmppConfiguration &QXmppOutgoingClient::configuration()
 
 void QXmppOutgoingClient::connectToHost()
 {
+    setIqTimeout(d->config.iqTimeout());
+
     // if a host for resumption is available, connect to it
     if (d->canResume && !d->resumeHost.isEmpty() && d->resumePort) {
         d->connectToHost(d->resumeHost, d->resumePort);
@@ -341,6 +346,88 @@ bool QXmppOutgoingClient::isStreamResumed() const
     return d->streamResumed;
 }
 
+// version of the format written by saveStreamManagementState()
+static const quint8 streamManagementStateVersion = 1;
+
+///
+/// Returns the state of the current \xep{0198} session as a binary blob, or
+/// an empty byte array if the session can not be resumed.
+///
+/// The state contains the full JID bound to the session, the session ID, the
+/// resumption address, the sequence numbers and all stanzas which have not been acknowledged by the server
+/// yet. It can be passed to restoreStreamManagementState(), e.g. after a
+/// restart of the process, to resume the session instead of starting a new
+/// one.
+///
+/// The state must be saved before calling disconnectFromHost(), as
+/// explicitly disconnecting ends the session.
+///
+/// \since QXmpp 1.5
+///
+QByteArray QXmppOutgoingClient::saveStreamManagementState() const
+{
+    if (!d->canResume || d->smId.isEmpty())
+        return {};
+
+    QByteArray state;
+    QDataStream out(&state, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_9);
+    out << streamManagementStateVersion
+        << d->smJid
+        << d->smId
+        << d->resumeHost
+        << d->resumePort;
+    writeStreamManagementState(out);
+    return state;
+}
+
+///
+/// Restores a \xep{0198} session saved using saveStreamManagementState().
+///
+/// The next call to connectToHost() will then try to resume the session. If
+/// resumption fails, a new session is started and the restored stanzas are
+/// resent.
+///
+/// The configured JID is set to the session's full JID. Once the session has
+/// been resumed, configuration() reports the resource the server bound
+/// originally, even if a different resource has been configured in between.
+///
+/// Returns false if the stream is connected or the state is invalid.
+///
+/// \since QXmpp 1.5
+///
+bool QXmppOutgoingClient::restoreStreamManagementState(const QByteArray &state)
+{
+    if (isConnected()) {
+        warning(QStringLiteral("Can not restore the stream management state while connected"));
+        return false;
+    }
+
+    QDataStream in(state);
+    in.setVersion(QDataStream::Qt_5_9);
+
+    quint8 version;
+    QString jid, smId, resumeHost;
+    quint16 resumePort;
+    in >> version;
+    if (in.status() != QDataStream::Ok || version != streamManagementStateVersion)
+        return false;
+
+    in >> jid >> smId >> resumeHost >> resumePort;
+    if (in.status() != QDataStream::Ok || smId.isEmpty() || !readStreamManagementState(in))
+        return false;
+
+    // QXmppClient drops the unacknowledged stanzas when connecting with a
+    // different account
+    d->config.setJid(jid);
+    d->smJid = jid;
+    d->smId = smId;
+    d->resumeHost = resumeHost;
+    d->resumePort = resumePort;
+    d->canResume = true;
+    return true;
+}
+
 void QXmppOutgoingClient::_q_socketDisconnected()
 {
     debug("Socket disconnected");
@@ -737,12 +824,18 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         QXmppStreamManagementEnabled streamManagementEnabled;
         streamManagementEnabled.parse(nodeRecv);
         d->smId = streamManagementEnabled.id();
+        d->smJid = d->config.jid();
         d->canResume = streamManagementEnabled.resume();
         if (streamManagementEnabled.resume() && !streamManagementEnabled.location().isEmpty()) {
             setResumeAddress(streamManagementEnabled.location());
         }
 
         d->streamManagementEnabled = true;
+        setStreamManagementAckPolicy(configuration().streamManagementAckInterval(),
+                                     configuration().streamManagementAckIdleTimeout(),
+                                     configuration().streamManagementAckByteThreshold());
+        setStreamManagementQueueLimit(configuration().streamManagementQueueLimit(),
+                                      configuration().streamManagementSpillDirectory());
         enableStreamManagement(true);
         // we are connected now
         emit connected();
@@ -750,11 +843,26 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         QXmppStreamManagementResumed streamManagementResumed;
         streamManagementResumed.parse(nodeRecv);
         setAcknowledgedSequenceNumber(streamManagementResumed.h());
+        // the session keeps the resource bound when it was created
+        configuration().setJid(d->smJid);
         d->isResuming = false;
         d->streamResumed = true;
 
         d->streamManagementEnabled = true;
-        enableStreamManagement(false);
+        setStreamManagementAckPolicy(configuration().streamManagementAckInterval(),
+                                     configuration().streamManagementAckIdleTimeout(),
+                                     configuration().streamManagementAckByteThreshold());
+        setStreamManagementQueueLimit(configuration().streamManagementQueueLimit(),
+                                      configuration().streamManagementSpillDirectory());
+        if (!enableStreamManagement(false)) {
+            // the session's stanzas can not be resent in sequence, end it so
+            // the remaining stanzas are resent on a new session
+            warning(QStringLiteral("Could not resend the stanzas of the resumed stream"));
+            d->xmppStreamError = QXmppStanza::Error::UndefinedCondition;
+            emit error(QXmppClient::XmppStreamError);
+            disconnectFromHost();
+            return;
+        }
         // we are connected now
         // TODO: The stream was resumed. Therefore, we should not send presence information or request the roster.
         emit connected();
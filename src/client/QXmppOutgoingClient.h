@@ -58,6 +58,9 @@ public:
     bool isStreamManagementEnabled() const;
     bool isStreamResumed() const;
 
+    QByteArray saveStreamManagementState() const;
+    bool restoreStreamManagementState(const QByteArray &state);
+
     /// Returns the used socket
     QSslSocket *socket() const { return QXmppStream::socket(); };
     QXmppStanza::Error::Condition xmppStreamError();
@@ -69,6 +69,7 @@ bool QXmppTlsManager::handleStanza(const QDomElement &stanza)
 
     if (QXmppStartTlsPacket::isStartTlsPacket(stanza, QXmppStartTlsPacket::Proceed)) {
         debug("Starting encryption");
+        clientStream()->flush();
         clientStream()->socket()->startClientEncryption();
         return true;
     }
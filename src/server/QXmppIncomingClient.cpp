@@ -39,6 +39,17 @@
 #include <QSslSocket>
 #include <QTimer>
 
+// Adds an attribute to the start tag of a raw stanza.
+static QByteArray addAttribute(const QByteArray &data, const QString &name, const QString &value)
+{
+    // the attribute is added after the tag name
+    int pos = 1;
+    while (pos < data.size() && !QChar::isSpace(uchar(data.at(pos))) && data.at(pos) != '/' && data.at(pos) != '>')
+        pos++;
+
+    return data.left(pos) + ' ' + name.toUtf8() + "=\"" + value.toHtmlEscaped().toUtf8() + '"' + data.mid(pos);
+}
+
 class QXmppIncomingClientPrivate
 {
 public:
@@ -83,6 +94,12 @@ void QXmppIncomingClientPrivate::checkCredentials(const QByteArray &response)
         reply->setProperty("__sasl_raw", response);
         QObject::connect(reply, &QXmppPasswordReply::finished,
                          q, &QXmppIncomingClient::onDigestReply);
+    } else if (auto *scramServer = dynamic_cast<QXmppSaslServerScram *>(saslServer)) {
+        QXmppPasswordReply *reply = passwordChecker->getScramCredentials(request, scramServer->algorithm());
+        reply->setParent(q);
+        reply->setProperty("__sasl_raw", response);
+        QObject::connect(reply, &QXmppPasswordReply::finished,
+                         q, &QXmppIncomingClient::onScramReply);
     }
 }
 
@@ -109,6 +126,9 @@ QXmppIncomingClient::QXmppIncomingClient(QSslSocket *socket, const QString &doma
     d = new QXmppIncomingClientPrivate(this);
     d->domain = domain;
 
+    // received stanzas are forwarded as they are
+    setRawStanzaDataEnabled(true);
+
     if (socket) {
         connect(socket, &QAbstractSocket::disconnected,
                 this, &QXmppIncomingClient::onSocketDisconnected);
@@ -218,6 +238,9 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
         features.setSessionMode(QXmppStreamFeatures::Enabled);
     } else if (d->passwordChecker) {
         QStringList mechanisms;
+        const auto scramAlgorithms = d->passwordChecker->scramAlgorithms();
+        for (const auto algorithm : scramAlgorithms)
+            mechanisms << QXmppSaslServerScram::mechanismName(algorithm);
         mechanisms << "PLAIN";
         if (d->passwordChecker->hasGetPassword())
             mechanisms << "DIGEST-MD5";
@@ -235,6 +258,7 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
 
     if (QXmppStartTlsPacket::isStartTlsPacket(nodeRecv, QXmppStartTlsPacket::StartTls)) {
         sendPacket(QXmppStartTlsPacket(QXmppStartTlsPacket::Proceed));
+        flush();
         socket()->flush();
         socket()->startServerEncryption();
         return;
@@ -251,6 +275,11 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
             auth.parse(nodeRecv);
 
             d->saslServer = QXmppSaslServer::create(auth.mechanism(), this);
+            auto *scramServer = dynamic_cast<QXmppSaslServerScram *>(d->saslServer);
+            if (scramServer && !d->passwordChecker->scramAlgorithms().contains(scramServer->algorithm())) {
+                delete d->saslServer;
+                d->saslServer = nullptr;
+            }
             if (!d->saslServer) {
                 sendPacket(QXmppSaslFailure("invalid-mechanism"));
                 disconnectFromHost();
@@ -294,11 +323,14 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                 d->jid = QString("%1@%2").arg(d->saslServer->username(), d->domain);
                 info(QString("Authentication succeeded for '%1' from %2").arg(d->jid, d->origin()));
                 updateCounter("incoming-client.auth.success");
-                sendPacket(QXmppSaslSuccess());
+                sendPacket(QXmppSaslSuccess(challenge));
                 handleStart();
+            } else if (result == QXmppSaslServer::Challenge) {
+                sendPacket(QXmppSaslChallenge(challenge));
             } else {
-                // FIXME: what condition?
-                sendPacket(QXmppSaslFailure());
+                warning(QString("Authentication failed for '%1' from %2").arg(d->saslServer->username(), d->origin()));
+                updateCounter("incoming-client.auth.not-authorized");
+                sendPacket(QXmppSaslFailure("not-authorized"));
                 disconnectFromHost();
             }
         }
@@ -347,6 +379,13 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
             nodeRecv.tagName() == QLatin1String("message") ||
             nodeRecv.tagName() == QLatin1String("presence")) {
             QDomElement nodeFull(nodeRecv);
+            QByteArray data = rawStanzaData();
+
+            // an empty attribute cannot be replaced in the raw data
+            if (nodeFull.hasAttribute("from") && nodeFull.attribute("from").isEmpty())
+                data.clear();
+            if (nodeFull.hasAttribute("to") && nodeFull.attribute("to").isEmpty())
+                data.clear();
 
             // if the sender is empty, set it to the appropriate JID
             if (nodeFull.attribute("from").isEmpty()) {
@@ -356,14 +395,21 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
                     nodeFull.setAttribute("from", QXmppUtils::jidToBareJid(d->jid));
                 else
                     nodeFull.setAttribute("from", d->jid);
+
+                if (!data.isEmpty())
+                    data = addAttribute(data, QStringLiteral("from"), nodeFull.attribute("from"));
             }
 
             // if the recipient is empty, set it to the local domain
-            if (nodeFull.attribute("to").isEmpty())
+            if (nodeFull.attribute("to").isEmpty()) {
                 nodeFull.setAttribute("to", d->domain);
+                if (!data.isEmpty())
+                    data = addAttribute(data, QStringLiteral("to"), d->domain);
+            }
 
             // emit stanza for processing by server
             emit elementReceived(nodeFull);
+            emit stanzaReceived(nodeFull, data);
         }
     }
 }
@@ -400,6 +446,44 @@ void QXmppIncomingClient::onDigestReply()
     sendPacket(QXmppSaslChallenge(challenge));
 }
 
+void QXmppIncomingClient::onScramReply()
+{
+    auto *reply = qobject_cast<QXmppPasswordReply *>(sender());
+    if (!reply)
+        return;
+    reply->deleteLater();
+
+    if (reply->error() == QXmppPasswordReply::TemporaryError) {
+        warning(QString("Temporary authentication failure for '%1' from %2").arg(d->saslServer->username(), d->origin()));
+        updateCounter("incoming-client.auth.temporary-auth-failure");
+        sendPacket(QXmppSaslFailure("temporary-auth-failure"));
+        disconnectFromHost();
+        return;
+    }
+
+    // an unknown user gets a challenge like any other user and only fails
+    // at the proof step, so accounts can not be enumerated
+    const QXmppScramCredentials credentials = reply->scramCredentials();
+    auto *scramServer = static_cast<QXmppSaslServerScram *>(d->saslServer);
+    if (reply->error() == QXmppPasswordReply::NoError && credentials.algorithm() == scramServer->algorithm() && !credentials.isNull())
+        scramServer->setCredentials(credentials.salt(), credentials.iterations(), credentials.storedKey(), credentials.serverKey());
+    else
+        scramServer->setFakeCredentials();
+
+    QByteArray challenge;
+    QXmppSaslServer::Response result = d->saslServer->respond(reply->property("__sasl_raw").toByteArray(), challenge);
+    if (result != QXmppSaslServer::Challenge) {
+        warning(QString("Authentication failed for '%1' from %2").arg(d->saslServer->username(), d->origin()));
+        updateCounter("incoming-client.auth.not-authorized");
+        sendPacket(QXmppSaslFailure("not-authorized"));
+        disconnectFromHost();
+        return;
+    }
+
+    // send server-first message
+    sendPacket(QXmppSaslChallenge(challenge));
+}
+
 void QXmppIncomingClient::onPasswordReply()
 {
     auto *reply = qobject_cast<QXmppPasswordReply *>(sender());
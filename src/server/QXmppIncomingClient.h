@@ -54,6 +54,14 @@ Q_SIGNALS:
     /// This signal is emitted when an element is received.
     void elementReceived(const QDomElement &element);
 
+    /// This signal is emitted when an element is received, along with its
+    /// raw \a data ready to be forwarded.
+    ///
+    /// The data is empty if the element has to be serialized again.
+    ///
+    /// \since QXmpp 1.5
+    void stanzaReceived(const QDomElement &element, const QByteArray &data);
+
 protected:
     /// \cond
     void handleStream(const QDomElement &element) override;
@@ -63,6 +71,7 @@ protected:
 private Q_SLOTS:
     void onDigestReply();
     void onPasswordReply();
+    void onScramReply();
     void onSocketDisconnected();
     void onTimeout();
 
@@ -77,6 +77,9 @@ QXmppIncomingServer::QXmppIncomingServer(QSslSocket *socket, const QString &doma
     d = new QXmppIncomingServerPrivate(this);
     d->domain = domain;
 
+    // received stanzas are forwarded as they are
+    setRawStanzaDataEnabled(true);
+
     if (socket) {
         connect(socket, &QAbstractSocket::disconnected,
                 this, &QXmppIncomingServer::slotSocketDisconnected);
@@ -134,6 +137,7 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
 
     if (QXmppStartTlsPacket::isStartTlsPacket(stanza, QXmppStartTlsPacket::StartTls)) {
         sendPacket(QXmppStartTlsPacket(QXmppStartTlsPacket::Proceed));
+        flush();
         socket()->flush();
         socket()->startServerEncryption();
         return;
@@ -167,6 +171,7 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
     } else if (d->authenticated.contains(QXmppUtils::jidToDomain(stanza.attribute("from")))) {
         // relay stanza if the remote party is authenticated
         emit elementReceived(stanza);
+        emit stanzaReceived(stanza, rawStanzaData());
     } else {
         warning(QString("Received an element from unverified domain '%1' on %2").arg(QXmppUtils::jidToDomain(stanza.attribute("from")), d->origin()));
         disconnectFromHost();
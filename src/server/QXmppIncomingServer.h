@@ -52,6 +52,14 @@ Q_SIGNALS:
     /// This signal is emitted when an element is received.
     void elementReceived(const QDomElement &element);
 
+    /// This signal is emitted when an element is received, along with its
+    /// raw \a data ready to be forwarded.
+    ///
+    /// The data is empty if the element has to be serialized again.
+    ///
+    /// \since QXmpp 1.5
+    void stanzaReceived(const QDomElement &element, const QByteArray &data);
+
 protected:
     /// \cond
     void handleStanza(const QDomElement &stanzaElement) override;
@@ -41,6 +41,7 @@ class QXmppOutgoingServerPrivate
 {
 public:
     QList<QByteArray> dataQueue;
+    qint64 dataQueueBytes;
     QDnsLookup dns;
     QString localDomain;
     QString localStreamKey;
@@ -82,6 +83,7 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
 
     d->localDomain = domain;
     d->ready = false;
+    d->dataQueueBytes = 0;
 
     connect(socket, QOverload<const QList<QSslError> &>::of(&QSslSocket::sslErrors), this, &QXmppOutgoingServer::slotSslErrors);
 }
@@ -198,6 +200,7 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
         sendDialback();
     } else if (QXmppStartTlsPacket::isStartTlsPacket(stanza, QXmppStartTlsPacket::Proceed)) {
         debug("Starting encryption");
+        flush();
         socket()->startClientEncryption();
         return;
     } else if (QXmppDialback::isDialback(stanza)) {
@@ -220,6 +223,7 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
                 for (const auto &data : std::as_const(d->dataQueue))
                     sendData(data);
                 d->dataQueue.clear();
+                d->dataQueueBytes = 0;
 
                 // emit signal
                 emit connected();
@@ -272,10 +276,25 @@ void QXmppOutgoingServer::setVerify(const QString &id, const QString &key)
 
 void QXmppOutgoingServer::queueData(const QByteArray &data)
 {
-    if (isConnected())
+    if (isConnected()) {
         sendData(data);
-    else
+    } else {
         d->dataQueue.append(data);
+        d->dataQueueBytes += data.size();
+    }
+}
+
+///
+/// Returns the number of bytes which are waiting to be sent, either because
+/// the stream is not ready yet or because they have not been written to the
+/// network, including data in the stream's write queue which is only flushed
+/// once control returns to the event loop.
+///
+/// \since QXmpp 1.5
+///
+qint64 QXmppOutgoingServer::queuedBytes() const
+{
+    return d->dataQueueBytes + bytesToWrite();
 }
 
 /// Returns the remote server's domain.
@@ -52,6 +52,7 @@ public:
     void setVerify(const QString &id, const QString &key);
 
     QString remoteDomain() const;
+    qint64 queuedBytes() const;
 
 Q_SIGNALS:
     /// This signal is emitted when a dialback verify response is received.
@@ -23,9 +23,30 @@
 
 #include "QXmppPasswordChecker.h"
 
+#include "QXmppFutureUtils_p.h"
+#include "QXmppSasl_p.h"
+#include "QXmppUtils.h"
+
+#include <memory>
+
+#include <QCache>
 #include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
 #include <QString>
+#include <QThreadPool>
 #include <QTimer>
+#include <QWaitCondition>
+
+using namespace QXmpp::Private;
+
+static QByteArray md5Digest(const QXmppPasswordRequest &request, const QString &secret)
+{
+    return QCryptographicHash::hash(
+        (request.username() + ":" + request.domain() + ":" + secret).toUtf8(),
+        QCryptographicHash::Md5);
+}
 
 /// Returns the requested domain.
 
@@ -73,6 +94,115 @@ void QXmppPasswordRequest::setUsername(const QString &username)
     m_username = username;
 }
 
+/// Constructs empty SCRAM credentials.
+
+QXmppScramCredentials::QXmppScramCredentials()
+    : m_algorithm(QCryptographicHash::Sha1),
+      m_iterations(0)
+{
+}
+
+/// Returns true if no keys are set.
+
+bool QXmppScramCredentials::isNull() const
+{
+    return m_storedKey.isEmpty() || m_serverKey.isEmpty();
+}
+
+/// Returns the hash algorithm the keys were derived with.
+
+QCryptographicHash::Algorithm QXmppScramCredentials::algorithm() const
+{
+    return m_algorithm;
+}
+
+/// Sets the hash \a algorithm the keys were derived with.
+
+void QXmppScramCredentials::setAlgorithm(QCryptographicHash::Algorithm algorithm)
+{
+    m_algorithm = algorithm;
+}
+
+/// Returns the salt which was used to derive the keys.
+
+QByteArray QXmppScramCredentials::salt() const
+{
+    return m_salt;
+}
+
+/// Sets the \a salt which was used to derive the keys.
+
+void QXmppScramCredentials::setSalt(const QByteArray &salt)
+{
+    m_salt = salt;
+}
+
+/// Returns the iteration count which was used to derive the keys.
+
+int QXmppScramCredentials::iterations() const
+{
+    return m_iterations;
+}
+
+/// Sets the iteration count which was used to derive the keys.
+
+void QXmppScramCredentials::setIterations(int iterations)
+{
+    m_iterations = iterations;
+}
+
+/// Returns the StoredKey, which is used to verify the client's proof.
+
+QByteArray QXmppScramCredentials::storedKey() const
+{
+    return m_storedKey;
+}
+
+/// Sets the StoredKey, which is used to verify the client's proof.
+
+void QXmppScramCredentials::setStoredKey(const QByteArray &storedKey)
+{
+    m_storedKey = storedKey;
+}
+
+/// Returns the ServerKey, which is used to prove the server's identity to
+/// the client.
+
+QByteArray QXmppScramCredentials::serverKey() const
+{
+    return m_serverKey;
+}
+
+/// Sets the ServerKey, which is used to prove the server's identity to the
+/// client.
+
+void QXmppScramCredentials::setServerKey(const QByteArray &serverKey)
+{
+    m_serverKey = serverKey;
+}
+
+/// Derives the SCRAM credentials for a \a password.
+///
+/// This runs the PBKDF2 key derivation and is therefore slow by design. Call
+/// it when the password is set and store the result in your backend.
+///
+/// \param algorithm the hash algorithm of the SCRAM mechanism
+/// \param password the user's password
+/// \param salt the salt, if empty a random salt is generated
+/// \param iterations the iteration count
+
+QXmppScramCredentials QXmppScramCredentials::fromPassword(QCryptographicHash::Algorithm algorithm, const QString &password,
+                                                          const QByteArray &salt, int iterations)
+{
+    QXmppScramCredentials credentials;
+    credentials.m_algorithm = algorithm;
+    credentials.m_salt = salt.isEmpty() ? QXmppUtils::generateRandomBytes(16) : salt;
+    credentials.m_iterations = iterations;
+    QXmppSaslServerScram::deriveKeys(algorithm, password.toUtf8(), credentials.m_salt, iterations,
+                                     credentials.m_storedKey, credentials.m_serverKey);
+    return credentials;
+}
+
 /// Constructs a new QXmppPasswordReply.
 ///
 /// \param parent
@@ -100,6 +230,24 @@ void QXmppPasswordReply::setDigest(const QByteArray &digest)
     m_digest = digest;
 }
 
+/// Returns the received SCRAM credentials.
+///
+/// \since QXmpp 1.5
+
+QXmppScramCredentials QXmppPasswordReply::scramCredentials() const
+{
+    return m_scramCredentials;
+}
+
+/// Sets the received SCRAM credentials.
+///
+/// \since QXmpp 1.5
+
+void QXmppPasswordReply::setScramCredentials(const QXmppScramCredentials &credentials)
+{
+    m_scramCredentials = credentials;
+}
+
 /// Returns the error that was found during the processing of this request.
 ///
 /// If no error was found, returns NoError.
@@ -154,6 +302,8 @@ void QXmppPasswordReply::setPassword(const QString &password)
     m_password = password;
 }
 
+QXmppPasswordChecker::~QXmppPasswordChecker() = default;
+
 /// Checks that the given credentials are valid.
 ///
 /// The base implementation requires that you reimplement getPassword().
@@ -192,9 +342,7 @@ QXmppPasswordReply *QXmppPasswordChecker::getDigest(const QXmppPasswordRequest &
     QString secret;
     QXmppPasswordReply::Error error = getPassword(request, secret);
     if (error == QXmppPasswordReply::NoError) {
-        reply->setDigest(QCryptographicHash::hash(
-            (request.username() + ":" + request.domain() + ":" + secret).toUtf8(),
-            QCryptographicHash::Md5));
+        reply->setDigest(md5Digest(request, secret));
     } else {
         reply->setError(error);
     }
@@ -225,3 +373,322 @@ bool QXmppPasswordChecker::hasGetPassword() const
 {
     return false;
 }
+
+/// Retrieves the SCRAM credentials for the given username.
+///
+/// Reimplement this method together with scramAlgorithms() to offer the
+/// SCRAM mechanisms. The credentials are precomputed using
+/// QXmppScramCredentials::fromPassword(), so the password itself does not
+/// need to be stored. The base implementation fails with a TemporaryError.
+///
+/// \param request
+/// \param algorithm the hash algorithm of the SCRAM mechanism
+///
+/// \since QXmpp 1.5
+
+QXmppPasswordReply *QXmppPasswordChecker::getScramCredentials(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm)
+{
+    Q_UNUSED(request);
+    Q_UNUSED(algorithm);
+
+    auto *reply = new QXmppPasswordReply;
+    reply->setError(QXmppPasswordReply::TemporaryError);
+    reply->finishLater();
+    return reply;
+}
+
+/// Returns the hash algorithms for which getScramCredentials() can return
+/// credentials, in order of preference. The SCRAM mechanisms are offered for
+/// these algorithms.
+///
+/// The base implementation returns an empty list.
+///
+/// \since QXmpp 1.5
+
+QList<QCryptographicHash::Algorithm> QXmppPasswordChecker::scramAlgorithms() const
+{
+    return {};
+}
+
+/// Looks up whether the user of the given request exists.
+///
+/// Returns NoError if the user exists, AuthorizationError if it does not and
+/// TemporaryError if this can not be told. Unlike the other lookups, this
+/// method is synchronous: it is called from the server's thread pool, for
+/// instance by QXmppServerOfflineStore, and must therefore be thread-safe.
+///
+/// The base implementation always returns TemporaryError, as getPassword()
+/// is not required to be thread-safe. Reimplement this method if your
+/// checker can look up users from any thread.
+///
+/// \param request
+///
+/// \since QXmpp 1.5
+
+QXmppPasswordReply::Error QXmppPasswordChecker::checkUser(const QXmppPasswordRequest &request)
+{
+    Q_UNUSED(request);
+    return QXmppPasswordReply::TemporaryError;
+}
+
+// The result of a password lookup.
+struct QXmppPasswordLookup
+{
+    QXmppPasswordReply::Error error = QXmppPasswordReply::TemporaryError;
+    QString password;
+};
+
+class QXmppAsyncPasswordCheckerPrivate
+{
+public:
+    struct CacheEntry
+    {
+        QXmppPasswordLookup lookup;
+        qint64 expiry;
+    };
+
+    QXmppAsyncPasswordCheckerPrivate(QXmppAsyncPasswordChecker *qq);
+
+    QFuture<QXmppPasswordLookup> lookup(const QXmppPasswordRequest &request);
+
+    QThreadPool *threadPool;
+    int cacheTimeout;
+    int negativeCacheTimeout;
+    QElapsedTimer clock;
+
+    // guards the cache and the pending lookups
+    QMutex mutex;
+    QWaitCondition lookupsFinished;
+    QCache<QString, CacheEntry> cache;
+    QHash<QString, QFuture<QXmppPasswordLookup>> pendingLookups;
+
+private:
+    QXmppAsyncPasswordChecker *q;
+};
+
+QXmppAsyncPasswordCheckerPrivate::QXmppAsyncPasswordCheckerPrivate(QXmppAsyncPasswordChecker *qq)
+    : threadPool(QThreadPool::globalInstance()),
+      cacheTimeout(60000),
+      negativeCacheTimeout(10000),
+      cache(0),
+      q(qq)
+{
+    clock.start();
+}
+
+/// Looks up the password for a user, either in the cache or in the thread
+/// pool.
+
+QFuture<QXmppPasswordLookup> QXmppAsyncPasswordCheckerPrivate::lookup(const QXmppPasswordRequest &request)
+{
+    const auto key = request.domain() + QChar(0) + request.username();
+
+    QMutexLocker locker(&mutex);
+    if (auto *entry = cache.object(key)) {
+        if (entry->expiry > clock.elapsed())
+            return makeReadyFuture(QXmppPasswordLookup(entry->lookup));
+        cache.remove(key);
+    }
+
+    // share the lookup with concurrent requests for the same user
+    const auto pending = pendingLookups.constFind(key);
+    if (pending != pendingLookups.constEnd())
+        return *pending;
+
+    auto interface = std::make_shared<QFutureInterface<QXmppPasswordLookup>>(QFutureInterfaceBase::Started);
+    pendingLookups.insert(key, interface->future());
+
+    runInThreadPool(threadPool, [this, key, request, interface]() {
+        QXmppPasswordLookup lookup;
+        lookup.error = q->getPassword(request, lookup.password);
+
+        {
+            // temporary errors are not cached
+            QMutexLocker locker(&mutex);
+            const auto timeout = lookup.error == QXmppPasswordReply::NoError ? cacheTimeout : negativeCacheTimeout;
+            if (cache.maxCost() > 0 && lookup.error != QXmppPasswordReply::TemporaryError && timeout > 0)
+                cache.insert(key, new CacheEntry { lookup, clock.elapsed() + timeout });
+
+            // report the result before the checker may be destroyed
+            interface->reportResult(lookup);
+            interface->reportFinished();
+            pendingLookups.remove(key);
+            lookupsFinished.wakeAll();
+        }
+    });
+    return interface->future();
+}
+
+/// Constructs a new asynchronous password checker.
+///
+/// By default, lookups run in the global thread pool and results are not
+/// cached.
+
+QXmppAsyncPasswordChecker::QXmppAsyncPasswordChecker()
+    : d(new QXmppAsyncPasswordCheckerPrivate(this))
+{
+}
+
+/// Destroys the password checker, waiting for running lookups to finish.
+///
+/// At this point the subclass has already been destroyed, so subclasses
+/// must call waitForLookups() from their own destructor.
+
+QXmppAsyncPasswordChecker::~QXmppAsyncPasswordChecker()
+{
+    waitForLookups();
+    delete d;
+}
+
+/// Blocks until all lookups which are running in the thread pool have
+/// finished.
+///
+/// Subclasses must call this from their destructor, so that getPassword()
+/// is not called on a partially destroyed object. No new requests may be
+/// made afterwards.
+
+void QXmppAsyncPasswordChecker::waitForLookups()
+{
+    QMutexLocker locker(&d->mutex);
+    while (!d->pendingLookups.isEmpty())
+        d->lookupsFinished.wait(&d->mutex);
+}
+
+/// Checks that the given credentials are valid.
+///
+/// The password is looked up in the thread pool using getPassword(), unless
+/// it is found in the cache.
+///
+/// \param request
+
+QXmppPasswordReply *QXmppAsyncPasswordChecker::checkPassword(const QXmppPasswordRequest &request)
+{
+    auto *reply = new QXmppPasswordReply;
+    const auto password = request.password();
+    await(d->lookup(request), reply, [reply, password](const QXmppPasswordLookup &lookup) {
+        if (lookup.error != QXmppPasswordReply::NoError)
+            reply->setError(lookup.error);
+        else if (password != lookup.password)
+            reply->setError(QXmppPasswordReply::AuthorizationError);
+        reply->finish();
+    });
+    return reply;
+}
+
+/// Retrieves the MD5 digest for the given username.
+///
+/// The password is looked up in the thread pool using getPassword(), unless
+/// it is found in the cache.
+///
+/// \param request
+
+QXmppPasswordReply *QXmppAsyncPasswordChecker::getDigest(const QXmppPasswordRequest &request)
+{
+    auto *reply = new QXmppPasswordReply;
+    await(d->lookup(request), reply, [reply, request](const QXmppPasswordLookup &lookup) {
+        if (lookup.error == QXmppPasswordReply::NoError)
+            reply->setDigest(md5Digest(request, lookup.password));
+        else
+            reply->setError(lookup.error);
+        reply->finish();
+    });
+    return reply;
+}
+
+/// Looks up whether the user of the given request exists.
+///
+/// This calls getPassword() directly, in the calling thread, since it is
+/// thread-safe for this class.
+///
+/// \param request
+
+QXmppPasswordReply::Error QXmppAsyncPasswordChecker::checkUser(const QXmppPasswordRequest &request)
+{
+    if (!hasGetPassword())
+        return QXmppPasswordReply::TemporaryError;
+
+    QString password;
+    return getPassword(request, password);
+}
+
+/// Returns the thread pool in which passwords are looked up.
+
+QThreadPool *QXmppAsyncPasswordChecker::threadPool() const
+{
+    return d->threadPool;
+}
+
+/// Sets the thread \a pool in which passwords are looked up. The default is
+/// the global thread pool.
+///
+/// A dedicated pool keeps a slow backend from occupying the threads of the
+/// global pool.
+
+void QXmppAsyncPasswordChecker::setThreadPool(QThreadPool *pool)
+{
+    d->threadPool = pool ? pool : QThreadPool::globalInstance();
+}
+
+/// Returns the maximum number of users whose lookup results are cached.
+
+int QXmppAsyncPasswordChecker::cacheSize() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->cache.maxCost();
+}
+
+/// Sets the maximum number of users whose lookup results are cached. When
+/// the cache is full, the least recently used results are dropped.
+///
+/// The default is 0, which disables the cache. Note that the cache holds the
+/// passwords returned by getPassword().
+
+void QXmppAsyncPasswordChecker::setCacheSize(int size)
+{
+    QMutexLocker locker(&d->mutex);
+    d->cache.setMaxCost(qMax(0, size));
+}
+
+/// Returns the time in milliseconds during which a found password is cached.
+
+int QXmppAsyncPasswordChecker::cacheTimeout() const
+{
+    return d->cacheTimeout;
+}
+
+/// Sets the time in milliseconds during which a found password is cached.
+/// The default is one minute.
+
+void QXmppAsyncPasswordChecker::setCacheTimeout(int msecs)
+{
+    QMutexLocker locker(&d->mutex);
+    d->cacheTimeout = qMax(0, msecs);
+}
+
+/// Returns the time in milliseconds during which an authorization error,
+/// for instance for an unknown user, is cached.
+
+int QXmppAsyncPasswordChecker::negativeCacheTimeout() const
+{
+    return d->negativeCacheTimeout;
+}
+
+/// Sets the time in milliseconds during which an authorization error, for
+/// instance for an unknown user, is cached. The default is 10 seconds.
+///
+/// Temporary errors are never cached.
+
+void QXmppAsyncPasswordChecker::setNegativeCacheTimeout(int msecs)
+{
+    QMutexLocker locker(&d->mutex);
+    d->negativeCacheTimeout = qMax(0, msecs);
+}
+
+/// Removes all lookup results from the cache, for instance after passwords
+/// have been changed.
+
+void QXmppAsyncPasswordChecker::clearCache()
+{
+    QMutexLocker locker(&d->mutex);
+    d->cache.clear();
+}
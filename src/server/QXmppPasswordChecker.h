@@ -26,8 +26,12 @@
 
 #include "QXmppGlobal.h"
 
+#include <QCryptographicHash>
 #include <QObject>
 
+class QThreadPool;
+class QXmppAsyncPasswordCheckerPrivate;
+
 /// \brief The QXmppPasswordRequest class represents a password request.
 ///
 class QXMPP_EXPORT QXmppPasswordRequest
@@ -53,6 +57,48 @@ private:
     QString m_username;
 };
 
+/// \brief The QXmppScramCredentials class holds the keys which a server
+/// stores for a user to authenticate them with SCRAM.
+///
+/// Unlike a password, the stored keys cannot be used to log in as the user.
+/// They are derived from the password once, using fromPassword(), so that
+/// the expensive key derivation does not happen at login time.
+///
+/// \since QXmpp 1.5
+///
+class QXMPP_EXPORT QXmppScramCredentials
+{
+public:
+    QXmppScramCredentials();
+
+    bool isNull() const;
+
+    QCryptographicHash::Algorithm algorithm() const;
+    void setAlgorithm(QCryptographicHash::Algorithm algorithm);
+
+    QByteArray salt() const;
+    void setSalt(const QByteArray &salt);
+
+    int iterations() const;
+    void setIterations(int iterations);
+
+    QByteArray storedKey() const;
+    void setStoredKey(const QByteArray &storedKey);
+
+    QByteArray serverKey() const;
+    void setServerKey(const QByteArray &serverKey);
+
+    static QXmppScramCredentials fromPassword(QCryptographicHash::Algorithm algorithm, const QString &password,
+                                              const QByteArray &salt = QByteArray(), int iterations = 4096);
+
+private:
+    QCryptographicHash::Algorithm m_algorithm;
+    QByteArray m_salt;
+    int m_iterations;
+    QByteArray m_storedKey;
+    QByteArray m_serverKey;
+};
+
 /// \brief The QXmppPasswordReply class represents a password reply.
 ///
 class QXMPP_EXPORT QXmppPasswordReply : public QObject
@@ -75,6 +121,9 @@ public:
     QString password() const;
     void setPassword(const QString &password);
 
+    QXmppScramCredentials scramCredentials() const;
+    void setScramCredentials(const QXmppScramCredentials &credentials);
+
     QXmppPasswordReply::Error error() const;
     void setError(QXmppPasswordReply::Error error);
 
@@ -91,6 +140,7 @@ Q_SIGNALS:
 private:
     QByteArray m_digest;
     QString m_password;
+    QXmppScramCredentials m_scramCredentials;
     QXmppPasswordReply::Error m_error;
     bool m_isFinished;
 };
@@ -101,12 +151,65 @@ private:
 class QXMPP_EXPORT QXmppPasswordChecker
 {
 public:
+    virtual ~QXmppPasswordChecker();
+
     virtual QXmppPasswordReply *checkPassword(const QXmppPasswordRequest &request);
     virtual QXmppPasswordReply *getDigest(const QXmppPasswordRequest &request);
     virtual bool hasGetPassword() const;
 
+    virtual QXmppPasswordReply *getScramCredentials(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm);
+    virtual QList<QCryptographicHash::Algorithm> scramAlgorithms() const;
+
+    virtual QXmppPasswordReply::Error checkUser(const QXmppPasswordRequest &request);
+
 protected:
     virtual QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password);
 };
 
+/// \brief The QXmppAsyncPasswordChecker class represents a password checker
+/// which looks up passwords in a thread pool.
+///
+/// Like with QXmppPasswordChecker, you reimplement getPassword() and
+/// hasGetPassword(). getPassword() is called from the threads of a thread
+/// pool, so a slow backend does not block the streams, and must therefore be
+/// thread-safe. The replies finish in the thread which made the request.
+///
+/// Concurrent requests for the same user share a single lookup. The results
+/// can also be kept in a bounded cache, so that many reconnections do not
+/// hit the backend every time.
+///
+/// \warning A lookup may still be running in the thread pool when the
+/// checker is destroyed. Subclasses must call waitForLookups() from their
+/// own destructor, before the members used by getPassword() are destroyed.
+///
+/// \since QXmpp 1.5
+
+class QXMPP_EXPORT QXmppAsyncPasswordChecker : public QXmppPasswordChecker
+{
+public:
+    QXmppAsyncPasswordChecker();
+    ~QXmppAsyncPasswordChecker() override;
+
+    QXmppPasswordReply *checkPassword(const QXmppPasswordRequest &request) override;
+    QXmppPasswordReply *getDigest(const QXmppPasswordRequest &request) override;
+    QXmppPasswordReply::Error checkUser(const QXmppPasswordRequest &request) override;
+
+    QThreadPool *threadPool() const;
+    void setThreadPool(QThreadPool *pool);
+
+    int cacheSize() const;
+    void setCacheSize(int size);
+    int cacheTimeout() const;
+    void setCacheTimeout(int msecs);
+    int negativeCacheTimeout() const;
+    void setNegativeCacheTimeout(int msecs);
+    void clearCache();
+
+    void waitForLookups();
+
+private:
+    friend class QXmppAsyncPasswordCheckerPrivate;
+    QXmppAsyncPasswordCheckerPrivate *const d;
+};
+
 #endif
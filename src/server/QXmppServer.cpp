@@ -25,6 +25,7 @@
 
 #include "QXmppConstants_p.h"
 #include "QXmppDialback.h"
+#include "QXmppFutureUtils_p.h"
 #include "QXmppIncomingClient.h"
 #include "QXmppIncomingServer.h"
 #include "QXmppIq.h"
@@ -32,16 +33,34 @@
 #include "QXmppPresence.h"
 #include "QXmppServerExtension.h"
 #include "QXmppServerPlugin.h"
+#include "QXmppServer_p.h"
 #include "QXmppUtils.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include <QCoreApplication>
 #include <QDomElement>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QMutex>
 #include <QPluginLoader>
+#include <QPointer>
+#include <QQueue>
+#include <QReadWriteLock>
 #include <QSslCertificate>
 #include <QSslConfiguration>
 #include <QSslKey>
 #include <QSslSocket>
+#include <QThread>
+#include <QThreadPool>
+#include <QVarLengthArray>
+
+#ifdef Q_OS_LINUX
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 static void helperToXmlAddDomElement(QXmlStreamWriter *stream, const QDomElement &element, const QStringList &omitNamespaces)
 {
@@ -70,32 +89,224 @@ static void helperToXmlAddDomElement(QXmlStreamWriter *stream, const QDomElement
     stream->writeEndElement();
 }
 
+/// Makes \a server listen on a socket which shares its port with other
+/// sockets, letting the kernel distribute incoming connections among them.
+
+static bool listenReusePort(QTcpServer *server, const QHostAddress &address, quint16 port)
+{
+#if defined(Q_OS_LINUX) && defined(SO_REUSEPORT)
+    sockaddr_storage storage = {};
+    socklen_t length;
+    int v6only = 0;
+    if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+        auto *addr = reinterpret_cast<sockaddr_in *>(&storage);
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons(port);
+        addr->sin_addr.s_addr = htonl(address.toIPv4Address());
+        length = sizeof(sockaddr_in);
+    } else if (address.protocol() == QAbstractSocket::IPv6Protocol ||
+               address.protocol() == QAbstractSocket::AnyIPProtocol) {
+        // QHostAddress::Any accepts both IPv4 and IPv6 connections
+        const auto ip = address.toIPv6Address();
+        auto *addr = reinterpret_cast<sockaddr_in6 *>(&storage);
+        addr->sin6_family = AF_INET6;
+        addr->sin6_port = htons(port);
+        memcpy(&addr->sin6_addr, ip.c, sizeof(ip.c));
+        length = sizeof(sockaddr_in6);
+        v6only = address.protocol() == QAbstractSocket::IPv6Protocol;
+    } else {
+        return false;
+    }
+
+    const int fd = ::socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+
+    const int on = 1;
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+        (storage.ss_family == AF_INET6 && ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) ||
+        ::bind(fd, reinterpret_cast<sockaddr *>(&storage), length) < 0 ||
+        ::listen(fd, SOMAXCONN) < 0 ||
+        !server->setSocketDescriptor(fd)) {
+        ::close(fd);
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(server)
+    Q_UNUSED(address)
+    Q_UNUSED(port)
+    return false;
+#endif
+}
+
+QXmppServerWorker::QXmppServerWorker()
+    : m_drainScheduled(false)
+{
+}
+
+/// Sets the \a logger the worker's log messages end up in.
+///
+/// The log messages are relayed through the server, which forwards them to
+/// its logger. This lets the worker and its streams skip building messages
+/// the logger discards, instead of treating the relay as an unknown
+/// receiver which wants everything.
+
+void QXmppServerWorker::setLogger(QXmppLogger *logger)
+{
+    setLogSink(logger);
+}
+
+/// Queues \a data for the streams with the given \a streamIds.
+///
+/// This method is thread-safe.
+
+void QXmppServerWorker::post(const QVector<quint64> &streamIds, const QByteArray &data)
+{
+    m_queue.push({ streamIds, data });
+
+    // only wake up the worker thread once for all data posted until it
+    // drains the queue
+    if (!m_drainScheduled.exchange(true))
+        QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+}
+
+/// Takes ownership of a \a stream which has been moved to the worker thread.
+
+void QXmppServerWorker::addStream(quint64 streamId, QObject *stream)
+{
+    auto *client = qobject_cast<QXmppIncomingClient *>(stream);
+    if (!client)
+        return;
+
+    client->setParent(this);
+    m_streams.insert(streamId, client);
+    connect(client, &QObject::destroyed, this, [this, streamId]() {
+        m_streams.remove(streamId);
+    });
+}
+
+void QXmppServerWorker::drain()
+{
+    // reset the flag first, data posted from now on schedules another drain
+    m_drainScheduled = false;
+
+    Delivery delivery;
+    while (m_queue.pop(delivery)) {
+        for (const auto streamId : std::as_const(delivery.streamIds)) {
+            // the stream may have been destroyed since the data was routed
+            if (auto *stream = m_streams.value(streamId))
+                stream->sendData(delivery.data);
+        }
+    }
+}
+
+// A client stream as found in the routing tables.
+struct QXmppClientRoute
+{
+    // routes are copied out of the routing tables and used without holding
+    // the lock, by which time the stream may have been deleted
+    QPointer<QXmppIncomingClient> stream;
+    // the worker owning the stream, or nullptr if the stream lives in the
+    // server's thread
+    QXmppServerWorker *worker = nullptr;
+    quint64 id = 0;
+};
+
+// A stanza which is being offered to the extensions.
+struct QXmppStanzaJob
+{
+    QDomElement element;
+    QByteArray data;
+    // extensions may be added or removed while the job waits, so they are
+    // not referenced by their index
+    QVector<QPointer<QXmppServerExtension>> extensions;
+    int nextExtension;
+    QString orderingKey;
+};
+
 class QXmppServerPrivate
 {
 public:
     QXmppServerPrivate(QXmppServer *qq);
     void loadExtensions(QXmppServer *server);
-    bool routeData(const QString &to, const QByteArray &data);
+    bool routeData(const QString &from, const QString &to, const QByteArray &data);
+    void handleStanza(const QDomElement &element, const QByteArray &data);
+    void processStanza(const QDomElement &element, const QByteArray &data);
+    QVector<int> extensionsForStanza(const QDomElement &element);
+    bool dispatchStanza(QXmppStanzaJob &job);
+    void handleStanzaAsync(QXmppServerExtension *extension, QXmppStanzaJob &job);
+    void finishStanza(const QString &orderingKey);
+    QString orderingKey(const QDomElement &element) const;
+    void routeStanza(const QDomElement &element, const QByteArray &data);
+    QXmppOutgoingServer *outgoingServerFor(const QString &from, const QString &to);
+    QXmppOutgoingServer *connectToDomain(const QString &domain, int slot);
+    void deliver(const QVector<QXmppClientRoute> &routes, const QByteArray &data);
+    int broadcast(const QStringList &recipients, const QByteArray &data);
+    void applyRateLimits(QXmppStream *stream);
+    void connectClient(QXmppIncomingClient *stream);
+    void registerClient(const QXmppClientRoute &route);
+    void acceptClient(QXmppServerWorker *worker, QSslSocket *socket);
+    QXmppSslServer *createSslServer(QObject *parent);
+    bool listenForClientsOnWorkers(const QHostAddress &address, quint16 port);
     void startExtensions();
     void stopExtensions();
+    void buildDispatchTable();
+    void startWorkers();
+    void stopWorkers();
+    QXmppServerWorker *nextWorker();
 
     void info(const QString &message);
     void warning(const QString &message);
 
     QString domain;
     QList<QXmppServerExtension *> extensions;
+
+    // extensions to offer stanzas to, as indexes into extensions sorted by
+    // priority, built from QXmppServerExtension::handledStanzas()
+    bool dispatchTableValid;
+    QVector<int> catchAllExtensions;
+    QHash<QString, QVector<int>> extensionsByTagName;
+    QHash<QPair<QString, QString>, QVector<int>> extensionsByPayload;
+
+    // stanzas held back while an earlier stanza with the same ordering key
+    // is handled asynchronously
+    QHash<QString, QQueue<QXmppStanzaJob>> asyncQueues;
+    QThreadPool asyncPool;
     QXmppLogger *logger;
     QXmppPasswordChecker *passwordChecker;
 
+    // rate limits for incoming streams
+    int stanzaRateLimit;
+    int stanzaRateBurst;
+    qint64 byteRateLimit;
+    qint64 byteRateBurst;
+
     // client-to-server
-    QSet<QXmppIncomingClient *> incomingClients;
-    QHash<QString, QXmppIncomingClient *> incomingClientsByJid;
-    QHash<QString, QSet<QXmppIncomingClient *>> incomingClientsByBareJid;
+    QHash<QXmppIncomingClient *, QXmppClientRoute> incomingClients;
     QSet<QXmppSslServer *> serversForClients;
+    std::atomic<quint64> lastStreamId;
+    bool reusePort;
+
+    // routing tables, may be read from any thread
+    mutable QReadWriteLock routesLock;
+    QHash<QString, QXmppClientRoute> incomingClientsByJid;
+    QHash<QString, QVector<QXmppClientRoute>> incomingClientsByBareJid;
+
+    // worker threads
+    int workerThreadCount;
+    QVector<QThread *> workerThreads;
+    QVector<QXmppServerWorker *> workers;
+    int nextWorkerIndex;
 
     // server-to-server
     QSet<QXmppIncomingServer *> incomingServers;
     QSet<QXmppOutgoingServer *> outgoingServers;
+    // the connections to each remote domain, by slot of the pool, with
+    // nullptr for the slots which have no connection
+    QHash<QString, QVector<QXmppOutgoingServer *>> outgoingServersByDomain;
+    int outgoingServerPoolSize;
     QSet<QXmppSslServer *> serversForServers;
 
     // ssl
@@ -112,6 +323,16 @@ private:
 QXmppServerPrivate::QXmppServerPrivate(QXmppServer *qq)
     : logger(nullptr),
       passwordChecker(nullptr),
+      dispatchTableValid(false),
+      stanzaRateLimit(0),
+      stanzaRateBurst(0),
+      byteRateLimit(0),
+      byteRateBurst(0),
+      lastStreamId(0),
+      reusePort(false),
+      outgoingServerPoolSize(1),
+      workerThreadCount(0),
+      nextWorkerIndex(0),
       loaded(false),
       started(false),
       q(qq)
@@ -124,7 +345,7 @@ QXmppServerPrivate::QXmppServerPrivate(QXmppServer *qq)
 /// \param data
 ///
 
-bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
+bool QXmppServerPrivate::routeData(const QString &from, const QString &to, const QByteArray &data)
 {
     // refuse to route packets to empty destination, own domain or sub-domains
     const QString toDomain = QXmppUtils::jidToDomain(to);
@@ -133,75 +354,435 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
 
     if (toDomain == domain) {
         // look for a client connection
-        QList<QXmppIncomingClient *> found;
-        if (QXmppUtils::jidToResource(to).isEmpty()) {
-            const auto &connections = incomingClientsByBareJid.value(to);
-            for (auto *conn : connections)
-                found << conn;
-        } else {
-            QXmppIncomingClient *conn = incomingClientsByJid.value(to);
-            if (conn)
-                found << conn;
+        QVector<QXmppClientRoute> found;
+        {
+            QReadLocker locker(&routesLock);
+            if (QXmppUtils::jidToResource(to).isEmpty()) {
+                found = incomingClientsByBareJid.value(to);
+            } else {
+                const auto route = incomingClientsByJid.value(to);
+                if (route.stream)
+                    found << route;
+            }
         }
 
         // send data
-        for (auto *conn : found)
-            QMetaObject::invokeMethod(conn, "sendData", Q_ARG(QByteArray, data));
+        deliver(found, data);
         return !found.isEmpty();
 
     } else if (!serversForServers.isEmpty()) {
 
-        // look for an outgoing S2S connection
-        for (auto *conn : std::as_const(outgoingServers)) {
-            if (conn->remoteDomain() == toDomain) {
-                // send or queue data
-                QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-                return true;
+        // send or queue data, establishing the S2S connection if needed
+        auto *conn = outgoingServerFor(from, to);
+        QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
+        return true;
+
+    } else {
+
+        // S2S is disabled, failed to route data
+        return false;
+    }
+}
+
+/// Returns the outgoing S2S connection to use for a stanza between the
+/// given JIDs.
+///
+/// The pair of bare JIDs picks a slot of the remote domain's pool, so the
+/// stanzas between two users always take the same connection and are not
+/// reordered. The connection of a slot is opened when it is first needed.
+
+QXmppOutgoingServer *QXmppServerPrivate::outgoingServerFor(const QString &from, const QString &to)
+{
+    const QString toDomain = QXmppUtils::jidToDomain(to);
+    auto &pool = outgoingServersByDomain[toDomain];
+    if (pool.size() < outgoingServerPoolSize)
+        pool.resize(outgoingServerPoolSize);
+
+    const auto hash = qHash(QXmppUtils::jidToBareJid(to), qHash(QXmppUtils::jidToBareJid(from)));
+    const int slot = int(hash % uint(outgoingServerPoolSize));
+    if (auto *conn = pool.at(slot))
+        return conn;
+    return connectToDomain(toDomain, slot);
+}
+
+/// Opens a new outgoing S2S connection to the given remote domain, for the
+/// given slot of its pool.
+
+QXmppOutgoingServer *QXmppServerPrivate::connectToDomain(const QString &remoteDomain, int slot)
+{
+    auto *conn = new QXmppOutgoingServer(domain, nullptr);
+    conn->setLocalStreamKey(QXmppUtils::generateStanzaHash().toLatin1());
+    conn->moveToThread(q->thread());
+    conn->setParent(q);
+
+    QObject::connect(conn, &QXmppStream::disconnected,
+                     q, &QXmppServer::_q_outgoingServerDisconnected);
+
+    // add stream
+    outgoingServers.insert(conn);
+    outgoingServersByDomain[remoteDomain][slot] = conn;
+    q->setGauge("outgoing-server.count", outgoingServers.size());
+
+    QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, remoteDomain));
+    return conn;
+}
+
+/// Sends the same data to client streams, which may live in other threads.
+///
+/// The streams of each worker thread are handed over in a single batch.
+
+void QXmppServerPrivate::deliver(const QVector<QXmppClientRoute> &routes, const QByteArray &data)
+{
+    q->updateHistogram("routing.fan-out", routes.size());
+
+    const bool inServerThread = QThread::currentThread() == q->thread();
+
+    QVarLengthArray<std::pair<QXmppServerWorker *, QVector<quint64>>, 8> batches;
+    for (const auto &route : routes) {
+        if (!route.worker) {
+            if (inServerThread) {
+                if (route.stream)
+                    route.stream->sendData(data);
+            } else {
+                // the stream is only deleted in the server thread, so it is
+                // looked up there
+                QMetaObject::invokeMethod(
+                    q, [stream = route.stream, data]() {
+                        if (stream)
+                            stream->sendData(data);
+                    },
+                    Qt::QueuedConnection);
+            }
+            continue;
+        }
+
+        auto batch = std::find_if(batches.begin(), batches.end(), [&](const auto &batch) {
+            return batch.first == route.worker;
+        });
+        if (batch == batches.end()) {
+            batches.append({ route.worker, {} });
+            batch = batches.end() - 1;
+        }
+        batch->second << route.id;
+    }
+
+    for (const auto &batch : std::as_const(batches))
+        batch.first->post(batch.second, data);
+}
+
+/// Sends the same data to the client streams of several local users.
+///
+/// Returns the number of recipients for which a stream was found.
+
+int QXmppServerPrivate::broadcast(const QStringList &recipients, const QByteArray &data)
+{
+    QVector<QXmppClientRoute> found;
+    int routed = 0;
+    {
+        QReadLocker locker(&routesLock);
+        for (const auto &to : recipients) {
+            if (QXmppUtils::jidToDomain(to) != domain)
+                continue;
+
+            const auto count = found.size();
+            if (QXmppUtils::jidToResource(to).isEmpty()) {
+                found << incomingClientsByBareJid.value(to);
+            } else {
+                const auto route = incomingClientsByJid.value(to);
+                if (route.stream)
+                    found << route;
             }
+            if (found.size() > count)
+                routed++;
         }
+    }
 
-        // if we did not find an outgoing server,
-        // we need to establish the S2S connection
-        auto *conn = new QXmppOutgoingServer(domain, nullptr);
-        conn->setLocalStreamKey(QXmppUtils::generateStanzaHash().toLatin1());
-        conn->moveToThread(q->thread());
-        conn->setParent(q);
+    deliver(found, data);
 
-        QObject::connect(conn, &QXmppStream::disconnected,
-                         q, &QXmppServer::_q_outgoingServerDisconnected);
+    q->updateCounter("fan-out.count");
+    q->updateCounter("fan-out.streams", found.size());
+    return routed;
+}
 
-        // add stream
-        outgoingServers.insert(conn);
-        q->setGauge("outgoing-server.count", outgoingServers.size());
+/// Applies the server's rate limits to an incoming \a stream.
 
-        // queue data and connect to remote server
-        QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-        QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, toDomain));
-        return true;
+void QXmppServerPrivate::applyRateLimits(QXmppStream *stream)
+{
+    stream->setStanzaRateLimit(stanzaRateLimit, stanzaRateBurst);
+    stream->setByteRateLimit(byteRateLimit, byteRateBurst);
+}
 
-    } else {
+/// Connects the signals of a client \a stream to the server.
+///
+/// This method is thread-safe.
 
-        // S2S is disabled, failed to route data
-        return false;
+void QXmppServerPrivate::connectClient(QXmppIncomingClient *stream)
+{
+    stream->setPasswordChecker(passwordChecker);
+    applyRateLimits(stream);
+
+    QObject::connect(stream, &QXmppStream::connected,
+                     q, &QXmppServer::_q_clientConnected);
+
+    QObject::connect(stream, &QXmppStream::disconnected,
+                     q, &QXmppServer::_q_clientDisconnected);
+
+    QObject::connect(stream, &QXmppIncomingClient::stanzaReceived,
+                     q, [this](const QDomElement &element, const QByteArray &data) {
+                         handleStanza(element, data);
+                     });
+}
+
+/// Adds a client stream to the server's streams.
+
+void QXmppServerPrivate::registerClient(const QXmppClientRoute &route)
+{
+    incomingClients.insert(route.stream.data(), route);
+    q->setGauge("incoming-client.count", incomingClients.size());
+}
+
+/// Handles a new incoming TCP connection accepted by a listener of a worker.
+///
+/// This is called in the worker thread. The stream is registered with the
+/// server before it can emit any signal.
+
+void QXmppServerPrivate::acceptClient(QXmppServerWorker *worker, QSslSocket *socket)
+{
+    // check the socket didn't die since the signal was emitted
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        delete socket;
+        return;
     }
+
+    auto *stream = new QXmppIncomingClient(socket, domain, nullptr);
+    stream->setInactivityTimeout(120);
+    socket->setParent(stream);
+    connectClient(stream);
+
+    const auto streamId = ++lastStreamId;
+    worker->addStream(streamId, stream);
+    emit worker->streamAccepted(streamId, stream);
+}
+
+/// Creates a listener using the server's SSL configuration.
+
+QXmppSslServer *QXmppServerPrivate::createSslServer(QObject *parent)
+{
+    auto *server = new QXmppSslServer(parent);
+    server->addCaCertificates(caCertificates);
+    server->setLocalCertificate(localCertificate);
+    server->setPrivateKey(privateKey);
+    return server;
+}
+
+/// Opens one listener for client connections per worker thread, all sharing
+/// the same port.
+
+bool QXmppServerPrivate::listenForClientsOnWorkers(const QHostAddress &address, quint16 port)
+{
+    startWorkers();
+
+    QList<QXmppSslServer *> servers;
+    const int count = qMax(1, workers.size());
+    for (int i = 0; i < count; i++) {
+        auto *worker = workers.value(i);
+        auto *server = createSslServer(worker ? nullptr : q);
+        if (!listenReusePort(server, address, port)) {
+            delete server;
+            for (auto *other : std::as_const(servers))
+                other->deleteLater();
+            return false;
+        }
+
+        // when listening on any port, the other listeners share the port of
+        // the first one
+        port = server->serverPort();
+
+        if (worker) {
+            server->moveToThread(worker->thread());
+            QObject::connect(server, &QXmppSslServer::newConnection,
+                             worker, [this, worker](QSslSocket *socket) {
+                                 acceptClient(worker, socket);
+                             });
+        } else {
+            QObject::connect(server, SIGNAL(newConnection(QSslSocket *)),
+                             q, SLOT(_q_clientConnection(QSslSocket *)));
+        }
+        servers << server;
+    }
+
+    for (auto *server : std::as_const(servers))
+        serversForClients.insert(server);
+    return true;
 }
 
 /// Handles an incoming XML element.
 ///
-/// \param server
-/// \param stream
 /// \param element
+/// \param data The raw data of the element, which is routed as it is if the
+/// element is not for the server. If empty, the element is serialized again.
+///
+/// The time spent is recorded in the stanza.processing-time histogram.
+
+void QXmppServerPrivate::handleStanza(const QDomElement &element, const QByteArray &data)
+{
+    QElapsedTimer timer;
+    timer.start();
+    processStanza(element, data);
+    q->updateHistogram("stanza.processing-time", timer.nsecsElapsed() / 1e9);
+}
+
+void QXmppServerPrivate::processStanza(const QDomElement &element, const QByteArray &data)
+{
+    QXmppStanzaJob job { element, data, {}, 0, QString() };
+    const auto indexes = extensionsForStanza(element);
+    job.extensions.reserve(indexes.size());
+    for (const int index : indexes)
+        job.extensions << extensions.at(index);
+
+    // hold the stanza back while an earlier one for the same user is handled
+    // asynchronously
+    if (!asyncQueues.isEmpty()) {
+        job.orderingKey = orderingKey(element);
+        const auto itr = asyncQueues.find(job.orderingKey);
+        if (itr != asyncQueues.end()) {
+            itr->enqueue(job);
+            return;
+        }
+    }
+
+    dispatchStanza(job);
+}
+
+/// Returns the extensions which handle the given stanza, as indexes into
+/// extensions sorted by priority.
+
+QVector<int> QXmppServerPrivate::extensionsForStanza(const QDomElement &element)
+{
+    if (!dispatchTableValid)
+        buildDispatchTable();
+
+    const QString tagName = element.tagName();
+    const auto tagItr = extensionsByTagName.constFind(tagName);
+    const QVector<int> *candidates = tagItr != extensionsByTagName.constEnd() ? &*tagItr : &catchAllExtensions;
+
+    // the payload lists include the tag name and catch-all extensions, they
+    // only need to be merged if several payloads match
+    QVarLengthArray<const QVector<int> *, 4> matches;
+    if (!extensionsByPayload.isEmpty()) {
+        for (auto child = element.firstChildElement(); !child.isNull(); child = child.nextSiblingElement()) {
+            const auto itr = extensionsByPayload.constFind(qMakePair(tagName, child.namespaceURI()));
+            if (itr != extensionsByPayload.constEnd() && !std::count(matches.cbegin(), matches.cend(), &*itr))
+                matches.append(&*itr);
+        }
+    }
+
+    if (matches.size() > 1) {
+        QVector<int> merged;
+        for (const auto *match : std::as_const(matches))
+            merged += *match;
+        std::sort(merged.begin(), merged.end());
+        merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+        return merged;
+    }
+    return matches.size() == 1 ? *matches.first() : *candidates;
+}
+
+/// Offers a stanza to the remaining extensions of the \a job, then applies
+/// the default handlers.
+///
+/// Returns true if an extension claimed the stanza to handle it
+/// asynchronously, in which case the job is resumed once it is done.
 
-static void handleStanza(QXmppServer *server, const QDomElement &element)
+bool QXmppServerPrivate::dispatchStanza(QXmppStanzaJob &job)
 {
-    // try extensions
-    const auto &extensions = server->extensions();
-    for (auto *extension : extensions)
-        if (extension->handleStanza(element))
+    while (job.nextExtension < job.extensions.size()) {
+        QXmppServerExtension *extension = job.extensions.at(job.nextExtension++);
+        if (!extension)
+            continue;
+        if (extension->claimStanza(job.element)) {
+            handleStanzaAsync(extension, job);
+            return true;
+        }
+        if (extension->handleStanza(job.element))
+            return false;
+    }
+
+    routeStanza(job.element, job.data);
+    return false;
+}
+
+/// Passes a claimed stanza to QXmppServerExtension::handleStanzaAsync() in
+/// the thread pool.
+///
+/// The responses are routed and the job is resumed in the server's thread.
+
+void QXmppServerPrivate::handleStanzaAsync(QXmppServerExtension *extension, QXmppStanzaJob &job)
+{
+    using Result = QPair<bool, QXmppStanzaResponses>;
+
+    if (job.orderingKey.isEmpty())
+        job.orderingKey = orderingKey(job.element);
+    asyncQueues[job.orderingKey];
+
+    // the extension gets a document of its own, so that it is not shared
+    // between threads
+    QDomDocument document;
+    const QDomElement element = document.importNode(job.element, true).toElement();
+    document.appendChild(element);
+
+    auto interface = std::make_shared<QFutureInterface<Result>>(QFutureInterfaceBase::Started);
+    runInThreadPool(&asyncPool, [extension, element, interface]() {
+        Result result;
+        result.first = extension->handleStanzaAsync(element, result.second);
+        interface->reportResult(result);
+        interface->reportFinished();
+    });
+
+    await(interface->future(), q, [this, job](const Result &result) {
+        for (const auto &stanza : result.second.m_stanzas)
+            routeData(stanza.from, stanza.to, stanza.data);
+
+        // if the extension did not handle the stanza, resume the dispatch
+        auto remainingJob = job;
+        if (result.first || !dispatchStanza(remainingJob))
+            finishStanza(job.orderingKey);
+    });
+}
+
+/// Processes the stanzas which were held back while a stanza with the given
+/// ordering key was handled asynchronously.
+
+void QXmppServerPrivate::finishStanza(const QString &orderingKey)
+{
+    auto itr = asyncQueues.find(orderingKey);
+    while (itr != asyncQueues.end() && !itr->isEmpty()) {
+        auto job = itr->dequeue();
+        if (dispatchStanza(job))
             return;
+        itr = asyncQueues.find(orderingKey);
+    }
+    asyncQueues.remove(orderingKey);
+}
+
+/// Returns the key under which the order of stanzas is preserved: the bare
+/// JID of the recipient, or of the sender for stanzas to the server itself.
+
+QString QXmppServerPrivate::orderingKey(const QDomElement &element) const
+{
+    const QString to = element.attribute(QStringLiteral("to"));
+    if (to.isEmpty() || to == domain)
+        return QXmppUtils::jidToBareJid(element.attribute(QStringLiteral("from")));
+    return QXmppUtils::jidToBareJid(to);
+}
+
+/// Applies the default handlers to a stanza which no extension handled.
+
+void QXmppServerPrivate::routeStanza(const QDomElement &element, const QByteArray &data)
+{
+    auto *server = q;
 
     // default handlers
-    const QString domain = server->domain();
     const QString to = element.attribute("to");
     if (to == domain) {
         if (element.tagName() == QLatin1String("iq")) {
@@ -224,7 +805,8 @@ static void handleStanza(QXmppServer *server, const QDomElement &element)
     } else {
 
         // route element or reply on behalf of missing peer
-        if (!server->sendElement(element) && element.tagName() == QLatin1String("iq")) {
+        const bool routed = data.isEmpty() ? server->sendElement(element) : routeData(element.attribute("from"), to, data);
+        if (!routed && element.tagName() == QLatin1String("iq")) {
             QXmppIq request;
             request.parse(element);
 
@@ -280,22 +862,140 @@ void QXmppServerPrivate::startExtensions()
         for (auto *extension : extensions)
             if (!extension->start())
                 warning(QString("Could not start extension %1").arg(extension->extensionName()));
+        buildDispatchTable();
         started = true;
     }
 }
 
+/// Builds the table which maps stanzas to the extensions handling them.
+///
+/// Each list is sorted by priority and already includes the extensions
+/// which handle all stanzas of the tag name, and those which did not declare
+/// the stanzas they handle.
+
+void QXmppServerPrivate::buildDispatchTable()
+{
+    loadExtensions(q);
+
+    catchAllExtensions.clear();
+    extensionsByTagName.clear();
+    extensionsByPayload.clear();
+
+    QVector<QVector<QXmppServerExtension::HandledStanza>> declarations;
+    declarations.reserve(extensions.size());
+    for (int i = 0; i < extensions.size(); ++i) {
+        declarations << extensions.at(i)->handledStanzas();
+        if (declarations.last().isEmpty())
+            catchAllExtensions << i;
+        for (const auto &stanza : std::as_const(declarations.last())) {
+            extensionsByTagName.insert(stanza.tagName, {});
+            if (!stanza.payloadNamespace.isEmpty())
+                extensionsByPayload.insert(qMakePair(stanza.tagName, stanza.payloadNamespace), {});
+        }
+    }
+
+    auto handles = [&](int index, const QString &tagName, const QString &payloadNamespace) {
+        const auto &declaration = declarations.at(index);
+        return declaration.isEmpty() || std::any_of(declaration.cbegin(), declaration.cend(), [&](const auto &stanza) {
+                   return stanza.tagName == tagName && (stanza.payloadNamespace.isEmpty() || stanza.payloadNamespace == payloadNamespace);
+               });
+    };
+
+    for (auto itr = extensionsByTagName.begin(); itr != extensionsByTagName.end(); ++itr)
+        for (int i = 0; i < extensions.size(); ++i)
+            if (handles(i, itr.key(), QString()))
+                itr.value() << i;
+
+    for (auto itr = extensionsByPayload.begin(); itr != extensionsByPayload.end(); ++itr)
+        for (int i = 0; i < extensions.size(); ++i)
+            if (handles(i, itr.key().first, itr.key().second))
+                itr.value() << i;
+
+    dispatchTableValid = true;
+}
+
 /// Stop the server's extensions (in reverse order).
 ///
 
 void QXmppServerPrivate::stopExtensions()
 {
     if (started) {
+        asyncPool.waitForDone();
         for (int i = extensions.size() - 1; i >= 0; --i)
             extensions[i]->stop();
         started = false;
     }
 }
 
+/// Starts the worker threads for client streams.
+
+void QXmppServerPrivate::startWorkers()
+{
+    while (workers.size() < workerThreadCount) {
+        auto *thread = new QThread;
+        thread->setObjectName(QStringLiteral("QXmppServer worker %1").arg(workers.size()));
+
+        auto *worker = new QXmppServerWorker;
+
+        // the worker is not a child of the server, relay its log messages
+        // and metrics from the worker thread, so that metrics can be
+        // recorded without going through the server's thread
+        QObject::connect(worker, &QXmppLoggable::logMessage,
+                         q, &QXmppLoggable::logMessage, Qt::DirectConnection);
+        worker->setLogger(logger);
+        worker->moveToThread(thread);
+        QObject::connect(worker, &QXmppLoggable::setGauge,
+                         q, &QXmppLoggable::setGauge, Qt::DirectConnection);
+        QObject::connect(worker, &QXmppLoggable::updateCounter,
+                         q, &QXmppLoggable::updateCounter, Qt::DirectConnection);
+        QObject::connect(worker, &QXmppLoggable::updateHistogram,
+                         q, &QXmppLoggable::updateHistogram, Qt::DirectConnection);
+
+        // streams accepted by the worker's own listeners
+        QObject::connect(worker, &QXmppServerWorker::streamAccepted,
+                         q, [this, worker](quint64 streamId, QObject *stream) {
+                             QXmppClientRoute route;
+                             route.stream = static_cast<QXmppIncomingClient *>(stream);
+                             route.worker = worker;
+                             route.id = streamId;
+                             registerClient(route);
+                         });
+
+        // the worker and its streams are destroyed in the worker thread
+        QObject::connect(thread, &QThread::finished,
+                         worker, &QObject::deleteLater);
+
+        thread->start();
+        workerThreads << thread;
+        workers << worker;
+    }
+}
+
+/// Stops the worker threads, destroying the streams they still own.
+
+void QXmppServerPrivate::stopWorkers()
+{
+    for (auto *thread : std::as_const(workerThreads)) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    workerThreads.clear();
+    workers.clear();
+}
+
+/// Returns the worker which should handle the next client stream, or
+/// nullptr if streams are handled in the server's thread.
+
+QXmppServerWorker *QXmppServerPrivate::nextWorker()
+{
+    if (workers.isEmpty())
+        return nullptr;
+
+    nextWorkerIndex = (nextWorkerIndex + 1) % workers.size();
+    return workers.at(nextWorkerIndex);
+}
+
 /// Constructs a new XMPP server instance.
 ///
 /// \param parent
@@ -312,6 +1012,8 @@ QXmppServer::QXmppServer(QObject *parent)
 QXmppServer::~QXmppServer()
 {
     close();
+    d->stopWorkers();
+    d->asyncPool.waitForDone();
     delete d;
 }
 
@@ -328,6 +1030,7 @@ void QXmppServer::addExtension(QXmppServerExtension *extension)
     extension->setServer(this);
 
     // keep extensions sorted by priority
+    d->dispatchTableValid = false;
     for (int i = 0; i < d->extensions.size(); ++i) {
         QXmppServerExtension *other = d->extensions[i];
         if (other->extensionPriority() < extension->extensionPriority()) {
@@ -383,6 +1086,8 @@ void QXmppServer::setLogger(QXmppLogger *logger)
                        d->logger, &QXmppLogger::setGauge);
             disconnect(this, &QXmppLoggable::updateCounter,
                        d->logger, &QXmppLogger::updateCounter);
+            disconnect(this, &QXmppLoggable::updateHistogram,
+                       d->logger, &QXmppLogger::updateHistogram);
         }
 
         d->logger = logger;
@@ -393,6 +1098,16 @@ void QXmppServer::setLogger(QXmppLogger *logger)
                     d->logger, &QXmppLogger::setGauge);
             connect(this, &QXmppLoggable::updateCounter,
                     d->logger, &QXmppLogger::updateCounter);
+            connect(this, &QXmppLoggable::updateHistogram,
+                    d->logger, &QXmppLogger::updateHistogram);
+        }
+        setLogSink(d->logger);
+        for (auto *worker : std::as_const(d->workers)) {
+            QMetaObject::invokeMethod(
+                worker, [worker, logger = QPointer<QXmppLogger>(d->logger)]() {
+                    worker->setLogger(logger);
+                },
+                Qt::QueuedConnection);
         }
 
         emit loggerChanged(d->logger);
@@ -417,6 +1132,153 @@ void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+///
+/// Returns the number of worker threads which handle client streams.
+///
+/// \since QXmpp 1.5
+///
+int QXmppServer::workerThreadCount() const
+{
+    return d->workerThreadCount;
+}
+
+///
+/// Sets the number of worker threads which handle client streams.
+///
+/// By default, all streams are handled in the server's thread. With worker
+/// threads, new client connections are distributed over the workers, which
+/// handle the socket I/O, encryption, parsing and authentication of their
+/// streams. Received stanzas are still processed by the extensions in the
+/// server's thread.
+///
+/// This must be set before the server starts listening for clients. As the
+/// password checker is then called from the worker threads, it must be
+/// thread-safe.
+///
+/// \since QXmpp 1.5
+///
+void QXmppServer::setWorkerThreadCount(int count)
+{
+    d->workerThreadCount = qMax(0, count);
+}
+
+///
+/// Returns whether client connections are accepted by several listeners
+/// sharing the same port.
+///
+/// \since QXmpp 1.5
+///
+bool QXmppServer::isReusePortEnabled() const
+{
+    return d->reusePort;
+}
+
+///
+/// Sets whether client connections are accepted by several listeners sharing
+/// the same port.
+///
+/// When enabled, listenForClients() opens one listening socket with
+/// SO_REUSEPORT per worker thread, and the kernel distributes incoming
+/// connections among them. Each connection is then accepted and encrypted in
+/// the thread of its listener instead of the server's thread. Without worker
+/// threads, a single listener is opened in the server's thread.
+///
+/// This is only supported on Linux, elsewhere listenForClients() fails. It
+/// must be set before the server starts listening for clients.
+///
+/// \since QXmpp 1.5
+///
+void QXmppServer::setReusePortEnabled(bool enabled)
+{
+    d->reusePort = enabled;
+}
+
+///
+/// Returns the maximum number of stanzas per second which are handled for
+/// each incoming stream, or 0 if there is no limit.
+///
+/// \since QXmpp 1.5
+///
+int QXmppServer::stanzaRateLimit() const
+{
+    return d->stanzaRateLimit;
+}
+
+///
+/// Limits the number of stanzas per second which are handled for each
+/// incoming client and server stream.
+///
+/// A stream which exceeds the limit stops being read from until it is back
+/// within the limit, so a flooding peer is slowed down by TCP flow control
+/// instead of starving the other streams. See
+/// QXmppStream::setStanzaRateLimit() for details.
+///
+/// This applies to streams which connect after the limit was set.
+///
+/// \since QXmpp 1.5
+///
+void QXmppServer::setStanzaRateLimit(int stanzasPerSecond, int burst)
+{
+    d->stanzaRateLimit = qMax(0, stanzasPerSecond);
+    d->stanzaRateBurst = qMax(0, burst);
+}
+
+///
+/// Returns the maximum number of bytes per second which are read for each
+/// incoming stream, or 0 if there is no limit.
+///
+/// \since QXmpp 1.5
+///
+qint64 QXmppServer::byteRateLimit() const
+{
+    return d->byteRateLimit;
+}
+
+///
+/// Limits the number of bytes per second which are read for each incoming
+/// client and server stream.
+///
+/// See setStanzaRateLimit() and QXmppStream::setByteRateLimit() for
+/// details.
+///
+/// \since QXmpp 1.5
+///
+void QXmppServer::setByteRateLimit(qint64 bytesPerSecond, qint64 burst)
+{
+    d->byteRateLimit = qMax<qint64>(0, bytesPerSecond);
+    d->byteRateBurst = qMax<qint64>(0, burst);
+}
+
+///
+/// Returns the maximum number of outgoing server-to-server connections which
+/// are opened to the same remote domain.
+///
+/// \since QXmpp 1.5
+///
+int QXmppServer::outgoingServerPoolSize() const
+{
+    return d->outgoingServerPoolSize;
+}
+
+///
+/// Sets the maximum number of outgoing server-to-server connections which
+/// are opened to the same remote domain.
+///
+/// The stanzas between two users always take the same connection, picked by
+/// hashing their bare JIDs, so they are not reordered. A connection is only
+/// opened once stanzas are sent over it. The default is a single connection
+/// per domain.
+///
+/// Changing the pool size while connections are open moves users to other
+/// connections, so stanzas which are still queued may be overtaken.
+///
+/// \since QXmpp 1.5
+///
+void QXmppServer::setOutgoingServerPoolSize(int size)
+{
+    d->outgoingServerPoolSize = qMax(1, size);
+}
+
 /// Returns the statistics for the server.
 
 QVariantMap QXmppServer::statistics() const
@@ -543,22 +1405,27 @@ bool QXmppServer::listenForClients(const QHostAddress &address, quint16 port)
         return false;
     }
 
-    // create new server
-    auto *server = new QXmppSslServer(this);
-    server->addCaCertificates(d->caCertificates);
-    server->setLocalCertificate(d->localCertificate);
-    server->setPrivateKey(d->privateKey);
+    if (d->reusePort) {
+        if (!d->listenForClientsOnWorkers(address, port)) {
+            d->warning(QString("Could not start listening for C2S on %1 %2 with SO_REUSEPORT").arg(address.toString(), QString::number(port)));
+            return false;
+        }
+    } else {
+        // create new server
+        auto *server = d->createSslServer(this);
 
-    check = connect(server, SIGNAL(newConnection(QSslSocket *)),
-                    this, SLOT(_q_clientConnection(QSslSocket *)));
-    Q_ASSERT(check);
+        check = connect(server, SIGNAL(newConnection(QSslSocket *)),
+                        this, SLOT(_q_clientConnection(QSslSocket *)));
+        Q_ASSERT(check);
 
-    if (!server->listen(address, port)) {
-        d->warning(QString("Could not start listening for C2S on %1 %2").arg(address.toString(), QString::number(port)));
-        delete server;
-        return false;
+        if (!server->listen(address, port)) {
+            d->warning(QString("Could not start listening for C2S on %1 %2").arg(address.toString(), QString::number(port)));
+            delete server;
+            return false;
+        }
+        d->serversForClients.insert(server);
+        d->startWorkers();
     }
-    d->serversForClients.insert(server);
 
     // start extensions
     d->loadExtensions(this);
@@ -573,8 +1440,13 @@ void QXmppServer::close()
 {
     // prevent new connections
     for (auto *server : d->serversForClients + d->serversForServers) {
-        server->close();
-        delete server;
+        if (server->thread() == thread()) {
+            server->close();
+            delete server;
+        } else {
+            // the listener lives in a worker thread, where it is destroyed
+            server->deleteLater();
+        }
     }
     d->serversForClients.clear();
     d->serversForServers.clear();
@@ -582,10 +1454,10 @@ void QXmppServer::close()
     // stop extensions
     d->stopExtensions();
 
-    // close XMPP streams
-    QSetIterator<QXmppIncomingClient *> itr(d->incomingClients);
-    while (itr.hasNext())
-        itr.next()->disconnectFromHost();
+    // close XMPP streams, which may live in worker threads
+    const auto clients = d->incomingClients.keys();
+    for (auto *stream : clients)
+        QMetaObject::invokeMethod(stream, "disconnectFromHost");
     for (auto *stream : d->incomingServers)
         stream->disconnectFromHost();
     for (auto *stream : d->outgoingServers)
@@ -608,10 +1480,7 @@ bool QXmppServer::listenForServers(const QHostAddress &address, quint16 port)
     }
 
     // create new server
-    auto *server = new QXmppSslServer(this);
-    server->addCaCertificates(d->caCertificates);
-    server->setLocalCertificate(d->localCertificate);
-    server->setPrivateKey(d->privateKey);
+    auto *server = d->createSslServer(this);
 
     check = connect(server, SIGNAL(newConnection(QSslSocket *)),
                     this, SLOT(_q_serverConnection(QSslSocket *)));
@@ -643,7 +1512,7 @@ bool QXmppServer::sendElement(const QDomElement &element)
     helperToXmlAddDomElement(&xmlStream, element, omitNamespaces);
 
     // route data
-    return d->routeData(element.attribute("to"), data);
+    return d->routeData(element.attribute("from"), element.attribute("to"), data);
 }
 
 /// Route an XMPP packet.
@@ -658,31 +1527,58 @@ bool QXmppServer::sendPacket(const QXmppStanza &packet)
     packet.toXml(&xmlStream);
 
     // route data
-    return d->routeData(packet.to(), data);
+    return d->routeData(packet.from(), packet.to(), data);
 }
 
-/// Add a new incoming client \a stream.
+/// Sends the same serialized stanza \a data to several \a recipients.
 ///
-/// This method can be used for instance to implement BOSH support
-/// as a server extension.
+/// The data is shared by all recipients and handed to each worker thread
+/// only once, which makes this cheaper than routing a copy of the stanza
+/// per recipient, for instance when broadcasting presence.
+///
+/// Only clients of the local domain can be reached this way, other
+/// recipients are skipped. A bare JID reaches all connected resources.
+///
+/// Returns the number of recipients for which a stream was found.
+///
+/// \since QXmpp 1.5
 
-void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
+int QXmppServer::broadcastData(const QStringList &recipients, const QByteArray &data)
 {
+    return d->broadcast(recipients, data);
+}
 
-    stream->setPasswordChecker(d->passwordChecker);
+/// Sends the same \a packet to several \a recipients.
+///
+/// The packet is serialized only once, so its 'to' attribute is the same
+/// for all recipients. See broadcastData() for details.
+///
+/// \since QXmpp 1.5
+
+int QXmppServer::broadcastPacket(const QStringList &recipients, const QXmppStanza &packet)
+{
+    // serialize data
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    packet.toXml(&xmlStream);
 
-    connect(stream, &QXmppStream::connected,
-            this, &QXmppServer::_q_clientConnected);
+    return d->broadcast(recipients, data);
+}
 
-    connect(stream, &QXmppStream::disconnected,
-            this, &QXmppServer::_q_clientDisconnected);
+/// Add a new incoming client \a stream.
+///
+/// This method can be used for instance to implement BOSH support
+/// as a server extension.
 
-    connect(stream, &QXmppIncomingClient::elementReceived,
-            this, &QXmppServer::handleElement);
+void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
+{
+    d->connectClient(stream);
 
     // add stream
-    d->incomingClients.insert(stream);
-    setGauge("incoming-client.count", d->incomingClients.size());
+    QXmppClientRoute route;
+    route.stream = stream;
+    route.id = ++d->lastStreamId;
+    d->registerClient(route);
 }
 
 /// Handle a new incoming TCP connection from a client.
@@ -697,10 +1593,21 @@ void QXmppServer::_q_clientConnection(QSslSocket *socket)
         return;
     }
 
-    auto *stream = new QXmppIncomingClient(socket, d->domain, this);
+    auto *worker = d->nextWorker();
+    auto *stream = new QXmppIncomingClient(socket, d->domain, worker ? nullptr : this);
     stream->setInactivityTimeout(120);
     socket->setParent(stream);
     addIncomingClient(stream);
+
+    // hand the stream over to a worker thread
+    if (worker) {
+        auto &route = d->incomingClients[stream];
+        route.worker = worker;
+        stream->moveToThread(worker->thread());
+        QMetaObject::invokeMethod(worker, "addStream", Qt::QueuedConnection,
+                                  Q_ARG(quint64, route.id),
+                                  Q_ARG(QObject *, stream));
+    }
 }
 
 /// Handle a successful stream connection for a client.
@@ -715,14 +1622,23 @@ void QXmppServer::_q_clientConnected()
     // FIXME: at this point the JID must contain a resource, assert it?
     const QString jid = client->jid();
 
+    const auto route = d->incomingClients.value(client);
+    if (!route.stream)
+        return;
+
     // check whether the connection conflicts with another one
-    QXmppIncomingClient *old = d->incomingClientsByJid.value(jid);
+    QWriteLocker locker(&d->routesLock);
+    auto *old = d->incomingClientsByJid.value(jid).stream.data();
     if (old && old != client) {
-        old->sendData("<stream:error><conflict xmlns='urn:ietf:params:xml:ns:xmpp-streams'/><text xmlns='urn:ietf:params:xml:ns:xmpp-streams'>Replaced by new connection</text></stream:error>");
-        old->disconnectFromHost();
+        // the stream may live in a worker thread
+        QMetaObject::invokeMethod(old, "sendData", Q_ARG(QByteArray, QByteArrayLiteral("<stream:error><conflict xmlns='urn:ietf:params:xml:ns:xmpp-streams'/><text xmlns='urn:ietf:params:xml:ns:xmpp-streams'>Replaced by new connection</text></stream:error>")));
+        QMetaObject::invokeMethod(old, "disconnectFromHost");
     }
-    d->incomingClientsByJid.insert(jid, client);
-    d->incomingClientsByBareJid[QXmppUtils::jidToBareJid(jid)].insert(client);
+    d->incomingClientsByJid.insert(jid, route);
+    auto &bareJidRoutes = d->incomingClientsByBareJid[QXmppUtils::jidToBareJid(jid)];
+    if (std::none_of(bareJidRoutes.cbegin(), bareJidRoutes.cend(), [client](const QXmppClientRoute &other) { return other.stream == client; }))
+        bareJidRoutes << route;
+    locker.unlock();
 
     // emit signal
     emit clientConnected(jid);
@@ -740,13 +1656,18 @@ void QXmppServer::_q_clientDisconnected()
         // remove stream from routing tables
         const QString jid = client->jid();
         if (!jid.isEmpty()) {
-            if (d->incomingClientsByJid.value(jid) == client)
+            QWriteLocker locker(&d->routesLock);
+            if (d->incomingClientsByJid.value(jid).stream == client)
                 d->incomingClientsByJid.remove(jid);
             const QString bareJid = QXmppUtils::jidToBareJid(jid);
-            if (d->incomingClientsByBareJid.contains(bareJid)) {
-                d->incomingClientsByBareJid[bareJid].remove(client);
-                if (d->incomingClientsByBareJid[bareJid].isEmpty())
-                    d->incomingClientsByBareJid.remove(bareJid);
+            auto itr = d->incomingClientsByBareJid.find(bareJid);
+            if (itr != d->incomingClientsByBareJid.end()) {
+                itr->erase(std::remove_if(itr->begin(), itr->end(), [client](const QXmppClientRoute &route) {
+                               return route.stream == client;
+                           }),
+                           itr->end());
+                if (itr->isEmpty())
+                    d->incomingClientsByBareJid.erase(itr);
             }
         }
 
@@ -770,11 +1691,11 @@ void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
 
     if (dialback.command() == QXmppDialback::Verify) {
         // handle a verify request
-        for (auto *out : std::as_const(d->outgoingServers)) {
-            if (out->remoteDomain() != dialback.from())
-                continue;
-
-            bool isValid = dialback.key() == out->localStreamKey();
+        const auto &pool = std::as_const(d->outgoingServersByDomain)[dialback.from()];
+        if (!pool.isEmpty()) {
+            const bool isValid = std::any_of(pool.cbegin(), pool.cend(), [&](QXmppOutgoingServer *out) {
+                return out && dialback.key() == out->localStreamKey();
+            });
             QXmppDialback verify;
             verify.setCommand(QXmppDialback::Verify);
             verify.setId(dialback.id());
@@ -791,7 +1712,7 @@ void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
 
 void QXmppServer::handleElement(const QDomElement &element)
 {
-    handleStanza(this, element);
+    d->handleStanza(element, {});
 }
 
 /// Handle a stream disconnection for an outgoing server.
@@ -803,6 +1724,12 @@ void QXmppServer::_q_outgoingServerDisconnected()
         return;
 
     if (d->outgoingServers.remove(outgoing)) {
+        auto itr = d->outgoingServersByDomain.find(outgoing->remoteDomain());
+        if (itr != d->outgoingServersByDomain.end()) {
+            std::replace(itr->begin(), itr->end(), outgoing, static_cast<QXmppOutgoingServer *>(nullptr));
+            if (std::all_of(itr->cbegin(), itr->cend(), [](QXmppOutgoingServer *out) { return !out; }))
+                d->outgoingServersByDomain.erase(itr);
+        }
         outgoing->deleteLater();
         setGauge("outgoing-server.count", d->outgoingServers.size());
     }
@@ -823,6 +1750,7 @@ void QXmppServer::_q_serverConnection(QSslSocket *socket)
 
     auto *stream = new QXmppIncomingServer(socket, d->domain, this);
     socket->setParent(stream);
+    d->applyRateLimits(stream);
 
     connect(stream, &QXmppStream::disconnected,
             this, &QXmppServer::_q_serverDisconnected);
@@ -830,8 +1758,10 @@ void QXmppServer::_q_serverConnection(QSslSocket *socket)
     connect(stream, &QXmppIncomingServer::dialbackRequestReceived,
             this, &QXmppServer::_q_dialbackRequestReceived);
 
-    connect(stream, &QXmppIncomingServer::elementReceived,
-            this, &QXmppServer::handleElement);
+    connect(stream, &QXmppIncomingServer::stanzaReceived,
+            this, [this](const QDomElement &element, const QByteArray &data) {
+                d->handleStanza(element, data);
+            });
 
     // add stream
     d->incomingServers.insert(stream);
@@ -855,6 +1785,8 @@ void QXmppServer::_q_serverDisconnected()
 class QXmppSslServerPrivate
 {
 public:
+    // the server may accept connections in a worker thread
+    QMutex mutex;
     QList<QSslCertificate> caCertificates;
     QSslCertificate localCertificate;
     QSslKey privateKey;
@@ -886,6 +1818,7 @@ void QXmppSslServer::incomingConnection(qintptr socketDescriptor)
         return;
     }
 
+    QMutexLocker locker(&d->mutex);
     if (!d->localCertificate.isNull() && !d->privateKey.isNull()) {
         auto sslConfig = socket->sslConfiguration();
         sslConfig.setCaCertificates(sslConfig.caCertificates() + d->caCertificates);
@@ -895,6 +1828,8 @@ void QXmppSslServer::incomingConnection(qintptr socketDescriptor)
         socket->setLocalCertificate(d->localCertificate);
         socket->setPrivateKey(d->privateKey);
     }
+    locker.unlock();
+
     emit newConnection(socket);
 }
 
@@ -905,6 +1840,7 @@ void QXmppSslServer::incomingConnection(qintptr socketDescriptor)
 
 void QXmppSslServer::addCaCertificates(const QList<QSslCertificate> &certificates)
 {
+    QMutexLocker locker(&d->mutex);
     d->caCertificates += certificates;
 }
 
@@ -914,6 +1850,7 @@ void QXmppSslServer::addCaCertificates(const QList<QSslCertificate> &certificate
 
 void QXmppSslServer::setLocalCertificate(const QSslCertificate &certificate)
 {
+    QMutexLocker locker(&d->mutex);
     d->localCertificate = certificate;
 }
 
@@ -923,5 +1860,6 @@ void QXmppSslServer::setLocalCertificate(const QSslCertificate &certificate)
 
 void QXmppSslServer::setPrivateKey(const QSslKey &key)
 {
+    QMutexLocker locker(&d->mutex);
     d->privateKey = key;
 }
@@ -80,6 +80,20 @@ public:
     QXmppPasswordChecker *passwordChecker();
     void setPasswordChecker(QXmppPasswordChecker *checker);
 
+    int workerThreadCount() const;
+    void setWorkerThreadCount(int count);
+
+    bool isReusePortEnabled() const;
+    void setReusePortEnabled(bool enabled);
+
+    int stanzaRateLimit() const;
+    void setStanzaRateLimit(int stanzasPerSecond, int burst = 0);
+    qint64 byteRateLimit() const;
+    void setByteRateLimit(qint64 bytesPerSecond, qint64 burst = 0);
+
+    int outgoingServerPoolSize() const;
+    void setOutgoingServerPoolSize(int size);
+
     QVariantMap statistics() const;
 
     void addCaCertificates(const QString &caCertificates);
@@ -95,6 +109,9 @@ public:
     bool sendElement(const QDomElement &element);
     bool sendPacket(const QXmppStanza &stanza);
 
+    int broadcastData(const QStringList &recipients, const QByteArray &data);
+    int broadcastPacket(const QStringList &recipients, const QXmppStanza &packet);
+
     void addIncomingClient(QXmppIncomingClient *stream);
 
 Q_SIGNALS:
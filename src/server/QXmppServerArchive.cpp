@@ -0,0 +1,830 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServerArchive.h"
+
+#include "QXmppConstants_p.h"
+#include "QXmppMamIq.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDomElement>
+#include <QFile>
+#include <QMutex>
+#include <QXmlStreamWriter>
+#include <QtEndian>
+
+// A record holds the size of the message, the size of the JID of the other
+// party and the archive ID, all big-endian, followed by the JID and the
+// message.
+static const int RECORD_HEADER_SIZE = 14;
+
+// An index entry holds the archive ID and the offset of a record.
+static const int INDEX_ENTRY_SIZE = 16;
+
+// number of bytes of records between two index entries
+static const qint64 INDEX_INTERVAL = 4096;
+
+// number of users whose last segment is remembered
+static const int TAIL_CACHE_SIZE = 1024;
+
+// size above which results are sent before the page is complete
+static const int RESULT_CHUNK_SIZE = 65536;
+
+namespace {
+
+// The last segment of an archive, to which records are appended.
+struct ArchiveTail
+{
+    // path of the segment without its extension, empty if there is none
+    QString segmentPath;
+    qint64 size;
+    qint64 indexedOffset;
+    qint64 lastId;
+};
+
+struct Record
+{
+    qint64 id;
+    const char *with;
+    int withSize;
+    const char *message;
+    int messageSize;
+};
+
+// A segment and its index, mapped into memory.
+struct MappedSegment
+{
+    QFile file;
+    QFile indexFile;
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    const uchar *index = nullptr;
+    qint64 indexCount = 0;
+
+    qint64 entryId(qint64 entry) const
+    {
+        return qFromBigEndian<qint64>(index + entry * INDEX_ENTRY_SIZE);
+    }
+
+    qint64 entryOffset(qint64 entry) const
+    {
+        return qFromBigEndian<qint64>(index + entry * INDEX_ENTRY_SIZE + 8);
+    }
+};
+
+// A position in an archive.
+struct Position
+{
+    int segment;
+    qint64 offset;
+};
+
+// Reads the pages of an archive.
+//
+// Records are appended with increasing IDs, so a page is found by a binary
+// search over the segments, then over the sparse index of a segment, and a
+// scan of at most one index interval. Records point into the mapped
+// segments, they remain valid as long as the reader.
+class ArchiveReader
+{
+public:
+    explicit ArchiveReader(const QString &path);
+
+    bool contains(qint64 id);
+    bool readForward(qint64 lowerId, qint64 upperId, const QString &with, int max, QVector<Record> &page);
+    bool readBackward(qint64 lowerId, qint64 upperId, const QString &with, int max, QVector<Record> &page);
+
+private:
+    MappedSegment *segment(int index);
+    Position seek(qint64 id);
+    bool next(Position &position, Record &record);
+    qint64 blockStart(MappedSegment *segment, qint64 offset) const;
+
+    QString m_path;
+    QStringList m_names;
+    QVector<qint64> m_firstIds;
+    std::vector<std::unique_ptr<MappedSegment>> m_segments;
+};
+
+}  // namespace
+
+// Parses the record at the given offset. Returns false at the end of the data
+// or if the record was truncated by a crash while it was appended.
+static bool parseRecord(const uchar *data, qint64 size, qint64 offset, Record &record, qint64 &next)
+{
+    if (size - offset < RECORD_HEADER_SIZE)
+        return false;
+
+    const qint64 messageSize = qFromBigEndian<quint32>(data + offset);
+    const qint64 withSize = qFromBigEndian<quint16>(data + offset + 4);
+    if (size - offset - RECORD_HEADER_SIZE < withSize + messageSize)
+        return false;
+
+    const auto *payload = reinterpret_cast<const char *>(data + offset + RECORD_HEADER_SIZE);
+    record.id = qFromBigEndian<qint64>(data + offset + 6);
+    record.with = payload;
+    record.withSize = int(withSize);
+    record.message = payload + withSize;
+    record.messageSize = int(messageSize);
+    next = offset + RECORD_HEADER_SIZE + withSize + messageSize;
+    return true;
+}
+
+static bool matchesWith(const Record &record, const QString &with)
+{
+    if (with.isEmpty())
+        return true;
+
+    // a bare JID matches all of its resources
+    const auto recordWith = QString::fromUtf8(record.with, record.withSize);
+    if (QXmppUtils::jidToResource(with).isEmpty())
+        return QXmppUtils::jidToBareJid(recordWith) == with;
+    return recordWith == with;
+}
+
+// Archive IDs are the time at which a message was archived in microseconds,
+// made unique by incrementing them, formatted as hexadecimal so that their
+// order is kept by segment file names.
+static QString idToString(qint64 id)
+{
+    return QStringLiteral("%1").arg(id, 16, 16, QLatin1Char('0'));
+}
+
+static qint64 idFromString(const QString &string)
+{
+    bool ok = false;
+    const auto id = string.toLongLong(&ok, 16);
+    return ok && string.size() == 16 && id >= 0 ? id : -1;
+}
+
+static QStringList segmentNames(const QString &path)
+{
+    auto names = QDir(path).entryList({ QStringLiteral("*.seg") }, QDir::Files, QDir::Name);
+    for (auto &name : names)
+        name.chop(4);
+    return names;
+}
+
+ArchiveReader::ArchiveReader(const QString &path)
+    : m_path(path),
+      m_names(segmentNames(path))
+{
+    for (const auto &name : std::as_const(m_names))
+        m_firstIds << idFromString(name);
+    m_segments.resize(m_names.size());
+}
+
+MappedSegment *ArchiveReader::segment(int index)
+{
+    auto &segment = m_segments[index];
+    if (!segment) {
+        segment = std::make_unique<MappedSegment>();
+        const auto basePath = m_path + QLatin1Char('/') + m_names.at(index);
+
+        // records appended after the segment was mapped are not read
+        segment->file.setFileName(basePath + QStringLiteral(".seg"));
+        const auto size = segment->file.open(QIODevice::ReadOnly) ? segment->file.size() : 0;
+        if (size > 0) {
+            segment->data = segment->file.map(0, size);
+            if (segment->data)
+                segment->size = size;
+        }
+
+        // a segment with a single index interval has no index
+        segment->indexFile.setFileName(basePath + QStringLiteral(".idx"));
+        const auto indexCount = segment->indexFile.open(QIODevice::ReadOnly) ? segment->indexFile.size() / INDEX_ENTRY_SIZE : 0;
+        if (indexCount > 0) {
+            segment->index = segment->indexFile.map(0, indexCount * INDEX_ENTRY_SIZE);
+            if (segment->index)
+                segment->indexCount = indexCount;
+        }
+    }
+    return segment.get();
+}
+
+// Returns the position of the first record with an ID which is not lower
+// than the given one.
+Position ArchiveReader::seek(qint64 id)
+{
+    const auto firstId = std::upper_bound(m_firstIds.cbegin(), m_firstIds.cend(), id);
+    const int index = int(firstId - m_firstIds.cbegin()) - 1;
+    if (index < 0)
+        return { 0, 0 };
+
+    // the last index entry which is not after the ID
+    auto *segment = this->segment(index);
+    qint64 low = 0;
+    qint64 high = segment->indexCount;
+    while (low < high) {
+        const auto middle = (low + high) / 2;
+        if (segment->entryId(middle) <= id)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    qint64 offset = low > 0 ? segment->entryOffset(low - 1) : 0;
+
+    Record record;
+    qint64 nextOffset;
+    while (parseRecord(segment->data, segment->size, offset, record, nextOffset)) {
+        if (record.id >= id)
+            return { index, offset };
+        offset = nextOffset;
+    }
+    return { index + 1, 0 };
+}
+
+bool ArchiveReader::next(Position &position, Record &record)
+{
+    while (position.segment < m_names.size()) {
+        auto *segment = this->segment(position.segment);
+        qint64 nextOffset;
+        if (parseRecord(segment->data, segment->size, position.offset, record, nextOffset)) {
+            position.offset = nextOffset;
+            return true;
+        }
+        position = { position.segment + 1, 0 };
+    }
+    return false;
+}
+
+// Returns the offset of the last index entry before the given offset.
+qint64 ArchiveReader::blockStart(MappedSegment *segment, qint64 offset) const
+{
+    qint64 low = 0;
+    qint64 high = segment->indexCount;
+    while (low < high) {
+        const auto middle = (low + high) / 2;
+        if (segment->entryOffset(middle) < offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low > 0 ? segment->entryOffset(low - 1) : 0;
+}
+
+bool ArchiveReader::contains(qint64 id)
+{
+    auto position = seek(id);
+    Record record;
+    return next(position, record) && record.id == id;
+}
+
+// Reads the first page of matching records with IDs from lowerId up to
+// upperId excluded. Returns true if there are no more matching records.
+bool ArchiveReader::readForward(qint64 lowerId, qint64 upperId, const QString &with, int max, QVector<Record> &page)
+{
+    auto position = seek(lowerId);
+    Record record;
+    while (next(position, record)) {
+        if (record.id >= upperId)
+            return true;
+        if (!matchesWith(record, with))
+            continue;
+        if (page.size() >= max)
+            return false;
+        page << record;
+    }
+    return true;
+}
+
+// Reads the last page of matching records with IDs from lowerId up to upperId
+// excluded, one index interval at a time, going backwards from upperId.
+// Returns true if there are no more matching records.
+bool ArchiveReader::readBackward(qint64 lowerId, qint64 upperId, const QString &with, int max, QVector<Record> &page)
+{
+    auto end = seek(upperId);
+    while (true) {
+        if (end.offset == 0) {
+            if (end.segment == 0)
+                return true;
+            end = { end.segment - 1, segment(end.segment - 1)->size };
+            continue;
+        }
+
+        auto *segment = this->segment(end.segment);
+        const auto start = blockStart(segment, end.offset);
+
+        QVector<Record> matches;
+        bool reachedLowerId = false;
+        Record record;
+        qint64 offset = start;
+        qint64 nextOffset;
+        while (offset < end.offset && parseRecord(segment->data, segment->size, offset, record, nextOffset)) {
+            if (record.id < lowerId)
+                reachedLowerId = true;
+            else if (matchesWith(record, with))
+                matches << record;
+            offset = nextOffset;
+        }
+
+        page = matches + page;
+        if (page.size() > max) {
+            page.remove(0, page.size() - max);
+            return false;
+        }
+        if (reachedLowerId)
+            return true;
+        end.offset = start;
+    }
+}
+
+class QXmppServerArchivePrivate
+{
+public:
+    QXmppServerArchivePrivate(QXmppServerArchive *qq);
+
+    bool isLocalUser(const QString &jid) const;
+    QString userPath(const QString &bareJid) const;
+    ArchiveTail *tail(const QString &path);
+    bool append(const QString &bareJid, const QString &with, const QByteArray &message);
+
+    bool archiveMessage(const QDomElement &element);
+    void handleQuery(const QDomElement &element, QXmppStanzaResponses &responses);
+    QByteArray resultMessage(const QString &to, const QString &from, const QString &queryId, const Record &record) const;
+
+    QString directory;
+    qint64 segmentSize;
+    int maxPageSize;
+    bool started;
+
+    // guards the appends to the archives
+    QMutex mutex;
+    QCache<QString, ArchiveTail> tails;
+
+private:
+    QXmppServerArchive *q;
+};
+
+QXmppServerArchivePrivate::QXmppServerArchivePrivate(QXmppServerArchive *qq)
+    : segmentSize(16 * 1024 * 1024),
+      maxPageSize(100),
+      started(false),
+      tails(TAIL_CACHE_SIZE),
+      q(qq)
+{
+}
+
+bool QXmppServerArchivePrivate::isLocalUser(const QString &jid) const
+{
+    return !QXmppUtils::jidToUser(jid).isEmpty() && QXmppUtils::jidToDomain(jid) == q->server()->domain();
+}
+
+/// Returns the directory holding the archive of the given user.
+
+QString QXmppServerArchivePrivate::userPath(const QString &bareJid) const
+{
+    const auto hash = QCryptographicHash::hash(bareJid.toUtf8(), QCryptographicHash::Sha1);
+    return directory + QLatin1Char('/') + QString::fromLatin1(hash.toHex());
+}
+
+/// Returns the last segment of an archive, recovering it from the files if
+/// it is not cached. The mutex must be held.
+
+ArchiveTail *QXmppServerArchivePrivate::tail(const QString &path)
+{
+    if (auto *tail = tails.object(path))
+        return tail;
+    if (!QDir().mkpath(path))
+        return nullptr;
+
+    auto *tail = new ArchiveTail { QString(), 0, 0, 0 };
+    const auto names = segmentNames(path);
+    if (!names.isEmpty()) {
+        tail->segmentPath = path + QLatin1Char('/') + names.last();
+        tail->lastId = idFromString(names.last()) - 1;
+
+        // only the records after the last index entry are read
+        QFile index(tail->segmentPath + QStringLiteral(".idx"));
+        const auto indexCount = index.open(QIODevice::ReadOnly) ? index.size() / INDEX_ENTRY_SIZE : 0;
+        if (indexCount > 0 && index.seek((indexCount - 1) * INDEX_ENTRY_SIZE)) {
+            const auto entry = index.read(INDEX_ENTRY_SIZE);
+            if (entry.size() == INDEX_ENTRY_SIZE)
+                tail->indexedOffset = qFromBigEndian<qint64>(entry.constData() + 8);
+        }
+
+        QFile file(tail->segmentPath + QStringLiteral(".seg"));
+        if (!file.open(QIODevice::ReadWrite)) {
+            delete tail;
+            return nullptr;
+        }
+        if (tail->indexedOffset > file.size())
+            tail->indexedOffset = 0;
+        file.seek(tail->indexedOffset);
+        const auto data = file.readAll();
+
+        Record record;
+        qint64 offset = 0;
+        qint64 nextOffset;
+        const auto *bytes = reinterpret_cast<const uchar *>(data.constData());
+        while (parseRecord(bytes, data.size(), offset, record, nextOffset)) {
+            tail->lastId = record.id;
+            offset = nextOffset;
+        }
+        tail->size = tail->indexedOffset + offset;
+
+        // do not leave a partial record in front of the next one
+        if (file.size() > tail->size)
+            file.resize(tail->size);
+    }
+    tails.insert(path, tail);
+    return tail;
+}
+
+/// Appends a message to a user's archive. The mutex must be held.
+
+bool QXmppServerArchivePrivate::append(const QString &bareJid, const QString &with, const QByteArray &message)
+{
+    const auto path = userPath(bareJid);
+    auto *tail = this->tail(path);
+    if (!tail)
+        return false;
+
+    const auto id = qMax(QDateTime::currentMSecsSinceEpoch() * 1000, tail->lastId + 1);
+    const auto withData = with.toUtf8().left(std::numeric_limits<quint16>::max());
+
+    QByteArray record(RECORD_HEADER_SIZE, Qt::Uninitialized);
+    qToBigEndian<quint32>(message.size(), record.data());
+    qToBigEndian<quint16>(withData.size(), record.data() + 4);
+    qToBigEndian<qint64>(id, record.data() + 6);
+    record += withData;
+    record += message;
+
+    // segments are named after their first record
+    if (tail->segmentPath.isEmpty() || (tail->size > 0 && tail->size + record.size() > segmentSize)) {
+        tail->segmentPath = path + QLatin1Char('/') + idToString(id);
+        tail->size = 0;
+        tail->indexedOffset = 0;
+    }
+
+    QFile file(tail->segmentPath + QStringLiteral(".seg"));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+    if (file.write(record) != record.size()) {
+        file.resize(tail->size);
+        return false;
+    }
+
+    // the index is sparse, a missing entry only makes seeking scan further
+    if (tail->size - tail->indexedOffset >= INDEX_INTERVAL) {
+        QByteArray entry(INDEX_ENTRY_SIZE, Qt::Uninitialized);
+        qToBigEndian<qint64>(id, entry.data());
+        qToBigEndian<qint64>(tail->size, entry.data() + 8);
+
+        QFile index(tail->segmentPath + QStringLiteral(".idx"));
+        if (index.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            const auto indexSize = index.size() - index.size() % INDEX_ENTRY_SIZE;
+            if (index.size() == indexSize || index.resize(indexSize)) {
+                if (index.write(entry) == entry.size())
+                    tail->indexedOffset = tail->size;
+                else
+                    index.resize(indexSize);
+            }
+        }
+    }
+
+    tail->size += record.size();
+    tail->lastId = id;
+    return true;
+}
+
+/// Appends a message to the archives of its local sender and recipient.
+
+bool QXmppServerArchivePrivate::archiveMessage(const QDomElement &element)
+{
+    QXmppMessage message;
+    message.parse(element);
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    message.toXml(&writer);
+
+    // the message is forwarded in the results, where it needs its namespace
+    data.insert(int(qstrlen("<message")), QByteArrayLiteral(" xmlns=\"jabber:client\""));
+
+    const auto fromBareJid = QXmppUtils::jidToBareJid(message.from());
+    const auto toBareJid = QXmppUtils::jidToBareJid(message.to());
+
+    QMutexLocker locker(&mutex);
+    bool archived = true;
+    if (isLocalUser(message.from()))
+        archived &= append(fromBareJid, message.to(), data);
+    if (isLocalUser(message.to()) && toBareJid != fromBareJid)
+        archived &= append(toBareJid, message.from(), data);
+    return archived;
+}
+
+/// Answers a query for the sender's archive.
+
+void QXmppServerArchivePrivate::handleQuery(const QDomElement &element, QXmppStanzaResponses &responses)
+{
+    QXmppMamQueryIq request;
+    request.parse(element);
+
+    const auto sendError = [&](QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition) {
+        QXmppIq response(QXmppIq::Error);
+        response.setId(request.id());
+        response.setFrom(request.to());
+        response.setTo(request.from());
+        response.setError(QXmppStanza::Error(type, condition));
+        responses.sendPacket(response);
+    };
+
+    // the filters, as a range of IDs and the JID of the other party
+    qint64 lowerId = 0;
+    qint64 upperId = std::numeric_limits<qint64>::max();
+    QString with;
+    const auto fields = request.form().fields();
+    for (const auto &field : fields) {
+        const auto value = field.value().toString();
+        if (field.key() == QStringLiteral("with")) {
+            with = value;
+        } else if (field.key() == QStringLiteral("start") || field.key() == QStringLiteral("end")) {
+            const auto stamp = QXmppUtils::datetimeFromString(value);
+            if (!stamp.isValid()) {
+                sendError(QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+                return;
+            }
+            if (field.key() == QStringLiteral("start"))
+                lowerId = qMax(lowerId, stamp.toMSecsSinceEpoch() * 1000);
+            else
+                upperId = qMin(upperId, (stamp.toMSecsSinceEpoch() + 1) * 1000);
+        }
+    }
+
+    const auto resultSetQuery = request.resultSetQuery();
+    const int max = resultSetQuery.max() >= 0 ? qMin(resultSetQuery.max(), maxPageSize) : maxPageSize;
+
+    ArchiveReader reader(userPath(QXmppUtils::jidToBareJid(request.from())));
+    if (!resultSetQuery.after().isEmpty()) {
+        const auto id = idFromString(resultSetQuery.after());
+        if (id < 0 || !reader.contains(id)) {
+            sendError(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return;
+        }
+        lowerId = qMax(lowerId, id + 1);
+    }
+    if (!resultSetQuery.before().isEmpty()) {
+        const auto id = idFromString(resultSetQuery.before());
+        if (id < 0 || !reader.contains(id)) {
+            sendError(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return;
+        }
+        upperId = qMin(upperId, id);
+    }
+
+    // an empty <before/> element asks for the last page
+    const auto setElement = element.firstChildElement(QStringLiteral("query")).firstChildElement(QStringLiteral("set"));
+    const bool backward = !setElement.firstChildElement(QStringLiteral("before")).isNull();
+
+    QVector<Record> page;
+    const bool complete = backward ? reader.readBackward(lowerId, upperId, with, max, page)
+                                   : reader.readForward(lowerId, upperId, with, max, page);
+
+    // the results are queued in chunks, directly from the mapped segments,
+    // and routed by the server's thread ahead of the final result
+    const auto archiveJid = QXmppUtils::jidToBareJid(request.from());
+    QByteArray results;
+    for (const auto &record : std::as_const(page)) {
+        results += resultMessage(request.from(), archiveJid, request.queryId(), record);
+        if (results.size() >= RESULT_CHUNK_SIZE) {
+            responses.sendData(archiveJid, request.from(), results);
+            results.clear();
+        }
+    }
+    if (!results.isEmpty())
+        responses.sendData(archiveJid, request.from(), results);
+
+    QXmppResultSetReply resultSetReply;
+    if (!page.isEmpty()) {
+        resultSetReply.setFirst(idToString(page.first().id));
+        resultSetReply.setLast(idToString(page.last().id));
+    }
+
+    QXmppMamResultIq result;
+    result.setType(QXmppIq::Result);
+    result.setId(request.id());
+    result.setFrom(request.to());
+    result.setTo(request.from());
+    result.setResultSetReply(resultSetReply);
+    result.setComplete(complete);
+    responses.sendPacket(result);
+}
+
+/// Returns a result message forwarding an archived message.
+
+QByteArray QXmppServerArchivePrivate::resultMessage(const QString &to, const QString &from, const QString &queryId, const Record &record) const
+{
+    QByteArray data;
+    {
+        QXmlStreamWriter writer(&data);
+        writer.writeStartElement(QStringLiteral("message"));
+        writer.writeAttribute(QStringLiteral("to"), to);
+        writer.writeAttribute(QStringLiteral("from"), from);
+        writer.writeStartElement(QStringLiteral("result"));
+        writer.writeDefaultNamespace(ns_mam);
+        helperToXmlAddAttribute(&writer, QStringLiteral("queryid"), queryId);
+        writer.writeAttribute(QStringLiteral("id"), idToString(record.id));
+        writer.writeStartElement(QStringLiteral("forwarded"));
+        writer.writeDefaultNamespace(ns_forwarding);
+        writer.writeStartElement(QStringLiteral("delay"));
+        writer.writeDefaultNamespace(ns_delayed_delivery);
+        writer.writeAttribute(QStringLiteral("stamp"), QXmppUtils::datetimeToString(QDateTime::fromMSecsSinceEpoch(record.id / 1000, Qt::UTC)));
+        writer.writeEndElement();
+    }
+    data.append(record.message, record.messageSize);
+    data.append("</forwarded></result></message>");
+    return data;
+}
+
+///
+/// Constructs a new message archive.
+///
+/// A directory must be set before the archive is started.
+///
+QXmppServerArchive::QXmppServerArchive()
+    : d(new QXmppServerArchivePrivate(this))
+{
+}
+
+QXmppServerArchive::~QXmppServerArchive()
+{
+    stop();
+    delete d;
+}
+
+///
+/// Returns the directory in which the archives are stored.
+///
+QString QXmppServerArchive::directory() const
+{
+    return d->directory;
+}
+
+///
+/// Sets the \a path of the directory in which the archives are stored. It is
+/// created if needed.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerArchive::setDirectory(const QString &path)
+{
+    d->directory = path;
+}
+
+///
+/// Returns the size in bytes above which a new segment is started.
+///
+qint64 QXmppServerArchive::segmentSize() const
+{
+    return d->segmentSize;
+}
+
+///
+/// Sets the size in \a bytes above which a new segment is started. The
+/// default is 16 MiB.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerArchive::setSegmentSize(qint64 bytes)
+{
+    d->segmentSize = qMax<qint64>(1, bytes);
+}
+
+///
+/// Returns the maximum number of messages returned in a page.
+///
+int QXmppServerArchive::maxPageSize() const
+{
+    return d->maxPageSize;
+}
+
+///
+/// Sets the maximum number of messages returned in a page, which is also
+/// the size of a page if the query does not limit it. The default is 100.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerArchive::setMaxPageSize(int count)
+{
+    d->maxPageSize = qMax(1, count);
+}
+
+///
+/// Returns 1, so that messages are archived before other extensions, like
+/// QXmppServerOfflineStore, take them.
+///
+int QXmppServerArchive::extensionPriority() const
+{
+    return 1;
+}
+
+QStringList QXmppServerArchive::discoveryFeatures() const
+{
+    return { ns_mam };
+}
+
+QVector<QXmppServerExtension::HandledStanza> QXmppServerArchive::handledStanzas() const
+{
+    return {
+        { QStringLiteral("message"), QString() },
+        { QStringLiteral("iq"), ns_mam },
+    };
+}
+
+///
+/// Claims the messages to archive and the queries of local users for their
+/// own archive.
+///
+bool QXmppServerArchive::claimStanza(const QDomElement &stanza)
+{
+    if (!d->started)
+        return false;
+
+    const auto from = stanza.attribute(QStringLiteral("from"));
+    const auto to = stanza.attribute(QStringLiteral("to"));
+    if (stanza.tagName() == QStringLiteral("iq")) {
+        const auto query = stanza.firstChildElement(QStringLiteral("query"));
+        return QXmppMamQueryIq::isMamQueryIq(stanza) &&
+            stanza.attribute(QStringLiteral("type")) == QStringLiteral("set") &&
+            query.attribute(QStringLiteral("node")).isEmpty() &&
+            d->isLocalUser(from) &&
+            (to.isEmpty() || to == server()->domain() || to == QXmppUtils::jidToBareJid(from));
+    }
+
+    const auto type = stanza.attribute(QStringLiteral("type"));
+    if (type == QStringLiteral("error") || type == QStringLiteral("groupchat") || type == QStringLiteral("headline"))
+        return false;
+    if (stanza.firstChildElement(QStringLiteral("body")).isNull())
+        return false;
+    return d->isLocalUser(from) || d->isLocalUser(to);
+}
+
+///
+/// Archives a claimed message, which is then routed as usual, or answers a
+/// claimed query.
+///
+bool QXmppServerArchive::handleStanzaAsync(const QDomElement &stanza, QXmppStanzaResponses &responses)
+{
+    if (stanza.tagName() == QStringLiteral("iq")) {
+        d->handleQuery(stanza, responses);
+        return true;
+    }
+
+    if (!d->archiveMessage(stanza))
+        warning(QStringLiteral("Could not archive message from %1").arg(stanza.attribute(QStringLiteral("from"))));
+    return false;
+}
+
+///
+/// Starts archiving messages and answering queries.
+///
+bool QXmppServerArchive::start()
+{
+    if (!server())
+        return false;
+
+    if (d->directory.isEmpty() || !QDir().mkpath(d->directory)) {
+        warning(QStringLiteral("Could not store archives in %1").arg(d->directory));
+        return false;
+    }
+
+    d->started = true;
+    return true;
+}
+
+///
+/// Stops archiving messages and answering queries.
+///
+void QXmppServerArchive::stop()
+{
+    d->started = false;
+}
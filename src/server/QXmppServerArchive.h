@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERARCHIVE_H
+#define QXMPPSERVERARCHIVE_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerArchivePrivate;
+
+///
+/// \brief The QXmppServerArchive class archives the messages of local users
+/// and answers their \xep{0313}: Message Archive Management queries.
+///
+/// Chat and normal messages with a body which are sent or received by a
+/// local user are appended to the user's archive, in time-ordered segment
+/// files with a sparse index. Queries with \xep{0059}: Result Set Management
+/// paging seek to the requested page using the index, and the results are
+/// read from the segments mapped into memory, so a conversation is never
+/// loaded as a whole.
+///
+/// \ingroup Core
+///
+/// \since QXmpp 1.5
+///
+class QXMPP_EXPORT QXmppServerArchive : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "mam")
+
+public:
+    QXmppServerArchive();
+    ~QXmppServerArchive() override;
+
+    QString directory() const;
+    void setDirectory(const QString &path);
+
+    qint64 segmentSize() const;
+    void setSegmentSize(qint64 bytes);
+
+    int maxPageSize() const;
+    void setMaxPageSize(int count);
+
+    int extensionPriority() const override;
+    QStringList discoveryFeatures() const override;
+    QVector<HandledStanza> handledStanzas() const override;
+    bool claimStanza(const QDomElement &stanza) override;
+    bool handleStanzaAsync(const QDomElement &stanza, QXmppStanzaResponses &responses) override;
+
+    bool start() override;
+    void stop() override;
+
+private:
+    friend class QXmppServerArchivePrivate;
+    QXmppServerArchivePrivate *const d;
+};
+
+#endif
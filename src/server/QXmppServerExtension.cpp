@@ -25,11 +25,40 @@
 
 #include "QXmppLogger.h"
 #include "QXmppServer.h"
+#include "QXmppStanza.h"
 
 #include <QDomElement>
 #include <QMetaClassInfo>
 #include <QStringList>
 
+/// Queues an XMPP \a packet, which is routed once the stanza was handled.
+
+void QXmppStanzaResponses::sendPacket(const QXmppStanza &packet)
+{
+    QByteArray data;
+    QXmlStreamWriter xmlStream(&data);
+    packet.toXml(&xmlStream);
+    m_stanzas.append({ packet.from(), packet.to(), data });
+}
+
+/// Queues serialized stanzas from \a from, which are routed to \a to once
+/// the stanza was handled.
+///
+/// The \a data may hold several stanzas between the same JIDs. Everything
+/// which was queued is routed in order.
+
+void QXmppStanzaResponses::sendData(const QString &from, const QString &to, const QByteArray &data)
+{
+    m_stanzas.append({ from, to, data });
+}
+
+/// Returns true if no stanzas were queued.
+
+bool QXmppStanzaResponses::isEmpty() const
+{
+    return m_stanzas.isEmpty();
+}
+
 class QXmppServerExtensionPrivate
 {
 public:
@@ -99,6 +128,66 @@ bool QXmppServerExtension::handleStanza(const QDomElement &stanza)
     return false;
 }
 
+/// Returns the stanzas which are passed to handleStanza().
+///
+/// The server builds a dispatch table from these declarations when the
+/// extensions are started, so that a stanza is only offered to the
+/// extensions which handle it, still in order of priority.
+///
+/// The default implementation returns an empty list, which means that every
+/// stanza is passed to handleStanza().
+///
+/// \since QXmpp 1.5
+
+QVector<QXmppServerExtension::HandledStanza> QXmppServerExtension::handledStanzas() const
+{
+    return {};
+}
+
+/// Claims an incoming XMPP stanza, to handle it asynchronously.
+///
+/// This is called in the server's thread, before handleStanza(). Return true
+/// to have the stanza passed to handleStanzaAsync() in a thread pool. The
+/// default implementation returns false.
+///
+/// \param stanza The received stanza.
+///
+/// \since QXmpp 1.5
+
+bool QXmppServerExtension::claimStanza(const QDomElement &stanza)
+{
+    Q_UNUSED(stanza);
+    return false;
+}
+
+/// Handles a stanza claimed by claimStanza(), in a thread of the server's
+/// thread pool. The stanza belongs to a document of its own.
+///
+/// Stanzas sent in response are queued in \a responses. They are routed by
+/// the server's thread once this method returns. If it returns false, the
+/// stanza is then offered to the remaining extensions, as if handleStanza()
+/// had returned false.
+///
+/// Later stanzas to the same bare JID, or from it if they are addressed to
+/// the server, are held back until the claimed stanza has been handled, so
+/// they are not reordered.
+///
+/// Stanzas for different bare JIDs are handled concurrently, in several
+/// threads of the pool. This method must therefore be thread-safe, as must
+/// everything it uses from the extension.
+///
+/// \param stanza The received stanza.
+/// \param responses The stanzas to send once the stanza was handled.
+///
+/// \since QXmpp 1.5
+
+bool QXmppServerExtension::handleStanzaAsync(const QDomElement &stanza, QXmppStanzaResponses &responses)
+{
+    Q_UNUSED(stanza);
+    Q_UNUSED(responses);
+    return false;
+}
+
 /// Returns the list of subscribers for the given JID.
 ///
 /// \param jid
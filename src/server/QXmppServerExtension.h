@@ -27,13 +27,43 @@
 #include "QXmppLogger.h"
 
 #include <QVariant>
+#include <QVector>
 
 class QDomElement;
 
 class QXmppServer;
 class QXmppServerExtensionPrivate;
+class QXmppStanza;
 class QXmppStream;
 
+/// \brief The QXmppStanzaResponses class collects the stanzas which an
+/// extension sends while it handles a stanza asynchronously.
+///
+/// The stanzas are serialized right away, in the extension's thread, and
+/// routed by the server's thread once the extension is done.
+///
+/// \since QXmpp 1.5
+
+class QXMPP_EXPORT QXmppStanzaResponses
+{
+public:
+    void sendPacket(const QXmppStanza &packet);
+    void sendData(const QString &from, const QString &to, const QByteArray &data);
+
+    bool isEmpty() const;
+
+private:
+    friend class QXmppServerPrivate;
+
+    struct Stanza
+    {
+        QString from;
+        QString to;
+        QByteArray data;
+    };
+    QVector<Stanza> m_stanzas;
+};
+
 /// \brief The QXmppServerExtension class is the base class for QXmppServer
 /// extensions.
 ///
@@ -42,6 +72,17 @@ class QXmppStream;
 /// and implement handleStanza(). You can then add your extension to the
 /// client instance using QXmppServer::addExtension().
 ///
+/// By default, every incoming stanza is offered to every extension. If your
+/// extension only handles some stanzas, reimplement handledStanzas() so the
+/// server only offers it those.
+///
+/// handleStanza() runs in the server's thread, which routes all stanzas. An
+/// extension doing slow work, like storing stanzas, can instead claim them
+/// with claimStanza() and handle them in a thread pool with
+/// handleStanzaAsync(). Stanzas to the same user are still processed in the
+/// order in which they were received, but stanzas to different users are
+/// handled concurrently, so handleStanzaAsync() must be thread-safe.
+///
 /// \ingroup Core
 
 class QXMPP_EXPORT QXmppServerExtension : public QXmppLoggable
@@ -49,6 +90,20 @@ class QXMPP_EXPORT QXmppServerExtension : public QXmppLoggable
     Q_OBJECT
 
 public:
+    ///
+    /// Describes stanzas handled by an extension.
+    ///
+    /// \since QXmpp 1.5
+    ///
+    struct HandledStanza
+    {
+        /// The tag name of the stanza, for instance "iq" or "message".
+        QString tagName;
+        /// The namespace of one of the stanza's child elements, or an empty
+        /// string to handle all stanzas with the given tag name.
+        QString payloadNamespace;
+    };
+
     QXmppServerExtension();
     ~QXmppServerExtension() override;
     virtual QString extensionName() const;
@@ -63,6 +118,10 @@ public:
     virtual bool start();
     virtual void stop();
 
+    virtual QVector<HandledStanza> handledStanzas() const;
+    virtual bool claimStanza(const QDomElement &stanza);
+    virtual bool handleStanzaAsync(const QDomElement &stanza, QXmppStanzaResponses &responses);
+
 protected:
     QXmppServer *server() const;
 
@@ -0,0 +1,576 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServerMetrics.h"
+
+#include "QXmppServer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QSaveFile>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+
+// maximum size of an HTTP request for the metrics
+static const qint64 MAX_REQUEST_SIZE = 8192;
+
+static std::atomic<quint64> lastMetricsId(0);
+
+namespace {
+
+struct Counter
+{
+    std::atomic<qint64> value { 0 };
+};
+
+struct Gauge
+{
+    std::atomic<double> value { 0 };
+    // the most recent value of a gauge wins over all threads
+    std::atomic<quint64> sequence { 0 };
+};
+
+struct Histogram
+{
+    explicit Histogram(const QVector<double> &bounds)
+        : bounds(bounds),
+          buckets(new std::atomic<quint64>[bounds.size() + 1]())
+    {
+    }
+
+    const QVector<double> bounds;
+    // the last bucket holds the values above all bounds
+    std::unique_ptr<std::atomic<quint64>[]> buckets;
+    std::atomic<quint64> count { 0 };
+    std::atomic<double> sum { 0 };
+};
+
+// The metrics recorded by one thread.
+//
+// Only the owning thread updates the metrics, so it can do so with plain
+// atomic loads and stores. It takes the mutex when adding a metric, which is
+// also held while another thread reads the shard.
+struct Shard
+{
+    ~Shard()
+    {
+        qDeleteAll(counters);
+        qDeleteAll(gauges);
+        qDeleteAll(histograms);
+    }
+
+    QMutex mutex;
+    QHash<QString, Counter *> counters;
+    QHash<QString, Gauge *> gauges;
+    QHash<QString, Histogram *> histograms;
+};
+
+template<typename T>
+void add(std::atomic<T> &value, T amount)
+{
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+// Gauges which every stream reports under the same name, e.g.
+// stream-management.unacked.count. The streams overwrite
+// each other's values, so the value would be meaningless for the process.
+static bool isStreamGauge(const QString &name)
+{
+    return name.startsWith(QStringLiteral("stream.")) ||
+        name.startsWith(QStringLiteral("stream-management."));
+}
+
+static QByteArray metricName(const QString &name)
+{
+    QByteArray result = QByteArrayLiteral("qxmpp_");
+    for (const auto c : name.toLatin1()) {
+        const bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+        result += valid ? c : '_';
+    }
+    return result;
+}
+
+static QByteArray formatValue(double value)
+{
+    if (std::isnan(value))
+        return QByteArrayLiteral("NaN");
+    if (std::isinf(value))
+        return value > 0 ? QByteArrayLiteral("+Inf") : QByteArrayLiteral("-Inf");
+    return QByteArray::number(value, 'g', 15);
+}
+
+class QXmppServerMetricsPrivate
+{
+public:
+    QXmppServerMetricsPrivate(QXmppServerMetrics *qq);
+
+    Shard *localShard();
+    QVector<double> bucketsForHistogram(const QString &histogram) const;
+
+    void setGauge(const QString &gauge, double value);
+    void updateCounter(const QString &counter, qint64 amount);
+    void updateHistogram(const QString &histogram, double value);
+
+    void handleHttpConnections();
+    void writeFile();
+
+    const quint64 id;
+
+    QHostAddress address;
+    quint16 port;
+    QString filePath;
+    int fileInterval;
+
+    // guards the list of shards and the histogram buckets
+    mutable QMutex mutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+    QHash<QThread *, Shard *> shardsByThread;
+    QHash<QString, QVector<double>> histogramBuckets;
+    std::atomic<quint64> gaugeSequence;
+
+    QList<QMetaObject::Connection> connections;
+    QTcpServer *httpServer;
+    QTimer *fileTimer;
+
+private:
+    QXmppServerMetrics *q;
+};
+
+QXmppServerMetricsPrivate::QXmppServerMetricsPrivate(QXmppServerMetrics *qq)
+    : id(++lastMetricsId),
+      address(QHostAddress::LocalHost),
+      port(0),
+      fileInterval(10000),
+      gaugeSequence(0),
+      httpServer(nullptr),
+      fileTimer(nullptr),
+      q(qq)
+{
+    // latencies in seconds
+    histogramBuckets.insert(QStringLiteral("stanza.processing-time"),
+                            { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1 });
+    // number of streams
+    histogramBuckets.insert(QStringLiteral("routing.fan-out"),
+                            { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 });
+}
+
+/// Returns the shard of the current thread.
+
+Shard *QXmppServerMetricsPrivate::localShard()
+{
+    // the shard last used by the thread is looked up without locking
+    thread_local quint64 cachedId = 0;
+    thread_local Shard *cachedShard = nullptr;
+    if (cachedId == id)
+        return cachedShard;
+
+    QMutexLocker locker(&mutex);
+    auto &shard = shardsByThread[QThread::currentThread()];
+    if (!shard) {
+        shards.push_back(std::make_unique<Shard>());
+        shard = shards.back().get();
+    }
+    cachedId = id;
+    cachedShard = shard;
+    return shard;
+}
+
+QVector<double> QXmppServerMetricsPrivate::bucketsForHistogram(const QString &histogram) const
+{
+    QMutexLocker locker(&mutex);
+    const auto itr = histogramBuckets.constFind(histogram);
+    if (itr != histogramBuckets.constEnd())
+        return *itr;
+    return { 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+}
+
+void QXmppServerMetricsPrivate::setGauge(const QString &name, double value)
+{
+    if (isStreamGauge(name))
+        return;
+
+    auto *shard = localShard();
+    auto *gauge = shard->gauges.value(name);
+    if (!gauge) {
+        QMutexLocker locker(&shard->mutex);
+        gauge = new Gauge;
+        shard->gauges.insert(name, gauge);
+    }
+    gauge->value.store(value, std::memory_order_relaxed);
+    gauge->sequence.store(++gaugeSequence, std::memory_order_release);
+}
+
+void QXmppServerMetricsPrivate::updateCounter(const QString &name, qint64 amount)
+{
+    auto *shard = localShard();
+    auto *counter = shard->counters.value(name);
+    if (!counter) {
+        QMutexLocker locker(&shard->mutex);
+        counter = new Counter;
+        shard->counters.insert(name, counter);
+    }
+    add(counter->value, amount);
+}
+
+void QXmppServerMetricsPrivate::updateHistogram(const QString &name, double value)
+{
+    auto *shard = localShard();
+    auto *histogram = shard->histograms.value(name);
+    if (!histogram) {
+        const auto bounds = bucketsForHistogram(name);
+        QMutexLocker locker(&shard->mutex);
+        histogram = new Histogram(bounds);
+        shard->histograms.insert(name, histogram);
+    }
+
+    const auto &bounds = histogram->bounds;
+    const auto bucket = std::lower_bound(bounds.cbegin(), bounds.cend(), value) - bounds.cbegin();
+    add(histogram->buckets[bucket], quint64(1));
+    add(histogram->count, quint64(1));
+    add(histogram->sum, value);
+}
+
+void QXmppServerMetricsPrivate::handleHttpConnections()
+{
+    while (auto *socket = httpServer->nextPendingConnection()) {
+        QObject::connect(socket, &QAbstractSocket::disconnected,
+                         socket, &QObject::deleteLater);
+        QObject::connect(socket, &QIODevice::readyRead, socket, [this, socket]() {
+            // answer any request once its headers have been received
+            if (socket->bytesAvailable() > MAX_REQUEST_SIZE) {
+                socket->abort();
+                return;
+            }
+            if (!socket->peek(MAX_REQUEST_SIZE).contains("\r\n\r\n"))
+                return;
+            socket->readAll();
+
+            const auto body = q->openMetricsText();
+            socket->write(QByteArrayLiteral("HTTP/1.0 200 OK\r\n"
+                                            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                            "Content-Length: ") +
+                          QByteArray::number(body.size()) +
+                          QByteArrayLiteral("\r\nConnection: close\r\n\r\n") +
+                          body);
+            socket->disconnectFromHost();
+        });
+    }
+}
+
+void QXmppServerMetricsPrivate::writeFile()
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        q->warning(QStringLiteral("Could not write metrics to %1").arg(filePath));
+        return;
+    }
+    file.write(q->openMetricsText());
+    file.commit();
+}
+
+///
+/// Constructs a new metrics extension.
+///
+/// By default, the metrics are neither served nor written to a file.
+///
+QXmppServerMetrics::QXmppServerMetrics()
+    : d(new QXmppServerMetricsPrivate(this))
+{
+}
+
+QXmppServerMetrics::~QXmppServerMetrics()
+{
+    stop();
+    delete d;
+}
+
+///
+/// Returns the address on which the metrics are served.
+///
+QHostAddress QXmppServerMetrics::address() const
+{
+    return d->address;
+}
+
+///
+/// Sets the \a address on which the metrics are served. The default is the
+/// loopback address.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerMetrics::setAddress(const QHostAddress &address)
+{
+    d->address = address;
+}
+
+///
+/// Returns the TCP port on which the metrics are served, or 0 if they are
+/// not served.
+///
+quint16 QXmppServerMetrics::port() const
+{
+    return d->port;
+}
+
+///
+/// Sets the TCP \a port on which the metrics are served over HTTP. Every
+/// request is answered with the current metrics.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerMetrics::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+///
+/// Returns the path of the file to which the metrics are written, or an
+/// empty string if they are not written to a file.
+///
+QString QXmppServerMetrics::filePath() const
+{
+    return d->filePath;
+}
+
+///
+/// Sets the \a path of the file to which the metrics are written at regular
+/// intervals, and when the extension is stopped.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerMetrics::setFilePath(const QString &path)
+{
+    d->filePath = path;
+}
+
+///
+/// Returns the interval in milliseconds at which the metrics are written to
+/// the file.
+///
+int QXmppServerMetrics::fileInterval() const
+{
+    return d->fileInterval;
+}
+
+///
+/// Sets the interval in milliseconds at which the metrics are written to the
+/// file. The default is 10 seconds.
+///
+void QXmppServerMetrics::setFileInterval(int msecs)
+{
+    d->fileInterval = qMax(1, msecs);
+    if (d->fileTimer)
+        d->fileTimer->setInterval(d->fileInterval);
+}
+
+///
+/// Returns the upper bounds of the buckets of the given \a histogram.
+///
+QVector<double> QXmppServerMetrics::histogramBuckets(const QString &histogram) const
+{
+    return d->bucketsForHistogram(histogram);
+}
+
+///
+/// Sets the upper \a bounds of the buckets of the given \a histogram.
+///
+/// The server reports the stanza.processing-time histogram in seconds and
+/// the routing.fan-out histogram in number of streams, which have suitable
+/// buckets by default.
+///
+/// This must be set before the histogram is first updated.
+///
+void QXmppServerMetrics::setHistogramBuckets(const QString &histogram, const QVector<double> &bounds)
+{
+    auto sorted = bounds;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    QMutexLocker locker(&d->mutex);
+    d->histogramBuckets.insert(histogram, sorted);
+}
+
+///
+/// Returns the current metrics in the OpenMetrics text format.
+///
+/// The metrics recorded by all threads are merged: counters and histograms
+/// are added up, while the most recently set value of a gauge wins. Names are
+/// prefixed with "qxmpp_" and characters which are not allowed are replaced
+/// by underscores.
+///
+/// Only process-wide gauges, such as incoming-client.count or
+/// muc.room.count, are exported. Gauges which each stream reports for itself
+/// (those starting with "stream." or "stream-management.") are left out, as
+/// there is no single value for them.
+///
+/// This method is thread-safe.
+///
+QByteArray QXmppServerMetrics::openMetricsText() const
+{
+    struct HistogramData
+    {
+        QVector<double> bounds;
+        QVector<quint64> buckets;
+        quint64 count = 0;
+        double sum = 0;
+    };
+
+    QMap<QString, std::pair<quint64, double>> gauges;
+    QMap<QString, qint64> counters;
+    QMap<QString, HistogramData> histograms;
+
+    // merge the shards
+    {
+        QMutexLocker locker(&d->mutex);
+        for (const auto &shard : d->shards) {
+            QMutexLocker shardLocker(&shard->mutex);
+            for (auto itr = shard->gauges.cbegin(); itr != shard->gauges.cend(); ++itr) {
+                const auto sequence = itr.value()->sequence.load(std::memory_order_acquire);
+                auto &gauge = gauges[itr.key()];
+                if (sequence > gauge.first)
+                    gauge = { sequence, itr.value()->value.load(std::memory_order_relaxed) };
+            }
+            for (auto itr = shard->counters.cbegin(); itr != shard->counters.cend(); ++itr)
+                counters[itr.key()] += itr.value()->value.load(std::memory_order_relaxed);
+            for (auto itr = shard->histograms.cbegin(); itr != shard->histograms.cend(); ++itr) {
+                const auto *histogram = itr.value();
+                auto &data = histograms[itr.key()];
+                if (data.bounds.isEmpty()) {
+                    data.bounds = histogram->bounds;
+                    data.buckets.fill(0, histogram->bounds.size() + 1);
+                } else if (data.bounds != histogram->bounds) {
+                    // the buckets were changed after the histogram was used
+                    continue;
+                }
+                for (int i = 0; i < data.buckets.size(); i++)
+                    data.buckets[i] += histogram->buckets[i].load(std::memory_order_relaxed);
+                data.count += histogram->count.load(std::memory_order_relaxed);
+                data.sum += histogram->sum.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    QByteArray text;
+    for (auto itr = gauges.cbegin(); itr != gauges.cend(); ++itr) {
+        const auto name = metricName(itr.key());
+        text += "# TYPE " + name + " gauge\n";
+        text += name + ' ' + formatValue(itr.value().second) + '\n';
+    }
+    for (auto itr = counters.cbegin(); itr != counters.cend(); ++itr) {
+        const auto name = metricName(itr.key());
+        text += "# TYPE " + name + " counter\n";
+        text += name + "_total " + QByteArray::number(itr.value()) + '\n';
+    }
+    for (auto itr = histograms.cbegin(); itr != histograms.cend(); ++itr) {
+        const auto name = metricName(itr.key());
+        const auto &data = itr.value();
+        text += "# TYPE " + name + " histogram\n";
+
+        // buckets are cumulative
+        quint64 count = 0;
+        for (int i = 0; i < data.bounds.size(); i++) {
+            count += data.buckets.at(i);
+            text += name + "_bucket{le=\"" + formatValue(data.bounds.at(i)) + "\"} " + QByteArray::number(count) + '\n';
+        }
+        text += name + "_bucket{le=\"+Inf\"} " + QByteArray::number(data.count) + '\n';
+        text += name + "_sum " + formatValue(data.sum) + '\n';
+        text += name + "_count " + QByteArray::number(data.count) + '\n';
+    }
+    text += "# EOF\n";
+    return text;
+}
+
+///
+/// Starts recording the server's metrics, and serving them or writing them
+/// to a file if configured.
+///
+bool QXmppServerMetrics::start()
+{
+    auto *server = this->server();
+    if (!server)
+        return false;
+
+    // the metrics are recorded in the thread which reports them
+    d->connections << connect(
+        server, &QXmppLoggable::setGauge, this,
+        [this](const QString &gauge, double value) { d->setGauge(gauge, value); },
+        Qt::DirectConnection);
+    d->connections << connect(
+        server, &QXmppLoggable::updateCounter, this,
+        [this](const QString &counter, qint64 amount) { d->updateCounter(counter, amount); },
+        Qt::DirectConnection);
+    d->connections << connect(
+        server, &QXmppLoggable::updateHistogram, this,
+        [this](const QString &histogram, double value) { d->updateHistogram(histogram, value); },
+        Qt::DirectConnection);
+
+    if (d->port) {
+        d->httpServer = new QTcpServer(this);
+        connect(d->httpServer, &QTcpServer::newConnection, this, [this]() {
+            d->handleHttpConnections();
+        });
+        if (!d->httpServer->listen(d->address, d->port)) {
+            warning(QStringLiteral("Could not serve metrics on %1 %2").arg(d->address.toString(), QString::number(d->port)));
+            stop();
+            return false;
+        }
+    }
+
+    if (!d->filePath.isEmpty()) {
+        d->fileTimer = new QTimer(this);
+        d->fileTimer->setInterval(d->fileInterval);
+        connect(d->fileTimer, &QTimer::timeout, this, [this]() {
+            d->writeFile();
+        });
+        d->fileTimer->start();
+    }
+    return true;
+}
+
+///
+/// Stops recording the server's metrics. The metrics are written to the
+/// file a last time.
+///
+void QXmppServerMetrics::stop()
+{
+    for (const auto &connection : std::as_const(d->connections))
+        disconnect(connection);
+    d->connections.clear();
+
+    delete d->httpServer;
+    d->httpServer = nullptr;
+
+    if (d->fileTimer) {
+        delete d->fileTimer;
+        d->fileTimer = nullptr;
+        d->writeFile();
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERMETRICS_H
+#define QXMPPSERVERMETRICS_H
+
+#include "QXmppServerExtension.h"
+
+#include <QHostAddress>
+#include <QVector>
+
+class QXmppServerMetricsPrivate;
+
+///
+/// \brief The QXmppServerMetrics class collects the gauges, counters and
+/// histograms reported by a QXmppServer and exports them in the OpenMetrics
+/// text format.
+///
+/// The metrics are recorded in the thread which reports them, without
+/// locking. They can be scraped over HTTP on a local TCP port, written to a
+/// file at regular intervals, or retrieved using openMetricsText().
+///
+/// \ingroup Core
+///
+/// \since QXmpp 1.5
+///
+class QXMPP_EXPORT QXmppServerMetrics : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "metrics")
+
+public:
+    QXmppServerMetrics();
+    ~QXmppServerMetrics() override;
+
+    QHostAddress address() const;
+    void setAddress(const QHostAddress &address);
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    QString filePath() const;
+    void setFilePath(const QString &path);
+    int fileInterval() const;
+    void setFileInterval(int msecs);
+
+    QVector<double> histogramBuckets(const QString &histogram) const;
+    void setHistogramBuckets(const QString &histogram, const QVector<double> &bounds);
+
+    QByteArray openMetricsText() const;
+
+    bool start() override;
+    void stop() override;
+
+private:
+    friend class QXmppServerMetricsPrivate;
+    QXmppServerMetricsPrivate *const d;
+};
+
+#endif
@@ -0,0 +1,897 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServerMuc.h"
+
+#include "QXmppConstants_p.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppMessage.h"
+#include "QXmppMucIq.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+#include <limits>
+
+#include <QDateTime>
+#include <QDomElement>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QTimer>
+#include <QXmlStreamWriter>
+
+// pending presences are sent before the batch interval elapsed once they
+// reach this size
+static const int MAX_PRESENCE_BATCH_SIZE = 64 * 1024;
+
+namespace {
+
+struct Occupant
+{
+    QString jid;
+    QString nick;
+    QXmppMucItem::Affiliation affiliation;
+    QXmppMucItem::Role role;
+
+    // the occupant's presence as sent to the other occupants
+    QByteArray presence;
+
+    // the pending presences of the room which were queued before the
+    // occupant joined, and which it already knows from the join
+    quint64 batch;
+    int batchOffset;
+};
+
+struct Room
+{
+    QString jid;
+    QString ownerJid;
+
+    // the occupants are stored contiguously, the last one takes the place
+    // of an occupant which leaves
+    QVector<Occupant> occupants;
+    QHash<QString, int> occupantsByNick;
+    QHash<QString, int> occupantsByJid;
+
+    // the JIDs of the occupants, rebuilt when an occupant joins or leaves
+    QStringList recipients;
+    bool recipientsValid = false;
+
+    // ring buffer of the last messages, with their delay
+    QVector<QByteArray> history;
+    int historyStart = 0;
+    QByteArray subject;
+
+    QByteArray pendingPresences;
+    quint64 batch = 0;
+};
+
+}  // namespace
+
+static QByteArray serialize(const QXmppStanza &stanza)
+{
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    stanza.toXml(&writer);
+    return data;
+}
+
+// Returns the subject message which is sent to new occupants of a room
+// without a subject.
+static QByteArray emptySubject(const QString &roomJid)
+{
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    writer.writeStartElement(QStringLiteral("message"));
+    writer.writeAttribute(QStringLiteral("from"), roomJid);
+    writer.writeAttribute(QStringLiteral("type"), QStringLiteral("groupchat"));
+    writer.writeEmptyElement(QStringLiteral("subject"));
+    writer.writeEndElement();
+    return data;
+}
+
+// Returns the number of history messages requested in a join presence.
+static int requestedHistory(const QDomElement &stanza)
+{
+    for (auto x = stanza.firstChildElement(QStringLiteral("x")); !x.isNull(); x = x.nextSiblingElement(QStringLiteral("x"))) {
+        if (x.namespaceURI() != ns_muc)
+            continue;
+
+        const auto history = x.firstChildElement(QStringLiteral("history"));
+        if (history.attribute(QStringLiteral("maxchars")) == QStringLiteral("0"))
+            return 0;
+
+        bool ok = false;
+        const int maxStanzas = history.attribute(QStringLiteral("maxstanzas")).toInt(&ok);
+        if (ok)
+            return qMax(0, maxStanzas);
+        break;
+    }
+    return std::numeric_limits<int>::max();
+}
+
+class QXmppServerMucPrivate
+{
+public:
+    QXmppServerMucPrivate(QXmppServerMuc *qq);
+
+    void handlePresence(const QDomElement &stanza);
+    void handleMessage(const QDomElement &stanza);
+    void handleIq(const QDomElement &stanza);
+    void handleDiscovery(const QDomElement &stanza);
+    void handleAdmin(const QDomElement &stanza);
+    void sendError(const QDomElement &stanza, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition);
+
+    void join(const QDomElement &stanza, const QString &roomJid, const QString &nick);
+    void updatePresence(Room *room, Occupant &occupant, const QDomElement &stanza);
+    void removeOccupant(Room *room, int index, QXmppPresence presence, const QList<int> &statusCodes);
+    QXmppPresence occupantPresence(const Room *room, const Occupant &occupant, QXmppPresence presence) const;
+
+    const QStringList &recipients(Room *room) const;
+    void appendHistory(Room *room, const QByteArray &message);
+    void queuePresence(Room *room, const QByteArray &presence);
+    void flushPresences(Room *room);
+    void flushAllPresences();
+
+    void clientDisconnected(const QString &jid);
+
+    QString jid;
+    int historySize;
+    int presenceBatchInterval;
+    int presenceBatchThreshold;
+    bool started;
+
+    QHash<QString, Room *> rooms;
+    // the rooms joined by each real JID
+    QHash<QString, QSet<QString>> occupantRooms;
+    QSet<QString> pendingRooms;
+
+    QList<QMetaObject::Connection> connections;
+    QTimer *batchTimer;
+
+private:
+    QXmppServerMuc *q;
+};
+
+QXmppServerMucPrivate::QXmppServerMucPrivate(QXmppServerMuc *qq)
+    : historySize(20),
+      presenceBatchInterval(100),
+      presenceBatchThreshold(100),
+      started(false),
+      batchTimer(nullptr),
+      q(qq)
+{
+}
+
+void QXmppServerMucPrivate::handlePresence(const QDomElement &stanza)
+{
+    const auto from = stanza.attribute(QStringLiteral("from"));
+    const auto to = stanza.attribute(QStringLiteral("to"));
+    const auto roomJid = QXmppUtils::jidToBareJid(to);
+    const auto nick = QXmppUtils::jidToResource(to);
+    const auto type = stanza.attribute(QStringLiteral("type"));
+
+    auto *room = rooms.value(roomJid);
+    const int index = room ? room->occupantsByJid.value(from, -1) : -1;
+
+    if (type == QStringLiteral("unavailable")) {
+        if (index >= 0) {
+            QXmppPresence presence;
+            presence.parse(stanza);
+            presence.setMucItem(QXmppMucItem());
+            removeOccupant(room, index, presence, {});
+        }
+        return;
+    }
+
+    // errors, subscriptions and probes are ignored
+    if (!type.isEmpty())
+        return;
+
+    if (QXmppUtils::jidToUser(roomJid).isEmpty() || nick.isEmpty()) {
+        sendError(stanza, QXmppStanza::Error::Modify, QXmppStanza::Error::JidMalformed);
+        return;
+    }
+
+    if (index >= 0) {
+        auto &occupant = room->occupants[index];
+        if (occupant.nick == nick)
+            updatePresence(room, occupant, stanza);
+        else
+            sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::NotAcceptable);
+        return;
+    }
+
+    // the room's broadcasts only reach clients of the server
+    if (QXmppUtils::jidToDomain(from) != q->server()->domain()) {
+        sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::NotAllowed);
+        return;
+    }
+    if (room && room->occupantsByNick.contains(nick)) {
+        sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::Conflict);
+        return;
+    }
+
+    join(stanza, roomJid, nick);
+}
+
+void QXmppServerMucPrivate::handleMessage(const QDomElement &stanza)
+{
+    const auto type = stanza.attribute(QStringLiteral("type"));
+    if (type == QStringLiteral("error"))
+        return;
+
+    const auto from = stanza.attribute(QStringLiteral("from"));
+    const auto to = stanza.attribute(QStringLiteral("to"));
+    const auto nick = QXmppUtils::jidToResource(to);
+
+    auto *room = rooms.value(QXmppUtils::jidToBareJid(to));
+    if (!room) {
+        sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        return;
+    }
+
+    const int senderIndex = room->occupantsByJid.value(from, -1);
+    if (senderIndex < 0) {
+        sendError(stanza, QXmppStanza::Error::Modify, QXmppStanza::Error::NotAcceptable);
+        return;
+    }
+    const auto &sender = room->occupants.at(senderIndex);
+
+    QXmppMessage message;
+    message.parse(stanza);
+    message.setFrom(room->jid + QLatin1Char('/') + sender.nick);
+
+    if (!nick.isEmpty()) {
+        // private message
+        const int recipientIndex = room->occupantsByNick.value(nick, -1);
+        if (type == QStringLiteral("groupchat")) {
+            sendError(stanza, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+        } else if (recipientIndex < 0) {
+            sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        } else {
+            message.setTo(room->occupants.at(recipientIndex).jid);
+            q->server()->sendPacket(message);
+        }
+        return;
+    }
+
+    if (type != QStringLiteral("groupchat")) {
+        sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented);
+        return;
+    }
+
+    const bool isSubject = !stanza.firstChildElement(QStringLiteral("subject")).isNull() &&
+        stanza.firstChildElement(QStringLiteral("body")).isNull();
+    if (isSubject && sender.role != QXmppMucItem::ModeratorRole) {
+        sendError(stanza, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+        return;
+    }
+
+    // the message has no recipient, so the same data is sent to all
+    // occupants, after the presences which were queued before it
+    message.setTo(QString());
+    const auto data = serialize(message);
+    flushPresences(room);
+    q->server()->broadcastData(recipients(room), data);
+
+    if (isSubject) {
+        room->subject = data;
+    } else if (!message.body().isEmpty() && historySize > 0) {
+        message.setStamp(QDateTime::currentDateTimeUtc());
+        appendHistory(room, serialize(message));
+    }
+}
+
+void QXmppServerMucPrivate::handleIq(const QDomElement &stanza)
+{
+    const auto type = stanza.attribute(QStringLiteral("type"));
+    if (type == QStringLiteral("result") || type == QStringLiteral("error"))
+        return;
+
+    // requests to occupants are not forwarded
+    const auto to = stanza.attribute(QStringLiteral("to"));
+    if (QXmppUtils::jidToResource(to).isEmpty()) {
+        if (type == QStringLiteral("get") && QXmppDiscoveryIq::isDiscoveryIq(stanza)) {
+            handleDiscovery(stanza);
+            return;
+        }
+        if (type == QStringLiteral("set") && QXmppMucAdminIq::isMucAdminIq(stanza)) {
+            handleAdmin(stanza);
+            return;
+        }
+    }
+
+    sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented);
+}
+
+void QXmppServerMucPrivate::handleDiscovery(const QDomElement &stanza)
+{
+    QXmppDiscoveryIq request;
+    request.parse(stanza);
+
+    const Room *room = nullptr;
+    if (request.to() != jid) {
+        room = rooms.value(request.to());
+        if (!room) {
+            sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return;
+        }
+    }
+
+    QXmppDiscoveryIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(request.id());
+    response.setFrom(request.to());
+    response.setTo(request.from());
+    response.setQueryType(request.queryType());
+
+    if (request.queryType() == QXmppDiscoveryIq::InfoQuery) {
+        QXmppDiscoveryIq::Identity identity;
+        identity.setCategory(QStringLiteral("conference"));
+        identity.setType(QStringLiteral("text"));
+        identity.setName(room ? QXmppUtils::jidToUser(room->jid) : QStringLiteral("Chatrooms"));
+        response.setIdentities({ identity });
+
+        if (room) {
+            response.setFeatures({ ns_muc,
+                                   QStringLiteral("muc_nonanonymous"),
+                                   QStringLiteral("muc_open"),
+                                   QStringLiteral("muc_public"),
+                                   QStringLiteral("muc_temporary"),
+                                   QStringLiteral("muc_unmoderated"),
+                                   QStringLiteral("muc_unsecured") });
+        } else {
+            response.setFeatures({ ns_disco_info, ns_disco_items, ns_muc });
+        }
+    } else if (!room) {
+        QList<QXmppDiscoveryIq::Item> items;
+        for (const auto *other : std::as_const(rooms)) {
+            QXmppDiscoveryIq::Item item;
+            item.setJid(other->jid);
+            item.setName(QXmppUtils::jidToUser(other->jid));
+            items << item;
+        }
+        response.setItems(items);
+    }
+
+    q->server()->sendPacket(response);
+}
+
+/// Handles an admin request, of which only kicking an occupant is
+/// supported.
+
+void QXmppServerMucPrivate::handleAdmin(const QDomElement &stanza)
+{
+    QXmppMucAdminIq request;
+    request.parse(stanza);
+
+    auto *room = rooms.value(request.to());
+    if (!room) {
+        sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        return;
+    }
+
+    const int actorIndex = room->occupantsByJid.value(request.from(), -1);
+    if (actorIndex < 0 || room->occupants.at(actorIndex).role != QXmppMucItem::ModeratorRole) {
+        sendError(stanza, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+        return;
+    }
+
+    const auto items = request.items();
+    if (items.size() != 1 || items.first().role() != QXmppMucItem::NoRole || items.first().nick().isEmpty()) {
+        sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented);
+        return;
+    }
+
+    const auto &item = items.first();
+    const int index = room->occupantsByNick.value(item.nick(), -1);
+    if (index < 0) {
+        sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        return;
+    }
+    if (room->occupants.at(index).affiliation == QXmppMucItem::OwnerAffiliation) {
+        sendError(stanza, QXmppStanza::Error::Cancel, QXmppStanza::Error::NotAllowed);
+        return;
+    }
+
+    QXmppMucItem kickItem;
+    kickItem.setActor(request.from());
+    kickItem.setReason(item.reason());
+    QXmppPresence presence(QXmppPresence::Unavailable);
+    presence.setMucItem(kickItem);
+    removeOccupant(room, index, presence, { 307 });
+
+    QXmppIq response(QXmppIq::Result);
+    response.setId(request.id());
+    response.setFrom(request.to());
+    response.setTo(request.from());
+    q->server()->sendPacket(response);
+}
+
+void QXmppServerMucPrivate::sendError(const QDomElement &stanza, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition)
+{
+    const auto reply = [&](QXmppStanza &response) {
+        response.setId(stanza.attribute(QStringLiteral("id")));
+        response.setFrom(stanza.attribute(QStringLiteral("to")));
+        response.setTo(stanza.attribute(QStringLiteral("from")));
+        response.setError(QXmppStanza::Error(type, condition));
+        q->server()->sendPacket(response);
+    };
+
+    const auto tagName = stanza.tagName();
+    if (tagName == QStringLiteral("presence")) {
+        QXmppPresence response(QXmppPresence::Error);
+        reply(response);
+    } else if (tagName == QStringLiteral("message")) {
+        QXmppMessage response;
+        response.setType(QXmppMessage::Error);
+        reply(response);
+    } else {
+        QXmppIq response(QXmppIq::Error);
+        reply(response);
+    }
+}
+
+/// Adds an occupant to a room, creating the room if needed.
+///
+/// The new occupant gets the presences of the other occupants, its own
+/// presence, the history and the subject in one go.
+
+void QXmppServerMucPrivate::join(const QDomElement &stanza, const QString &roomJid, const QString &nick)
+{
+    QXmppPresence presence;
+    presence.parse(stanza);
+
+    auto *room = rooms.value(roomJid);
+    const bool created = !room;
+    if (created) {
+        room = new Room;
+        room->jid = roomJid;
+        room->ownerJid = QXmppUtils::jidToBareJid(presence.from());
+        rooms.insert(roomJid, room);
+        q->setGauge(QStringLiteral("muc.room.count"), rooms.size());
+    }
+
+    Occupant occupant;
+    occupant.jid = presence.from();
+    occupant.nick = nick;
+    if (QXmppUtils::jidToBareJid(occupant.jid) == room->ownerJid) {
+        occupant.affiliation = QXmppMucItem::OwnerAffiliation;
+        occupant.role = QXmppMucItem::ModeratorRole;
+    } else {
+        occupant.affiliation = QXmppMucItem::NoAffiliation;
+        occupant.role = QXmppMucItem::ParticipantRole;
+    }
+
+    const auto broadcast = occupantPresence(room, occupant, presence);
+    occupant.presence = serialize(broadcast);
+
+    QByteArray data;
+    for (const auto &other : std::as_const(room->occupants))
+        data += other.presence;
+
+    auto self = broadcast;
+    self.setId(presence.id());
+    self.setMucStatusCodes(created ? QList<int> { 100, 110, 201 } : QList<int> { 100, 110 });
+    data += serialize(self);
+
+    const int historyCount = room->history.size();
+    for (int i = historyCount - qMin(historyCount, requestedHistory(stanza)); i < historyCount; ++i)
+        data += room->history.at((room->historyStart + i) % historyCount);
+
+    data += room->subject.isEmpty() ? emptySubject(room->jid) : room->subject;
+    q->server()->broadcastData({ occupant.jid }, data);
+
+    // the other occupants are told before the new occupant is added
+    queuePresence(room, occupant.presence);
+    occupant.batch = room->batch;
+    occupant.batchOffset = room->pendingPresences.size();
+
+    const int index = room->occupants.size();
+    room->occupantsByNick.insert(occupant.nick, index);
+    room->occupantsByJid.insert(occupant.jid, index);
+    occupantRooms[occupant.jid].insert(room->jid);
+    room->occupants.append(std::move(occupant));
+    room->recipientsValid = false;
+}
+
+void QXmppServerMucPrivate::updatePresence(Room *room, Occupant &occupant, const QDomElement &stanza)
+{
+    QXmppPresence presence;
+    presence.parse(stanza);
+    occupant.presence = serialize(occupantPresence(room, occupant, presence));
+    queuePresence(room, occupant.presence);
+}
+
+/// Removes an occupant from a room, and destroys the room once it is empty.
+///
+/// The occupant gets the unavailable \a presence with the \a statusCodes
+/// right away, the remaining occupants get it with the room's presences.
+
+void QXmppServerMucPrivate::removeOccupant(Room *room, int index, QXmppPresence presence, const QList<int> &statusCodes)
+{
+    const auto occupant = room->occupants.at(index);
+
+    auto item = presence.mucItem();
+    item.setAffiliation(occupant.affiliation);
+    item.setRole(QXmppMucItem::NoRole);
+    item.setJid(occupant.jid);
+    presence.setType(QXmppPresence::Unavailable);
+    presence.setFrom(room->jid + QLatin1Char('/') + occupant.nick);
+    presence.setTo(QString());
+    presence.setMucItem(item);
+    presence.setMucSupported(false);
+    presence.setMucPassword(QString());
+
+    auto self = presence;
+    self.setMucStatusCodes(statusCodes + QList<int> { 110 });
+    q->server()->broadcastPacket({ occupant.jid }, self);
+
+    room->occupantsByNick.remove(occupant.nick);
+    room->occupantsByJid.remove(occupant.jid);
+    const int last = room->occupants.size() - 1;
+    if (index != last) {
+        room->occupants[index] = std::move(room->occupants[last]);
+        const auto &moved = room->occupants.at(index);
+        room->occupantsByNick.insert(moved.nick, index);
+        room->occupantsByJid.insert(moved.jid, index);
+    }
+    room->occupants.removeLast();
+    room->recipientsValid = false;
+
+    auto itr = occupantRooms.find(occupant.jid);
+    if (itr != occupantRooms.end()) {
+        itr->remove(room->jid);
+        if (itr->isEmpty())
+            occupantRooms.erase(itr);
+    }
+
+    if (room->occupants.isEmpty()) {
+        pendingRooms.remove(room->jid);
+        rooms.remove(room->jid);
+        delete room;
+        q->setGauge(QStringLiteral("muc.room.count"), rooms.size());
+        return;
+    }
+
+    presence.setMucStatusCodes(statusCodes);
+    queuePresence(room, serialize(presence));
+}
+
+/// Returns the presence of an occupant as it is sent to the other occupants,
+/// based on the presence the occupant sent to the room.
+
+QXmppPresence QXmppServerMucPrivate::occupantPresence(const Room *room, const Occupant &occupant, QXmppPresence presence) const
+{
+    QXmppMucItem item;
+    item.setAffiliation(occupant.affiliation);
+    item.setRole(occupant.role);
+    item.setJid(occupant.jid);
+
+    presence.setId(QString());
+    presence.setFrom(room->jid + QLatin1Char('/') + occupant.nick);
+    presence.setTo(QString());
+    presence.setMucItem(item);
+    presence.setMucStatusCodes({});
+    presence.setMucSupported(false);
+    presence.setMucPassword(QString());
+    return presence;
+}
+
+const QStringList &QXmppServerMucPrivate::recipients(Room *room) const
+{
+    if (!room->recipientsValid) {
+        room->recipients.clear();
+        room->recipients.reserve(room->occupants.size());
+        for (const auto &occupant : std::as_const(room->occupants))
+            room->recipients << occupant.jid;
+        room->recipientsValid = true;
+    }
+    return room->recipients;
+}
+
+void QXmppServerMucPrivate::appendHistory(Room *room, const QByteArray &message)
+{
+    if (room->history.size() < historySize) {
+        room->history.append(message);
+    } else if (!room->history.isEmpty()) {
+        room->history[room->historyStart] = message;
+        room->historyStart = (room->historyStart + 1) % room->history.size();
+    }
+}
+
+/// Sends a presence to the occupants of a room. The presences of large rooms
+/// are collected and sent together.
+
+void QXmppServerMucPrivate::queuePresence(Room *room, const QByteArray &presence)
+{
+    if (room->occupants.isEmpty())
+        return;
+
+    if (presenceBatchInterval <= 0 || room->occupants.size() < presenceBatchThreshold) {
+        flushPresences(room);
+        q->server()->broadcastData(recipients(room), presence);
+        return;
+    }
+
+    room->pendingPresences += presence;
+    if (room->pendingPresences.size() >= MAX_PRESENCE_BATCH_SIZE) {
+        flushPresences(room);
+    } else {
+        pendingRooms.insert(room->jid);
+        if (!batchTimer->isActive())
+            batchTimer->start();
+    }
+}
+
+/// Sends the pending presences of a room.
+///
+/// Occupants which joined after the batch was started only get the part
+/// which was queued after they joined.
+
+void QXmppServerMucPrivate::flushPresences(Room *room)
+{
+    if (room->pendingPresences.isEmpty())
+        return;
+
+    QStringList recipients;
+    QMap<int, QStringList> lateRecipients;
+    for (const auto &occupant : std::as_const(room->occupants)) {
+        if (occupant.batch == room->batch && occupant.batchOffset > 0)
+            lateRecipients[occupant.batchOffset] << occupant.jid;
+        else
+            recipients << occupant.jid;
+    }
+
+    auto *server = q->server();
+    server->broadcastData(recipients, room->pendingPresences);
+    for (auto itr = lateRecipients.cbegin(); itr != lateRecipients.cend(); ++itr) {
+        if (itr.key() < room->pendingPresences.size())
+            server->broadcastData(itr.value(), room->pendingPresences.mid(itr.key()));
+    }
+
+    room->pendingPresences.clear();
+    room->batch++;
+    pendingRooms.remove(room->jid);
+}
+
+void QXmppServerMucPrivate::flushAllPresences()
+{
+    const auto roomJids = pendingRooms;
+    for (const auto &roomJid : roomJids) {
+        if (auto *room = rooms.value(roomJid))
+            flushPresences(room);
+    }
+    pendingRooms.clear();
+}
+
+void QXmppServerMucPrivate::clientDisconnected(const QString &jid)
+{
+    const auto roomJids = occupantRooms.value(jid);
+    for (const auto &roomJid : roomJids) {
+        auto *room = rooms.value(roomJid);
+        const int index = room ? room->occupantsByJid.value(jid, -1) : -1;
+        if (index >= 0)
+            removeOccupant(room, index, QXmppPresence(QXmppPresence::Unavailable), {});
+    }
+}
+
+///
+/// Constructs a new multi-user chat service.
+///
+QXmppServerMuc::QXmppServerMuc()
+    : d(new QXmppServerMucPrivate(this))
+{
+}
+
+QXmppServerMuc::~QXmppServerMuc()
+{
+    stop();
+    delete d;
+}
+
+///
+/// Returns the JID of the service.
+///
+QString QXmppServerMuc::jid() const
+{
+    return d->jid;
+}
+
+///
+/// Sets the \a jid of the service, which must be a subdomain of the
+/// server's domain. If no JID is set, "conference." followed by the
+/// server's domain is used once the service is started.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerMuc::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+///
+/// Returns the number of messages which each room keeps for new occupants.
+///
+int QXmppServerMuc::historySize() const
+{
+    return d->historySize;
+}
+
+///
+/// Sets the number of messages which each room keeps for new occupants. The
+/// default is 20, 0 disables the history.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerMuc::setHistorySize(int count)
+{
+    d->historySize = qMax(0, count);
+}
+
+///
+/// Returns the interval in milliseconds during which the presences of large
+/// rooms are collected.
+///
+int QXmppServerMuc::presenceBatchInterval() const
+{
+    return d->presenceBatchInterval;
+}
+
+///
+/// Sets the interval in milliseconds during which the presences of large
+/// rooms are collected before they are sent together. The default is 100
+/// milliseconds, 0 sends every presence right away.
+///
+void QXmppServerMuc::setPresenceBatchInterval(int msecs)
+{
+    d->presenceBatchInterval = qMax(0, msecs);
+    if (d->batchTimer)
+        d->batchTimer->setInterval(d->presenceBatchInterval);
+}
+
+///
+/// Returns the number of occupants from which the presences of a room are
+/// sent in batches.
+///
+int QXmppServerMuc::presenceBatchThreshold() const
+{
+    return d->presenceBatchThreshold;
+}
+
+///
+/// Sets the number of \a occupants from which the presences of a room are
+/// sent in batches. The default is 100.
+///
+void QXmppServerMuc::setPresenceBatchThreshold(int occupants)
+{
+    d->presenceBatchThreshold = qMax(1, occupants);
+}
+
+///
+/// Returns the JIDs of the rooms.
+///
+/// This must be called from the server's thread.
+///
+QStringList QXmppServerMuc::rooms() const
+{
+    auto roomJids = d->rooms.keys();
+    roomJids.sort();
+    return roomJids;
+}
+
+///
+/// Returns the nicknames of the occupants of the room with the given JID.
+///
+/// This must be called from the server's thread.
+///
+QStringList QXmppServerMuc::occupants(const QString &roomJid) const
+{
+    QStringList nicks;
+    if (const auto *room = d->rooms.value(roomJid)) {
+        for (const auto &occupant : std::as_const(room->occupants))
+            nicks << occupant.nick;
+        nicks.sort();
+    }
+    return nicks;
+}
+
+QStringList QXmppServerMuc::discoveryItems() const
+{
+    return d->started ? QStringList { d->jid } : QStringList();
+}
+
+QVector<QXmppServerExtension::HandledStanza> QXmppServerMuc::handledStanzas() const
+{
+    return {
+        { QStringLiteral("iq"), QString() },
+        { QStringLiteral("message"), QString() },
+        { QStringLiteral("presence"), QString() },
+    };
+}
+
+///
+/// Handles the stanzas addressed to the service, its rooms and their
+/// occupants.
+///
+bool QXmppServerMuc::handleStanza(const QDomElement &stanza)
+{
+    if (!d->started || QXmppUtils::jidToDomain(stanza.attribute(QStringLiteral("to"))) != d->jid)
+        return false;
+
+    const auto tagName = stanza.tagName();
+    if (tagName == QStringLiteral("presence"))
+        d->handlePresence(stanza);
+    else if (tagName == QStringLiteral("message"))
+        d->handleMessage(stanza);
+    else if (tagName == QStringLiteral("iq"))
+        d->handleIq(stanza);
+    return true;
+}
+
+///
+/// Starts the service.
+///
+bool QXmppServerMuc::start()
+{
+    auto *server = this->server();
+    if (!server)
+        return false;
+
+    if (d->jid.isEmpty())
+        d->jid = QStringLiteral("conference.") + server->domain();
+
+    // occupants which disconnect leave their rooms
+    d->connections << connect(server, &QXmppServer::clientDisconnected, this, [this](const QString &jid) {
+        d->clientDisconnected(jid);
+    });
+
+    d->batchTimer = new QTimer(this);
+    d->batchTimer->setSingleShot(true);
+    d->batchTimer->setInterval(d->presenceBatchInterval);
+    connect(d->batchTimer, &QTimer::timeout, this, [this]() {
+        d->flushAllPresences();
+    });
+
+    d->started = true;
+    return true;
+}
+
+///
+/// Stops the service and destroys its rooms.
+///
+void QXmppServerMuc::stop()
+{
+    d->started = false;
+
+    for (const auto &connection : std::as_const(d->connections))
+        disconnect(connection);
+    d->connections.clear();
+
+    delete d->batchTimer;
+    d->batchTimer = nullptr;
+
+    qDeleteAll(d->rooms);
+    d->rooms.clear();
+    d->occupantRooms.clear();
+    d->pendingRooms.clear();
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERMUC_H
+#define QXMPPSERVERMUC_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerMucPrivate;
+
+///
+/// \brief The QXmppServerMuc class provides a \xep{0045}: Multi-User Chat
+/// service which is meant for rooms with many occupants.
+///
+/// Rooms are created when the first occupant joins, who becomes the room's
+/// owner, and they are destroyed when the last occupant leaves. The rooms
+/// are open, non-anonymous and not persistent.
+///
+/// A message to a room is serialized once and the same data is handed to the
+/// server for all local occupants. The presences of the occupants of large
+/// rooms are collected for a short interval and sent in batches. Each room
+/// keeps the last messages in a ring buffer, which is sent to new occupants.
+///
+/// Moderators can kick occupants. Room configuration, nickname changes and
+/// the other administrative requests are not supported.
+///
+/// \ingroup Core
+///
+/// \since QXmpp 1.5
+///
+class QXMPP_EXPORT QXmppServerMuc : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "muc")
+
+public:
+    QXmppServerMuc();
+    ~QXmppServerMuc() override;
+
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    int historySize() const;
+    void setHistorySize(int count);
+
+    int presenceBatchInterval() const;
+    void setPresenceBatchInterval(int msecs);
+
+    int presenceBatchThreshold() const;
+    void setPresenceBatchThreshold(int occupants);
+
+    QStringList rooms() const;
+    QStringList occupants(const QString &roomJid) const;
+
+    QStringList discoveryItems() const override;
+    QVector<HandledStanza> handledStanzas() const override;
+    bool handleStanza(const QDomElement &stanza) override;
+
+    bool start() override;
+    void stop() override;
+
+private:
+    friend class QXmppServerMucPrivate;
+    QXmppServerMucPrivate *const d;
+};
+
+#endif
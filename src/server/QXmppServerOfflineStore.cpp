@@ -0,0 +1,742 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServerOfflineStore.h"
+
+#include "QXmppFutureUtils_p.h"
+#include "QXmppMessage.h"
+#include "QXmppPasswordChecker.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDomElement>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <QTimer>
+#include <QXmlStreamWriter>
+#include <QtEndian>
+
+using namespace QXmpp::Private;
+
+// A record holds the length of the message and the time at which it was
+// stored in milliseconds, both big-endian, followed by the message.
+static const int RECORD_HEADER_SIZE = 12;
+
+// number of users whose queue is remembered
+static const int USER_QUEUE_CACHE_SIZE = 1024;
+
+namespace {
+
+struct UserQueue
+{
+    // the last segment, to which messages are appended
+    int index;
+    qint64 size;
+    // the records of all segments
+    int messages;
+    qint64 bytes;
+};
+
+enum class AppendResult {
+    Stored,
+    QuotaExceeded,
+    Failed
+};
+
+// The stored messages of a user, with the size which each segment had when
+// they were read.
+struct StoredMessages
+{
+    QByteArray messages;
+    QVector<QPair<QString, qint64>> segments;
+};
+
+}  // namespace
+
+// Calls function(stored, record, recordSize) for each record in the given
+// data and returns the number of bytes parsed. A record truncated by a crash
+// while it was appended ends the segment.
+template<typename Function>
+static qint64 forEachRecord(const uchar *data, qint64 size, Function function)
+{
+    qint64 pos = 0;
+    while (size - pos >= RECORD_HEADER_SIZE) {
+        const qint64 length = qFromBigEndian<quint32>(data + pos);
+        const auto stored = qFromBigEndian<qint64>(data + pos + 4);
+        if (length > size - pos - RECORD_HEADER_SIZE)
+            break;
+        function(stored, data + pos, RECORD_HEADER_SIZE + length);
+        pos += RECORD_HEADER_SIZE + length;
+    }
+    return pos;
+}
+
+static QString segmentFileName(int index)
+{
+    return QStringLiteral("%1.seg").arg(index, 8, 10, QLatin1Char('0'));
+}
+
+class QXmppServerOfflineStorePrivate
+{
+public:
+    QXmppServerOfflineStorePrivate(QXmppServerOfflineStore *qq);
+
+    QString userPath(const QString &bareJid) const;
+    bool isExpired(qint64 stored, qint64 now) const;
+
+    bool isUnknownUser(const QString &bareJid) const;
+    UserQueue *queue(const QString &path);
+    AppendResult append(const QString &bareJid, const QByteArray &message);
+    StoredMessages readMessages(const QString &path) const;
+    void removeMessages(const QString &path, const QVector<QPair<QString, qint64>> &segments);
+    void deliverMessages(const QString &jid);
+    void compact();
+    void compactUser(const QString &path, qint64 now);
+
+    void clientConnected(const QString &jid);
+    void clientDisconnected(const QString &jid);
+
+    QString directory;
+    qint64 segmentSize;
+    qint64 maxAge;
+    int compactionInterval;
+    int maxMessages;
+    qint64 maxBytes;
+    bool started;
+
+    // guards the online users and the segment files
+    QMutex mutex;
+    QHash<QString, int> onlineResources;
+    QCache<QString, UserQueue> queues;
+    // the directories of the users whose messages are being delivered, with
+    // the JID to deliver to again if the user reconnected in the meantime
+    QHash<QString, QString> deliveries;
+
+    QList<QMetaObject::Connection> connections;
+    QTimer *compactionTimer;
+    QThreadPool compactionPool;
+    QThreadPool deliveryPool;
+
+private:
+    QXmppServerOfflineStore *q;
+};
+
+QXmppServerOfflineStorePrivate::QXmppServerOfflineStorePrivate(QXmppServerOfflineStore *qq)
+    : segmentSize(4 * 1024 * 1024),
+      maxAge(qint64(30) * 24 * 3600 * 1000),
+      compactionInterval(600000),
+      maxMessages(1000),
+      maxBytes(10 * 1024 * 1024),
+      started(false),
+      queues(USER_QUEUE_CACHE_SIZE),
+      compactionTimer(nullptr),
+      q(qq)
+{
+    // a single compaction runs at a time
+    compactionPool.setMaxThreadCount(1);
+}
+
+/// Returns the directory holding the segments of the given user.
+
+QString QXmppServerOfflineStorePrivate::userPath(const QString &bareJid) const
+{
+    const auto hash = QCryptographicHash::hash(bareJid.toUtf8(), QCryptographicHash::Sha1);
+    return directory + QLatin1Char('/') + QString::fromLatin1(hash.toHex());
+}
+
+bool QXmppServerOfflineStorePrivate::isExpired(qint64 stored, qint64 now) const
+{
+    return maxAge > 0 && now - stored > maxAge;
+}
+
+/// Returns true if the server's password checker knows that the user does
+/// not exist.
+
+bool QXmppServerOfflineStorePrivate::isUnknownUser(const QString &bareJid) const
+{
+    auto *checker = q->server()->passwordChecker();
+    if (!checker)
+        return false;
+
+    QXmppPasswordRequest request;
+    request.setDomain(QXmppUtils::jidToDomain(bareJid));
+    request.setUsername(QXmppUtils::jidToUser(bareJid));
+    return checker->checkUser(request) == QXmppPasswordReply::AuthorizationError;
+}
+
+/// Returns the queue of the user with the given directory, reading it from
+/// the segments if it is not cached. The mutex must be held.
+
+UserQueue *QXmppServerOfflineStorePrivate::queue(const QString &path)
+{
+    if (auto *queue = queues.object(path))
+        return queue;
+    if (!QDir().mkpath(path))
+        return nullptr;
+
+    auto *queue = new UserQueue { 0, 0, 0, 0 };
+    const QDir dir(path);
+    for (const auto &name : dir.entryList({ QStringLiteral("*.seg") }, QDir::Files, QDir::Name)) {
+        QFile file(dir.filePath(name));
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+
+        const auto size = file.size();
+        queue->index = name.left(8).toInt();
+        queue->size = size;
+        queue->bytes += size;
+        if (auto *data = size ? file.map(0, size) : nullptr) {
+            forEachRecord(data, size, [&](qint64, const uchar *, qint64) {
+                queue->messages++;
+            });
+            file.unmap(data);
+        }
+    }
+    queues.insert(path, queue);
+    return queue;
+}
+
+/// Appends a message to the user's last segment, starting a new segment if
+/// it is full, unless the user's quota is exceeded. The mutex must be held.
+
+AppendResult QXmppServerOfflineStorePrivate::append(const QString &bareJid, const QByteArray &message)
+{
+    const auto path = userPath(bareJid);
+    auto *queue = this->queue(path);
+    if (!queue)
+        return AppendResult::Failed;
+
+    QByteArray record(RECORD_HEADER_SIZE, Qt::Uninitialized);
+    qToBigEndian<quint32>(message.size(), record.data());
+    qToBigEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), record.data() + 4);
+    record += message;
+
+    if ((maxMessages > 0 && queue->messages >= maxMessages) ||
+        (maxBytes > 0 && queue->bytes + record.size() > maxBytes))
+        return AppendResult::QuotaExceeded;
+
+    if (queue->size > 0 && queue->size + record.size() > segmentSize) {
+        queue->index++;
+        queue->size = 0;
+    }
+
+    QFile file(path + QLatin1Char('/') + segmentFileName(queue->index));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return AppendResult::Failed;
+    if (file.write(record) != record.size()) {
+        // do not leave a partial record in front of the next one
+        file.resize(queue->size);
+        return AppendResult::Failed;
+    }
+    queue->size += record.size();
+    queue->messages++;
+    queue->bytes += record.size();
+    return AppendResult::Stored;
+}
+
+/// Reads the messages of the user with the given directory which have not
+/// expired. The mutex must be held.
+
+StoredMessages QXmppServerOfflineStorePrivate::readMessages(const QString &path) const
+{
+    const QDir dir(path);
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    StoredMessages stored;
+    for (const auto &name : dir.entryList({ QStringLiteral("*.seg") }, QDir::Files, QDir::Name)) {
+        QFile file(dir.filePath(name));
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+
+        const auto size = file.size();
+        if (auto *data = size ? file.map(0, size) : nullptr) {
+            forEachRecord(data, size, [&](qint64 stamp, const uchar *record, qint64 recordSize) {
+                if (!isExpired(stamp, now))
+                    stored.messages.append(reinterpret_cast<const char *>(record) + RECORD_HEADER_SIZE,
+                                           int(recordSize - RECORD_HEADER_SIZE));
+            });
+            file.unmap(data);
+        }
+        stored.segments.append(qMakePair(name, size));
+    }
+    return stored;
+}
+
+/// Removes the given segments of the user with the given directory, as far
+/// as they were read. The mutex must be held.
+
+void QXmppServerOfflineStorePrivate::removeMessages(const QString &path, const QVector<QPair<QString, qint64>> &segments)
+{
+    QDir dir(path);
+    for (const auto &segment : segments) {
+        const auto segmentPath = dir.filePath(segment.first);
+        QFile file(segmentPath);
+        if (file.size() <= segment.second) {
+            file.remove();
+            continue;
+        }
+
+        // the user went offline again and messages were appended, those are
+        // kept
+        if (!file.open(QIODevice::ReadOnly) || !file.seek(segment.second))
+            continue;
+        const auto remaining = file.readAll();
+        file.close();
+        QSaveFile output(segmentPath);
+        if (!output.open(QIODevice::WriteOnly) || output.write(remaining) != remaining.size() || !output.commit())
+            q->warning(QStringLiteral("Could not remove delivered offline messages from %1").arg(segmentPath));
+    }
+    dir.rmdir(path);
+    queues.remove(path);
+}
+
+void QXmppServerOfflineStorePrivate::compact()
+{
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    const QDir dir(directory);
+    for (const auto &name : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        // the mutex is taken for each user, so appends are not held back
+        // for a whole compaction
+        QMutexLocker locker(&mutex);
+        const auto path = dir.filePath(name);
+        if (!deliveries.contains(path))
+            compactUser(path, now);
+    }
+}
+
+/// Drops the expired messages of a user and merges neighbouring segments
+/// which fit into one. The mutex must be held.
+
+void QXmppServerOfflineStorePrivate::compactUser(const QString &path, qint64 now)
+{
+    struct Segment
+    {
+        QString path;
+        qint64 size;
+    };
+
+    QVector<Segment> segments;
+    const QDir dir(path);
+    for (const auto &name : dir.entryList({ QStringLiteral("*.seg") }, QDir::Files, QDir::Name)) {
+        const auto segmentPath = dir.filePath(name);
+        QFile file(segmentPath);
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+
+        // a segment is only rewritten if records were dropped
+        const auto size = file.size();
+        QByteArray kept;
+        qint64 parsed = 0;
+        if (auto *data = size ? file.map(0, size) : nullptr) {
+            parsed = forEachRecord(data, size, [&](qint64 stored, const uchar *record, qint64 recordSize) {
+                if (!isExpired(stored, now))
+                    kept.append(reinterpret_cast<const char *>(record), int(recordSize));
+            });
+            file.unmap(data);
+        }
+        file.close();
+
+        if (kept.isEmpty()) {
+            QFile::remove(segmentPath);
+            continue;
+        }
+        if (kept.size() != size || parsed != size) {
+            QSaveFile output(segmentPath);
+            if (!output.open(QIODevice::WriteOnly) || output.write(kept) != kept.size() || !output.commit()) {
+                q->warning(QStringLiteral("Could not compact offline messages in %1").arg(segmentPath));
+                continue;
+            }
+        }
+        segments.append({ segmentPath, qint64(kept.size()) });
+    }
+
+    for (int i = 0; i + 1 < segments.size();) {
+        auto &current = segments[i];
+        const auto &next = segments.at(i + 1);
+        if (current.size + next.size > segmentSize) {
+            ++i;
+            continue;
+        }
+
+        // the records of the next segment are appended, so they stay in order
+        QFile input(next.path);
+        QFile output(current.path);
+        if (!input.open(QIODevice::ReadOnly) || !output.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            ++i;
+            continue;
+        }
+        const auto data = input.readAll();
+        if (output.write(data) != data.size()) {
+            output.resize(current.size);
+            ++i;
+            continue;
+        }
+        input.remove();
+        current.size += data.size();
+        segments.removeAt(i + 1);
+    }
+
+    if (segments.isEmpty())
+        QDir().rmdir(path);
+    queues.remove(path);
+}
+
+void QXmppServerOfflineStorePrivate::clientConnected(const QString &jid)
+{
+    const auto bareJid = QXmppUtils::jidToBareJid(jid);
+
+    // no more messages are stored once the user is online
+    {
+        QMutexLocker locker(&mutex);
+        if (onlineResources[bareJid]++ > 0)
+            return;
+    }
+    deliverMessages(jid);
+}
+
+/// Delivers the stored messages of a user to the given stream.
+///
+/// The segments are read in the thread pool and the messages are handed to
+/// the stream in the server's thread. The delivered messages are then
+/// removed in the thread pool; the user's segments are not compacted in the
+/// meantime.
+
+void QXmppServerOfflineStorePrivate::deliverMessages(const QString &jid)
+{
+    const auto path = userPath(QXmppUtils::jidToBareJid(jid));
+    {
+        QMutexLocker locker(&mutex);
+        auto itr = deliveries.find(path);
+        if (itr != deliveries.end()) {
+            *itr = jid;
+            return;
+        }
+        deliveries.insert(path, QString());
+    }
+
+    auto interface = std::make_shared<QFutureInterface<StoredMessages>>(QFutureInterfaceBase::Started);
+    runInThreadPool(&deliveryPool, [this, path, interface]() {
+        StoredMessages stored;
+        {
+            QMutexLocker locker(&mutex);
+            if (QDir(path).exists())
+                stored = readMessages(path);
+        }
+        interface->reportResult(stored);
+        interface->reportFinished();
+    });
+
+    await(interface->future(), q, [this, jid, path](const StoredMessages &stored) {
+        // the segments are kept if the stream is already gone, so the
+        // messages are delivered on the next connection
+        const bool delivered = stored.messages.isEmpty() || q->server()->broadcastData({ jid }, stored.messages) > 0;
+        runInThreadPool(&deliveryPool, [this, path, stored, delivered]() {
+            QMutexLocker locker(&mutex);
+            if (delivered && !stored.segments.isEmpty())
+                removeMessages(path, stored.segments);
+
+            const auto nextJid = deliveries.take(path);
+            if (!nextJid.isEmpty())
+                QMetaObject::invokeMethod(q, [this, nextJid]() { deliverMessages(nextJid); }, Qt::QueuedConnection);
+        });
+    });
+}
+
+void QXmppServerOfflineStorePrivate::clientDisconnected(const QString &jid)
+{
+    const auto bareJid = QXmppUtils::jidToBareJid(jid);
+
+    QMutexLocker locker(&mutex);
+    auto itr = onlineResources.find(bareJid);
+    if (itr != onlineResources.end() && --itr.value() <= 0)
+        onlineResources.erase(itr);
+}
+
+///
+/// Constructs a new offline message store.
+///
+/// A directory must be set before the store is started.
+///
+QXmppServerOfflineStore::QXmppServerOfflineStore()
+    : d(new QXmppServerOfflineStorePrivate(this))
+{
+}
+
+QXmppServerOfflineStore::~QXmppServerOfflineStore()
+{
+    stop();
+    delete d;
+}
+
+///
+/// Returns the directory in which the messages are stored.
+///
+QString QXmppServerOfflineStore::directory() const
+{
+    return d->directory;
+}
+
+///
+/// Sets the \a path of the directory in which the messages are stored. It is
+/// created if needed.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerOfflineStore::setDirectory(const QString &path)
+{
+    d->directory = path;
+}
+
+///
+/// Returns the size in bytes above which a new segment is started.
+///
+qint64 QXmppServerOfflineStore::segmentSize() const
+{
+    return d->segmentSize;
+}
+
+///
+/// Sets the size in \a bytes above which a new segment is started. The
+/// default is 4 MiB.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerOfflineStore::setSegmentSize(qint64 bytes)
+{
+    d->segmentSize = qMax<qint64>(1, bytes);
+}
+
+///
+/// Returns the time in milliseconds after which a stored message expires.
+///
+qint64 QXmppServerOfflineStore::maxAge() const
+{
+    return d->maxAge;
+}
+
+///
+/// Sets the time in milliseconds after which a stored message expires and
+/// is no longer delivered. The default is 30 days, 0 keeps messages forever.
+///
+/// This must be set before the extension is started.
+///
+void QXmppServerOfflineStore::setMaxAge(qint64 msecs)
+{
+    d->maxAge = qMax<qint64>(0, msecs);
+}
+
+///
+/// Returns the interval in milliseconds at which the segments are compacted.
+///
+int QXmppServerOfflineStore::compactionInterval() const
+{
+    return d->compactionInterval;
+}
+
+///
+/// Sets the interval in milliseconds at which the segments are compacted.
+/// The default is 10 minutes.
+///
+void QXmppServerOfflineStore::setCompactionInterval(int msecs)
+{
+    d->compactionInterval = qMax(1, msecs);
+    if (d->compactionTimer)
+        d->compactionTimer->setInterval(d->compactionInterval);
+}
+
+///
+/// Returns the number of messages which are stored for a user at most.
+///
+int QXmppServerOfflineStore::maxMessages() const
+{
+    return d->maxMessages;
+}
+
+///
+/// Sets the number of \a messages which are stored for a user at most.
+/// Further messages are bounced with a resource-constraint error. The
+/// default is 1000, 0 disables the limit.
+///
+void QXmppServerOfflineStore::setMaxMessages(int messages)
+{
+    d->maxMessages = qMax(0, messages);
+}
+
+///
+/// Returns the size in bytes of the segments which are stored for a user at
+/// most.
+///
+qint64 QXmppServerOfflineStore::maxBytes() const
+{
+    return d->maxBytes;
+}
+
+///
+/// Sets the size in \a bytes of the segments which are stored for a user at
+/// most. Messages which do not fit are bounced with a resource-constraint
+/// error. The default is 10 MiB, 0 disables the limit.
+///
+void QXmppServerOfflineStore::setMaxBytes(qint64 bytes)
+{
+    d->maxBytes = qMax<qint64>(0, bytes);
+}
+
+QVector<QXmppServerExtension::HandledStanza> QXmppServerOfflineStore::handledStanzas() const
+{
+    return { { QStringLiteral("message"), QString() } };
+}
+
+///
+/// Claims chat and normal messages with a body which are addressed to a
+/// local user who has no connected resource.
+///
+bool QXmppServerOfflineStore::claimStanza(const QDomElement &stanza)
+{
+    if (!d->started)
+        return false;
+
+    const auto type = stanza.attribute(QStringLiteral("type"));
+    if (type == QStringLiteral("error") || type == QStringLiteral("groupchat") || type == QStringLiteral("headline"))
+        return false;
+    if (stanza.firstChildElement(QStringLiteral("body")).isNull())
+        return false;
+
+    const auto to = stanza.attribute(QStringLiteral("to"));
+    if (QXmppUtils::jidToUser(to).isEmpty() || QXmppUtils::jidToDomain(to) != server()->domain())
+        return false;
+
+    QMutexLocker locker(&d->mutex);
+    return !d->onlineResources.contains(QXmppUtils::jidToBareJid(to));
+}
+
+///
+/// Appends a claimed message to the recipient's segments.
+///
+/// If the recipient connected in the meantime, the message is left to the
+/// server, which delivers it. Messages to unknown users or exceeding the
+/// recipient's quota are bounced.
+///
+bool QXmppServerOfflineStore::handleStanzaAsync(const QDomElement &stanza, QXmppStanzaResponses &responses)
+{
+    QXmppMessage message;
+    message.parse(stanza);
+
+    const auto bounce = [&](QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition) {
+        QXmppMessage response;
+        response.setType(QXmppMessage::Error);
+        response.setId(message.id());
+        response.setFrom(message.to());
+        response.setTo(message.from());
+        response.setError(QXmppStanza::Error(type, condition));
+        responses.sendPacket(response);
+    };
+
+    const auto bareJid = QXmppUtils::jidToBareJid(message.to());
+    if (d->isUnknownUser(bareJid)) {
+        bounce(QXmppStanza::Error::Cancel, QXmppStanza::Error::ServiceUnavailable);
+        return true;
+    }
+
+    if (!message.stamp().isValid())
+        message.setStamp(QDateTime::currentDateTimeUtc());
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    message.toXml(&writer);
+
+    QMutexLocker locker(&d->mutex);
+    if (d->onlineResources.contains(bareJid))
+        return false;
+
+    switch (d->append(bareJid, data)) {
+    case AppendResult::Stored:
+        return true;
+    case AppendResult::QuotaExceeded:
+        locker.unlock();
+        bounce(QXmppStanza::Error::Wait, QXmppStanza::Error::ResourceConstraint);
+        return true;
+    case AppendResult::Failed:
+        break;
+    }
+    warning(QStringLiteral("Could not store offline message to %1").arg(bareJid));
+    return false;
+}
+
+///
+/// Starts storing messages to offline users, and delivering them when the
+/// users connect.
+///
+bool QXmppServerOfflineStore::start()
+{
+    auto *server = this->server();
+    if (!server)
+        return false;
+
+    if (d->directory.isEmpty() || !QDir().mkpath(d->directory)) {
+        warning(QStringLiteral("Could not store offline messages in %1").arg(d->directory));
+        return false;
+    }
+
+    d->connections << connect(server, &QXmppServer::clientConnected, this, [this](const QString &jid) {
+        d->clientConnected(jid);
+    });
+    d->connections << connect(server, &QXmppServer::clientDisconnected, this, [this](const QString &jid) {
+        d->clientDisconnected(jid);
+    });
+
+    d->compactionTimer = new QTimer(this);
+    d->compactionTimer->setInterval(d->compactionInterval);
+    connect(d->compactionTimer, &QTimer::timeout, this, [this]() {
+        // skip the compaction if the previous one is still running
+        if (d->compactionPool.activeThreadCount() == 0)
+            runInThreadPool(&d->compactionPool, [this]() { d->compact(); });
+    });
+    d->compactionTimer->start();
+
+    d->started = true;
+    return true;
+}
+
+///
+/// Stops storing messages and waits for a running compaction to finish.
+///
+void QXmppServerOfflineStore::stop()
+{
+    d->started = false;
+
+    for (const auto &connection : std::as_const(d->connections))
+        disconnect(connection);
+    d->connections.clear();
+
+    delete d->compactionTimer;
+    d->compactionTimer = nullptr;
+    d->compactionPool.waitForDone();
+    d->deliveryPool.waitForDone();
+
+    QMutexLocker locker(&d->mutex);
+    d->onlineResources.clear();
+    d->deliveries.clear();
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVEROFFLINESTORE_H
+#define QXMPPSERVEROFFLINESTORE_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppServerOfflineStorePrivate;
+
+///
+/// \brief The QXmppServerOfflineStore class stores messages to local users
+/// who are offline and delivers them once the user connects.
+///
+/// The messages are appended to segment files on disk, one directory per
+/// user, so queued messages do not use any memory. When the user's first
+/// resource connects, the segments are mapped into memory and their messages
+/// are sent in a single write. Delivered messages carry a XEP-0203: Delayed
+/// Delivery timestamp.
+///
+/// Segments are compacted in the background: expired messages are dropped
+/// and small segments are merged.
+///
+/// Messages to users which the server's password checker does not know, as
+/// told by QXmppPasswordChecker::checkUser(), are bounced with a
+/// service-unavailable error, and so are messages exceeding the recipient's
+/// quota, with a resource-constraint error.
+///
+/// Stored messages are delivered at most once: they are removed as soon as
+/// they were handed to the user's stream. If the connection drops before
+/// the client received them, they are lost, unless the client resumes the
+/// stream using XEP-0198: Stream Management.
+///
+/// \ingroup Core
+///
+/// \since QXmpp 1.5
+///
+class QXMPP_EXPORT QXmppServerOfflineStore : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "offline")
+
+public:
+    QXmppServerOfflineStore();
+    ~QXmppServerOfflineStore() override;
+
+    QString directory() const;
+    void setDirectory(const QString &path);
+
+    qint64 segmentSize() const;
+    void setSegmentSize(qint64 bytes);
+
+    qint64 maxAge() const;
+    void setMaxAge(qint64 msecs);
+
+    int compactionInterval() const;
+    void setCompactionInterval(int msecs);
+
+    int maxMessages() const;
+    void setMaxMessages(int messages);
+
+    qint64 maxBytes() const;
+    void setMaxBytes(qint64 bytes);
+
+    QVector<HandledStanza> handledStanzas() const override;
+    bool claimStanza(const QDomElement &stanza) override;
+    bool handleStanzaAsync(const QDomElement &stanza, QXmppStanzaResponses &responses) override;
+
+    bool start() override;
+    void stop() override;
+
+private:
+    friend class QXmppServerOfflineStorePrivate;
+    QXmppServerOfflineStorePrivate *const d;
+};
+
+#endif
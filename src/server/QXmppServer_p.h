@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVER_P_H
+#define QXMPPSERVER_P_H
+
+#include "QXmppLogger.h"
+#include "QXmppMpscQueue_p.h"
+
+#include <atomic>
+
+#include <QHash>
+#include <QVector>
+
+class QXmppIncomingClient;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+///
+/// The QXmppServerWorker class owns the client streams which are handled in
+/// one of the server's worker threads.
+///
+/// Data routed to these streams from other threads is passed through a
+/// lock-free queue, which is drained once per event loop iteration of the
+/// worker thread. Data sent to several streams of the same worker is queued
+/// only once.
+///
+class QXmppServerWorker : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppServerWorker();
+
+    void post(const QVector<quint64> &streamIds, const QByteArray &data);
+
+    void setLogger(QXmppLogger *logger);
+
+    Q_INVOKABLE void addStream(quint64 streamId, QObject *stream);
+
+    /// This signal is emitted when a client \a stream was accepted by a
+    /// listener of the worker thread.
+    Q_SIGNAL void streamAccepted(quint64 streamId, QObject *stream);
+
+private:
+    Q_SLOT void drain();
+
+    // the same data for one or more streams
+    struct Delivery
+    {
+        QVector<quint64> streamIds;
+        QByteArray data;
+    };
+
+    QXmpp::Private::MpscQueue<Delivery> m_queue;
+    std::atomic<bool> m_drainScheduled;
+
+    // only accessed from the worker thread
+    QHash<quint64, QXmppIncomingClient *> m_streams;
+};
+
+#endif  // QXMPPSERVER_P_H
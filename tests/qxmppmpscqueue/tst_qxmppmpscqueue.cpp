@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppMpscQueue_p.h"
+
+#include "util.h"
+#include <QObject>
+
+#include <thread>
+#include <vector>
+
+using namespace QXmpp::Private;
+
+class tst_QXmppMpscQueue : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testPushPop();
+    Q_SLOT void testConcurrentProducers();
+};
+
+void tst_QXmppMpscQueue::testPushPop()
+{
+    MpscQueue<QString> queue;
+    QString value;
+    QVERIFY(!queue.pop(value));
+
+    queue.push(QStringLiteral("a"));
+    queue.push(QStringLiteral("b"));
+    QVERIFY(queue.pop(value));
+    QCOMPARE(value, QStringLiteral("a"));
+    QVERIFY(queue.pop(value));
+    QCOMPARE(value, QStringLiteral("b"));
+    QVERIFY(!queue.pop(value));
+
+    // the queue can be reused once it has been drained
+    queue.push(QStringLiteral("c"));
+    QVERIFY(queue.pop(value));
+    QCOMPARE(value, QStringLiteral("c"));
+    QVERIFY(!queue.pop(value));
+
+    // values left in the queue are released on destruction
+    queue.push(QStringLiteral("d"));
+}
+
+void tst_QXmppMpscQueue::testConcurrentProducers()
+{
+    const int producerCount = 4;
+    const int valueCount = 10000;
+
+    MpscQueue<int> queue;
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < producerCount; producer++) {
+        producers.emplace_back([&queue, producer, valueCount]() {
+            for (int i = 0; i < valueCount; i++)
+                queue.push(producer * valueCount + i);
+        });
+    }
+
+    // the values of each producer arrive in order
+    std::vector<int> last(producerCount, -1);
+    bool ordered = true;
+    int received = 0;
+    int value;
+    while (received < producerCount * valueCount) {
+        if (!queue.pop(value))
+            continue;
+
+        const auto producer = value / valueCount;
+        ordered = ordered && value % valueCount == last[producer] + 1;
+        last[producer] = value % valueCount;
+        received++;
+    }
+
+    for (auto &producer : producers)
+        producer.join();
+    QVERIFY(ordered);
+    QVERIFY(!queue.pop(value));
+}
+
+QTEST_MAIN(tst_QXmppMpscQueue)
+#include "tst_qxmppmpscqueue.moc"
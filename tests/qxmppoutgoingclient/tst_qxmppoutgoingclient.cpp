@@ -21,10 +21,13 @@
  *
  */
 
+#include "QXmppConfiguration.h"
 #include "QXmppOutgoingClient.h"
 
 #include "util.h"
 
+#include <QDataStream>
+
 class tst_QXmppOutgoingClient : public QObject
 {
     Q_OBJECT
@@ -32,6 +35,7 @@ class tst_QXmppOutgoingClient : public QObject
 private:
     Q_SLOT void testParseHostAddress_data();
     Q_SLOT void testParseHostAddress();
+    Q_SLOT void testStreamManagementState();
 };
 
 void tst_QXmppOutgoingClient::testParseHostAddress_data()
@@ -82,5 +86,40 @@ void tst_QXmppOutgoingClient::testParseHostAddress()
     QCOMPARE(address.second, resultPort);
 }
 
+void tst_QXmppOutgoingClient::testStreamManagementState()
+{
+    QXmppOutgoingClient client(nullptr);
+
+    // nothing to resume
+    QVERIFY(client.saveStreamManagementState().isEmpty());
+    QVERIFY(!client.restoreStreamManagementState(QByteArray()));
+    QVERIFY(!client.restoreStreamManagementState(QByteArrayLiteral("garbage")));
+
+    QByteArray state;
+    QDataStream out(&state, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_9);
+    out << quint8(1)
+        << QStringLiteral("juliet@capulet.lit/balcony")
+        << QStringLiteral("some-long-sm-id")
+        << QStringLiteral("[2001:41D0:1:A49b::1]")
+        << quint16(9222)
+        // incoming, outgoing and acknowledged sequence numbers
+        << 10u << 12u << 10u
+        // unacknowledged stanzas
+        << qint32(2)
+        << 11u << QByteArrayLiteral("<message to='romeo@montague.lit'><body>1</body></message>")
+        << 12u << QByteArrayLiteral("<message to='romeo@montague.lit'><body>2</body></message>");
+
+    QVERIFY(client.restoreStreamManagementState(state));
+    QCOMPARE(client.configuration().jidBare(), QStringLiteral("juliet@capulet.lit"));
+    QCOMPARE(client.configuration().resource(), QStringLiteral("balcony"));
+    QCOMPARE(client.configuration().jid(), QStringLiteral("juliet@capulet.lit/balcony"));
+    QCOMPARE(client.saveStreamManagementState(), state);
+
+    // a truncated state is rejected and leaves the current state untouched
+    QVERIFY(!client.restoreStreamManagementState(state.left(state.size() - 4)));
+    QCOMPARE(client.saveStreamManagementState(), state);
+}
+
 QTEST_MAIN(tst_QXmppOutgoingClient)
 #include "tst_qxmppoutgoingclient.moc"
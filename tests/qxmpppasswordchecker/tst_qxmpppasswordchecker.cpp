@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppPasswordChecker.h"
+
+#include "util.h"
+#include <QCryptographicHash>
+#include <QSemaphore>
+#include <QThread>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class TestAsyncPasswordChecker : public QXmppAsyncPasswordChecker
+{
+public:
+    ~TestAsyncPasswordChecker() override
+    {
+        waitForLookups();
+        alive = false;
+    }
+
+    QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password) override
+    {
+        lookups++;
+        lookupThread = QThread::currentThread();
+        if (blockLookups)
+            lookupGate.acquire();
+
+        // the lookup must not outlive the subclass
+        if (!alive)
+            qFatal("getPassword() called on a destroyed password checker");
+
+        if (request.username() == QStringLiteral("unavailable"))
+            return QXmppPasswordReply::TemporaryError;
+        if (request.username() != QStringLiteral("testuser"))
+            return QXmppPasswordReply::AuthorizationError;
+        password = QStringLiteral("testpwd");
+        return QXmppPasswordReply::NoError;
+    }
+
+    std::atomic<int> lookups { 0 };
+    std::atomic<QThread *> lookupThread { nullptr };
+    std::atomic<bool> blockLookups { false };
+    std::atomic<bool> alive { true };
+    QSemaphore lookupGate;
+};
+
+static QXmppPasswordRequest passwordRequest(const QString &username, const QString &password = QString())
+{
+    QXmppPasswordRequest request;
+    request.setDomain(QStringLiteral("example.com"));
+    request.setUsername(username);
+    request.setPassword(password);
+    return request;
+}
+
+static bool waitForReply(QXmppPasswordReply *reply)
+{
+    if (!reply->isFinished()) {
+        QSignalSpy spy(reply, &QXmppPasswordReply::finished);
+        if (!spy.wait())
+            return false;
+    }
+    return true;
+}
+
+class tst_QXmppPasswordChecker : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testCheckPassword_data();
+    Q_SLOT void testCheckPassword();
+    Q_SLOT void testGetDigest();
+    Q_SLOT void testCache();
+    Q_SLOT void testCacheTimeout();
+    Q_SLOT void testConcurrentLookups();
+    Q_SLOT void testDestroyDuringLookup();
+};
+
+void tst_QXmppPasswordChecker::testCheckPassword_data()
+{
+    QTest::addColumn<QString>("username");
+    QTest::addColumn<QString>("password");
+    QTest::addColumn<int>("error");
+
+    QTest::newRow("good") << "testuser"
+                          << "testpwd" << int(QXmppPasswordReply::NoError);
+    QTest::newRow("bad-username") << "baduser"
+                                  << "testpwd" << int(QXmppPasswordReply::AuthorizationError);
+    QTest::newRow("bad-password") << "testuser"
+                                  << "badpwd" << int(QXmppPasswordReply::AuthorizationError);
+    QTest::newRow("unavailable") << "unavailable"
+                                 << "testpwd" << int(QXmppPasswordReply::TemporaryError);
+}
+
+void tst_QXmppPasswordChecker::testCheckPassword()
+{
+    QFETCH(QString, username);
+    QFETCH(QString, password);
+    QFETCH(int, error);
+
+    TestAsyncPasswordChecker checker;
+    std::unique_ptr<QXmppPasswordReply> reply(checker.checkPassword(passwordRequest(username, password)));
+    QVERIFY(waitForReply(reply.get()));
+    QCOMPARE(int(reply->error()), error);
+
+    // the lookup ran in the thread pool, the reply finished in this thread
+    QCOMPARE(checker.lookups.load(), 1);
+    QVERIFY(checker.lookupThread.load() != QThread::currentThread());
+    QCOMPARE(reply->thread(), QThread::currentThread());
+}
+
+void tst_QXmppPasswordChecker::testGetDigest()
+{
+    TestAsyncPasswordChecker checker;
+    std::unique_ptr<QXmppPasswordReply> reply(checker.getDigest(passwordRequest("testuser")));
+    QVERIFY(waitForReply(reply.get()));
+    QCOMPARE(reply->error(), QXmppPasswordReply::NoError);
+    QCOMPARE(reply->digest(), QCryptographicHash::hash("testuser:example.com:testpwd", QCryptographicHash::Md5));
+
+    reply.reset(checker.getDigest(passwordRequest("baduser")));
+    QVERIFY(waitForReply(reply.get()));
+    QCOMPARE(reply->error(), QXmppPasswordReply::AuthorizationError);
+    QVERIFY(reply->digest().isEmpty());
+}
+
+void tst_QXmppPasswordChecker::testCache()
+{
+    TestAsyncPasswordChecker checker;
+    QCOMPARE(checker.cacheSize(), 0);
+    checker.setCacheSize(10);
+    QCOMPARE(checker.cacheSize(), 10);
+
+    auto check = [&](const QString &username, const QString &password) {
+        std::unique_ptr<QXmppPasswordReply> reply(checker.checkPassword(passwordRequest(username, password)));
+        return waitForReply(reply.get()) ? reply->error() : QXmppPasswordReply::TemporaryError;
+    };
+
+    // found passwords are cached
+    QCOMPARE(check("testuser", "testpwd"), QXmppPasswordReply::NoError);
+    QCOMPARE(check("testuser", "badpwd"), QXmppPasswordReply::AuthorizationError);
+    QCOMPARE(check("testuser", "testpwd"), QXmppPasswordReply::NoError);
+    QCOMPARE(checker.lookups.load(), 1);
+
+    // unknown users are cached
+    QCOMPARE(check("baduser", "testpwd"), QXmppPasswordReply::AuthorizationError);
+    QCOMPARE(check("baduser", "testpwd"), QXmppPasswordReply::AuthorizationError);
+    QCOMPARE(checker.lookups.load(), 2);
+
+    // temporary errors are not cached
+    QCOMPARE(check("unavailable", "testpwd"), QXmppPasswordReply::TemporaryError);
+    QCOMPARE(check("unavailable", "testpwd"), QXmppPasswordReply::TemporaryError);
+    QCOMPARE(checker.lookups.load(), 4);
+
+    // the digest is computed from the cached password
+    std::unique_ptr<QXmppPasswordReply> reply(checker.getDigest(passwordRequest("testuser")));
+    QVERIFY(waitForReply(reply.get()));
+    QCOMPARE(reply->digest(), QCryptographicHash::hash("testuser:example.com:testpwd", QCryptographicHash::Md5));
+    QCOMPARE(checker.lookups.load(), 4);
+
+    checker.clearCache();
+    QCOMPARE(check("testuser", "testpwd"), QXmppPasswordReply::NoError);
+    QCOMPARE(checker.lookups.load(), 5);
+}
+
+void tst_QXmppPasswordChecker::testCacheTimeout()
+{
+    TestAsyncPasswordChecker checker;
+    checker.setCacheSize(10);
+    checker.setCacheTimeout(100);
+    QCOMPARE(checker.cacheTimeout(), 100);
+    checker.setNegativeCacheTimeout(0);
+    QCOMPARE(checker.negativeCacheTimeout(), 0);
+
+    auto check = [&](const QString &username) {
+        std::unique_ptr<QXmppPasswordReply> reply(checker.checkPassword(passwordRequest(username, "testpwd")));
+        return waitForReply(reply.get()) ? reply->error() : QXmppPasswordReply::TemporaryError;
+    };
+
+    QCOMPARE(check("testuser"), QXmppPasswordReply::NoError);
+    QCOMPARE(check("testuser"), QXmppPasswordReply::NoError);
+    QCOMPARE(checker.lookups.load(), 1);
+
+    // expired entries are looked up again
+    QTest::qWait(150);
+    QCOMPARE(check("testuser"), QXmppPasswordReply::NoError);
+    QCOMPARE(checker.lookups.load(), 2);
+
+    // a timeout of zero disables caching
+    QCOMPARE(check("baduser"), QXmppPasswordReply::AuthorizationError);
+    QCOMPARE(check("baduser"), QXmppPasswordReply::AuthorizationError);
+    QCOMPARE(checker.lookups.load(), 4);
+}
+
+void tst_QXmppPasswordChecker::testConcurrentLookups()
+{
+    TestAsyncPasswordChecker checker;
+    checker.blockLookups = true;
+
+    // requests for the same user share a single lookup
+    std::vector<std::unique_ptr<QXmppPasswordReply>> replies;
+    for (int i = 0; i < 5; ++i)
+        replies.emplace_back(checker.checkPassword(passwordRequest("testuser", "testpwd")));
+    replies.emplace_back(checker.checkPassword(passwordRequest("testuser", "badpwd")));
+
+    checker.lookupGate.release();
+    for (const auto &reply : replies)
+        QVERIFY(waitForReply(reply.get()));
+
+    QCOMPARE(checker.lookups.load(), 1);
+    for (int i = 0; i < 5; ++i)
+        QCOMPARE(replies[i]->error(), QXmppPasswordReply::NoError);
+    QCOMPARE(replies.back()->error(), QXmppPasswordReply::AuthorizationError);
+}
+
+void tst_QXmppPasswordChecker::testDestroyDuringLookup()
+{
+    auto *checker = new TestAsyncPasswordChecker;
+    checker->blockLookups = true;
+
+    std::unique_ptr<QXmppPasswordReply> reply(checker->checkPassword(passwordRequest("testuser", "testpwd")));
+    QTRY_COMPARE(checker->lookups.load(), 1);
+
+    // the lookup is still blocked when the checker is destroyed
+    std::thread release([checker]() {
+        QThread::msleep(100);
+        checker->lookupGate.release();
+    });
+    delete checker;
+    release.join();
+
+    QVERIFY(waitForReply(reply.get()));
+    QCOMPARE(reply->error(), QXmppPasswordReply::NoError);
+}
+
+QTEST_MAIN(tst_QXmppPasswordChecker)
+#include "tst_qxmpppasswordchecker.moc"
@@ -26,6 +26,8 @@
 #include "util.h"
 #include <QObject>
 
+#include <memory>
+
 class tst_QXmppSasl : public QObject
 {
     Q_OBJECT
@@ -39,6 +41,7 @@ private slots:
     void testFailure();
     void testResponse_data();
     void testResponse();
+    void testSuccess_data();
     void testSuccess();
 
     // client
@@ -61,6 +64,10 @@ private slots:
     void testServerDigestMd5();
     void testServerPlain();
     void testServerPlainChallenge();
+    void testServerScramSha1();
+    void testServerScramSha1_bad();
+    void testServerScramSha256();
+    void testServerScramUnknownUser();
 };
 
 void tst_QXmppSasl::testParsing()
@@ -180,11 +187,28 @@ void tst_QXmppSasl::testResponse()
     serializePacket(response, xml);
 }
 
+void tst_QXmppSasl::testSuccess_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+    QTest::addColumn<QByteArray>("value");
+
+    QTest::newRow("empty")
+        << QByteArray("<success xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\"/>")
+        << QByteArray();
+
+    QTest::newRow("value")
+        << QByteArray("<success xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\">dj1ybUY5cHFWOFM3c3VBb1pXamE0ZEpSa0ZzS1E9</success>")
+        << QByteArray("v=rmF9pqV8S7suAoZWja4dJRkFsKQ=");
+}
+
 void tst_QXmppSasl::testSuccess()
 {
-    const QByteArray xml = "<success xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\"/>";
+    QFETCH(QByteArray, xml);
+    QFETCH(QByteArray, value);
+
     QXmppSaslSuccess stanza;
     parsePacket(stanza, xml);
+    QCOMPARE(stanza.value(), value);
     serializePacket(stanza, xml);
 }
 
@@ -540,5 +564,134 @@ void tst_QXmppSasl::testServerPlainChallenge()
     delete server;
 }
 
+void tst_QXmppSasl::testServerScramSha1()
+{
+    QXmppSaslDigestMd5::setNonce("3rfcNHYJY1ZVvWVs7j");
+
+    QXmppSaslServer *server = QXmppSaslServer::create("SCRAM-SHA-1");
+    QVERIFY(server != 0);
+    QCOMPARE(server->mechanism(), QLatin1String("SCRAM-SHA-1"));
+
+    // credentials needed
+    QByteArray response;
+    const QByteArray request("n,,n=user,r=fyko+d2lbbFgONRv9qkxdawL");
+    QCOMPARE(server->respond(request, response), QXmppSaslServer::InputNeeded);
+    QCOMPARE(server->username(), QLatin1String("user"));
+
+    QByteArray storedKey, serverKey;
+    const QByteArray salt = QByteArray::fromBase64("QSXCR+Q6sek8bf92");
+    QXmppSaslServerScram::deriveKeys(QCryptographicHash::Sha1, "pencil", salt, 4096, storedKey, serverKey);
+    static_cast<QXmppSaslServerScram *>(server)->setCredentials(salt, 4096, storedKey, serverKey);
+
+    // first challenge
+    QCOMPARE(server->respond(request, response), QXmppSaslServer::Challenge);
+    QCOMPARE(response, QByteArray("r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,s=QSXCR+Q6sek8bf92,i=4096"));
+
+    // success, with the server signature as additional data
+    QCOMPARE(server->respond("c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,p=v0X8v3Bz2T0CJGbJQyF0X+HI4Ts=", response), QXmppSaslServer::Succeeded);
+    QCOMPARE(response, QByteArray("v=rmF9pqV8S7suAoZWja4dJRkFsKQ="));
+
+    // any further step is an error
+    QCOMPARE(server->respond(QByteArray(), response), QXmppSaslServer::Failed);
+
+    delete server;
+}
+
+void tst_QXmppSasl::testServerScramSha1_bad()
+{
+    QXmppSaslDigestMd5::setNonce("3rfcNHYJY1ZVvWVs7j");
+
+    QByteArray storedKey, serverKey;
+    const QByteArray salt = QByteArray::fromBase64("QSXCR+Q6sek8bf92");
+    QXmppSaslServerScram::deriveKeys(QCryptographicHash::Sha1, "pencil", salt, 4096, storedKey, serverKey);
+
+    auto createServer = [&]() {
+        auto *server = new QXmppSaslServerScram(QCryptographicHash::Sha1);
+        server->setCredentials(salt, 4096, storedKey, serverKey);
+        return server;
+    };
+    const QByteArray request("n,,n=user,r=fyko+d2lbbFgONRv9qkxdawL");
+    QByteArray response;
+
+    // channel binding is not supported
+    std::unique_ptr<QXmppSaslServerScram> server(createServer());
+    QCOMPARE(server->respond("p=tls-unique,,n=user,r=fyko+d2lbbFgONRv9qkxdawL", response), QXmppSaslServer::Failed);
+
+    // no nonce
+    server.reset(createServer());
+    QCOMPARE(server->respond("n,,n=user", response), QXmppSaslServer::Failed);
+
+    // wrong nonce
+    server.reset(createServer());
+    QCOMPARE(server->respond(request, response), QXmppSaslServer::Challenge);
+    QCOMPARE(server->respond("c=biws,r=fyko+d2lbbFgONRv9qkxdawL,p=v0X8v3Bz2T0CJGbJQyF0X+HI4Ts=", response), QXmppSaslServer::Failed);
+
+    // wrong proof
+    server.reset(createServer());
+    QCOMPARE(server->respond(request, response), QXmppSaslServer::Challenge);
+    QCOMPARE(server->respond("c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,p=AAAAv3Bz2T0CJGbJQyF0X+HI4Ts=", response), QXmppSaslServer::Failed);
+}
+
+void tst_QXmppSasl::testServerScramSha256()
+{
+    QXmppSaslDigestMd5::setNonce("%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0");
+
+    QXmppSaslServer *server = QXmppSaslServer::create("SCRAM-SHA-256");
+    QVERIFY(server != 0);
+    QCOMPARE(server->mechanism(), QLatin1String("SCRAM-SHA-256"));
+
+    // credentials needed
+    QByteArray response;
+    const QByteArray request("n,,n=user,r=rOprNGfwEbeRWgbNEkqO");
+    QCOMPARE(server->respond(request, response), QXmppSaslServer::InputNeeded);
+    QCOMPARE(server->username(), QLatin1String("user"));
+
+    QByteArray storedKey, serverKey;
+    const QByteArray salt = QByteArray::fromBase64("W22ZaJ0SNY7soEsUEjb6gQ==");
+    QXmppSaslServerScram::deriveKeys(QCryptographicHash::Sha256, "pencil", salt, 4096, storedKey, serverKey);
+    static_cast<QXmppSaslServerScram *>(server)->setCredentials(salt, 4096, storedKey, serverKey);
+
+    // first challenge
+    QCOMPARE(server->respond(request, response), QXmppSaslServer::Challenge);
+    QCOMPARE(response, QByteArray("r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096"));
+
+    // success, with the server signature as additional data
+    QCOMPARE(server->respond("c=biws,r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,p=dHzbZapWIk4jUhN+Ute9ytag9zjfMHgsqmmiz7AndVQ=", response), QXmppSaslServer::Succeeded);
+    QCOMPARE(response, QByteArray("v=6rriTRBi23WpRR/wtup+mMhUZUn/dB5nLTJRsjl95G4="));
+
+    delete server;
+}
+
+void tst_QXmppSasl::testServerScramUnknownUser()
+{
+    QXmppSaslDigestMd5::setNonce("3rfcNHYJY1ZVvWVs7j");
+
+    const QByteArray request("n,,n=nobody,r=fyko+d2lbbFgONRv9qkxdawL");
+    auto challenge = [&]() {
+        QXmppSaslServerScram server(QCryptographicHash::Sha1);
+        QByteArray response;
+        if (server.respond(request, response) != QXmppSaslServer::InputNeeded)
+            return QByteArray();
+        server.setFakeCredentials();
+        if (server.respond(request, response) != QXmppSaslServer::Challenge)
+            return QByteArray();
+        return response;
+    };
+
+    // an unknown user gets a challenge with a stable salt
+    const auto response = challenge();
+    QVERIFY(response.startsWith("r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,s="));
+    QVERIFY(response.endsWith(",i=4096"));
+    QCOMPARE(challenge(), response);
+
+    // and fails at the proof step
+    QXmppSaslServerScram server(QCryptographicHash::Sha1);
+    QByteArray ignored;
+    QCOMPARE(server.respond(request, ignored), QXmppSaslServer::InputNeeded);
+    server.setFakeCredentials();
+    QCOMPARE(server.respond(request, ignored), QXmppSaslServer::Challenge);
+    QCOMPARE(server.respond("c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,p=v0X8v3Bz2T0CJGbJQyF0X+HI4Ts=", ignored), QXmppSaslServer::Failed);
+}
+
 QTEST_MAIN(tst_QXmppSasl)
 #include "tst_qxmppsasl.moc"
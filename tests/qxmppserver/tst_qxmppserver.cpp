@@ -22,9 +22,87 @@
  */
 
 #include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppOutgoingServer.h"
 #include "QXmppServer.h"
+#include "QXmppServerExtension.h"
 
 #include "util.h"
+#include <QMutex>
+#include <QThread>
+
+class TestDispatchExtension : public QXmppServerExtension
+{
+public:
+    TestDispatchExtension(const QString &name, int priority, const QVector<HandledStanza> &stanzas, QStringList &calls)
+        : m_name(name), m_priority(priority), m_stanzas(stanzas), m_calls(calls)
+    {
+    }
+
+    int extensionPriority() const override
+    {
+        return m_priority;
+    }
+
+    QVector<HandledStanza> handledStanzas() const override
+    {
+        return m_stanzas;
+    }
+
+    bool handleStanza(const QDomElement &stanza) override
+    {
+        m_calls << m_name;
+        return stanza.attribute("id") == m_name;
+    }
+
+private:
+    QString m_name;
+    int m_priority;
+    QVector<HandledStanza> m_stanzas;
+    QStringList &m_calls;
+};
+
+class TestAsyncExtension : public QXmppServerExtension
+{
+public:
+    int extensionPriority() const override
+    {
+        return 10;
+    }
+
+    bool claimStanza(const QDomElement &stanza) override
+    {
+        return stanza.firstChildElement("body").text().startsWith("async");
+    }
+
+    bool handleStanzaAsync(const QDomElement &stanza, QXmppStanzaResponses &responses) override
+    {
+        Q_UNUSED(responses);
+        QThread::msleep(50);
+
+        QMutexLocker locker(&mutex);
+        const QString body = stanza.firstChildElement("body").text();
+        handled << body;
+        threads << QThread::currentThread();
+        return body == "async-handled";
+    }
+
+    QMutex mutex;
+    QStringList handled;
+    QList<QThread *> threads;
+};
+
+class TestRecordingExtension : public QXmppServerExtension
+{
+public:
+    bool handleStanza(const QDomElement &stanza) override
+    {
+        recorded << stanza.firstChildElement("body").text();
+        return true;
+    }
+
+    QStringList recorded;
+};
 
 class tst_QXmppServer : public QObject
 {
@@ -33,6 +111,12 @@ class tst_QXmppServer : public QObject
 private slots:
     void testConnect_data();
     void testConnect();
+    void testWorkerThreads();
+    void testReusePort();
+    void testExtensionDispatch();
+    void testAsyncExtension();
+    void testOutgoingServerPool();
+    void testOutgoingServerQueuedBytes();
 };
 
 void tst_QXmppServer::testConnect_data()
@@ -61,6 +145,19 @@ void tst_QXmppServer::testConnect_data()
     QTest::newRow("digest-bad-password") << "testuser"
                                          << "badpwd"
                                          << "DIGEST-MD5" << false;
+
+    QTest::newRow("scram-sha1-good") << "testuser"
+                                     << "testpwd"
+                                     << "SCRAM-SHA-1" << true;
+    QTest::newRow("scram-sha1-bad-username") << "baduser"
+                                             << "testpwd"
+                                             << "SCRAM-SHA-1" << false;
+    QTest::newRow("scram-sha1-bad-password") << "testuser"
+                                             << "badpwd"
+                                             << "SCRAM-SHA-1" << false;
+    QTest::newRow("scram-sha256-good") << "testuser"
+                                       << "testpwd"
+                                       << "SCRAM-SHA-256" << true;
 }
 
 void tst_QXmppServer::testConnect()
@@ -109,5 +206,236 @@ void tst_QXmppServer::testConnect()
     QCOMPARE(client.isConnected(), connected);
 }
 
+void tst_QXmppServer::testWorkerThreads()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12346;
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+    passwordChecker.addCredentials("bob", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setWorkerThreadCount(2);
+    QCOMPARE(server.workerThreadCount(), 2);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // connect two clients, which end up in different worker threads
+    auto connectClient = [&](QXmppClient &client, const QString &username) {
+        QXmppConfiguration config;
+        config.setDomain(testDomain);
+        config.setHost(testHost.toString());
+        config.setPort(testPort);
+        config.setUser(username);
+        config.setPassword("testpwd");
+        client.connectToServer(config);
+    };
+
+    QXmppClient alice;
+    QXmppClient bob;
+    connectClient(alice, "alice");
+    connectClient(bob, "bob");
+    QTRY_VERIFY(alice.isConnected());
+    QTRY_VERIFY(bob.isConnected());
+
+    // route a message between the workers
+    QList<QXmppMessage> messages;
+    connect(&bob, &QXmppClient::messageReceived, this, [&](const QXmppMessage &message) {
+        messages << message;
+    });
+
+    QXmppMessage message;
+    message.setTo(bob.configuration().jid());
+    message.setBody("Hello Bob");
+    QVERIFY(alice.sendPacket(message));
+
+    QTRY_COMPARE(messages.size(), 1);
+    QCOMPARE(messages.first().body(), QStringLiteral("Hello Bob"));
+    QCOMPARE(messages.first().from(), alice.configuration().jid());
+
+    // broadcast a message to both workers, remote recipients are skipped
+    QList<QXmppMessage> aliceMessages;
+    connect(&alice, &QXmppClient::messageReceived, this, [&](const QXmppMessage &message) {
+        aliceMessages << message;
+    });
+
+    QXmppMessage announcement;
+    announcement.setFrom(testDomain);
+    announcement.setBody("Hello everyone");
+    const QStringList recipients = { "alice@localhost", "bob@localhost", "carol@example.com" };
+    QCOMPARE(server.broadcastPacket(recipients, announcement), 2);
+
+    QTRY_COMPARE(aliceMessages.size(), 1);
+    QTRY_COMPARE(messages.size(), 2);
+    QCOMPARE(aliceMessages.first().body(), QStringLiteral("Hello everyone"));
+    QCOMPARE(messages.last().body(), QStringLiteral("Hello everyone"));
+
+    alice.disconnectFromServer();
+    bob.disconnectFromServer();
+}
+
+void tst_QXmppServer::testReusePort()
+{
+#ifndef Q_OS_LINUX
+    QSKIP("SO_REUSEPORT listeners are only supported on Linux");
+#endif
+
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12347;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setWorkerThreadCount(2);
+    server.setReusePortEnabled(true);
+    QVERIFY(server.isReusePortEnabled());
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // the listeners of the workers accept connections on the same port
+    QList<QString> connectedJids;
+    connect(&server, &QXmppServer::clientConnected, this, [&](const QString &jid) {
+        connectedJids << jid;
+    });
+
+    QXmppClient clients[4];
+    for (int i = 0; i < 4; i++) {
+        QXmppConfiguration config;
+        config.setDomain(testDomain);
+        config.setHost(testHost.toString());
+        config.setPort(testPort);
+        config.setUser("testuser");
+        config.setPassword("testpwd");
+        config.setResource(QStringLiteral("resource%1").arg(i));
+        clients[i].connectToServer(config);
+    }
+    for (auto &client : clients)
+        QTRY_VERIFY(client.isConnected());
+    QTRY_COMPARE(connectedJids.size(), 4);
+
+    for (auto &client : clients)
+        client.disconnectFromServer();
+}
+
+void tst_QXmppServer::testExtensionDispatch()
+{
+    QStringList calls;
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.addExtension(new TestDispatchExtension("all", 0, {}, calls));
+    server.addExtension(new TestDispatchExtension("ping", 10, { { "iq", "urn:xmpp:ping" } }, calls));
+    server.addExtension(new TestDispatchExtension("iq", 5, { { "iq", QString() } }, calls));
+    server.addExtension(new TestDispatchExtension("receipts", 20, { { "message", "urn:xmpp:receipts" } }, calls));
+    server.addExtension(new TestDispatchExtension("chatstates", 1, { { "message", "http://jabber.org/protocol/chatstates" } }, calls));
+
+    auto dispatch = [&](const QByteArray &xml) {
+        calls.clear();
+        server.handleElement(xmlToDom(xml));
+        return calls;
+    };
+
+    // matching extensions are called in order of priority
+    QCOMPARE(dispatch("<iq xmlns='jabber:client' id='none' to='localhost' type='get'><ping xmlns='urn:xmpp:ping'/></iq>"),
+             QStringList({ "ping", "iq", "all" }));
+    QCOMPARE(dispatch("<iq xmlns='jabber:client' id='none' to='localhost' type='get'><query xmlns='jabber:iq:version'/></iq>"),
+             QStringList({ "iq", "all" }));
+    QCOMPARE(dispatch("<presence xmlns='jabber:client' id='none' to='localhost'/>"),
+             QStringList({ "all" }));
+
+    // several payloads merge their extensions
+    QCOMPARE(dispatch("<message xmlns='jabber:client' id='none' to='localhost'><body>hi</body>"
+                      "<active xmlns='http://jabber.org/protocol/chatstates'/><request xmlns='urn:xmpp:receipts'/></message>"),
+             QStringList({ "receipts", "chatstates", "all" }));
+    QCOMPARE(dispatch("<message xmlns='jabber:client' id='none' to='localhost'><body>hi</body></message>"),
+             QStringList({ "all" }));
+
+    // handling a stanza stops the dispatch
+    QCOMPARE(dispatch("<iq xmlns='jabber:client' id='ping' to='localhost' type='get'><ping xmlns='urn:xmpp:ping'/></iq>"),
+             QStringList({ "ping" }));
+
+    // extensions added later are taken into account
+    server.addExtension(new TestDispatchExtension("presence", 30, { { "presence", QString() } }, calls));
+    QCOMPARE(dispatch("<presence xmlns='jabber:client' id='none' to='localhost'/>"),
+             QStringList({ "presence", "all" }));
+}
+
+void tst_QXmppServer::testAsyncExtension()
+{
+    QXmppServer server;
+    server.setDomain("localhost");
+    auto *asyncExtension = new TestAsyncExtension;
+    auto *recordingExtension = new TestRecordingExtension;
+    server.addExtension(asyncExtension);
+    server.addExtension(recordingExtension);
+
+    auto send = [&](const QString &to, const QString &body) {
+        QXmppMessage message("alice@localhost/res", to, body);
+        server.handleElement(writePacketToDom(message));
+    };
+
+    send("bob@localhost", "async-1");
+    send("bob@localhost/res", "sync-2");
+    send("carol@localhost", "sync-3");
+    send("bob@localhost", "async-handled");
+    send("bob@localhost", "sync-5");
+
+    // stanzas to bob wait for the claimed stanza, others are not delayed
+    QCOMPARE(recordingExtension->recorded, QStringList({ "sync-3" }));
+
+    // unhandled claimed stanzas go on to the next extension, in order
+    QTRY_COMPARE(recordingExtension->recorded, QStringList({ "sync-3", "async-1", "sync-2", "sync-5" }));
+
+    QMutexLocker locker(&asyncExtension->mutex);
+    QCOMPARE(asyncExtension->handled, QStringList({ "async-1", "async-handled" }));
+    for (auto *thread : std::as_const(asyncExtension->threads))
+        QVERIFY(thread != QThread::currentThread());
+}
+
+void tst_QXmppServer::testOutgoingServerPool()
+{
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setOutgoingServerPoolSize(4);
+    QVERIFY(server.listenForServers(QHostAddress::LocalHost, 12360));
+
+    // the connections are opened synchronously, before the DNS lookups
+    // of the remote domains can fail
+    auto send = [&](const QString &from, const QString &to) {
+        server.sendPacket(QXmppMessage(from, to, "hi"));
+        return server.statistics().value("outgoing-servers").toInt();
+    };
+
+    // the stanzas between two users always take the same connection
+    for (int i = 0; i < 10; ++i)
+        QCOMPARE(send(QStringLiteral("alice@localhost/res%1").arg(i), "bob@a.invalid/res"), 1);
+
+    // other users are spread over the pool of the domain, which is filled
+    // as connections are needed
+    for (int i = 0; i < 64; ++i)
+        send("alice@localhost", QStringLiteral("user%1@a.invalid").arg(i));
+    QCOMPARE(server.statistics().value("outgoing-servers").toInt(), 4);
+
+    // each domain has a pool of its own
+    QCOMPARE(send("alice@localhost", "bob@b.invalid"), 5);
+}
+
+void tst_QXmppServer::testOutgoingServerQueuedBytes()
+{
+    QXmppOutgoingServer stream("localhost", nullptr);
+    QCOMPARE(stream.queuedBytes(), qint64(0));
+
+    // data is queued until the stream is connected
+    stream.queueData("<message/>");
+    stream.queueData("<presence/>");
+    QCOMPARE(stream.queuedBytes(), qint64(21));
+}
+
 QTEST_MAIN(tst_QXmppServer)
 #include "tst_qxmppserver.moc"
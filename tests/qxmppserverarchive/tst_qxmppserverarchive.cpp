@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppMamManager.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+#include "QXmppServerArchive.h"
+
+#include "util.h"
+#include <QDirIterator>
+#include <QObject>
+#include <QTemporaryDir>
+
+struct ArchivePage
+{
+    QStringList bodies;
+    QXmppResultSetReply resultSetReply;
+    bool complete = false;
+};
+
+class tst_QXmppServerArchive : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testClaim_data();
+    Q_SLOT void testClaim();
+    Q_SLOT void testQuery();
+    Q_SLOT void testRecovery();
+
+    ArchivePage query(QXmppMamManager *manager, const QXmppResultSetQuery &resultSetQuery, const QString &with = QString());
+};
+
+static void sendMessage(QXmppServer &server, const QString &from, int number)
+{
+    // large messages, so that the archive has several segments and index
+    // entries
+    const auto body = QString::number(number) + QLatin1Char(' ') + QString(600, QLatin1Char('x'));
+    QXmppMessage message(from, QStringLiteral("alice@localhost"), body);
+    server.handleElement(writePacketToDom(message));
+}
+
+static QStringList numbers(int first, int last)
+{
+    QStringList numbers;
+    for (int i = first; i <= last; i++)
+        numbers << QString::number(i);
+    return numbers;
+}
+
+static QXmppResultSetQuery resultSetQuery(int max, const QString &after = QString(), const QString &before = QString())
+{
+    QXmppResultSetQuery query;
+    query.setMax(max);
+    query.setAfter(after);
+    query.setBefore(before);
+    return query;
+}
+
+ArchivePage tst_QXmppServerArchive::query(QXmppMamManager *manager, const QXmppResultSetQuery &resultSetQuery, const QString &with)
+{
+    ArchivePage page;
+    bool finished = false;
+
+    QObject context;
+    const auto queryId = manager->retrieveArchivedMessages(QString(), QString(), with, QDateTime(), QDateTime(), resultSetQuery);
+    connect(manager, &QXmppMamManager::archivedMessageReceived, &context, [&](const QString &id, const QXmppMessage &message) {
+        if (id == queryId)
+            page.bodies << message.body().section(QLatin1Char(' '), 0, 0);
+    });
+    connect(manager, &QXmppMamManager::resultsRecieved, &context, [&](const QString &id, const QXmppResultSetReply &resultSetReply, bool complete) {
+        if (id == queryId) {
+            page.resultSetReply = resultSetReply;
+            page.complete = complete;
+            finished = true;
+        }
+    });
+
+    [&]() { QTRY_VERIFY(finished); }();
+    return page;
+}
+
+void tst_QXmppServerArchive::testClaim_data()
+{
+    QTest::addColumn<QString>("xml");
+    QTest::addColumn<bool>("claimed");
+
+    QTest::newRow("received") << "<message from='bob@example.com/res' to='alice@localhost' type='chat'><body>hi</body></message>" << true;
+    QTest::newRow("sent") << "<message from='alice@localhost/res' to='bob@example.com'><body>hi</body></message>" << true;
+    QTest::newRow("remote") << "<message from='bob@example.com/res' to='carol@example.com'><body>hi</body></message>" << false;
+    QTest::newRow("no-body") << "<message from='bob@example.com/res' to='alice@localhost' type='chat'/>" << false;
+    QTest::newRow("groupchat") << "<message from='room@example.com/bob' to='alice@localhost/res' type='groupchat'><body>hi</body></message>" << false;
+    QTest::newRow("error") << "<message from='bob@example.com/res' to='alice@localhost' type='error'><body>hi</body></message>" << false;
+
+    QTest::newRow("query") << "<iq from='alice@localhost/res' id='q1' type='set'><query xmlns='urn:xmpp:mam:2'/></iq>" << true;
+    QTest::newRow("query-bare-jid") << "<iq from='alice@localhost/res' to='alice@localhost' id='q1' type='set'><query xmlns='urn:xmpp:mam:2'/></iq>" << true;
+    QTest::newRow("query-other-user") << "<iq from='alice@localhost/res' to='bob@localhost' id='q1' type='set'><query xmlns='urn:xmpp:mam:2'/></iq>" << false;
+    QTest::newRow("query-remote") << "<iq from='bob@example.com/res' to='localhost' id='q1' type='set'><query xmlns='urn:xmpp:mam:2'/></iq>" << false;
+    QTest::newRow("query-node") << "<iq from='alice@localhost/res' id='q1' type='set'><query xmlns='urn:xmpp:mam:2' node='news'/></iq>" << false;
+}
+
+void tst_QXmppServerArchive::testClaim()
+{
+    QFETCH(QString, xml);
+    QFETCH(bool, claimed);
+
+    QTemporaryDir dir;
+    QXmppServer server;
+    server.setDomain("localhost");
+    auto *archive = new QXmppServerArchive;
+    archive->setDirectory(dir.path());
+    server.addExtension(archive);
+    QCOMPARE(archive->extensionName(), QStringLiteral("mam"));
+    QVERIFY(archive->start());
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+    QCOMPARE(archive->claimStanza(doc.documentElement()), claimed);
+}
+
+void tst_QXmppServerArchive::testQuery()
+{
+    const quint16 testPort = 12350;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+
+    QTemporaryDir dir;
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    auto *archive = new QXmppServerArchive;
+    archive->setDirectory(dir.path());
+    archive->setSegmentSize(8192);
+    archive->setMaxPageSize(20);
+    server.addExtension(archive);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    QXmppClient client;
+    auto *manager = new QXmppMamManager;
+    client.addExtension(manager);
+    connectClient(client, "alice", testPort);
+    QTRY_VERIFY(client.isConnected());
+
+    // queries are answered after the earlier messages to alice were archived
+    for (int i = 1; i <= 30; i++)
+        sendMessage(server, i % 3 ? QStringLiteral("bob@example.com/res") : QStringLiteral("carol@example.com/res"), i);
+
+    // page forwards
+    auto page = query(manager, resultSetQuery(10));
+    QCOMPARE(page.bodies, numbers(1, 10));
+    QVERIFY(!page.complete);
+
+    page = query(manager, resultSetQuery(15, page.resultSetReply.last()));
+    QCOMPARE(page.bodies, numbers(11, 25));
+    QVERIFY(!page.complete);
+
+    page = query(manager, resultSetQuery(15, page.resultSetReply.last()));
+    QCOMPARE(page.bodies, numbers(26, 30));
+    QVERIFY(page.complete);
+
+    // page backwards from the end
+    page = query(manager, resultSetQuery(4, QString(), QStringLiteral("")));
+    QCOMPARE(page.bodies, numbers(27, 30));
+    QVERIFY(!page.complete);
+
+    page = query(manager, resultSetQuery(25, QString(), page.resultSetReply.first()));
+    QCOMPARE(page.bodies, numbers(7, 26));
+    QVERIFY(!page.complete);
+
+    page = query(manager, resultSetQuery(25, QString(), page.resultSetReply.first()));
+    QCOMPARE(page.bodies, numbers(1, 6));
+    QVERIFY(page.complete);
+
+    // the page size is limited by the server
+    page = query(manager, QXmppResultSetQuery());
+    QCOMPARE(page.bodies, numbers(1, 20));
+    QVERIFY(!page.complete);
+
+    // filter by the other party
+    page = query(manager, resultSetQuery(4, QString(), QStringLiteral("")), QStringLiteral("carol@example.com"));
+    QCOMPARE(page.bodies, QStringList({ "21", "24", "27", "30" }));
+    QVERIFY(!page.complete);
+
+    page = query(manager, resultSetQuery(10, page.resultSetReply.last()), QStringLiteral("carol@example.com/res"));
+    QCOMPARE(page.bodies, QStringList());
+    QVERIFY(page.complete);
+
+    // unknown IDs are rejected
+    QXmppIq error;
+    connect(&client, &QXmppClient::iqReceived, this, [&](const QXmppIq &iq) {
+        error = iq;
+    });
+    const auto queryId = manager->retrieveArchivedMessages(QString(), QString(), QString(), QDateTime(), QDateTime(),
+                                                           resultSetQuery(10, QStringLiteral("0000000000000001")));
+    QTRY_COMPARE(error.id(), queryId);
+    QCOMPARE(error.type(), QXmppIq::Error);
+    QCOMPARE(error.error().condition(), QXmppStanza::Error::ItemNotFound);
+}
+
+void tst_QXmppServerArchive::testRecovery()
+{
+    const quint16 testPort = 12351;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+
+    QTemporaryDir dir;
+    {
+        QXmppServer server;
+        server.setDomain("localhost");
+        auto *archive = new QXmppServerArchive;
+        archive->setDirectory(dir.path());
+        server.addExtension(archive);
+        QVERIFY(archive->start());
+
+        for (int i = 1; i <= 10; i++)
+            sendMessage(server, QStringLiteral("bob@example.com/res"), i);
+    }
+
+    // a record truncated by a crash is dropped
+    QDirIterator itr(dir.path(), { QStringLiteral("*.seg") }, QDir::Files, QDirIterator::Subdirectories);
+    QVERIFY(itr.hasNext());
+    QFile segment(itr.next());
+    QVERIFY(segment.open(QIODevice::WriteOnly | QIODevice::Append));
+    segment.write(QByteArray(20, '\xff'));
+    segment.close();
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    auto *archive = new QXmppServerArchive;
+    archive->setDirectory(dir.path());
+    server.addExtension(archive);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    for (int i = 11; i <= 12; i++)
+        sendMessage(server, QStringLiteral("bob@example.com/res"), i);
+
+    QXmppClient client;
+    auto *manager = new QXmppMamManager;
+    client.addExtension(manager);
+    connectClient(client, "alice", testPort);
+    QTRY_VERIFY(client.isConnected());
+
+    const auto page = query(manager, resultSetQuery(20));
+    QCOMPARE(page.bodies, numbers(1, 12));
+    QVERIFY(page.complete);
+}
+
+QTEST_MAIN(tst_QXmppServerArchive)
+#include "tst_qxmppserverarchive.moc"
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServer.h"
+#include "QXmppServerMetrics.h"
+
+#include "util.h"
+#include <QObject>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+
+#include <thread>
+
+class tst_QXmppServerMetrics : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testOpenMetrics();
+    Q_SLOT void testHistogramBuckets();
+    Q_SLOT void testHttp();
+    Q_SLOT void testFile();
+};
+
+void tst_QXmppServerMetrics::testOpenMetrics()
+{
+    QXmppServer server;
+    auto *metrics = new QXmppServerMetrics;
+    server.addExtension(metrics);
+    QCOMPARE(metrics->extensionName(), QStringLiteral("metrics"));
+    QVERIFY(metrics->start());
+
+    emit server.setGauge("incoming-client.count", 1);
+    emit server.setGauge("incoming-client.count", 2);
+    emit server.updateCounter("fan-out.count");
+    emit server.updateCounter("fan-out.count", 3);
+    emit server.updateHistogram("routing.fan-out", 1);
+    emit server.updateHistogram("routing.fan-out", 3);
+    emit server.updateHistogram("routing.fan-out", 2000);
+
+    // gauges of individual streams are not exported
+    emit server.setGauge("stream.bytes", 3);
+    emit server.setGauge("stream-management.unacked.count", 5);
+
+    // metrics reported by other threads are merged
+    std::thread([&server]() {
+        emit server.updateCounter("fan-out.count", 5);
+        emit server.setGauge("incoming-client.count", 4);
+    }).join();
+
+    QCOMPARE(metrics->openMetricsText(),
+             QByteArray("# TYPE qxmpp_incoming_client_count gauge\n"
+                        "qxmpp_incoming_client_count 4\n"
+                        "# TYPE qxmpp_fan_out_count counter\n"
+                        "qxmpp_fan_out_count_total 9\n"
+                        "# TYPE qxmpp_routing_fan_out histogram\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"1\"} 1\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"2\"} 1\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"5\"} 2\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"10\"} 2\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"20\"} 2\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"50\"} 2\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"100\"} 2\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"200\"} 2\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"500\"} 2\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"1000\"} 2\n"
+                        "qxmpp_routing_fan_out_bucket{le=\"+Inf\"} 3\n"
+                        "qxmpp_routing_fan_out_sum 2004\n"
+                        "qxmpp_routing_fan_out_count 3\n"
+                        "# EOF\n"));
+
+    // nothing is recorded once stopped
+    metrics->stop();
+    emit server.updateCounter("fan-out.count");
+    QVERIFY(metrics->openMetricsText().contains("qxmpp_fan_out_count_total 9\n"));
+}
+
+void tst_QXmppServerMetrics::testHistogramBuckets()
+{
+    QXmppServer server;
+    auto *metrics = new QXmppServerMetrics;
+    metrics->setHistogramBuckets("test.latency", { 0.5, 0.1, 0.5 });
+    QCOMPARE(metrics->histogramBuckets("test.latency"), QVector<double>({ 0.1, 0.5 }));
+    server.addExtension(metrics);
+    QVERIFY(metrics->start());
+
+    emit server.updateHistogram("test.latency", 0.1);
+    emit server.updateHistogram("test.latency", 0.25);
+
+    QCOMPARE(metrics->openMetricsText(),
+             QByteArray("# TYPE qxmpp_test_latency histogram\n"
+                        "qxmpp_test_latency_bucket{le=\"0.1\"} 1\n"
+                        "qxmpp_test_latency_bucket{le=\"0.5\"} 2\n"
+                        "qxmpp_test_latency_bucket{le=\"+Inf\"} 2\n"
+                        "qxmpp_test_latency_sum 0.35\n"
+                        "qxmpp_test_latency_count 2\n"
+                        "# EOF\n"));
+}
+
+void tst_QXmppServerMetrics::testHttp()
+{
+    QXmppServer server;
+    auto *metrics = new QXmppServerMetrics;
+    metrics->setPort(12349);
+    server.addExtension(metrics);
+    QVERIFY(metrics->start());
+    emit server.updateCounter("fan-out.count");
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 12349);
+    QVERIFY(socket.waitForConnected());
+    socket.write("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+    QByteArray response;
+    connect(&socket, &QIODevice::readyRead, this, [&]() {
+        response += socket.readAll();
+    });
+    QTRY_COMPARE(socket.state(), QAbstractSocket::UnconnectedState);
+    response += socket.readAll();
+
+    QVERIFY(response.startsWith("HTTP/1.0 200 OK\r\n"));
+    QVERIFY(response.endsWith("\r\n\r\n" + metrics->openMetricsText()));
+}
+
+void tst_QXmppServerMetrics::testFile()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const auto path = dir.filePath("metrics.txt");
+
+    QXmppServer server;
+    auto *metrics = new QXmppServerMetrics;
+    metrics->setFilePath(path);
+    server.addExtension(metrics);
+    QVERIFY(metrics->start());
+    emit server.updateCounter("fan-out.count", 2);
+
+    // the metrics are written when stopping
+    metrics->stop();
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), metrics->openMetricsText());
+}
+
+QTEST_MAIN(tst_QXmppServerMetrics)
+#include "tst_qxmppservermetrics.moc"
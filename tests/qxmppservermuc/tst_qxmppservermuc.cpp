@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppMucManager.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppServerMuc.h"
+#include "QXmppUtils.h"
+
+#include "util.h"
+#include <QObject>
+
+static const QString roomJid = QStringLiteral("room@conference.localhost");
+
+class tst_QXmppServerMuc : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testHandled_data();
+    Q_SLOT void testHandled();
+    Q_SLOT void testOccupants();
+    Q_SLOT void testMessages();
+    Q_SLOT void testPresenceBatching();
+};
+
+static void sendPresence(QXmppServer &server, const QString &from, const QString &nick, QXmppPresence::Type type = QXmppPresence::Available)
+{
+    QXmppPresence presence(type);
+    presence.setFrom(from);
+    presence.setTo(roomJid + QLatin1Char('/') + nick);
+    server.handleElement(writePacketToDom(presence));
+}
+
+void tst_QXmppServerMuc::testHandled_data()
+{
+    QTest::addColumn<QString>("xml");
+    QTest::addColumn<bool>("handled");
+
+    QTest::newRow("join") << "<presence from='alice@localhost/res' to='room@conference.localhost/alice'/>" << true;
+    QTest::newRow("message") << "<message from='alice@localhost/res' to='room@conference.localhost' type='groupchat'><body>hi</body></message>" << true;
+    QTest::newRow("disco") << "<iq from='alice@localhost/res' to='conference.localhost' id='d1' type='get'><query xmlns='http://jabber.org/protocol/disco#info'/></iq>" << true;
+    QTest::newRow("user") << "<message from='alice@localhost/res' to='bob@localhost' type='chat'><body>hi</body></message>" << false;
+    QTest::newRow("server") << "<iq from='alice@localhost/res' to='localhost' id='d1' type='get'><query xmlns='http://jabber.org/protocol/disco#info'/></iq>" << false;
+    QTest::newRow("other-service") << "<presence from='alice@localhost/res' to='room@muc.localhost/alice'/>" << false;
+}
+
+void tst_QXmppServerMuc::testHandled()
+{
+    QFETCH(QString, xml);
+    QFETCH(bool, handled);
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    auto *muc = new QXmppServerMuc;
+    server.addExtension(muc);
+    QCOMPARE(muc->extensionName(), QStringLiteral("muc"));
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+
+    // nothing is handled until the service is started
+    QVERIFY(!muc->handleStanza(doc.documentElement()));
+    QVERIFY(muc->start());
+    QCOMPARE(muc->jid(), QStringLiteral("conference.localhost"));
+    QCOMPARE(muc->handleStanza(doc.documentElement()), handled);
+}
+
+void tst_QXmppServerMuc::testOccupants()
+{
+    QXmppServer server;
+    server.setDomain("localhost");
+    auto *muc = new QXmppServerMuc;
+    server.addExtension(muc);
+    QVERIFY(muc->start());
+
+    sendPresence(server, "alice@localhost/res", "alice");
+    sendPresence(server, "bob@localhost/res", "bob");
+    sendPresence(server, "carol@localhost/res", "carol");
+    QCOMPARE(muc->rooms(), QStringList({ roomJid }));
+    QCOMPARE(muc->occupants(roomJid), QStringList({ "alice", "bob", "carol" }));
+
+    // taken nicknames, nickname changes and remote users are refused
+    sendPresence(server, "dave@localhost/res", "bob");
+    sendPresence(server, "alice@localhost/res", "alicia");
+    sendPresence(server, "erin@example.com/res", "erin");
+    QCOMPARE(muc->occupants(roomJid), QStringList({ "alice", "bob", "carol" }));
+
+    // occupants can leave and join again
+    sendPresence(server, "alice@localhost/res", "alice", QXmppPresence::Unavailable);
+    QCOMPARE(muc->occupants(roomJid), QStringList({ "bob", "carol" }));
+    sendPresence(server, "alice@localhost/res", "alice");
+    sendPresence(server, "carol@localhost/res", "carol", QXmppPresence::Unavailable);
+    QCOMPARE(muc->occupants(roomJid), QStringList({ "alice", "bob" }));
+
+    // the room is destroyed once it is empty
+    sendPresence(server, "alice@localhost/res", "alice", QXmppPresence::Unavailable);
+    sendPresence(server, "bob@localhost/res", "bob", QXmppPresence::Unavailable);
+    QVERIFY(muc->rooms().isEmpty());
+}
+
+void tst_QXmppServerMuc::testMessages()
+{
+    const quint16 testPort = 12352;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+    passwordChecker.addCredentials("bob", "testpwd");
+    passwordChecker.addCredentials("carol", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    auto *muc = new QXmppServerMuc;
+    muc->setHistorySize(2);
+    server.addExtension(muc);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    QXmppClient clients[3];
+    QXmppMucRoom *rooms[3];
+    QStringList received[3];
+    const QStringList users = { "alice", "bob", "carol" };
+    for (int i = 0; i < 3; ++i) {
+        auto *manager = new QXmppMucManager;
+        clients[i].addExtension(manager);
+        rooms[i] = manager->addRoom(roomJid);
+        rooms[i]->setNickName(users.at(i));
+        connect(rooms[i], &QXmppMucRoom::messageReceived, this, [&received, i](const QXmppMessage &message) {
+            if (!message.body().isEmpty())
+                received[i] << QXmppUtils::jidToResource(message.from()) + QLatin1Char(':') + message.body();
+        });
+        connectClient(clients[i], users.at(i), testPort);
+        QTRY_VERIFY(clients[i].isConnected());
+    }
+
+    // the first occupant owns the room
+    QVERIFY(rooms[0]->join());
+    QTRY_VERIFY(rooms[0]->isJoined());
+    QVERIFY(rooms[0]->allowedActions() & QXmppMucRoom::KickAction);
+    QVERIFY(rooms[1]->join());
+    QTRY_VERIFY(rooms[1]->isJoined());
+    QTRY_COMPARE(rooms[0]->participants().size(), 2);
+
+    // messages reach all occupants, including the sender
+    QVERIFY(rooms[0]->sendMessage("first"));
+    QTRY_COMPARE(received[1].size(), 1);
+    QVERIFY(rooms[1]->sendMessage("second"));
+    QTRY_COMPARE(received[0].size(), 2);
+    QVERIFY(rooms[0]->sendMessage("third"));
+    const QStringList messages = { "alice:first", "bob:second", "alice:third" };
+    QTRY_COMPARE(received[0], messages);
+    QTRY_COMPARE(received[1], messages);
+
+    // new occupants get the history
+    QVERIFY(rooms[2]->join());
+    QTRY_COMPARE(received[2], QStringList({ "bob:second", "alice:third" }));
+    QTRY_COMPARE(rooms[2]->participants().size(), 3);
+
+    // occupants which leave or are kicked are removed
+    QVERIFY(rooms[1]->leave());
+    QTRY_COMPARE(rooms[0]->participants().size(), 2);
+    QVERIFY(!rooms[0]->participants().contains(roomJid + "/bob"));
+
+    QString kickActor;
+    connect(rooms[2], &QXmppMucRoom::kicked, this, [&](const QString &actor) {
+        kickActor = actor;
+    });
+    QVERIFY(rooms[0]->kick(roomJid + "/carol", "bye"));
+    QTRY_VERIFY(!rooms[2]->isJoined());
+    QCOMPARE(kickActor, clients[0].configuration().jid());
+    QCOMPARE(muc->occupants(roomJid), QStringList({ "alice" }));
+
+    // the room is destroyed once the last occupant disconnects
+    clients[0].disconnectFromServer();
+    QTRY_VERIFY(muc->rooms().isEmpty());
+}
+
+void tst_QXmppServerMuc::testPresenceBatching()
+{
+    const quint16 testPort = 12353;
+    const int count = 5;
+
+    TestPasswordChecker passwordChecker;
+    for (int i = 0; i < count; ++i)
+        passwordChecker.addCredentials(QStringLiteral("user%1").arg(i), "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    auto *muc = new QXmppServerMuc;
+    muc->setPresenceBatchThreshold(1);
+    muc->setPresenceBatchInterval(200);
+    server.addExtension(muc);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    QXmppClient clients[count];
+    QStringList presences[count];
+    for (int i = 0; i < count; ++i) {
+        connect(&clients[i], &QXmppClient::presenceReceived, this, [&presences, i](const QXmppPresence &presence) {
+            if (QXmppUtils::jidToBareJid(presence.from()) == roomJid)
+                presences[i] << QXmppUtils::jidToResource(presence.from());
+        });
+        connectClient(clients[i], QStringLiteral("user%1").arg(i), testPort);
+        QTRY_VERIFY(clients[i].isConnected());
+    }
+
+    // occupants join while presences are pending, each of them learns about
+    // every occupant exactly once
+    QStringList nicks;
+    for (int i = 0; i < count; ++i) {
+        nicks << QStringLiteral("user%1").arg(i);
+        QXmppPresence presence;
+        presence.setTo(roomJid + QLatin1Char('/') + nicks.last());
+        clients[i].sendPacket(presence);
+        QTRY_VERIFY(presences[i].contains(nicks.last()));
+    }
+    QCOMPARE(muc->occupants(roomJid), nicks);
+
+    for (int i = 0; i < count; ++i) {
+        QTRY_COMPARE(presences[i].size(), count);
+        presences[i].sort();
+        QCOMPARE(presences[i], nicks);
+    }
+}
+
+QTEST_MAIN(tst_QXmppServerMuc)
+#include "tst_qxmppservermuc.moc"
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+#include "QXmppServerOfflineStore.h"
+
+#include "util.h"
+#include <QDirIterator>
+#include <QObject>
+#include <QTemporaryDir>
+
+class tst_QXmppServerOfflineStore : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testClaim_data();
+    Q_SLOT void testClaim();
+    Q_SLOT void testDelivery();
+    Q_SLOT void testBounce();
+    Q_SLOT void testCompaction();
+    Q_SLOT void testExpiry();
+};
+
+// Returns the names of the segments in the store's directory.
+static QStringList segments(const QString &directory)
+{
+    QStringList names;
+    QDirIterator itr(directory, { QStringLiteral("*.seg") }, QDir::Files, QDirIterator::Subdirectories);
+    while (itr.hasNext())
+        names << QFileInfo(itr.next()).fileName();
+    names.sort();
+    return names;
+}
+
+static void sendMessage(QXmppServer &server, const QString &to, const QString &body)
+{
+    QXmppMessage message(QStringLiteral("alice@localhost/res"), to, body);
+    server.handleElement(writePacketToDom(message));
+}
+
+void tst_QXmppServerOfflineStore::testClaim_data()
+{
+    QTest::addColumn<QString>("to");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<QString>("body");
+    QTest::addColumn<bool>("claimed");
+
+    QTest::newRow("chat") << "bob@localhost" << int(QXmppMessage::Chat) << "hi" << true;
+    QTest::newRow("normal") << "bob@localhost/res" << int(QXmppMessage::Normal) << "hi" << true;
+    QTest::newRow("groupchat") << "bob@localhost" << int(QXmppMessage::GroupChat) << "hi" << false;
+    QTest::newRow("headline") << "bob@localhost" << int(QXmppMessage::Headline) << "hi" << false;
+    QTest::newRow("error") << "bob@localhost" << int(QXmppMessage::Error) << "hi" << false;
+    QTest::newRow("no-body") << "bob@localhost" << int(QXmppMessage::Chat) << QString() << false;
+    QTest::newRow("server") << "localhost" << int(QXmppMessage::Chat) << "hi" << false;
+    QTest::newRow("remote") << "bob@example.com" << int(QXmppMessage::Chat) << "hi" << false;
+}
+
+void tst_QXmppServerOfflineStore::testClaim()
+{
+    QFETCH(QString, to);
+    QFETCH(int, type);
+    QFETCH(QString, body);
+    QFETCH(bool, claimed);
+
+    QTemporaryDir dir;
+    QXmppServer server;
+    server.setDomain("localhost");
+    auto *store = new QXmppServerOfflineStore;
+    store->setDirectory(dir.path());
+    server.addExtension(store);
+    QCOMPARE(store->extensionName(), QStringLiteral("offline"));
+
+    QXmppMessage message(QStringLiteral("alice@localhost/res"), to, body);
+    message.setType(QXmppMessage::Type(type));
+    const auto element = writePacketToDom(message);
+
+    // nothing is claimed until the store is started
+    QVERIFY(!store->claimStanza(element));
+    QVERIFY(store->start());
+    QCOMPARE(store->claimStanza(element), claimed);
+}
+
+void tst_QXmppServerOfflineStore::testDelivery()
+{
+    const quint16 testPort = 12348;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("bob", "testpwd");
+
+    QTemporaryDir dir;
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    auto *store = new QXmppServerOfflineStore;
+    store->setDirectory(dir.path());
+    // every message starts a new segment
+    store->setSegmentSize(1);
+    server.addExtension(store);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    sendMessage(server, "bob@localhost", "first");
+    sendMessage(server, "bob@localhost/res", "second");
+    QTRY_COMPARE(segments(dir.path()), QStringList({ "00000000.seg", "00000001.seg" }));
+
+    // the stored messages are delivered once bob connects, in order
+    QXmppClient bob;
+    QStringList received;
+    connect(&bob, &QXmppClient::messageReceived, this, [&](const QXmppMessage &message) {
+        QVERIFY(message.stamp().isValid());
+        received << message.body();
+    });
+    connectClient(bob, "bob", testPort);
+    QTRY_COMPARE(received, QStringList({ "first", "second" }));
+
+    // and removed once they were handed over
+    QTRY_VERIFY(segments(dir.path()).isEmpty());
+
+    // messages to online users are not stored
+    sendMessage(server, "bob@localhost", "third");
+    QTRY_COMPARE(received, QStringList({ "first", "second", "third" }));
+    QVERIFY(segments(dir.path()).isEmpty());
+}
+
+void tst_QXmppServerOfflineStore::testBounce()
+{
+    const quint16 testPort = 12350;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("alice", "testpwd");
+    passwordChecker.addCredentials("bob", "testpwd");
+
+    QTemporaryDir dir;
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    auto *store = new QXmppServerOfflineStore;
+    store->setDirectory(dir.path());
+    store->setMaxMessages(2);
+    server.addExtension(store);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    QXmppClient alice;
+    QList<QXmppMessage> errors;
+    connect(&alice, &QXmppClient::messageReceived, this, [&](const QXmppMessage &message) {
+        if (message.type() == QXmppMessage::Error)
+            errors << message;
+    });
+    connectClient(alice, "alice", testPort);
+    QTRY_VERIFY(alice.isAuthenticated());
+
+    // messages to unknown users are not stored
+    alice.sendMessage("carol@localhost", "lost");
+    QTRY_COMPARE(errors.size(), 1);
+    QCOMPARE(errors.at(0).from(), QStringLiteral("carol@localhost"));
+    QCOMPARE(errors.at(0).error().condition(), QXmppStanza::Error::ServiceUnavailable);
+    QVERIFY(segments(dir.path()).isEmpty());
+
+    // messages above the quota are not stored
+    alice.sendMessage("bob@localhost", "first");
+    alice.sendMessage("bob@localhost", "second");
+    alice.sendMessage("bob@localhost", "third");
+    QTRY_COMPARE(errors.size(), 2);
+    QCOMPARE(errors.at(1).from(), QStringLiteral("bob@localhost"));
+    QCOMPARE(errors.at(1).error().type(), QXmppStanza::Error::Wait);
+    QCOMPARE(errors.at(1).error().condition(), QXmppStanza::Error::ResourceConstraint);
+
+    QXmppClient bob;
+    QStringList received;
+    connect(&bob, &QXmppClient::messageReceived, this, [&](const QXmppMessage &message) {
+        received << message.body();
+    });
+    connectClient(bob, "bob", testPort);
+    QTRY_COMPARE(received, QStringList({ "first", "second" }));
+}
+
+void tst_QXmppServerOfflineStore::testCompaction()
+{
+    const quint16 testPort = 12349;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("bob", "testpwd");
+
+    QTemporaryDir dir;
+    {
+        QXmppServer server;
+        server.setDomain("localhost");
+        auto *store = new QXmppServerOfflineStore;
+        store->setDirectory(dir.path());
+        store->setSegmentSize(1);
+        server.addExtension(store);
+        QVERIFY(store->start());
+
+        sendMessage(server, "bob@localhost", "first");
+        sendMessage(server, "bob@localhost", "second");
+        sendMessage(server, "bob@localhost", "third");
+        QTRY_COMPARE(segments(dir.path()).size(), 3);
+    }
+
+    // a server with larger segments merges them
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    auto *store = new QXmppServerOfflineStore;
+    store->setDirectory(dir.path());
+    store->setCompactionInterval(50);
+    server.addExtension(store);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+    QTRY_COMPARE(segments(dir.path()), QStringList({ "00000000.seg" }));
+
+    QXmppClient bob;
+    QStringList received;
+    connect(&bob, &QXmppClient::messageReceived, this, [&](const QXmppMessage &message) {
+        received << message.body();
+    });
+    connectClient(bob, "bob", testPort);
+    QTRY_COMPARE(received, QStringList({ "first", "second", "third" }));
+}
+
+void tst_QXmppServerOfflineStore::testExpiry()
+{
+    QTemporaryDir dir;
+    QXmppServer server;
+    server.setDomain("localhost");
+    auto *store = new QXmppServerOfflineStore;
+    store->setDirectory(dir.path());
+    store->setMaxAge(500);
+    store->setCompactionInterval(50);
+    server.addExtension(store);
+    QVERIFY(store->start());
+
+    sendMessage(server, "bob@localhost", "expires");
+    QTRY_COMPARE(segments(dir.path()).size(), 1);
+
+    // the compaction removes the expired message and the user's directory
+    QTRY_VERIFY(segments(dir.path()).isEmpty());
+    QTRY_VERIFY(QDir(dir.path()).entryList(QDir::Dirs | QDir::NoDotAndDotDot).isEmpty());
+}
+
+QTEST_MAIN(tst_QXmppServerOfflineStore)
+#include "tst_qxmppserverofflinestore.moc"
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppStanzaScanner_p.h"
+
+#include "util.h"
+#include <QObject>
+
+using namespace QXmpp::Private;
+
+class tst_QXmppStanzaScanner : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testForwardable_data();
+    Q_SLOT void testForwardable();
+};
+
+void tst_QXmppStanzaScanner::testForwardable_data()
+{
+    QTest::addColumn<QByteArray>("stanza");
+    QTest::addColumn<bool>("forwardable");
+
+    QTest::newRow("plain") << QByteArray("<message to='a@b'><body>hi</body></message>") << true;
+    QTest::newRow("predefined-entities") << QByteArray("<message to='a&amp;b'><body>&lt;&gt;&amp;&quot;&apos;</body></message>") << true;
+    QTest::newRow("character-references") << QByteArray("<message><body>&#228;&#x20AC;</body></message>") << true;
+    QTest::newRow("cdata") << QByteArray("<message><body><![CDATA[&x; <!-- -->]]></body></message>") << true;
+    QTest::newRow("namespace") << QByteArray("<message xmlns='jabber:server'/>") << false;
+    QTest::newRow("entity") << QByteArray("<message><body>&x;</body></message>") << false;
+    QTest::newRow("entity-long-name") << QByteArray("<message><body>&ampampampamp;</body></message>") << false;
+    QTest::newRow("entity-in-attribute") << QByteArray("<message to='&x;'/>") << false;
+    QTest::newRow("comment") << QByteArray("<message><body>a<!-- x -->b</body></message>") << false;
+    QTest::newRow("processing-instruction") << QByteArray("<message><?x y?><body>a</body></message>") << false;
+}
+
+void tst_QXmppStanzaScanner::testForwardable()
+{
+    QFETCH(QByteArray, stanza);
+    QFETCH(bool, forwardable);
+
+    const QByteArray stream = "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>";
+    const QByteArray next = "<presence/>";
+
+    // the result does not depend on how the data is split
+    for (const int chunkSize : { 1, 5, 1000 }) {
+        StanzaScanner scanner;
+        const QByteArray data = stream + stanza + next;
+        for (int i = 0; i < data.size(); i += chunkSize)
+            scanner.scan(data.mid(i, chunkSize));
+
+        QCOMPARE(scanner.takeStanza(), forwardable ? stanza : QByteArray());
+
+        // the next stanza is not affected
+        QCOMPARE(scanner.takeStanza(), next);
+    }
+}
+
+QTEST_MAIN(tst_QXmppStanzaScanner)
+#include "tst_qxmppstanzascanner.moc"
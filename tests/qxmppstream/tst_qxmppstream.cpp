@@ -21,10 +21,18 @@
  *
  */
 
+#include "QXmppIq.h"
+#include "QXmppMessage.h"
 #include "QXmppStream.h"
 
 #include "util.h"
 
+#include <QDir>
+#include <QFile>
+#include <QSslSocket>
+#include <QTcpServer>
+#include <QTemporaryDir>
+
 Q_DECLARE_METATYPE(QDomElement)
 
 class TestStream : public QXmppStream
@@ -37,6 +45,15 @@ public:
     {
     }
 
+    using QXmppStream::enableStreamManagement;
+    using QXmppStream::setSocket;
+    using QXmppStream::setAcknowledgedSequenceNumber;
+    using QXmppStream::setStreamManagementAckPolicy;
+    using QXmppStream::setStreamManagementQueueLimit;
+    using QXmppStream::setRawStanzaDataEnabled;
+    using QXmppLoggable::isLoggingEnabled;
+    using QXmppLoggable::setLogSink;
+
     void handleStart() override
     {
         QXmppStream::handleStart();
@@ -50,9 +67,12 @@ public:
 
     void handleStanza(const QDomElement &element) override
     {
+        rawStanzas << rawStanzaData();
         emit stanzaReceived(element);
     }
 
+    QList<QByteArray> rawStanzas;
+
     Q_SIGNAL void started();
     Q_SIGNAL void streamReceived(const QDomElement &element);
     Q_SIGNAL void stanzaReceived(const QDomElement &element);
@@ -65,6 +85,21 @@ class tst_QXmppStream : public QObject
 private:
     Q_SLOT void initTestCase();
     Q_SLOT void testProcessData();
+    Q_SLOT void testProcessDataIncremental();
+    Q_SLOT void testProcessDataUtf8();
+    Q_SLOT void testRestrictedXml_data();
+    Q_SLOT void testRestrictedXml();
+    Q_SLOT void testWriteCoalescing();
+    Q_SLOT void testWriteSharedData();
+    Q_SLOT void testAckRequestPolicy();
+    Q_SLOT void testQueueLimit();
+    Q_SLOT void testQueueSpill();
+    Q_SLOT void testQueueSpillReadError();
+    Q_SLOT void testIqTimeout();
+    Q_SLOT void testSendPacketWithoutFuture();
+    Q_SLOT void testLoggingEnabled();
+    Q_SLOT void testRawStanzaData();
+    Q_SLOT void testStanzaRateLimit();
 };
 
 void tst_QXmppStream::initTestCase()
@@ -137,5 +172,581 @@ void tst_QXmppStream::testProcessData()
     stream.processData(R"(</stream:stream>)");
 }
 
+void tst_QXmppStream::testProcessDataIncremental()
+{
+    TestStream stream(this);
+
+    QSignalSpy onStreamReceived(&stream, &TestStream::streamReceived);
+    QSignalSpy onStanzaReceived(&stream, &TestStream::stanzaReceived);
+
+    stream.processData(R"(<?xml version='1.0'?><stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>)");
+    QCOMPARE(onStreamReceived.size(), 1);
+
+    // complete stanzas are processed without waiting for the next one
+    stream.processData(R"(<presence from='a@b/c'/><message from='a@b/c'><body>Hi</body></message><iq )");
+    QCOMPARE(onStanzaReceived.size(), 2);
+    QCOMPARE(onStanzaReceived[0][0].value<QDomElement>().tagName(), QStringLiteral("presence"));
+    QCOMPARE(onStanzaReceived[1][0].value<QDomElement>().firstChildElement("body").text(), QStringLiteral("Hi"));
+
+    // a stanza split into many reads
+    stream.processData(R"(type='get' id='1'><query xmlns='jabber:iq:version'>)");
+    for (int i = 0; i < 100; i++) {
+        stream.processData(R"(<item name='x'/>)");
+    }
+    QCOMPARE(onStanzaReceived.size(), 2);
+    stream.processData(R"(</query></iq>)");
+    QCOMPARE(onStanzaReceived.size(), 3);
+
+    const auto iq = onStanzaReceived[2][0].value<QDomElement>();
+    QCOMPARE(iq.namespaceURI(), QStringLiteral("jabber:client"));
+    QCOMPARE(iq.attribute("id"), QStringLiteral("1"));
+    const auto query = iq.firstChildElement("query");
+    QCOMPARE(query.namespaceURI(), QStringLiteral("jabber:iq:version"));
+    QCOMPARE(query.childNodes().size(), 100);
+
+    // whitespace ping
+    stream.processData(" ");
+    QCOMPARE(onStanzaReceived.size(), 4);
+    QVERIFY(onStanzaReceived[3][0].value<QDomElement>().isNull());
+
+    // whitespace inside a text split between reads is kept
+    stream.processData("<message><body>hello");
+    stream.processData(" ");
+    stream.processData("world</body><subject>");
+    stream.processData(" ");
+    stream.processData("again</subject><thread> </thread></message>");
+    QCOMPARE(onStanzaReceived.size(), 5);
+    const auto message = onStanzaReceived[4][0].value<QDomElement>();
+    QCOMPARE(message.firstChildElement("body").text(), QStringLiteral("hello world"));
+    QCOMPARE(message.firstChildElement("subject").text(), QStringLiteral(" again"));
+    QVERIFY(!message.firstChildElement("thread").hasChildNodes());
+}
+
+void tst_QXmppStream::testProcessDataUtf8()
+{
+    TestStream stream(this);
+
+    QSignalSpy onStanzaReceived(&stream, &TestStream::stanzaReceived);
+
+    stream.processData(R"(<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>)");
+
+    // multi-byte characters split between two reads
+    const auto body = QStringLiteral("Gr\u00FC\u00DFe \U0001F600").toUtf8();
+    const auto stanza = QByteArrayLiteral("<message><body>") + body + QByteArrayLiteral("</body></message>");
+    const auto split = stanza.indexOf(body) + 3;
+    stream.processData(stanza.left(split));
+    stream.processData(stanza.mid(split));
+
+    QCOMPARE(onStanzaReceived.size(), 1);
+    const auto message = onStanzaReceived[0][0].value<QDomElement>();
+    QCOMPARE(message.firstChildElement("body").text(), QString::fromUtf8(body));
+}
+
+void tst_QXmppStream::testRestrictedXml_data()
+{
+    QTest::addColumn<QByteArray>("prolog");
+    QTest::addColumn<QByteArray>("data");
+
+    const QByteArray stream = "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>";
+
+    QTest::newRow("dtd") << QByteArray("<?xml version='1.0'?><!DOCTYPE stream:stream>") + stream << QByteArray("<presence/>");
+    QTest::newRow("entity") << QByteArray("<!DOCTYPE stream:stream [<!ENTITY x '<presence/>'>]>") + stream << QByteArray("<message><body>&x;</body></message>");
+    QTest::newRow("comment") << stream << QByteArray("<!-- x --><presence/>");
+    QTest::newRow("comment-in-stanza") << stream << QByteArray("<message><body>a<!-- x -->b</body></message>");
+    QTest::newRow("processing-instruction") << stream << QByteArray("<message><?x y?><body>a</body></message>");
+}
+
+void tst_QXmppStream::testRestrictedXml()
+{
+    QFETCH(QByteArray, prolog);
+    QFETCH(QByteArray, data);
+
+    TestStream stream(this);
+    QSignalSpy onStanzaReceived(&stream, &TestStream::stanzaReceived);
+    QStringList sent;
+    connect(&stream, &QXmppLoggable::logMessage, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type == QXmppLogger::SentMessage)
+            sent << text;
+    });
+
+    stream.processData(prolog);
+    stream.processData(data);
+
+    // the stream is closed with an error instead of handling the stanza, and
+    // nothing after it is parsed
+    QCOMPARE(onStanzaReceived.size(), 0);
+    QCOMPARE(sent.size(), 1);
+    QCOMPARE(sent.first(), QStringLiteral("<stream:error><restricted-xml xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error>"));
+}
+
+void tst_QXmppStream::testWriteCoalescing()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    TestStream stream(this);
+    auto *socket = new QSslSocket(&stream);
+    stream.setSocket(socket);
+
+    QSignalSpy onStarted(&stream, &TestStream::started);
+    socket->connectToHost(server.serverAddress(), server.serverPort());
+    QVERIFY(onStarted.wait());
+    QVERIFY(server.waitForNewConnection(1000));
+    auto *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+
+    QSignalSpy onCounter(&stream, &QXmppLoggable::updateCounter);
+    const auto counter = [&](const QString &name) {
+        qint64 total = 0;
+        for (const auto &args : std::as_const(onCounter)) {
+            if (args[0].toString() == name) {
+                total += args[1].toLongLong();
+            }
+        }
+        return total;
+    };
+
+    // writes in one event loop iteration are flushed together
+    QVERIFY(stream.sendData("<a/>"));
+    QVERIFY(stream.sendData("<b/>"));
+    QCOMPARE(socket->bytesToWrite(), qint64(0));
+    QCOMPARE(stream.bytesToWrite(), qint64(8));
+    QCoreApplication::processEvents();
+    QCOMPARE(counter("stream.flush.count"), qint64(1));
+    QCOMPARE(counter("stream.flush.packets"), qint64(2));
+    QCOMPARE(counter("stream.flush.bytes"), qint64(8));
+
+    // corked streams are only flushed once uncorked
+    stream.cork();
+    stream.cork();
+    QVERIFY(stream.sendData("<c/>"));
+    QVERIFY(stream.sendData("<d/>"));
+    QVERIFY(stream.sendData("<e/>"));
+    QCoreApplication::processEvents();
+    QCOMPARE(counter("stream.flush.count"), qint64(1));
+    stream.uncork();
+    QCOMPARE(counter("stream.flush.count"), qint64(1));
+    stream.uncork();
+    QCOMPARE(counter("stream.flush.count"), qint64(2));
+    QCOMPARE(counter("stream.flush.packets"), qint64(5));
+    QCOMPARE(counter("stream.flush.bytes"), qint64(20));
+
+    QTRY_COMPARE(peer->bytesAvailable(), qint64(20));
+    QCOMPARE(peer->readAll(), QByteArrayLiteral("<a/><b/><c/><d/><e/>"));
+    QCOMPARE(stream.bytesToWrite(), qint64(0));
+}
+
+void tst_QXmppStream::testWriteSharedData()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    TestStream stream(this);
+    auto *socket = new QSslSocket(&stream);
+    stream.setSocket(socket);
+
+    QSignalSpy onStarted(&stream, &TestStream::started);
+    socket->connectToHost(server.serverAddress(), server.serverPort());
+    QVERIFY(onStarted.wait());
+    QVERIFY(server.waitForNewConnection(1000));
+    auto *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+
+    // without stream management stanzas are serialized into the write buffer
+    QByteArray received;
+    QVERIFY(stream.sendPacket(QXmppMessage({}, QStringLiteral("b@c"), QStringLiteral("0"))));
+    QTRY_VERIFY((received += peer->readAll()).endsWith("</message>"));
+    QVERIFY(received.contains("<body>0</body>"));
+
+    // stanzas kept by stream management and data serialized into the write
+    // buffer are written in order
+    received.clear();
+    stream.enableStreamManagement(true);
+    stream.setStreamManagementAckPolicy(0, 0, 0);
+    stream.cork();
+    QVERIFY(stream.sendData("<a/>"));
+    QVERIFY(stream.sendPacket(QXmppMessage({}, QStringLiteral("b@c"), QStringLiteral("1"))));
+    QVERIFY(stream.sendData("<d/>"));
+    QVERIFY(stream.sendPacket(QXmppMessage({}, QStringLiteral("b@c"), QStringLiteral("2"))));
+    stream.uncork();
+
+    QTRY_VERIFY((received += peer->readAll()).endsWith("</message>"));
+    QVERIFY(received.startsWith("<a/><message"));
+    QVERIFY(received.indexOf("<body>1</body>") < received.indexOf("<d/>"));
+    QVERIFY(received.indexOf("<d/>") < received.indexOf("<body>2</body>"));
+}
+
+void tst_QXmppStream::testAckRequestPolicy()
+{
+    TestStream stream(this);
+    stream.processData(R"(<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>)");
+
+    int ackRequests = 0;
+    connect(&stream, &QXmppLoggable::logMessage, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type == QXmppLogger::SentMessage && text.contains(QStringLiteral("<r xmlns=\"urn:xmpp:sm:3\"/>"))) {
+            ackRequests++;
+        }
+    });
+    QMap<QString, double> gauges;
+    connect(&stream, &QXmppLoggable::setGauge, this, [&](const QString &gauge, double value) {
+        gauges[gauge] = value;
+    });
+
+    const auto sendMessage = [&]() {
+        stream.send(QXmppMessage({}, QStringLiteral("a@b"), QStringLiteral("Hi")));
+    };
+
+    // default: request an ack after every stanza
+    stream.enableStreamManagement(true);
+    sendMessage();
+    sendMessage();
+    QCOMPARE(ackRequests, 2);
+
+    // every N stanzas
+    stream.setStreamManagementAckPolicy(3, 0, 0);
+    for (int i = 0; i < 7; i++) {
+        sendMessage();
+    }
+    QCOMPARE(ackRequests, 4);
+
+    // acks update the round-trip time, the queue depth is only reported
+    // when the state of the queue changes
+    stream.processData("<a xmlns='urn:xmpp:sm:3' h='8'/>");
+    QVERIFY(gauges.contains(QStringLiteral("stream-management.ack.rtt")));
+    QVERIFY(!gauges.contains(QStringLiteral("stream-management.unacked.count")));
+
+    // byte threshold, counted since the last request
+    stream.setStreamManagementAckPolicy(0, 0, 0);
+    stream.processData("<a xmlns='urn:xmpp:sm:3' h='9'/>");
+    sendMessage();
+    const auto messageSize = packetToXml(QXmppMessage({}, QStringLiteral("a@b"), QStringLiteral("Hi"))).size();
+    stream.setStreamManagementAckPolicy(0, 0, qint64(3 * messageSize));
+    sendMessage();
+    QCOMPARE(ackRequests, 4);
+    sendMessage();
+    QCOMPARE(ackRequests, 5);
+    // more than the threshold is still unacknowledged, but no request storm
+    sendMessage();
+    sendMessage();
+    QCOMPARE(ackRequests, 5);
+    sendMessage();
+    QCOMPARE(ackRequests, 6);
+
+    // idle timeout
+    stream.setStreamManagementAckPolicy(0, 10, 0);
+    sendMessage();
+    sendMessage();
+    QCOMPARE(ackRequests, 6);
+    QTRY_COMPARE(ackRequests, 7);
+}
+
+void tst_QXmppStream::testQueueLimit()
+{
+    TestStream stream(this);
+    stream.enableStreamManagement(true);
+
+    const auto message = QXmppMessage({}, QStringLiteral("a@b"), QStringLiteral("Hi"));
+    QByteArray serialized;
+    QXmlStreamWriter writer(&serialized);
+    message.toXml(&writer);
+
+    QMap<QString, double> gauges;
+    connect(&stream, &QXmppLoggable::setGauge, this, [&](const QString &gauge, double value) {
+        gauges[gauge] = value;
+    });
+
+    // room for two stanzas
+    stream.setStreamManagementQueueLimit(2 * serialized.size());
+
+    QList<QFuture<QXmpp::SendResult>> futures;
+    for (int i = 0; i < 4; i++) {
+        futures << stream.send(QXmppMessage(message));
+    }
+
+    for (int i = 0; i < 2; i++) {
+        QVERIFY(futures[i].isFinished());
+        const auto error = expectFutureVariant<QXmpp::SendError>(futures[i]);
+        QCOMPARE(error.type, QXmpp::SendError::QueueLimitExceeded);
+    }
+    QVERIFY(!futures[2].isFinished());
+    QVERIFY(!futures[3].isFinished());
+
+    // hitting the limit reports the queue
+    QCOMPARE(gauges.value(QStringLiteral("stream-management.unacked.count")), 2.0);
+    QCOMPARE(gauges.value(QStringLiteral("stream-management.unacked.bytes")), 2.0 * serialized.size());
+
+    // acknowledgements still refer to the original sequence numbers
+    stream.setAcknowledgedSequenceNumber(3);
+    QVERIFY(futures[2].isFinished());
+    QVERIFY(std::get<QXmpp::SendSuccess>(futures[2].result()).acknowledged);
+    QVERIFY(!futures[3].isFinished());
+}
+
+void tst_QXmppStream::testQueueSpill()
+{
+    QTemporaryDir spillDirectory;
+    QVERIFY(spillDirectory.isValid());
+
+    TestStream stream(this);
+    stream.enableStreamManagement(true);
+    stream.setStreamManagementQueueLimit(1, spillDirectory.path());
+
+    QMap<QString, double> gauges;
+    connect(&stream, &QXmppLoggable::setGauge, this, [&](const QString &gauge, double value) {
+        gauges[gauge] = value;
+    });
+
+    QList<QFuture<QXmpp::SendResult>> futures;
+    for (int i = 0; i < 5; i++) {
+        futures << stream.send(QXmppMessage({}, QStringLiteral("a@b"), QString::number(i)));
+    }
+    for (const auto &future : std::as_const(futures)) {
+        QVERIFY(!future.isFinished());
+    }
+
+    // the queue is reported once it starts spilling
+    QCOMPARE(gauges.value(QStringLiteral("stream-management.unacked.count")), 1.0);
+    QCOMPARE(gauges.value(QStringLiteral("stream-management.unacked.spilled")), 1.0);
+
+    stream.setAcknowledgedSequenceNumber(1);
+    QVERIFY(futures[0].isFinished());
+
+    // resuming resends the remaining stanzas in order
+    QStringList resent;
+    connect(&stream, &QXmppLoggable::logMessage, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type == QXmppLogger::SentMessage && text.contains(QStringLiteral("<message"))) {
+            resent << text;
+        }
+    });
+    stream.enableStreamManagement(false);
+
+    QCOMPARE(resent.size(), 4);
+    for (int i = 0; i < 4; i++) {
+        QVERIFY(resent[i].contains(QStringLiteral("<body>%1</body>").arg(i + 1)));
+    }
+
+    stream.setAcknowledgedSequenceNumber(5);
+    for (const auto &future : std::as_const(futures)) {
+        QVERIFY(future.isFinished());
+        QVERIFY(std::get<QXmpp::SendSuccess>(future.result()).acknowledged);
+    }
+
+    // and once it stops
+    QCOMPARE(gauges.value(QStringLiteral("stream-management.unacked.count")), 0.0);
+    QCOMPARE(gauges.value(QStringLiteral("stream-management.unacked.spilled")), 0.0);
+}
+
+void tst_QXmppStream::testQueueSpillReadError()
+{
+    QTemporaryDir spillDirectory;
+    QVERIFY(spillDirectory.isValid());
+
+    TestStream stream(this);
+    stream.enableStreamManagement(true);
+    stream.setStreamManagementQueueLimit(1, spillDirectory.path());
+
+    // two spilled stanzas and one kept in memory
+    QList<QFuture<QXmpp::SendResult>> futures;
+    for (int i = 0; i < 2; i++) {
+        futures << stream.send(QXmppMessage({}, QStringLiteral("a@b"), QString::number(i)));
+    }
+    stream.setStreamManagementQueueLimit(0, spillDirectory.path());
+    futures << stream.send(QXmppMessage({}, QStringLiteral("a@b"), QStringLiteral("2")));
+
+    // truncate the spill file behind the stream's back
+    const auto spillFiles = QDir(spillDirectory.path()).entryList(QDir::Files);
+    QCOMPARE(spillFiles.size(), 1);
+    QFile spillFile(QDir(spillDirectory.path()).filePath(spillFiles.first()));
+    QVERIFY(spillFile.resize(0));
+
+    QStringList resent;
+    connect(&stream, &QXmppLoggable::logMessage, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type == QXmppLogger::SentMessage && text.contains(QStringLiteral("<message"))) {
+            resent << text;
+        }
+    });
+
+    // resuming fails instead of sending an empty stanza
+    QVERIFY(!stream.enableStreamManagement(false));
+    QVERIFY(resent.isEmpty());
+    QVERIFY(futures[0].isFinished());
+    QCOMPARE(expectFutureVariant<QXmpp::SendError>(futures[0]).type, QXmpp::SendError::QueueLimitExceeded);
+    QVERIFY(!futures[1].isFinished());
+
+    // a new session skips the unreadable stanzas
+    QVERIFY(stream.enableStreamManagement(true));
+    QCOMPARE(resent.size(), 1);
+    QVERIFY(resent[0].contains(QStringLiteral("<body>2</body>")));
+    QVERIFY(futures[1].isFinished());
+    QCOMPARE(expectFutureVariant<QXmpp::SendError>(futures[1]).type, QXmpp::SendError::QueueLimitExceeded);
+
+    stream.setAcknowledgedSequenceNumber(1);
+    QVERIFY(futures[2].isFinished());
+    QVERIFY(std::get<QXmpp::SendSuccess>(futures[2].result()).acknowledged);
+}
+
+void tst_QXmppStream::testIqTimeout()
+{
+    TestStream stream(this);
+    stream.enableStreamManagement(true);
+
+    // IQs don't time out by default
+    QCOMPARE(stream.iqTimeout(), 0);
+
+    const auto createIq = [](const QString &id) {
+        QXmppIq iq;
+        iq.setId(id);
+        iq.setTo(QStringLiteral("capulet.lit"));
+        return iq;
+    };
+
+    auto noTimeout = stream.sendIq(createIq(QStringLiteral("1")));
+    auto timeout = stream.sendIq(createIq(QStringLiteral("2")), 1);
+
+    QTRY_VERIFY(timeout.isFinished());
+    const auto error = expectFutureVariant<QXmpp::SendError>(timeout);
+    QCOMPARE(error.type, QXmpp::SendError::Timeout);
+    QVERIFY(!stream.hasIqId(QStringLiteral("2")));
+
+    // responses still resolve IQs without a timeout
+    QVERIFY(!noTimeout.isFinished());
+    stream.processData(R"(<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>)");
+    stream.processData(R"(<iq id='1' from='capulet.lit' type='result'/>)");
+    QVERIFY(noTimeout.isFinished());
+}
+
+void tst_QXmppStream::testSendPacketWithoutFuture()
+{
+    TestStream stream(this);
+    stream.enableStreamManagement(true);
+
+    // packets without a future are still tracked by stream management
+    stream.sendPacket(QXmppMessage({}, QStringLiteral("a@b"), QStringLiteral("1")));
+    auto future = stream.send(QXmppMessage({}, QStringLiteral("a@b"), QStringLiteral("2")));
+
+    QStringList resent;
+    connect(&stream, &QXmppLoggable::logMessage, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type == QXmppLogger::SentMessage && text.contains(QStringLiteral("<message"))) {
+            resent << text;
+        }
+    });
+    stream.enableStreamManagement(false);
+    QCOMPARE(resent.size(), 2);
+    QVERIFY(resent[0].contains(QStringLiteral("<body>1</body>")));
+
+    stream.setAcknowledgedSequenceNumber(2);
+    QVERIFY(future.isFinished());
+}
+
+void tst_QXmppStream::testLoggingEnabled()
+{
+    QXmppLogger logger;
+    TestStream stream(this);
+    TestStream child(&stream);
+
+    // nothing is listening
+    QVERIFY(!stream.isLoggingEnabled(QXmppLogger::SentMessage));
+    QVERIFY(!child.isLoggingEnabled(QXmppLogger::SentMessage));
+
+    // the logger discards everything
+    connect(&stream, &QXmppLoggable::logMessage, &logger, &QXmppLogger::log);
+    stream.setLogSink(&logger);
+    QVERIFY(!stream.isLoggingEnabled(QXmppLogger::SentMessage));
+    QVERIFY(!child.isLoggingEnabled(QXmppLogger::SentMessage));
+
+    // changes on the logger are pushed down to the children
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+    QVERIFY(stream.isLoggingEnabled(QXmppLogger::SentMessage));
+    QVERIFY(child.isLoggingEnabled(QXmppLogger::SentMessage));
+    QVERIFY(child.isLoggingEnabled(QXmppLogger::ReceivedMessage));
+
+    logger.setMessageTypes(QXmppLogger::ReceivedMessage);
+    QVERIFY(!child.isLoggingEnabled(QXmppLogger::SentMessage));
+    QVERIFY(child.isLoggingEnabled(QXmppLogger::ReceivedMessage));
+
+    // other receivers get all messages
+    int logged = 0;
+    auto connection = connect(&child, &QXmppLoggable::logMessage, this, [&](QXmppLogger::MessageType type, const QString &) {
+        QCOMPARE(type, QXmppLogger::SentMessage);
+        logged++;
+    });
+    QVERIFY(child.isLoggingEnabled(QXmppLogger::SentMessage));
+    QVERIFY(!stream.isLoggingEnabled(QXmppLogger::SentMessage));
+
+    child.sendData("<message/>");
+    QCOMPARE(logged, 1);
+
+    disconnect(connection);
+    QVERIFY(!child.isLoggingEnabled(QXmppLogger::SentMessage));
+
+    stream.setLogSink(nullptr);
+    disconnect(&stream, &QXmppLoggable::logMessage, &logger, &QXmppLogger::log);
+    QVERIFY(!child.isLoggingEnabled(QXmppLogger::ReceivedMessage));
+}
+
+void tst_QXmppStream::testRawStanzaData()
+{
+    TestStream stream(this);
+    stream.setRawStanzaDataEnabled(true);
+
+    const QByteArray message1 = "<message to='a@b/c' type='chat'><body>a &gt; b <![CDATA[<b/>]]></body></message>";
+    const QByteArray presence = "<presence to=\"a@b\" status='/>'/>";
+    const QByteArray message2 = u8"<message><body>\u00e4\u20ac\U0001f600</body><x xmlns='urn:x'><y/></x></message>";
+    const QByteArray iq = "<iq xmlns='jabber:client' type='get' id='1'/>";
+    const QByteArray data = "<?xml version='1.0'?><stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>" +
+        message1 + "\n  " + presence + message2 + iq + "<presence/>";
+
+    // feed the data in small chunks
+    for (int i = 0; i < data.size(); i += 7)
+        stream.processData(data.mid(i, 7));
+
+    QCOMPARE(stream.rawStanzas.size(), 5);
+    QCOMPARE(stream.rawStanzas.at(0), message1);
+    QCOMPARE(stream.rawStanzas.at(1), presence);
+    QCOMPARE(stream.rawStanzas.at(2), message2);
+    // stanzas declaring their own namespace are not forwarded as they are
+    QVERIFY(stream.rawStanzas.at(3).isEmpty());
+    QCOMPARE(stream.rawStanzas.at(4), QByteArray("<presence/>"));
+
+    // prefixes declared on the stream element may be used by the stanzas
+    stream.rawStanzas.clear();
+    stream.handleStart();
+    stream.processData("<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' xmlns:foo='urn:foo'>"
+                       "<message><foo:bar/></message>");
+    QCOMPARE(stream.rawStanzas.size(), 1);
+    QVERIFY(stream.rawStanzas.at(0).isEmpty());
+}
+
+void tst_QXmppStream::testStanzaRateLimit()
+{
+    TestStream stream(this);
+    stream.setStanzaRateLimit(10, 2);
+    QCOMPARE(stream.stanzaRateLimit(), 10);
+
+    QStringList counters;
+    connect(&stream, &QXmppLoggable::updateCounter, this, [&](const QString &counter) {
+        counters << counter;
+    });
+
+    QByteArray data = "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>";
+    for (int i = 0; i < 5; i++)
+        data += "<message id='" + QByteArray::number(i) + "'/>";
+    stream.processData(data);
+
+    // the burst is handled at once, parsing then pauses
+    QCOMPARE(stream.rawStanzas.size(), 2);
+    QCOMPARE(counters, QStringList { "stream.throttled.stanzas" });
+
+    // the remaining stanzas are handled as the bucket refills
+    QTRY_COMPARE(stream.rawStanzas.size(), 5);
+    QVERIFY(counters.size() >= 2);
+
+    // removing the limit handles everything at once
+    stream.setStanzaRateLimit(0);
+    QCOMPARE(stream.stanzaRateLimit(), 0);
+    stream.processData("<message/><message/><message/>");
+    QCOMPARE(stream.rawStanzas.size(), 8);
+}
+
 QTEST_MAIN(tst_QXmppStream)
 #include "tst_qxmppstream.moc"
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2008-2022 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppTimingWheel_p.h"
+
+#include "util.h"
+#include <QObject>
+
+using namespace QXmpp::Private;
+
+class tst_QXmppTimingWheel : public QObject
+{
+    Q_OBJECT
+
+private:
+    Q_SLOT void testExpire();
+    Q_SLOT void testLongDelays_data();
+    Q_SLOT void testLongDelays();
+};
+
+void tst_QXmppTimingWheel::testExpire()
+{
+    TimingWheel<int> wheel(100);
+    QList<int> expired;
+    const auto collect = [&](int value) { expired << value; };
+
+    wheel.schedule(1000, 250, 1);
+    wheel.schedule(1000, 100, 2);
+    wheel.schedule(1050, 100, 3);
+    QCOMPARE(wheel.size(), 3);
+
+    // nothing expires early
+    wheel.expire(1099, collect);
+    QVERIFY(expired.isEmpty());
+
+    wheel.expire(1100, collect);
+    QCOMPARE(expired, QList<int>({ 2, 3 }));
+
+    wheel.expire(1300, collect);
+    QCOMPARE(expired, QList<int>({ 2, 3, 1 }));
+    QVERIFY(wheel.isEmpty());
+
+    // a wheel which has been idle does not expire new values immediately
+    wheel.schedule(100000, 100, 4);
+    wheel.expire(100000, collect);
+    QCOMPARE(expired.size(), 3);
+    wheel.expire(100100, collect);
+    QCOMPARE(expired.last(), 4);
+}
+
+void tst_QXmppTimingWheel::testLongDelays_data()
+{
+    QTest::addColumn<qint64>("start");
+    QTest::addColumn<qint64>("delay");
+
+    QTest::newRow("level-0") << qint64(0) << qint64(6300);
+    QTest::newRow("level-1") << qint64(0) << qint64(6400);
+    QTest::newRow("level-1-unaligned") << qint64(1234) << qint64(60000);
+    QTest::newRow("level-2") << qint64(0) << qint64(410000);
+    QTest::newRow("level-2-unaligned") << qint64(77777) << qint64(3600000);
+    QTest::newRow("level-3") << qint64(500) << qint64(30000000);
+}
+
+void tst_QXmppTimingWheel::testLongDelays()
+{
+    QFETCH(qint64, start);
+    QFETCH(qint64, delay);
+
+    TimingWheel<int> wheel(100);
+    bool expired = false;
+    const auto collect = [&](int) { expired = true; };
+
+    wheel.schedule(start, delay, 1);
+    // a value scheduled later must not influence the first one
+    wheel.schedule(start + 50, delay * 2, 2);
+
+    wheel.expire(start + delay - 100, collect);
+    QVERIFY(!expired);
+    wheel.expire(start + delay + 100, collect);
+    QVERIFY(expired);
+    QCOMPARE(wheel.size(), 1);
+}
+
+QTEST_MAIN(tst_QXmppTimingWheel)
+#include "tst_qxmpptimingwheel.moc"
@@ -26,6 +26,7 @@
 #ifndef TESTS_UTIL_H
 #define TESTS_UTIL_H
 
+#include "QXmppClient.h"
 #include "QXmppPasswordChecker.h"
 
 #include <variant>
@@ -102,12 +103,27 @@ T expectFutureVariant(const QFuture<Input> &future)
     return std::get<T>(future.result());
 }
 
+// Connects the client to a test server on the loopback interface, as the
+// given user of "localhost" with the password "testpwd".
+inline void connectClient(QXmppClient &client, const QString &user, quint16 port)
+{
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(port);
+    config.setUser(user);
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+}
+
 class TestPasswordChecker : public QXmppPasswordChecker
 {
 public:
     void addCredentials(const QString &user, const QString &password)
     {
         m_credentials.insert(user, password);
+        for (const auto algorithm : scramAlgorithms())
+            m_scramCredentials.insert(qMakePair(user, algorithm), QXmppScramCredentials::fromPassword(algorithm, password));
     };
 
     /// Retrieves the password for the given username.
@@ -127,8 +143,34 @@ public:
         return true;
     };
 
+    /// Looks up whether the given user exists.
+    QXmppPasswordReply::Error checkUser(const QXmppPasswordRequest &request) override
+    {
+        return m_credentials.contains(request.username()) ? QXmppPasswordReply::NoError : QXmppPasswordReply::AuthorizationError;
+    };
+
+    /// Retrieves the precomputed SCRAM credentials for the given username.
+    QXmppPasswordReply *getScramCredentials(const QXmppPasswordRequest &request, QCryptographicHash::Algorithm algorithm) override
+    {
+        auto *reply = new QXmppPasswordReply;
+        const auto key = qMakePair(request.username(), algorithm);
+        if (m_scramCredentials.contains(key))
+            reply->setScramCredentials(m_scramCredentials.value(key));
+        else
+            reply->setError(QXmppPasswordReply::AuthorizationError);
+        reply->finishLater();
+        return reply;
+    };
+
+    /// Returns the algorithms for which SCRAM credentials are stored.
+    QList<QCryptographicHash::Algorithm> scramAlgorithms() const override
+    {
+        return { QCryptographicHash::Sha256, QCryptographicHash::Sha1 };
+    };
+
 private:
     QMap<QString, QString> m_credentials;
+    QMap<QPair<QString, QCryptographicHash::Algorithm>, QXmppScramCredentials> m_scramCredentials;
 };
 
 #endif  // TESTS_UTIL_H